@@ -29,6 +29,8 @@ WINE_DEFAULT_DEBUG_CHANNEL(d3dadapter);
 #include <fcntl.h>
 #include <unistd.h>
 #include <pthread.h>
+#include <time.h>
+#include <errno.h>
 
 #include "dri3.h"
 
@@ -36,7 +38,7 @@ WINE_DEFAULT_DEBUG_CHANNEL(d3dadapter);
 #include <xcb/dri3.h>
 #include <xcb/present.h>
 
-#include "winbase.h" /* for Sleep */
+#include "winbase.h" /* for CreateThread */
 
 #ifdef D3DADAPTER9_DRI2
 #include <sys/ioctl.h>
@@ -133,6 +135,17 @@ DRI3CheckExtension(Display *dpy, int major, int minor)
 static EGLDisplay display = NULL;
 static int display_ref = 0;
 
+#define DRI2_BLIT_QUEUE_SIZE 8
+
+typedef void (*DRI2BlitFunc)(struct DRI2priv *dri2_priv, void *data);
+
+struct DRI2BlitJob {
+    DRI2BlitFunc func;
+    void *data;
+};
+
+/* The EGL context stays current on the blit thread, which runs all the GL
+ * work of the fallback in order. */
 struct DRI2priv {
     Display *dpy;
     EGLDisplay display;
@@ -140,8 +153,108 @@ struct DRI2priv {
     PFNGLEGLIMAGETARGETTEXTURE2DOESPROC glEGLImageTargetTexture2DOES_func;
     PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR_func;
     PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR_func;
+    BOOL has_fence_sync; /* EGL_KHR_fence_sync */
+    PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR_func;
+    PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR_func;
+    PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHR_func;
+    pthread_mutex_t blit_mutex;
+    pthread_cond_t blit_cond; /* signaled when a job is queued or done */
+    struct DRI2BlitJob jobs[DRI2_BLIT_QUEUE_SIZE];
+    unsigned int jobs_queued;
+    unsigned int jobs_done;
+    HANDLE blit_thread; /* started on first use */
+    BOOL blit_thread_exit;
+};
+
+/* GL objects of a DRI2 fallback pixmap, created and used on the blit thread */
+struct DRI2PixmapGL {
+    GLuint fbo_read;
+    GLuint fbo_write;
+    GLuint texture_read;
+    GLuint texture_write;
+    EGLSyncKHR fence; /* signaled when the last blit is done reading texture_read,
+                       * replaced and waited on with blit_mutex held */
 };
 
+static DWORD WINAPI
+DRI2BlitThread(void *arg)
+{
+    struct DRI2priv *priv = arg;
+    struct DRI2BlitJob job;
+
+    /* The bound API is per thread */
+    eglBindAPI(EGL_OPENGL_API);
+    if (!eglMakeCurrent(priv->display, EGL_NO_SURFACE, EGL_NO_SURFACE, priv->context))
+        ERR("eglMakeCurrent failed with 0x%0X\n", eglGetError());
+
+    pthread_mutex_lock(&priv->blit_mutex);
+    for (;;) {
+        while (priv->jobs_done == priv->jobs_queued && !priv->blit_thread_exit)
+            pthread_cond_wait(&priv->blit_cond, &priv->blit_mutex);
+        /* drain the queue before exiting */
+        if (priv->jobs_done == priv->jobs_queued)
+            break;
+        job = priv->jobs[priv->jobs_done % DRI2_BLIT_QUEUE_SIZE];
+        pthread_mutex_unlock(&priv->blit_mutex);
+        job.func(priv, job.data);
+        pthread_mutex_lock(&priv->blit_mutex);
+        priv->jobs_done++;
+        pthread_cond_broadcast(&priv->blit_cond);
+    }
+    pthread_mutex_unlock(&priv->blit_mutex);
+
+    eglMakeCurrent(priv->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+    eglReleaseThread();
+    return 0;
+}
+
+/* Queues func to run on the blit thread. If wait is set, returns once it
+ * has run. */
+static BOOL
+DRI2RunOnBlitThread(struct DRI2priv *priv, DRI2BlitFunc func, void *data, BOOL wait)
+{
+    unsigned int ticket;
+
+    pthread_mutex_lock(&priv->blit_mutex);
+    if (!priv->blit_thread) {
+        priv->blit_thread = CreateThread(NULL, 0, DRI2BlitThread, priv, 0, NULL);
+        if (!priv->blit_thread) {
+            ERR("Failed to create the DRI2 blit thread\n");
+            pthread_mutex_unlock(&priv->blit_mutex);
+            return FALSE;
+        }
+    }
+
+    while (priv->jobs_queued - priv->jobs_done == DRI2_BLIT_QUEUE_SIZE)
+        pthread_cond_wait(&priv->blit_cond, &priv->blit_mutex);
+
+    priv->jobs[priv->jobs_queued % DRI2_BLIT_QUEUE_SIZE].func = func;
+    priv->jobs[priv->jobs_queued % DRI2_BLIT_QUEUE_SIZE].data = data;
+    ticket = priv->jobs_queued++;
+    pthread_cond_broadcast(&priv->blit_cond);
+
+    if (wait) {
+        while ((int)(priv->jobs_done - ticket) <= 0)
+            pthread_cond_wait(&priv->blit_cond, &priv->blit_mutex);
+    }
+    pthread_mutex_unlock(&priv->blit_mutex);
+    return TRUE;
+}
+
+static void
+DRI2StopBlitThread(struct DRI2priv *priv)
+{
+    if (!priv->blit_thread)
+        return;
+    pthread_mutex_lock(&priv->blit_mutex);
+    priv->blit_thread_exit = TRUE;
+    pthread_cond_broadcast(&priv->blit_cond);
+    pthread_mutex_unlock(&priv->blit_mutex);
+    WaitForSingleObject(priv->blit_thread, INFINITE);
+    CloseHandle(priv->blit_thread);
+    priv->blit_thread = NULL;
+}
+
 /* TODO: We don't free memory properly. When exiting, eglTerminate doesn't work well(crash), and things are freed automatically. Rely on it */
 
 BOOL
@@ -151,6 +264,9 @@ DRI2FallbackInit(Display *dpy, struct DRI2priv **priv)
     PFNEGLCREATEIMAGEKHRPROC eglCreateImageKHR_func;
     PFNEGLGETPLATFORMDISPLAYEXTPROC eglGetPlatformDisplayEXT_func;
     PFNEGLDESTROYIMAGEKHRPROC eglDestroyImageKHR_func;
+    PFNEGLCREATESYNCKHRPROC eglCreateSyncKHR_func = NULL;
+    PFNEGLDESTROYSYNCKHRPROC eglDestroySyncKHR_func = NULL;
+    PFNEGLCLIENTWAITSYNCKHRPROC eglClientWaitSyncKHR_func = NULL;
     EGLint major, minor;
     EGLConfig config;
     EGLContext context;
@@ -210,6 +326,14 @@ DRI2FallbackInit(Display *dpy, struct DRI2priv **priv)
         goto clean_egl_display;
     }
 
+    /* Optional: without fences, buffers are released only when the X server
+     * is done with the copy */
+    if (strstr(extensions, "EGL_KHR_fence_sync")) {
+        eglCreateSyncKHR_func = (PFNEGLCREATESYNCKHRPROC) eglGetProcAddress("eglCreateSyncKHR");
+        eglDestroySyncKHR_func = (PFNEGLDESTROYSYNCKHRPROC) eglGetProcAddress("eglDestroySyncKHR");
+        eglClientWaitSyncKHR_func = (PFNEGLCLIENTWAITSYNCKHRPROC) eglGetProcAddress("eglClientWaitSyncKHR");
+    }
+
     eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
 
     *priv = calloc(1, sizeof(struct DRI2priv));
@@ -221,6 +345,12 @@ DRI2FallbackInit(Display *dpy, struct DRI2priv **priv)
     (*priv)->glEGLImageTargetTexture2DOES_func = glEGLImageTargetTexture2DOES_func;
     (*priv)->eglCreateImageKHR_func = eglCreateImageKHR_func;
     (*priv)->eglDestroyImageKHR_func = eglDestroyImageKHR_func;
+    (*priv)->has_fence_sync = eglCreateSyncKHR_func && eglDestroySyncKHR_func && eglClientWaitSyncKHR_func;
+    (*priv)->eglCreateSyncKHR_func = eglCreateSyncKHR_func;
+    (*priv)->eglDestroySyncKHR_func = eglDestroySyncKHR_func;
+    (*priv)->eglClientWaitSyncKHR_func = eglClientWaitSyncKHR_func;
+    pthread_mutex_init(&(*priv)->blit_mutex, NULL);
+    pthread_cond_init(&(*priv)->blit_cond, NULL);
     eglBindAPI(current_api);
     return TRUE;
 
@@ -231,11 +361,17 @@ clean_egl_display:
     return FALSE;
 }
 
-/* hypothesis: at this step all textures, etc are destroyed */
+/* hypothesis: at this step all textures, etc are destroyed or queued
+ * for destruction on the blit thread */
 void
 DRI2FallbackDestroy(struct DRI2priv *priv)
 {
     EGLenum current_api;
+
+    DRI2StopBlitThread(priv);
+    pthread_mutex_destroy(&priv->blit_mutex);
+    pthread_cond_destroy(&priv->blit_cond);
+
     current_api = eglQueryAPI();
     eglBindAPI(EGL_OPENGL_API);
     eglMakeCurrent(priv->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
@@ -571,20 +707,46 @@ DRI3DmaBufFromPixmap(Display *dpy, Pixmap pixmap, int *fd, int *width, int *heig
     return TRUE;
 }
 
+/* Pixmaps are stored in slots indexed by serial - 1, freed slots are
+ * reused. A hash table on the pixmap XID allows to find the pixmap of
+ * events sent for presentations without serial. */
+struct PRESENTPixmapRegistry {
+    PRESENTPixmapPriv **slots;
+    unsigned int slots_size;
+    unsigned int slots_used; /* slots below this index were given at least once */
+    uint32_t *free_serials;
+    unsigned int free_serials_count;
+    PRESENTPixmapPriv **xid_table; /* open addressing, linear probing */
+    unsigned int xid_table_size; /* power of two */
+    unsigned int count;
+};
+
 struct PRESENTPriv {
     xcb_connection_t *xcb_connection;
     xcb_connection_t *xcb_connection_bis; /* to avoid libxcb thread bugs, use a different connection to present pixmaps */
     XID window;
     uint64_t last_msc;
+    uint64_t last_ust; /* CLOCK_MONOTONIC time of the last completed presentation, in us */
+    uint64_t next_frame_time; /* frame limiter deadline, same clock */
+    uint32_t present_count; /* presentations issued */
+    uint32_t complete_present_count; /* present_count of the last presentation shown */
+    uint64_t complete_msc; /* msc at which it was shown */
+    uint64_t sync_msc; /* last vblank reported by the server */
+    uint64_t sync_ust;
+    uint64_t refresh_period_us; /* averaged, 0 if unknown */
     uint64_t last_target;
-    uint32_t last_serial_given;
     xcb_special_event_t *special_event;
-    PRESENTPixmapPriv *first_present_priv;
+    struct PRESENTPixmapRegistry pixmaps;
     int pixmap_present_pending;
     BOOL notify_with_serial_pending;
+    BOOL errors_unchecked; /* presentations sent since the last sync of xcb_connection_bis */
+    BOOL mailbox;
+    xcb_xfixes_region_t valid_region; /* persistent regions on xcb_connection_bis */
+    xcb_xfixes_region_t update_region;
     pthread_mutex_t mutex_present; /* protect readind/writing present_priv things */
-    pthread_mutex_t mutex_xcb_wait;
-    BOOL xcb_wait;
+    pthread_cond_t event_cond; /* signaled by the event thread after each event */
+    HANDLE event_thread; /* drains the special event queue of the current window */
+    BOOL event_thread_alive;
 };
 
 struct PRESENTPixmapPriv {
@@ -600,29 +762,177 @@ struct PRESENTPixmapPriv {
     struct {
         BOOL is_dri2;
         struct DRI2priv *dri2_priv;
-        GLuint fbo_read;
-        GLuint fbo_write;
-        GLuint texture_read;
-        GLuint texture_write;
+        struct DRI2PixmapGL gl;
     } dri2_info;
 #endif
     BOOL last_present_was_flip;
-    PRESENTPixmapPriv *next;
+    uint32_t present_count; /* present_priv->present_count of the last presentation */
+    unsigned int present_sequence; /* sequence of the last xcb_present_pixmap request */
+    pthread_cond_t released_cond; /* signaled when released or present_complete_pending change */
 };
 
+/* Serials used for xcb_present_notify_msc. They are matched against
+ * XCB_PRESENT_COMPLETE_KIND_NOTIFY_MSC events only, thus can't clash
+ * with pixmap serials. */
+#define PRESENT_NOTIFY_SERIAL_BARRIER 1
+#define PRESENT_NOTIFY_SERIAL_STOP    2
+
+static inline unsigned int PRESENTPixmapHash(Pixmap pixmap, unsigned int table_size)
+{
+    uint32_t h = (uint32_t)pixmap * 0x9e3779b1u;
+    return (h >> 7) & (table_size - 1);
+}
+
+static BOOL PRESENTRegistryGrowXidTable(struct PRESENTPixmapRegistry *registry)
+{
+    unsigned int new_size = max(16, registry->xid_table_size * 2);
+    PRESENTPixmapPriv **new_table;
+    unsigned int i, j;
+
+    if (!(new_table = calloc(new_size, sizeof(*new_table))))
+        return FALSE;
+
+    for (i = 0; i < registry->xid_table_size; i++) {
+        PRESENTPixmapPriv *entry = registry->xid_table[i];
+        if (!entry)
+            continue;
+        j = PRESENTPixmapHash(entry->pixmap, new_size);
+        while (new_table[j])
+            j = (j + 1) & (new_size - 1);
+        new_table[j] = entry;
+    }
+    free(registry->xid_table);
+    registry->xid_table = new_table;
+    registry->xid_table_size = new_size;
+    return TRUE;
+}
+
+/* mutex_present must be held. Gives a serial to the pixmap. */
+static BOOL PRESENTRegisterPixmapPriv(PRESENTpriv *present_priv, PRESENTPixmapPriv *present_pixmap_priv)
+{
+    struct PRESENTPixmapRegistry *registry = &present_priv->pixmaps;
+    unsigned int slot, i;
+
+    if ((registry->count + 1) * 2 > registry->xid_table_size &&
+        !PRESENTRegistryGrowXidTable(registry))
+        return FALSE;
+
+    if (registry->free_serials_count) {
+        slot = registry->free_serials[--registry->free_serials_count] - 1;
+    } else {
+        if (registry->slots_used == registry->slots_size) {
+            unsigned int new_size = max(8, registry->slots_size * 2);
+            PRESENTPixmapPriv **new_slots;
+            uint32_t *new_free_serials;
+
+            if (!(new_slots = realloc(registry->slots, new_size * sizeof(*new_slots))))
+                return FALSE;
+            registry->slots = new_slots;
+            if (!(new_free_serials = realloc(registry->free_serials, new_size * sizeof(*new_free_serials))))
+                return FALSE;
+            registry->free_serials = new_free_serials;
+            registry->slots_size = new_size;
+        }
+        slot = registry->slots_used++;
+    }
+
+    /* serial 0 is used for presentations we don't track */
+    present_pixmap_priv->serial = slot + 1;
+    registry->slots[slot] = present_pixmap_priv;
+
+    i = PRESENTPixmapHash(present_pixmap_priv->pixmap, registry->xid_table_size);
+    while (registry->xid_table[i])
+        i = (i + 1) & (registry->xid_table_size - 1);
+    registry->xid_table[i] = present_pixmap_priv;
+
+    registry->count++;
+    return TRUE;
+}
+
+/* mutex_present must be held */
+static void PRESENTUnregisterPixmapPriv(PRESENTpriv *present_priv, PRESENTPixmapPriv *present_pixmap_priv)
+{
+    struct PRESENTPixmapRegistry *registry = &present_priv->pixmaps;
+    unsigned int mask = registry->xid_table_size - 1;
+    unsigned int i, j, k;
+
+    registry->slots[present_pixmap_priv->serial - 1] = NULL;
+    registry->free_serials[registry->free_serials_count++] = present_pixmap_priv->serial;
+
+    i = PRESENTPixmapHash(present_pixmap_priv->pixmap, registry->xid_table_size);
+    while (registry->xid_table[i] != present_pixmap_priv)
+        i = (i + 1) & mask;
+    registry->xid_table[i] = NULL;
+
+    /* Shift back the following entries of the cluster, so lookups
+     * never need tombstones */
+    for (j = (i + 1) & mask; registry->xid_table[j]; j = (j + 1) & mask) {
+        k = PRESENTPixmapHash(registry->xid_table[j]->pixmap, registry->xid_table_size);
+        if ((j > i && (k <= i || k > j)) || (j < i && (k <= i && k > j))) {
+            registry->xid_table[i] = registry->xid_table[j];
+            registry->xid_table[j] = NULL;
+            i = j;
+        }
+    }
+
+    registry->count--;
+}
+
+static void PRESENTRegistryDestroy(struct PRESENTPixmapRegistry *registry)
+{
+    free(registry->slots);
+    free(registry->free_serials);
+    free(registry->xid_table);
+    memset(registry, 0, sizeof(*registry));
+}
+
 static PRESENTPixmapPriv *PRESENTFindPixmapPriv(PRESENTpriv *present_priv, uint32_t serial)
 {
-    PRESENTPixmapPriv *current = present_priv->first_present_priv;
+    struct PRESENTPixmapRegistry *registry = &present_priv->pixmaps;
+
+    if (!serial || serial > registry->slots_used)
+        return NULL;
+    return registry->slots[serial - 1];
+}
+
+static PRESENTPixmapPriv *PRESENTFindPixmapPrivByXID(PRESENTpriv *present_priv, Pixmap pixmap)
+{
+    struct PRESENTPixmapRegistry *registry = &present_priv->pixmaps;
+    unsigned int i;
+
+    if (!registry->xid_table_size)
+        return NULL;
 
-    while (current) {
-        if (current->serial == serial)
-            return current;
-        current = current->next;
+    i = PRESENTPixmapHash(pixmap, registry->xid_table_size);
+    while (registry->xid_table[i]) {
+        if (registry->xid_table[i]->pixmap == pixmap)
+            return registry->xid_table[i];
+        i = (i + 1) & (registry->xid_table_size - 1);
     }
     return NULL;
 }
 
-static void PRESENThandle_events(PRESENTpriv *present_priv, xcb_present_generic_event_t *ge)
+/* Every event carries the msc and ust of a vblank. Use them to
+ * estimate the refresh period. */
+static void PRESENTUpdateVblankTiming(PRESENTpriv *present_priv, uint64_t msc, uint64_t ust)
+{
+    if (present_priv->sync_ust && msc > present_priv->sync_msc && ust > present_priv->sync_ust) {
+        uint64_t period = (ust - present_priv->sync_ust) / (msc - present_priv->sync_msc);
+
+        if (!present_priv->refresh_period_us)
+            present_priv->refresh_period_us = period;
+        else
+            present_priv->refresh_period_us = (present_priv->refresh_period_us * 7 + period) / 8;
+    }
+    if (msc >= present_priv->sync_msc) {
+        present_priv->sync_msc = msc;
+        present_priv->sync_ust = ust;
+    }
+}
+
+/* Called by the event thread with mutex_present held.
+ * Returns FALSE when the event thread was asked to stop. */
+static BOOL PRESENThandle_events(PRESENTpriv *present_priv, xcb_present_generic_event_t *ge)
 {
     PRESENTPixmapPriv *present_pixmap_priv = NULL;
 
@@ -630,16 +940,18 @@ static void PRESENThandle_events(PRESENTpriv *present_priv, xcb_present_generic_
         case XCB_PRESENT_COMPLETE_NOTIFY: {
             xcb_present_complete_notify_event_t *ce = (void *) ge;
             if (ce->kind == XCB_PRESENT_COMPLETE_KIND_NOTIFY_MSC) {
-                if (ce->serial)
+                BOOL keep_running = (ce->serial != PRESENT_NOTIFY_SERIAL_STOP);
+                PRESENTUpdateVblankTiming(present_priv, ce->msc, ce->ust);
+                if (ce->serial == PRESENT_NOTIFY_SERIAL_BARRIER)
                     present_priv->notify_with_serial_pending = FALSE;
                 free(ce);
-                return;
+                return keep_running;
             }
             present_pixmap_priv = PRESENTFindPixmapPriv(present_priv, ce->serial);
             if (!present_pixmap_priv || ce->kind != XCB_PRESENT_COMPLETE_KIND_PIXMAP) {
                 ERR("FATAL ERROR: PRESENT handling failed\n");
                 free(ce);
-                return;
+                return TRUE;
             }
             present_pixmap_priv->present_complete_pending = FALSE;
             switch (ce->mode) {
@@ -649,63 +961,202 @@ static void PRESENThandle_events(PRESENTpriv *present_priv, xcb_present_generic_
                 case XCB_PRESENT_COMPLETE_MODE_COPY:
                     present_pixmap_priv->last_present_was_flip = FALSE;
                     break;
+                case XCB_PRESENT_COMPLETE_MODE_SKIP:
+                    /* replaced by a newer presentation (mailbox mode) */
+                    TRACE("Pixmap with serial %u skipped\n", ce->serial);
+                    present_pixmap_priv->last_present_was_flip = FALSE;
+                    break;
+            }
+            if (ce->mode != XCB_PRESENT_COMPLETE_MODE_SKIP) {
+                present_priv->complete_present_count = present_pixmap_priv->present_count;
+                present_priv->complete_msc = ce->msc;
+                PRESENTUpdateVblankTiming(present_priv, ce->msc, ce->ust);
             }
             present_priv->pixmap_present_pending--;
             present_priv->last_msc = ce->msc;
+            present_priv->last_ust = ce->ust;
             break;
         }
         case XCB_PRESENT_EVENT_IDLE_NOTIFY: {
             xcb_present_idle_notify_event_t *ie = (void *) ge;
             present_pixmap_priv = PRESENTFindPixmapPriv(present_priv, ie->serial);
-            if (!present_pixmap_priv || present_pixmap_priv->pixmap != ie->pixmap) {
+            /* presentations done with serial 0 (see PRESENTForceReleases)
+             * can only be matched by pixmap */
+            if (!present_pixmap_priv || present_pixmap_priv->pixmap != ie->pixmap)
+                present_pixmap_priv = PRESENTFindPixmapPrivByXID(present_priv, ie->pixmap);
+            if (!present_pixmap_priv) {
                 ERR("FATAL ERROR: PRESENT handling failed\n");
                 free(ie);
-                return;
+                return TRUE;
             }
             present_pixmap_priv->released = TRUE;
             break;
         }
     }
+    if (present_pixmap_priv)
+        pthread_cond_broadcast(&present_pixmap_priv->released_cond);
     free(ge);
+    return TRUE;
 }
 
-static void PRESENTflush_events(PRESENTpriv *present_priv, BOOL assert_no_other_thread_waiting)
+/* Dispatches the PRESENT events of the current window as soon as they arrive,
+ * so threads waiting for a pixmap release are woken up without polling. */
+static DWORD WINAPI PRESENTevent_thread(void *arg)
 {
+    PRESENTpriv *present_priv = arg;
+    xcb_special_event_t *special_event = present_priv->special_event;
     xcb_generic_event_t *ev;
+    BOOL keep_running = TRUE;
 
-    if ((present_priv->xcb_wait && !assert_no_other_thread_waiting) || /* don't steal events to someone waiting */
-        !present_priv->special_event)
-        return;
+    while (keep_running) {
+        ev = xcb_wait_for_special_event(present_priv->xcb_connection, special_event);
+
+        pthread_mutex_lock(&present_priv->mutex_present);
+        if (ev) {
+            keep_running = PRESENThandle_events(present_priv, (void *) ev);
+        } else {
+            struct PRESENTPixmapRegistry *registry = &present_priv->pixmaps;
+            unsigned int i;
+
+            ERR("FATAL error: xcb had an error\n");
+            /* wake up everybody, nothing will ever come anymore */
+            for (i = 0; i < registry->slots_used; i++) {
+                if (registry->slots[i])
+                    pthread_cond_broadcast(&registry->slots[i]->released_cond);
+            }
+            present_priv->event_thread_alive = FALSE;
+            keep_running = FALSE;
+        }
+        pthread_cond_broadcast(&present_priv->event_cond);
+        pthread_mutex_unlock(&present_priv->mutex_present);
+    }
+    return 0;
+}
+
+static void PRESENTReportPresentError(PRESENTpriv *present_priv, PRESENTPixmapPriv *present_pixmap_priv)
+{
+    xcb_get_geometry_cookie_t cookie_geom;
+    xcb_get_geometry_reply_t *reply;
 
-    while ((ev = xcb_poll_for_special_event(present_priv->xcb_connection, present_priv->special_event)) != NULL) {
-        PRESENThandle_events(present_priv, (void *) ev);
+    cookie_geom = xcb_get_geometry(present_priv->xcb_connection_bis, present_priv->window);
+    reply = xcb_get_geometry_reply(present_priv->xcb_connection_bis, cookie_geom, NULL);
+
+    ERR("Error using PRESENT. Here some debug info\n");
+    if (!reply) {
+        ERR("Error querying window info. Perhaps it doesn't exist anymore\n");
+        return;
     }
+    ERR("Pixmap: width=%d, height=%d, depth=%d\n",
+        present_pixmap_priv->width, present_pixmap_priv->height,
+        present_pixmap_priv->depth);
+    ERR("Window: width=%d, height=%d, depth=%d, x=%d, y=%d\n",
+        (int) reply->width, (int) reply->height,
+        (int) reply->depth, (int) reply->x, (int) reply->y);
+    ERR("Pending presentations=%d\n", present_priv->pixmap_present_pending);
+    if (present_pixmap_priv->depth != reply->depth)
+        ERR("Depths are different. PRESENT needs the pixmap and the window have same depth\n");
+    free(reply);
 }
 
-static BOOL PRESENTwait_events(PRESENTpriv *present_priv, BOOL allow_other_threads)
+/* mutex_present must be held. The presentation requests are sent unchecked,
+ * their errors are collected here. With sync, a round trip first makes sure
+ * the errors of all the presentations sent so far have arrived. Returns TRUE
+ * if a pending presentation was cancelled because of an error. */
+static BOOL PRESENTCheckErrors(PRESENTpriv *present_priv, BOOL sync)
 {
+    struct PRESENTPixmapRegistry *registry = &present_priv->pixmaps;
     xcb_generic_event_t *ev;
+    BOOL cancelled = FALSE;
+    unsigned int i;
 
-    if (allow_other_threads) {
-        present_priv->xcb_wait = TRUE;
-        pthread_mutex_lock(&present_priv->mutex_xcb_wait);
-        pthread_mutex_unlock(&present_priv->mutex_present);
+    if (sync && present_priv->errors_unchecked) {
+        free(xcb_get_input_focus_reply(present_priv->xcb_connection_bis,
+                                       xcb_get_input_focus(present_priv->xcb_connection_bis), NULL));
+        present_priv->errors_unchecked = FALSE;
     }
-    ev = xcb_wait_for_special_event(present_priv->xcb_connection, present_priv->special_event);
-    if (allow_other_threads) {
-        pthread_mutex_unlock(&present_priv->mutex_xcb_wait);
-        pthread_mutex_lock(&present_priv->mutex_present);
-        present_priv->xcb_wait = FALSE;
+
+    /* Nothing selects events on xcb_connection_bis, only errors come here */
+    while ((ev = xcb_poll_for_event(present_priv->xcb_connection_bis))) {
+        xcb_generic_error_t *error = (void *) ev;
+
+        if (ev->response_type != 0) {
+            free(ev);
+            continue;
+        }
+        WARN("X error %d (major %d, minor %d, sequence %u)\n", error->error_code,
+             error->major_code, error->minor_code, error->full_sequence);
+        for (i = 0; i < registry->slots_used; i++) {
+            PRESENTPixmapPriv *current = registry->slots[i];
+            if (!current || !current->present_complete_pending ||
+                current->present_sequence != error->full_sequence)
+                continue;
+            PRESENTReportPresentError(present_priv, current);
+            /* The presentation didn't happen, no event will come for it */
+            current->present_complete_pending = FALSE;
+            current->released = TRUE;
+            present_priv->pixmap_present_pending--;
+            pthread_cond_broadcast(&current->released_cond);
+            cancelled = TRUE;
+            break;
+        }
+        free(ev);
     }
-    if (!ev) {
-        ERR("FATAL error: xcb had an error\n");
+    if (cancelled)
+        pthread_cond_broadcast(&present_priv->event_cond);
+    return cancelled;
+}
+
+/* mutex_present must be held. Waits until cond is signaled by the event
+ * thread. The errors of failed presentations are collected before blocking,
+ * since no event will ever be signaled for those. Returns FALSE if the event
+ * thread isn't running anymore. */
+static BOOL PRESENTwait_cond(PRESENTpriv *present_priv, pthread_cond_t *cond)
+{
+    if (!present_priv->event_thread_alive)
         return FALSE;
-    }
+    if (PRESENTCheckErrors(present_priv, TRUE))
+        return TRUE;
+    pthread_cond_wait(cond, &present_priv->mutex_present);
+    return present_priv->event_thread_alive;
+}
 
-    PRESENThandle_events(present_priv, (void *) ev);
+/* mutex_present must be held. Waits until the event thread signals. */
+static BOOL PRESENTwait_events(PRESENTpriv *present_priv)
+{
+    return PRESENTwait_cond(present_priv, &present_priv->event_cond);
+}
+
+static BOOL PRESENTStartEventThread(PRESENTpriv *present_priv)
+{
+    present_priv->event_thread_alive = TRUE;
+    present_priv->event_thread = CreateThread(NULL, 0, PRESENTevent_thread, present_priv, 0, NULL);
+    if (!present_priv->event_thread) {
+        ERR("Failed to create the PRESENT event thread\n");
+        present_priv->event_thread_alive = FALSE;
+        return FALSE;
+    }
     return TRUE;
 }
 
+/* mutex_present must be held. It is released while joining the thread. */
+static void PRESENTStopEventThread(PRESENTpriv *present_priv)
+{
+    if (!present_priv->event_thread)
+        return;
+
+    if (present_priv->event_thread_alive) {
+        xcb_present_notify_msc(present_priv->xcb_connection, present_priv->window,
+                               PRESENT_NOTIFY_SERIAL_STOP, 0, 0, 0);
+        xcb_flush(present_priv->xcb_connection);
+    }
+    pthread_mutex_unlock(&present_priv->mutex_present);
+    WaitForSingleObject(present_priv->event_thread, INFINITE);
+    pthread_mutex_lock(&present_priv->mutex_present);
+    CloseHandle(present_priv->event_thread);
+    present_priv->event_thread = NULL;
+    present_priv->event_thread_alive = FALSE;
+}
+
 static struct xcb_connection_t *
 create_xcb_connection(Display *dpy)
 {
@@ -723,63 +1174,50 @@ create_xcb_connection(Display *dpy)
 }
 
 BOOL
-PRESENTInit(Display *dpy, PRESENTpriv **present_priv)
+PRESENTInit(Display *dpy, PRESENTpriv **present_priv, BOOL mailbox)
 {
     *present_priv = (PRESENTpriv *) calloc(1, sizeof(PRESENTpriv));
     if (!*present_priv) {
         return FALSE;
     }
+    (*present_priv)->mailbox = mailbox;
     (*present_priv)->xcb_connection = create_xcb_connection(dpy);
     (*present_priv)->xcb_connection_bis = create_xcb_connection(dpy);
     pthread_mutex_init(&(*present_priv)->mutex_present, NULL);
-    pthread_mutex_init(&(*present_priv)->mutex_xcb_wait, NULL);
+    pthread_cond_init(&(*present_priv)->event_cond, NULL);
     return TRUE;
 }
 
+/* mutex_present must be held */
 static void PRESENTForceReleases(PRESENTpriv *present_priv)
 {
+    struct PRESENTPixmapRegistry *registry = &present_priv->pixmaps;
     PRESENTPixmapPriv *current = NULL;
+    unsigned int i;
 
     if (!present_priv->window)
         return;
 
-    /* There should be no other thread listening for events here.
-     * This can happen when hDestWindowOverride changes without reset.
-     * This case should never happen, but can happen in theory.*/
-    if (present_priv->xcb_wait) {
-        xcb_present_notify_msc(present_priv->xcb_connection, present_priv->window, 0, 0, 0, 0);
-        xcb_flush(present_priv->xcb_connection);
-        pthread_mutex_lock(&present_priv->mutex_xcb_wait);
-        pthread_mutex_unlock(&present_priv->mutex_xcb_wait);
-        /* the problem here is that we don't have access to the event the other thread got.
-         * It is either presented event, idle event or notify event.
-         */
-        while (present_priv->pixmap_present_pending >= 2)
-            PRESENTwait_events(present_priv, FALSE);
-        PRESENTflush_events(present_priv, TRUE);
-        /* Remaining events to come can be a pair of present/idle,
-         * or an idle, or nothing. To be sure we are after all pixmaps
-         * have been presented, add an event to the queue that can only
-         * be after the present event, then if we receive an event more,
-         * we are sure all pixmaps were presented */
+    /* wait all sent pixmaps are presented */
+    while (present_priv->pixmap_present_pending && PRESENTwait_events(present_priv));
+
+    /* Idle events can still be on their way. Add an event to the queue
+     * that can only come after them, and wait for it. All pending presents
+     * are complete at this point, so one frame past the last target is
+     * enough and doesn't stall for extra vblanks. */
+    if (present_priv->event_thread_alive) {
         present_priv->notify_with_serial_pending = TRUE;
-        xcb_present_notify_msc(present_priv->xcb_connection, present_priv->window, 1, present_priv->last_target + 5, 0, 0);
+        xcb_present_notify_msc(present_priv->xcb_connection, present_priv->window,
+                               PRESENT_NOTIFY_SERIAL_BARRIER, present_priv->last_target + 1, 0, 0);
         xcb_flush(present_priv->xcb_connection);
-        while (present_priv->notify_with_serial_pending)
-            PRESENTwait_events(present_priv, FALSE);
-        /* Now we are sure we are not expecting any new event */
-    } else {
-        while (present_priv->pixmap_present_pending) /* wait all sent pixmaps are presented */
-            PRESENTwait_events(present_priv, FALSE);
-        PRESENTflush_events(present_priv, TRUE); /* may be remaining idle event */
-        /* Since idle events are send with the complete events when it is not flips,
-         * we are not expecting any new event here */
+        while (present_priv->notify_with_serial_pending && PRESENTwait_events(present_priv));
     }
+    /* Now we are sure we are not expecting any new event */
 
-    current = present_priv->first_present_priv;
-    while (current) {
-        if (!current->released) {
-            if (!current->last_present_was_flip && !present_priv->xcb_wait) {
+    for (i = 0; i < registry->slots_used && present_priv->event_thread_alive; i++) {
+        current = registry->slots[i];
+        if (current && !current->released) {
+            if (!current->last_present_was_flip) {
                 ERR("ERROR: a pixmap seems not released by PRESENT for no reason. Code bug.\n");
             } else {
                 /* Present the same pixmap with a non-valid part to force the copy mode and the releases */
@@ -798,22 +1236,30 @@ static void PRESENTForceReleases(PRESENTpriv *present_priv)
                 xcb_present_pixmap(present_priv->xcb_connection, present_priv->window,
                                    current->pixmap, 0, valid, update, 0, 0, None, None,
                                    None, XCB_PRESENT_OPTION_COPY | XCB_PRESENT_OPTION_ASYNC, 0, 0, 0, 0, NULL);
+                xcb_xfixes_destroy_region(present_priv->xcb_connection, update);
+                xcb_xfixes_destroy_region(present_priv->xcb_connection, valid);
                 xcb_flush(present_priv->xcb_connection);
-                PRESENTwait_events(present_priv, FALSE); /* by assumption this can only be idle event */
-                PRESENTflush_events(present_priv, TRUE); /* Shoudln't be needed */
+                /* by assumption the only event to come is the idle event */
+                while (registry->slots[i] == current && !current->released &&
+                       PRESENTwait_cond(present_priv, &current->released_cond));
             }
         }
-        current = current->next;
     }
-    /* Now all pixmaps are released (possibility if xcb_wait is true that one is not aware yet),
-     * and we don't expect any new Present event to come from Xserver */
+    /* Now all pixmaps are released, and we don't expect
+     * any new Present event to come from Xserver */
 }
 
+/* mutex_present must be held */
 static void PRESENTFreeXcbQueue(PRESENTpriv *present_priv)
 {
     if (present_priv->window) {
+        PRESENTStopEventThread(present_priv);
         xcb_unregister_for_special_event(present_priv->xcb_connection, present_priv->special_event);
         present_priv->last_msc = 0;
+        present_priv->last_ust = 0;
+        /* msc values are per crtc, they might not be comparable anymore */
+        present_priv->sync_msc = 0;
+        present_priv->sync_ust = 0;
         present_priv->last_target = 0;
         present_priv->special_event = NULL;
     }
@@ -845,11 +1291,39 @@ static BOOL PRESENTPrivChangeWindow(PRESENTpriv *present_priv, XID window)
                 xcb_unregister_for_special_event(present_priv->xcb_connection, present_priv->special_event);
             present_priv->special_event = NULL;
             present_priv->window = 0;
+        } else if (!PRESENTStartEventThread(present_priv)) {
+            xcb_unregister_for_special_event(present_priv->xcb_connection, present_priv->special_event);
+            present_priv->special_event = NULL;
+            present_priv->window = 0;
         }
     }
     return (present_priv->window != 0);
 }
 
+#ifdef D3DADAPTER9_DRI2
+
+/* Called on the blit thread */
+static void
+DRI2DeletePixmapGL(struct DRI2priv *dri2_priv, struct DRI2PixmapGL *gl)
+{
+    /* GL keeps the objects alive until the pending blits complete */
+    glDeleteFramebuffers(1, &gl->fbo_read);
+    glDeleteFramebuffers(1, &gl->fbo_write);
+    glDeleteTextures(1, &gl->texture_read);
+    glDeleteTextures(1, &gl->texture_write);
+    if (gl->fence != EGL_NO_SYNC_KHR)
+        dri2_priv->eglDestroySyncKHR_func(dri2_priv->display, gl->fence);
+}
+
+static void
+DRI2DestroyPixmapGL(struct DRI2priv *dri2_priv, void *data)
+{
+    DRI2DeletePixmapGL(dri2_priv, data);
+    free(data);
+}
+
+#endif
+
 /* Destroy the content, except the link and the struct mem */
 static void
 PRESENTDestroyPixmapContent(Display *dpy, PRESENTPixmapPriv *present_pixmap)
@@ -858,19 +1332,17 @@ PRESENTDestroyPixmapContent(Display *dpy, PRESENTPixmapPriv *present_pixmap)
 #ifdef D3DADAPTER9_DRI2
     if (present_pixmap->dri2_info.is_dri2) {
         struct DRI2priv *dri2_priv = present_pixmap->dri2_info.dri2_priv;
-        EGLenum current_api;
-        current_api = eglQueryAPI();
-        eglBindAPI(EGL_OPENGL_API);
-        if(eglMakeCurrent(dri2_priv->display, EGL_NO_SURFACE, EGL_NO_SURFACE, dri2_priv->context)) {
-            glDeleteFramebuffers(1, &present_pixmap->dri2_info.fbo_read);
-            glDeleteFramebuffers(1, &present_pixmap->dri2_info.fbo_write);
-            glDeleteTextures(1, &present_pixmap->dri2_info.texture_read);
-            glDeleteTextures(1, &present_pixmap->dri2_info.texture_write);
-        } else {
-            ERR("eglMakeCurrent failed with 0x%0X\n", eglGetError());
+        struct DRI2PixmapGL *gl = malloc(sizeof(*gl));
+
+        /* No need to wait, the blit thread drains its queue before the
+         * context is destroyed */
+        if (gl) {
+            *gl = present_pixmap->dri2_info.gl;
+            if (DRI2RunOnBlitThread(dri2_priv, DRI2DestroyPixmapGL, gl, FALSE))
+                return;
+            free(gl);
         }
-        eglMakeCurrent(dri2_priv->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-        eglBindAPI(current_api);
+        ERR("Failed to destroy the GL objects of pixmap %p\n", present_pixmap);
     }
 #endif
 }
@@ -878,27 +1350,36 @@ PRESENTDestroyPixmapContent(Display *dpy, PRESENTPixmapPriv *present_pixmap)
 void
 PRESENTDestroy(Display *dpy, PRESENTpriv *present_priv)
 {
-    PRESENTPixmapPriv *current = NULL;
+    struct PRESENTPixmapRegistry *registry = &present_priv->pixmaps;
+    unsigned int i;
 
     pthread_mutex_lock(&present_priv->mutex_present);
 
     PRESENTForceReleases(present_priv);
+    /* Join the event thread before freeing the pixmaps it looks up */
+    PRESENTFreeXcbQueue(present_priv);
 
-    current = present_priv->first_present_priv;
-    while (current) {
-        PRESENTPixmapPriv *next = current->next;
+    for (i = 0; i < registry->slots_used; i++) {
+        PRESENTPixmapPriv *current = registry->slots[i];
+        if (!current)
+            continue;
+        PRESENTUnregisterPixmapPriv(present_priv, current);
         PRESENTDestroyPixmapContent(dpy, current);
+        pthread_cond_destroy(&current->released_cond);
         free(current);
-        current = next;
     }
 
-    PRESENTFreeXcbQueue(present_priv);
+    if (present_priv->valid_region)
+        xcb_xfixes_destroy_region(present_priv->xcb_connection_bis, present_priv->valid_region);
+    if (present_priv->update_region)
+        xcb_xfixes_destroy_region(present_priv->xcb_connection_bis, present_priv->update_region);
 
     xcb_disconnect(present_priv->xcb_connection);
     xcb_disconnect(present_priv->xcb_connection_bis);
     pthread_mutex_unlock(&present_priv->mutex_present);
     pthread_mutex_destroy(&present_priv->mutex_present);
-    pthread_mutex_destroy(&present_priv->mutex_xcb_wait);
+    pthread_cond_destroy(&present_priv->event_cond);
+    PRESENTRegistryDestroy(registry);
 
     free(present_priv);
 }
@@ -925,18 +1406,21 @@ PRESENTPixmapInit(PRESENTpriv *present_priv, Pixmap pixmap, PRESENTPixmapPriv **
     (*present_pixmap_priv)->released = TRUE;
     (*present_pixmap_priv)->pixmap = pixmap;
     (*present_pixmap_priv)->present_priv = present_priv;
-    (*present_pixmap_priv)->next = present_priv->first_present_priv;
     (*present_pixmap_priv)->width = reply->width;
     (*present_pixmap_priv)->height = reply->height;
     (*present_pixmap_priv)->depth = reply->depth;
+    pthread_cond_init(&(*present_pixmap_priv)->released_cond, NULL);
 #ifdef D3DADAPTER9_DRI2
     (*present_pixmap_priv)->dri2_info.is_dri2 = FALSE;
 #endif
     free(reply);
 
-    present_priv->last_serial_given++;
-    (*present_pixmap_priv)->serial = present_priv->last_serial_given;
-    present_priv->first_present_priv = *present_pixmap_priv;
+    if (!PRESENTRegisterPixmapPriv(present_priv, *present_pixmap_priv)) {
+        pthread_cond_destroy(&(*present_pixmap_priv)->released_cond);
+        free(*present_pixmap_priv);
+        pthread_mutex_unlock(&present_priv->mutex_present);
+        return FALSE;
+    }
 
     pthread_mutex_unlock(&present_priv->mutex_present);
     return TRUE;
@@ -944,15 +1428,143 @@ PRESENTPixmapInit(PRESENTpriv *present_priv, Pixmap pixmap, PRESENTPixmapPriv **
 
 #ifdef D3DADAPTER9_DRI2
 
+struct DRI2CreateJob {
+    PRESENTPixmapPriv *present_pixmap_priv;
+    const EGLint *attribs; /* dma-buf import attributes */
+    BOOL success;
+};
+
+/* Called on the blit thread */
+static void
+DRI2CreatePixmapGL(struct DRI2priv *dri2_priv, void *data)
+{
+    struct DRI2CreateJob *job = data;
+    PRESENTPixmapPriv *present_pixmap_priv = job->present_pixmap_priv;
+    struct DRI2PixmapGL *gl = &present_pixmap_priv->dri2_info.gl;
+    EGLImageKHR image;
+    GLenum status;
+
+    /* We bind the dma-buf to a EGLImage, then to a texture, and then to a fbo.
+     * Note that we can delete the EGLImage, but we shouldn't delete the texture,
+     * else the fbo is invalid */
+    image = dri2_priv->eglCreateImageKHR_func(dri2_priv->display,
+                                              EGL_NO_CONTEXT,
+                                              EGL_LINUX_DMA_BUF_EXT,
+                                              NULL, job->attribs);
+    if (image == EGL_NO_IMAGE_KHR)
+        return;
+
+    glGenTextures(1, &gl->texture_read);
+    glBindTexture(GL_TEXTURE_2D, gl->texture_read);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    dri2_priv->glEGLImageTargetTexture2DOES_func(GL_TEXTURE_2D, image);
+    glGenFramebuffers(1, &gl->fbo_read);
+    glBindFramebuffer(GL_FRAMEBUFFER, gl->fbo_read);
+    glFramebufferTexture2D(GL_FRAMEBUFFER,
+                           GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, gl->texture_read,
+                           0);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    dri2_priv->eglDestroyImageKHR_func(dri2_priv->display, image);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+        goto fail;
+
+    /* We bind a newly created pixmap (to which we want to copy the content)
+     * to an EGLImage, then to a texture, then to a fbo. */
+    image = dri2_priv->eglCreateImageKHR_func(dri2_priv->display,
+                                              dri2_priv->context,
+                                              EGL_NATIVE_PIXMAP_KHR,
+                                              (void *)present_pixmap_priv->pixmap, NULL);
+    if (image == EGL_NO_IMAGE_KHR)
+        goto fail;
+
+    glGenTextures(1, &gl->texture_write);
+    glBindTexture(GL_TEXTURE_2D, gl->texture_write);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    dri2_priv->glEGLImageTargetTexture2DOES_func(GL_TEXTURE_2D, image);
+    glGenFramebuffers(1, &gl->fbo_write);
+    glBindFramebuffer(GL_FRAMEBUFFER, gl->fbo_write);
+    glFramebufferTexture2D(GL_FRAMEBUFFER,
+                           GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_2D, gl->texture_write,
+                           0);
+    status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+    glBindTexture(GL_TEXTURE_2D, 0);
+    dri2_priv->eglDestroyImageKHR_func(dri2_priv->display, image);
+    if (status != GL_FRAMEBUFFER_COMPLETE)
+        goto fail;
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    job->success = TRUE;
+    return;
+
+fail:
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    DRI2DeletePixmapGL(dri2_priv, gl);
+}
+
+/* Called on the blit thread */
+static void
+DRI2BlitPixmap(struct DRI2priv *dri2_priv, void *data)
+{
+    PRESENTPixmapPriv *present_pixmap_priv = data;
+    struct DRI2PixmapGL *gl = &present_pixmap_priv->dri2_info.gl;
+
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, gl->fbo_read);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, gl->fbo_write);
+
+    glBlitFramebuffer(0, 0, present_pixmap_priv->width, present_pixmap_priv->height,
+                      0, 0, present_pixmap_priv->width, present_pixmap_priv->height,
+                      GL_COLOR_BUFFER_BIT, GL_NEAREST);
+
+    if (dri2_priv->has_fence_sync) {
+        EGLSyncKHR fence = dri2_priv->eglCreateSyncKHR_func(dri2_priv->display, EGL_SYNC_FENCE_KHR, NULL);
+
+        /* DRI2WaitBlit might be waiting on the previous fence */
+        pthread_mutex_lock(&dri2_priv->blit_mutex);
+        if (gl->fence != EGL_NO_SYNC_KHR)
+            dri2_priv->eglDestroySyncKHR_func(dri2_priv->display, gl->fence);
+        gl->fence = fence;
+        pthread_mutex_unlock(&dri2_priv->blit_mutex);
+    }
+    /* The X server reads the pixmap once it gets the PresentPixmap request */
+    glFlush();
+}
+
+/* Waits for the GPU to be done reading the buffer. Returns FALSE if there
+ * is no fence to wait on. */
+static BOOL
+DRI2WaitBlit(PRESENTPixmapPriv *present_pixmap_priv)
+{
+    struct DRI2priv *dri2_priv = present_pixmap_priv->dri2_info.dri2_priv;
+    EGLSyncKHR fence;
+    BOOL ret = FALSE;
+
+    if (!dri2_priv->has_fence_sync)
+        return FALSE;
+
+    /* Keep the blit thread from destroying the fence while waiting on it.
+     * It was already flushed by the blit thread, so the wait is bounded. */
+    pthread_mutex_lock(&dri2_priv->blit_mutex);
+    fence = present_pixmap_priv->dri2_info.gl.fence;
+    if (fence != EGL_NO_SYNC_KHR)
+        ret = dri2_priv->eglClientWaitSyncKHR_func(dri2_priv->display, fence, 0,
+                                                   EGL_FOREVER_KHR) == EGL_CONDITION_SATISFIED_KHR;
+    pthread_mutex_unlock(&dri2_priv->blit_mutex);
+    return ret;
+}
+
 BOOL
 DRI2FallbackPRESENTPixmap(PRESENTpriv *present_priv, struct DRI2priv *dri2_priv,
                           int fd, int width, int height, int stride, int depth,
                           int bpp, PRESENTPixmapPriv **present_pixmap_priv)
 {
     Window root = RootWindow(dri2_priv->dpy, DefaultScreen(dri2_priv->dpy));
+    struct DRI2CreateJob job;
     Pixmap pixmap;
-    EGLImageKHR image;
-    GLuint texture_read, texture_write, fbo_read, fbo_write;
     EGLint attribs[] = {
         EGL_WIDTH, 0,
         EGL_HEIGHT, 0,
@@ -962,8 +1574,6 @@ DRI2FallbackPRESENTPixmap(PRESENTpriv *present_priv, struct DRI2priv *dri2_priv,
         EGL_DMA_BUF_PLANE0_PITCH_EXT, 0,
         EGL_NONE
     };
-    EGLenum current_api = 0;
-    int status;
 
     pthread_mutex_lock(&present_priv->mutex_present);
 
@@ -976,100 +1586,44 @@ DRI2FallbackPRESENTPixmap(PRESENTpriv *present_priv, struct DRI2priv *dri2_priv,
     attribs[7] = fd;
     attribs[11] = stride;
 
-    current_api = eglQueryAPI();
-    eglBindAPI(EGL_OPENGL_API);
-
-    /* We bind the dma-buf to a EGLImage, then to a texture, and then to a fbo.
-     * Note that we can delete the EGLImage, but we shouldn't delete the texture,
-     * else the fbo is invalid */
-
-    image = dri2_priv->eglCreateImageKHR_func(dri2_priv->display,
-                              EGL_NO_CONTEXT,
-                              EGL_LINUX_DMA_BUF_EXT,
-                              NULL, attribs);
-
-    if (image == EGL_NO_IMAGE_KHR)
-        goto fail;
-    close(fd);
-
-    if(eglMakeCurrent(dri2_priv->display, EGL_NO_SURFACE, EGL_NO_SURFACE, dri2_priv->context)) {
-        glGenTextures(1, &texture_read);
-        glBindTexture(GL_TEXTURE_2D, texture_read);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        dri2_priv->glEGLImageTargetTexture2DOES_func(GL_TEXTURE_2D, image);
-        glGenFramebuffers(1, &fbo_read);
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo_read);
-        glFramebufferTexture2D(GL_FRAMEBUFFER,
-                               GL_COLOR_ATTACHMENT0,
-                               GL_TEXTURE_2D, texture_read,
-                               0);
-        status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-        if (status != GL_FRAMEBUFFER_COMPLETE)
-            goto fail;
-        glBindTexture(GL_TEXTURE_2D, 0);
-        dri2_priv->eglDestroyImageKHR_func(dri2_priv->display, image);
-
-        /* We bind a newly created pixmap (to which we want to copy the content)
-         * to an EGLImage, then to a texture, then to a fbo. */
-        image = dri2_priv->eglCreateImageKHR_func(dri2_priv->display,
-                                                  dri2_priv->context,
-                                                  EGL_NATIVE_PIXMAP_KHR,
-                                                  (void *)pixmap, NULL);
-        if (image == EGL_NO_IMAGE_KHR)
-            goto fail;
-
-        glGenTextures(1, &texture_write);
-        glBindTexture(GL_TEXTURE_2D, texture_write);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-        dri2_priv->glEGLImageTargetTexture2DOES_func(GL_TEXTURE_2D, image);
-        glGenFramebuffers(1, &fbo_write);
-        glBindFramebuffer(GL_FRAMEBUFFER, fbo_write);
-        glFramebufferTexture2D(GL_FRAMEBUFFER,
-                               GL_COLOR_ATTACHMENT0,
-                               GL_TEXTURE_2D, texture_write,
-                               0);
-        status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
-        if (status != GL_FRAMEBUFFER_COMPLETE)
-            goto fail;
-        glBindTexture(GL_TEXTURE_2D, 0);
-        dri2_priv->eglDestroyImageKHR_func(dri2_priv->display, image);
-    } else {
-        ERR("eglMakeCurrent failed with 0x%0X\n", eglGetError());
-    }
-    eglMakeCurrent(dri2_priv->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-
     *present_pixmap_priv = (PRESENTPixmapPriv *) calloc(1, sizeof(PRESENTPixmapPriv));
     if (!*present_pixmap_priv) {
+        XFreePixmap(dri2_priv->dpy, pixmap);
         goto fail;
     }
 
     (*present_pixmap_priv)->released = TRUE;
     (*present_pixmap_priv)->pixmap = pixmap;
     (*present_pixmap_priv)->present_priv = present_priv;
-    (*present_pixmap_priv)->next = present_priv->first_present_priv;
     (*present_pixmap_priv)->width = width;
     (*present_pixmap_priv)->height = height;
     (*present_pixmap_priv)->depth = depth;
     (*present_pixmap_priv)->dri2_info.is_dri2 = TRUE;
     (*present_pixmap_priv)->dri2_info.dri2_priv = dri2_priv;
-    (*present_pixmap_priv)->dri2_info.fbo_read = fbo_read;
-    (*present_pixmap_priv)->dri2_info.fbo_write = fbo_write;
-    (*present_pixmap_priv)->dri2_info.texture_read = texture_read;
-    (*present_pixmap_priv)->dri2_info.texture_write = texture_write;
-
-    present_priv->last_serial_given++;
-    (*present_pixmap_priv)->serial = present_priv->last_serial_given;
-    present_priv->first_present_priv = *present_pixmap_priv;
+    (*present_pixmap_priv)->dri2_info.gl.fence = EGL_NO_SYNC_KHR;
+
+    job.present_pixmap_priv = *present_pixmap_priv;
+    job.attribs = attribs;
+    job.success = FALSE;
+    if (!DRI2RunOnBlitThread(dri2_priv, DRI2CreatePixmapGL, &job, TRUE) || !job.success) {
+        ERR("Failed to import the buffer\n");
+        XFreePixmap(dri2_priv->dpy, pixmap);
+        free(*present_pixmap_priv);
+        goto fail;
+    }
+    close(fd);
 
-    eglBindAPI(current_api);
+    pthread_cond_init(&(*present_pixmap_priv)->released_cond, NULL);
+    if (!PRESENTRegisterPixmapPriv(present_priv, *present_pixmap_priv)) {
+        PRESENTDestroyPixmapContent(dri2_priv->dpy, *present_pixmap_priv);
+        pthread_cond_destroy(&(*present_pixmap_priv)->released_cond);
+        free(*present_pixmap_priv);
+        goto fail;
+    }
 
     pthread_mutex_unlock(&present_priv->mutex_present);
     return TRUE;
 fail:
-    eglMakeCurrent(dri2_priv->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-    eglBindAPI(current_api);
     pthread_mutex_unlock(&present_priv->mutex_present);
     return FALSE;
 }
@@ -1080,7 +1634,6 @@ BOOL
 PRESENTTryFreePixmap(Display *dpy, PRESENTPixmapPriv *present_pixmap_priv)
 {
     PRESENTpriv *present_priv = present_pixmap_priv->present_priv;
-    PRESENTPixmapPriv *current;
 
     pthread_mutex_lock(&present_priv->mutex_present);
 
@@ -1089,17 +1642,9 @@ PRESENTTryFreePixmap(Display *dpy, PRESENTPixmapPriv *present_pixmap_priv)
         return FALSE;
     }
 
-    if (present_priv->first_present_priv == present_pixmap_priv) {
-        present_priv->first_present_priv = present_pixmap_priv->next;
-        goto free_priv;
-    }
-
-    current = present_priv->first_present_priv;
-    while (current->next != present_pixmap_priv)
-        current = current->next;
-    current->next = present_pixmap_priv->next;
-free_priv:
+    PRESENTUnregisterPixmapPriv(present_priv, present_pixmap_priv);
     PRESENTDestroyPixmapContent(dpy, present_pixmap_priv);
+    pthread_cond_destroy(&present_pixmap_priv->released_cond);
     free(present_pixmap_priv);
     pthread_mutex_unlock(&present_priv->mutex_present);
     return TRUE;
@@ -1140,18 +1685,107 @@ PRESENTHelperCopyFront(Display *dpy, PRESENTPixmapPriv *present_pixmap_priv)
     return (error != NULL);
 }
 
+#define PRESENT_MAX_UPDATE_RECTS 16
+
+static inline uint64_t PRESENTRectArea(const xcb_rectangle_t *rect)
+{
+    return (uint64_t)rect->width * rect->height;
+}
+
+static void PRESENTRectUnion(xcb_rectangle_t *dst, const xcb_rectangle_t *a, const xcb_rectangle_t *b)
+{
+    int x1 = min(a->x, b->x);
+    int y1 = min(a->y, b->y);
+    int x2 = max(a->x + a->width, b->x + b->width);
+    int y2 = max(a->y + a->height, b->y + b->height);
+
+    dst->x = x1;
+    dst->y = y1;
+    dst->width = x2 - x1;
+    dst->height = y2 - y1;
+}
+
+static BOOL PRESENTClipRect(xcb_rectangle_t *dst, const RECT *rect, unsigned int width, unsigned int height)
+{
+    int left = max(rect->left, 0);
+    int top = max(rect->top, 0);
+    int right = min(rect->right, (int)width);
+    int bottom = min(rect->bottom, (int)height);
+
+    if (left >= right || top >= bottom)
+        return FALSE;
+    dst->x = left;
+    dst->y = top;
+    dst->width = right - left;
+    dst->height = bottom - top;
+    return TRUE;
+}
+
+/* Adds rect to the count rects of the array, which must have room for
+ * PRESENT_MAX_UPDATE_RECTS + 1 rects. The new rect is merged with any rect
+ * when the area of their bounding box is at most the sum of their areas,
+ * and the merged rect is then checked against all the others again. Past
+ * PRESENT_MAX_UPDATE_RECTS rects, the pair whose bounding box adds the
+ * least area is merged. The update region can only grow, which is fine
+ * since the whole pixmap is valid. Returns the new count. */
+static unsigned int PRESENTAddUpdateRect(xcb_rectangle_t *rects, unsigned int count, const xcb_rectangle_t *rect)
+{
+    xcb_rectangle_t merged;
+    unsigned int i, j, best_i = 0, best_j = 0;
+    int64_t cost, best_cost;
+
+    rects[count++] = *rect;
+
+    /* rects[count - 1] is the new or last merged rect */
+    for (i = 0; i < count - 1; i++) {
+        PRESENTRectUnion(&merged, &rects[i], &rects[count - 1]);
+        if (PRESENTRectArea(&merged) <= PRESENTRectArea(&rects[i]) + PRESENTRectArea(&rects[count - 1])) {
+            rects[i] = rects[count - 2];
+            rects[count - 2] = merged;
+            count--;
+            i = -1; /* the merged rect may now touch others */
+        }
+    }
+
+    if (count <= PRESENT_MAX_UPDATE_RECTS)
+        return count;
+
+    best_cost = INT64_MAX;
+    for (i = 0; i < count; i++) {
+        for (j = i + 1; j < count; j++) {
+            PRESENTRectUnion(&merged, &rects[i], &rects[j]);
+            cost = PRESENTRectArea(&merged) - PRESENTRectArea(&rects[i]) - PRESENTRectArea(&rects[j]);
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_i = i;
+                best_j = j;
+            }
+        }
+    }
+    PRESENTRectUnion(&rects[best_i], &rects[best_i], &rects[best_j]);
+    rects[best_j] = rects[--count];
+    return count;
+}
+
+/* mutex_present must be held. The regions are kept for the lifetime of
+ * present_priv and updated with xcb_xfixes_set_region. */
+static void PRESENTCreateRegions(PRESENTpriv *present_priv)
+{
+    if (present_priv->valid_region)
+        return;
+    present_priv->valid_region = xcb_generate_id(present_priv->xcb_connection_bis);
+    present_priv->update_region = xcb_generate_id(present_priv->xcb_connection_bis);
+    xcb_xfixes_create_region(present_priv->xcb_connection_bis, present_priv->valid_region, 0, NULL);
+    xcb_xfixes_create_region(present_priv->xcb_connection_bis, present_priv->update_region, 0, NULL);
+}
+
 BOOL
 PRESENTPixmap(Display *dpy, XID window,
               PRESENTPixmapPriv *present_pixmap_priv, D3DPRESENT_PARAMETERS *pPresentationParameters,
               const RECT *pSourceRect, const RECT *pDestRect, const RGNDATA *pDirtyRegion)
 {
     PRESENTpriv *present_priv = present_pixmap_priv->present_priv;
-#ifdef D3DADAPTER9_DRI2
-    struct DRI2priv *dri2_priv = present_pixmap_priv->dri2_info.dri2_priv;
-    EGLenum current_api = 0;
-#endif
     xcb_void_cookie_t cookie;
-    xcb_generic_error_t *error;
     int64_t target_msc, presentationInterval;
     xcb_xfixes_region_t valid, update;
     int16_t x_off, y_off;
@@ -1168,29 +1802,28 @@ PRESENTPixmap(Display *dpy, XID window,
         return FALSE;
     }
 
-    PRESENTflush_events(present_priv, FALSE);
+    PRESENTCheckErrors(present_priv, FALSE);
+#ifdef D3DADAPTER9_DRI2
+    /* The buffer may be reused as soon as the blit is done, before the
+     * X server is done with the copy. Don't overwrite it too early. */
+    if (present_pixmap_priv->dri2_info.is_dri2) {
+        while ((!present_pixmap_priv->released || present_pixmap_priv->present_complete_pending) &&
+               PRESENTwait_cond(present_priv, &present_pixmap_priv->released_cond));
+    }
+#endif
     if (!present_pixmap_priv->released || present_pixmap_priv->present_complete_pending) {
         ERR("FATAL ERROR: Trying to Present a pixmap not released\n");
         pthread_mutex_unlock(&present_priv->mutex_present);
         return FALSE;
     }
 #ifdef D3DADAPTER9_DRI2
-    if (present_pixmap_priv->dri2_info.is_dri2) {
-        current_api = eglQueryAPI();
-        eglBindAPI(EGL_OPENGL_API);
-        if(eglMakeCurrent(dri2_priv->display, EGL_NO_SURFACE, EGL_NO_SURFACE, dri2_priv->context)) {
-            glBindFramebuffer(GL_READ_FRAMEBUFFER, present_pixmap_priv->dri2_info.fbo_read);
-            glBindFramebuffer(GL_DRAW_FRAMEBUFFER, present_pixmap_priv->dri2_info.fbo_write);
-
-            glBlitFramebuffer(0, 0, present_pixmap_priv->width, present_pixmap_priv->height,
-                              0, 0, present_pixmap_priv->width, present_pixmap_priv->height,
-                              GL_COLOR_BUFFER_BIT, GL_NEAREST);
-            glFlush(); /* Perhaps useless */
-        } else {
-            ERR("eglMakeCurrent failed with 0x%0X\n", eglGetError());
-        }
-        eglMakeCurrent(dri2_priv->display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
-        eglBindAPI(current_api);
+    /* Only wait for the blit to be flushed, the GPU work overlaps with
+     * the next frame */
+    if (present_pixmap_priv->dri2_info.is_dri2 &&
+        !DRI2RunOnBlitThread(present_pixmap_priv->dri2_info.dri2_priv, DRI2BlitPixmap,
+                             present_pixmap_priv, TRUE)) {
+        pthread_mutex_unlock(&present_priv->mutex_present);
+        return FALSE;
     }
 #endif
     target_msc = present_priv->last_msc;
@@ -1214,7 +1847,13 @@ PRESENTPixmap(Display *dpy, XID window,
             options |= XCB_PRESENT_OPTION_ASYNC;
             break;
     }
-    target_msc += presentationInterval * (present_priv->pixmap_present_pending + 1);
+    if (present_priv->mailbox && presentationInterval) {
+        /* Target the same vblank as the presentation still pending, if any.
+         * The X server then skips the older pixmap and releases it early,
+         * so the latest frame wins and the latency stays at one vblank. */
+        target_msc += presentationInterval;
+    } else
+        target_msc += presentationInterval * (present_priv->pixmap_present_pending + 1);
 
     /* Note: PRESENT defines some way to do partial copy:
      * presentproto:
@@ -1229,7 +1868,8 @@ PRESENTPixmap(Display *dpy, XID window,
         y_off = 0;
     } else {
         xcb_rectangle_t rect_update;
-        xcb_rectangle_t *rect_updates;
+        xcb_rectangle_t rect_updates[PRESENT_MAX_UPDATE_RECTS + 1];
+        unsigned int nrects = 0;
         int i;
 
         rect_update.x = 0;
@@ -1254,73 +1894,47 @@ PRESENTPixmap(Display *dpy, XID window,
             /* Note: the size of pDestRect and pSourceRect are supposed to be the same size
              * because the driver would have done things to assure that. */
         }
-        valid = xcb_generate_id(present_priv->xcb_connection_bis);
-        update = xcb_generate_id(present_priv->xcb_connection_bis);
-        xcb_xfixes_create_region(present_priv->xcb_connection_bis, valid, 1, &rect_update);
+        PRESENTCreateRegions(present_priv);
+        valid = present_priv->valid_region;
+        update = present_priv->update_region;
+        xcb_xfixes_set_region(present_priv->xcb_connection_bis, valid, 1, &rect_update);
         if (pDirtyRegion && pDirtyRegion->rdh.nCount) {
-            rect_updates = (void *) calloc(pDirtyRegion->rdh.nCount, sizeof(xcb_rectangle_t));
             for (i = 0; i < pDirtyRegion->rdh.nCount; i++)
             {
+                xcb_rectangle_t dirty;
                 RECT rc;
                 memcpy(&rc, pDirtyRegion->Buffer + i * sizeof(RECT), sizeof(RECT));
-                rect_update.x = rc.left;
-                rect_update.y = rc.top;
-                rect_update.width = rc.right - rc.left;
-                rect_update.height = rc.bottom - rc.top;
-                memcpy(rect_updates + i * sizeof(xcb_rectangle_t), &rect_update, sizeof(xcb_rectangle_t));
+                if (!PRESENTClipRect(&dirty, &rc, present_pixmap_priv->width, present_pixmap_priv->height))
+                    continue;
+                nrects = PRESENTAddUpdateRect(rect_updates, nrects, &dirty);
             }
-            xcb_xfixes_create_region(present_priv->xcb_connection_bis, update, pDirtyRegion->rdh.nCount, rect_updates);
-            free(rect_updates);
+            /* Nothing dirty is left after clipping, keep the default
+             * update area (the valid area) rather than an empty region */
+            if (nrects)
+                xcb_xfixes_set_region(present_priv->xcb_connection_bis, update, nrects, rect_updates);
+            else
+                update = 0;
         } else
-            xcb_xfixes_create_region(present_priv->xcb_connection_bis, update, 1, &rect_update);
+            xcb_xfixes_set_region(present_priv->xcb_connection_bis, update, 1, &rect_update);
     }
     if (pPresentationParameters->SwapEffect == D3DSWAPEFFECT_COPY)
         options |= XCB_PRESENT_OPTION_COPY;
-    cookie = xcb_present_pixmap_checked(present_priv->xcb_connection_bis,
-                                        window,
-                                        present_pixmap_priv->pixmap,
-                                        present_pixmap_priv->serial,
-                                        valid, update, x_off, y_off,
-                                        None, None, None, options,
-                                        target_msc, 0, 0, 0, NULL);
-    error = xcb_request_check(present_priv->xcb_connection_bis, cookie); /* performs a flush */
-
-    if (update)
-        xcb_xfixes_destroy_region(present_priv->xcb_connection_bis, update);
-    if (valid)
-        xcb_xfixes_destroy_region(present_priv->xcb_connection_bis, valid);
-
-    if (error) {
-        xcb_get_geometry_cookie_t cookie_geom;
-        xcb_get_geometry_reply_t *reply;
-
-        cookie_geom = xcb_get_geometry(present_priv->xcb_connection_bis, window);
-        reply = xcb_get_geometry_reply(present_priv->xcb_connection_bis, cookie_geom, NULL);
-
-        ERR("Error using PRESENT. Here some debug info\n");
-        if (!reply) {
-            ERR("Error querying window info. Perhaps it doesn't exist anymore\n");
-            pthread_mutex_unlock(&present_priv->mutex_present);
-            return FALSE;
-        }
-        ERR("Pixmap: width=%d, height=%d, depth=%d\n",
-            present_pixmap_priv->width, present_pixmap_priv->height,
-            present_pixmap_priv->depth);
-        ERR("Window: width=%d, height=%d, depth=%d, x=%d, y=%d\n",
-            (int) reply->width, (int) reply->height,
-            (int) reply->depth, (int) reply->x, (int) reply->y);
-        ERR("Present parameter: PresentationInterval=%d, BackBufferCount=%d, Pending presentations=%d\n",
-            pPresentationParameters->PresentationInterval,
-            pPresentationParameters->BackBufferCount,
-            present_priv->pixmap_present_pending
-           );
-        if (present_pixmap_priv->depth != reply->depth)
-            ERR("Depths are different. PRESENT needs the pixmap and the window have same depth\n");
-        free(reply);
-        pthread_mutex_unlock(&present_priv->mutex_present);
-        return FALSE;
-    }
+    /* Unchecked: a round trip per frame is too expensive. Errors are
+     * collected by PRESENTCheckErrors, on the next present or before
+     * waiting for an event. */
+    cookie = xcb_present_pixmap(present_priv->xcb_connection_bis,
+                                window,
+                                present_pixmap_priv->pixmap,
+                                present_pixmap_priv->serial,
+                                valid, update, x_off, y_off,
+                                None, None, None, options,
+                                target_msc, 0, 0, 0, NULL);
+    xcb_flush(present_priv->xcb_connection_bis);
+
+    present_pixmap_priv->present_sequence = cookie.sequence;
+    present_priv->errors_unchecked = TRUE;
     present_priv->last_target = target_msc;
+    present_pixmap_priv->present_count = ++present_priv->present_count;
     present_priv->pixmap_present_pending++;
     present_pixmap_priv->present_complete_pending = TRUE;
     present_pixmap_priv->released = FALSE;
@@ -1332,27 +1946,93 @@ BOOL
 PRESENTWaitPixmapReleased(PRESENTPixmapPriv *present_pixmap_priv)
 {
     PRESENTpriv *present_priv = present_pixmap_priv->present_priv;
+    BOOL ret;
+
+#ifdef D3DADAPTER9_DRI2
+    /* The X server only uses the copy */
+    if (present_pixmap_priv->dri2_info.is_dri2 && DRI2WaitBlit(present_pixmap_priv))
+        return TRUE;
+#endif
 
     pthread_mutex_lock(&present_priv->mutex_present);
 
-    PRESENTflush_events(present_priv, FALSE);
+    /* The event thread signals us as soon as the IdleNotify arrives */
+    while ((!present_pixmap_priv->released || present_pixmap_priv->present_complete_pending) &&
+           PRESENTwait_cond(present_priv, &present_pixmap_priv->released_cond));
 
-    while (!present_pixmap_priv->released || present_pixmap_priv->present_complete_pending) {
-        /* Note: following if should not happen because we'll never
-         * use two PRESENTWaitPixmapReleased in parallels on same window.
-         * However it would make it work in that case */
-        if (present_priv->xcb_wait) { /* we allow only one thread to dispatch events */
-            pthread_mutex_lock(&present_priv->mutex_xcb_wait);
-            /* here the other thread got an event but hasn't treated it yet */
-            pthread_mutex_unlock(&present_priv->mutex_xcb_wait);
-            pthread_mutex_unlock(&present_priv->mutex_present);
-            Sleep(10); /* Let it treat the event */
-            pthread_mutex_lock(&present_priv->mutex_present);
-        } else if (!PRESENTwait_events(present_priv, TRUE)) {
+    ret = present_pixmap_priv->released && !present_pixmap_priv->present_complete_pending;
+    pthread_mutex_unlock(&present_priv->mutex_present);
+    return ret;
+}
+
+static uint64_t PRESENTGetTime(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+BOOL
+PRESENTGetStats(PRESENTpriv *present_priv, struct PRESENTStats *stats)
+{
+    pthread_mutex_lock(&present_priv->mutex_present);
+    stats->present_count = present_priv->present_count;
+    stats->complete_present_count = present_priv->complete_present_count;
+    stats->complete_msc = present_priv->complete_msc;
+    stats->sync_msc = present_priv->sync_msc;
+    stats->sync_ust = present_priv->sync_ust;
+    stats->refresh_period_us = present_priv->refresh_period_us;
+    pthread_mutex_unlock(&present_priv->mutex_present);
+    stats->now_ust = PRESENTGetTime();
+    return stats->sync_ust != 0;
+}
+
+BOOL
+PRESENTThrottle(PRESENTpriv *present_priv, unsigned int max_pending, unsigned int frame_time_us, BOOL dont_wait)
+{
+    uint64_t now, deadline = 0;
+
+    pthread_mutex_lock(&present_priv->mutex_present);
+
+    if (max_pending) {
+        if (dont_wait && (unsigned int)present_priv->pixmap_present_pending >= max_pending) {
             pthread_mutex_unlock(&present_priv->mutex_present);
             return FALSE;
         }
+        while ((unsigned int)present_priv->pixmap_present_pending >= max_pending &&
+               PRESENTwait_events(present_priv));
+    }
+
+    if (frame_time_us) {
+        now = PRESENTGetTime();
+        /* UST is CLOCK_MONOTONIC based. When nothing is queued, don't show
+         * the new frame earlier than one frame time after the last one
+         * reached the screen. */
+        if (!present_priv->pixmap_present_pending && present_priv->last_ust &&
+            present_priv->last_ust + frame_time_us > present_priv->next_frame_time)
+            present_priv->next_frame_time = present_priv->last_ust + frame_time_us;
+        /* Don't try to catch up if we are more than a frame late */
+        if (present_priv->next_frame_time + frame_time_us < now)
+            present_priv->next_frame_time = now;
+        if (present_priv->next_frame_time > now) {
+            if (dont_wait) {
+                pthread_mutex_unlock(&present_priv->mutex_present);
+                return FALSE;
+            }
+            deadline = present_priv->next_frame_time;
+        }
+        present_priv->next_frame_time = max(present_priv->next_frame_time, now) + frame_time_us;
     }
+
     pthread_mutex_unlock(&present_priv->mutex_present);
+
+    if (deadline) {
+        struct timespec ts;
+
+        ts.tv_sec = deadline / 1000000;
+        ts.tv_nsec = (deadline % 1000000) * 1000;
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR);
+    }
     return TRUE;
 }
@@ -63,8 +63,10 @@ DRI3DmaBufFromPixmap(Display *dpy, Pixmap pixmap, int *fd, int *width, int *heig
 typedef struct PRESENTPriv PRESENTpriv;
 typedef struct PRESENTPixmapPriv PRESENTPixmapPriv;
 
+/* In mailbox mode, a presentation replaces the one still queued for the
+ * same vblank instead of being queued after it. */
 BOOL
-PRESENTInit(Display *dpy, PRESENTpriv **present_priv);
+PRESENTInit(Display *dpy, PRESENTpriv **present_priv, BOOL mailbox);
 
 /* will clean properly and free all PRESENTPixmapPriv associated to PRESENTpriv.
  * PRESENTPixmapPriv should not be freed by something else.
@@ -98,4 +100,25 @@ PRESENTPixmap(Display *dpy, XID window,
 BOOL
 PRESENTWaitPixmapReleased(PRESENTPixmapPriv *present_pixmap_priv);
 
+struct PRESENTStats {
+    UINT present_count; /* presentations issued */
+    UINT complete_present_count; /* present_count of the last presentation shown */
+    UINT64 complete_msc; /* msc at which it was shown */
+    UINT64 sync_msc; /* last vblank seen, and its time in us (CLOCK_MONOTONIC) */
+    UINT64 sync_ust;
+    UINT64 refresh_period_us; /* 0 if not known yet */
+    UINT64 now_ust; /* time at which the stats were taken */
+};
+
+/* Returns FALSE if no vblank timing has been received yet */
+BOOL
+PRESENTGetStats(PRESENTpriv *present_priv, struct PRESENTStats *stats);
+
+/* Blocks until less than max_pending presentations are in flight
+ * (0 for no limit), and until frame_time_us microseconds passed since the
+ * previous frame (0 for no limit). Returns FALSE instead of blocking if
+ * dont_wait is set. */
+BOOL
+PRESENTThrottle(PRESENTpriv *present_priv, unsigned int max_pending, unsigned int frame_time_us, BOOL dont_wait);
+
 #endif /* __WINE_DRI3_H */
@@ -43,6 +43,10 @@ WINE_DEFAULT_DEBUG_CHANNEL(d3dadapter);
 #define D3DPRESENT_DONOTWAIT      0x00000001
 #endif
 
+#ifndef D3DPRESENT_BACK_BUFFERS_MAX_EX
+#define D3DPRESENT_BACK_BUFFERS_MAX_EX 30
+#endif
+
 #define WINE_D3DADAPTER_DRIVER_PRESENT_VERSION_MAJOR 1
 #ifdef ID3DPresent_GetWindowOccluded
 #if defined (ID3DPresent_ResolutionMismatch) && \
@@ -91,6 +95,8 @@ struct x11drv_escape_get_drawable
     RECT                     dc_rect;      /* DC rectangle relative to drawable */
 };
 
+/* context_section only protects the hwnd -> d3d_drawable map. Each
+ * d3d_drawable has its own lock held while presenting to it. */
 static XContext d3d_hwnd_context;
 static CRITICAL_SECTION context_section;
 static CRITICAL_SECTION_DEBUG critsect_debug =
@@ -110,6 +116,10 @@ struct d3d_drawable
     RECT dc_rect; /* rect relative to the X11 drawable */
     HDC hdc;
     HWND wnd; /* HWND (for convenience) */
+    LONG refs; /* one for the hwnd map, one per user */
+    LONG invalid; /* set by the wndproc hook when dc_rect needs a refresh */
+    LONG tracked; /* whether the wndproc hook updates invalid */
+    CRITICAL_SECTION lock;
 };
 
 struct DRI3Present
@@ -130,6 +140,9 @@ struct DRI3Present
     HCURSOR hCursor;
 
     DEVMODEW initial_mode;
+    /* current mode for GetRasterStatus, 0 until queried or after a mode change */
+    DWORD mode_height;
+    DWORD mode_refresh_rate;
     BOOL resolution_mismatch;
     BOOL occluded;
     Display *gdi_display;
@@ -140,6 +153,10 @@ struct DRI3Present
     long style;
     long style_ex;
     boolean drop_wnd_messages;
+
+    BOOL mailbox;
+    unsigned int frame_time_us; /* frame limiter, 0 if disabled */
+    unsigned int max_frames_in_flight; /* 0 if unlimited */
 };
 
 struct D3DWindowBuffer
@@ -150,10 +167,27 @@ struct D3DWindowBuffer
 static void
 free_d3dadapter_drawable(struct d3d_drawable *d3d)
 {
+    if (d3d->tracked)
+        nine_unregister_drawable_window(d3d->wnd, &d3d->invalid);
+    d3d->lock.DebugInfo->Spare[0] = 0;
+    DeleteCriticalSection(&d3d->lock);
     ReleaseDC(d3d->wnd, d3d->hdc);
     HeapFree(GetProcessHeap(), 0, d3d);
 }
 
+static void
+d3d_drawable_addref(struct d3d_drawable *d3d)
+{
+    InterlockedIncrement(&d3d->refs);
+}
+
+static void
+d3d_drawable_release(struct d3d_drawable *d3d)
+{
+    if (!InterlockedDecrement(&d3d->refs))
+        free_d3dadapter_drawable(d3d);
+}
+
 void
 destroy_d3dadapter_drawable(Display *gdi_display, HWND hwnd)
 {
@@ -163,7 +197,10 @@ destroy_d3dadapter_drawable(Display *gdi_display, HWND hwnd)
     if (!XFindContext(gdi_display, (XID)hwnd,
                       d3d_hwnd_context, (char **)&d3d)) {
         XDeleteContext(gdi_display, (XID)hwnd, d3d_hwnd_context);
-        free_d3dadapter_drawable(d3d);
+        LeaveCriticalSection(&context_section);
+        /* drop the map reference, users may still hold theirs */
+        d3d_drawable_release(d3d);
+        return;
     }
     LeaveCriticalSection(&context_section);
 }
@@ -193,55 +230,72 @@ create_d3dadapter_drawable(HWND hwnd)
     d3d->drawable = extesc.drawable;
     d3d->wnd = hwnd;
     d3d->dc_rect = extesc.dc_rect;
+    d3d->refs = 1;
+    d3d->invalid = TRUE; /* the window might move before the hook is set */
+    InitializeCriticalSection(&d3d->lock);
+    d3d->lock.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": d3d_drawable.lock");
+    d3d->tracked = FALSE;
 
     return d3d;
 }
 
+/* Returns the drawable locked and referenced, release it with
+ * release_d3d_drawable */
 static struct d3d_drawable *
 get_d3d_drawable(Display *gdi_display, HWND hwnd)
 {
+    struct x11drv_escape_get_drawable extesc = { X11DRV_GET_DRAWABLE };
     struct d3d_drawable *d3d, *race;
 
     EnterCriticalSection(&context_section);
-    if (!XFindContext(gdi_display, (XID)hwnd,
-                      d3d_hwnd_context, (char **)&d3d)) {
-        struct x11drv_escape_get_drawable extesc = { X11DRV_GET_DRAWABLE };
+    if (XFindContext(gdi_display, (XID)hwnd,
+                     d3d_hwnd_context, (char **)&d3d)) {
+        LeaveCriticalSection(&context_section);
+
+        TRACE("No d3d_drawable attached to hwnd %p, creating one.\n", hwnd);
+
+        d3d = create_d3dadapter_drawable(hwnd);
+        if (!d3d) { return NULL; }
+
+        EnterCriticalSection(&context_section);
+        if (!XFindContext(gdi_display, (XID)hwnd,
+                          d3d_hwnd_context, (char **)&race)) {
+            /* apparently someone beat us to creating this d3d drawable. Let's not
+               waste more time with X11 calls and just use theirs instead. */
+            d3d_drawable_release(d3d);
+            d3d = race;
+        } else {
+            XSaveContext(gdi_display, (XID)hwnd, d3d_hwnd_context, (char *)d3d);
+            /* Without the hook, fall back to querying X11DRV on every present */
+            nine_register_drawable_window(hwnd, &d3d->invalid, &d3d->tracked);
+        }
+    }
+    d3d_drawable_addref(d3d);
+    LeaveCriticalSection(&context_section);
 
-        /* check if the window has moved since last we used it */
+    EnterCriticalSection(&d3d->lock);
+
+    /* check if the window has moved since last we used it */
+    if (!d3d->tracked || InterlockedExchange(&d3d->invalid, FALSE)) {
         if (ExtEscape(d3d->hdc, X11DRV_ESCAPE, sizeof(extesc), (LPCSTR)&extesc,
                       sizeof(extesc), (LPSTR)&extesc) <= 0) {
             WARN("Window update check failed (hwnd=%p, hdc=%p)\n",
                  hwnd, d3d->hdc);
-        }
-
-        if (!EqualRect(&d3d->dc_rect, &extesc.dc_rect))
+        } else if (!EqualRect(&d3d->dc_rect, &extesc.dc_rect)) {
             d3d->dc_rect = extesc.dc_rect;
-
-        return d3d;
+        }
     }
-    LeaveCriticalSection(&context_section);
 
-    TRACE("No d3d_drawable attached to hwnd %p, creating one.\n", hwnd);
-
-    d3d = create_d3dadapter_drawable(hwnd);
-    if (!d3d) { return NULL; }
-
-    EnterCriticalSection(&context_section);
-    if (!XFindContext(gdi_display, (XID)hwnd,
-                      d3d_hwnd_context, (char **)&race)) {
-        /* apparently someone beat us to creating this d3d drawable. Let's not
-           waste more time with X11 calls and just use theirs instead. */
-        free_d3dadapter_drawable(d3d);
-        return race;
-    }
-    XSaveContext(gdi_display, (XID)hwnd, d3d_hwnd_context, (char *)d3d);
     return d3d;
 }
 
 static void
 release_d3d_drawable(struct d3d_drawable *d3d)
 {
-    if (d3d) { LeaveCriticalSection(&context_section); }
+    if (d3d) {
+        LeaveCriticalSection(&d3d->lock);
+        d3d_drawable_release(d3d);
+    }
 }
 
 static ULONG WINAPI
@@ -260,8 +314,10 @@ DRI3Present_Release( struct DRI3Present *This )
     if (refs == 0) {
         /* dtor */
         (void) nine_unregister_window(This->focus_wnd);
-        if (This->d3d)
+        if (This->d3d) {
             destroy_d3dadapter_drawable(This->gdi_display, This->d3d->wnd);
+            d3d_drawable_release(This->d3d);
+        }
         ChangeDisplaySettingsExW(This->devname, &(This->initial_mode), 0, CDS_FULLSCREEN, NULL);
 
         PRESENTDestroy(This->gdi_display, This->present_priv);
@@ -389,6 +445,10 @@ DRI3Present_PresentBuffer( struct DRI3Present *This,
     struct d3d_drawable *d3d;
     RECT dest_translate;
 
+    if (!PRESENTThrottle(This->present_priv, This->max_frames_in_flight,
+                         This->frame_time_us, Flags & D3DPRESENT_DONOTWAIT))
+        return D3DERR_WASSTILLDRAWING;
+
     if (hWndOverride) {
         d3d = get_d3d_drawable(This->gdi_display, hWndOverride);
     } else if (This->params.hDeviceWindow) {
@@ -399,10 +459,15 @@ DRI3Present_PresentBuffer( struct DRI3Present *This,
     if (!d3d) { return D3DERR_DRIVERINTERNALERROR; }
 
     /* TODO: should we use a list here instead ? */
-    if (This->d3d && (This->d3d->wnd != d3d->wnd)) {
-        destroy_d3dadapter_drawable(This->gdi_display, This->d3d->wnd);
+    if (This->d3d != d3d) {
+        if (This->d3d) {
+            if (This->d3d->wnd != d3d->wnd)
+                destroy_d3dadapter_drawable(This->gdi_display, This->d3d->wnd);
+            d3d_drawable_release(This->d3d);
+        }
+        d3d_drawable_addref(d3d);
+        This->d3d = d3d;
     }
-    This->d3d = d3d;
 
     if (d3d->dc_rect.top != 0 &&
         d3d->dc_rect.left != 0) {
@@ -418,20 +483,66 @@ DRI3Present_PresentBuffer( struct DRI3Present *This,
     }
 
     if (!PRESENTPixmap(This->gdi_display, d3d->drawable, buffer->present_pixmap_priv,
-                       &This->params, pSourceRect, pDestRect, pDirtyRegion))
+                       &This->params, pSourceRect, pDestRect, pDirtyRegion)) {
+        release_d3d_drawable(d3d);
         return D3DERR_DRIVERINTERNALERROR;
+    }
 
     release_d3d_drawable(d3d);
 
     return D3D_OK;
 }
 
+/* The position of the beam is estimated from the last vblank
+ * timestamp (UST) and the refresh period measured by PRESENT */
 static HRESULT WINAPI
 DRI3Present_GetRasterStatus( struct DRI3Present *This,
                              D3DRASTER_STATUS *pRasterStatus )
 {
-    FIXME("(%p, %p), stub!\n", This, pRasterStatus);
-    return D3DERR_INVALIDCALL;
+    struct PRESENTStats stats;
+    UINT64 period, line_time, phase;
+    UINT scan_line;
+    DWORD height, refresh_rate;
+    DEVMODEW dm;
+
+    TRACE("(%p, %p)\n", This, pRasterStatus);
+
+    if (!pRasterStatus)
+        return D3DERR_INVALIDCALL;
+
+    /* Applications tend to spin on this, so only query the mode again
+     * after it changed. */
+    refresh_rate = This->mode_refresh_rate;
+    if (!(height = This->mode_height)) {
+        ZeroMemory(&dm, sizeof(dm));
+        dm.dmSize = sizeof(dm);
+        if (!EnumDisplaySettingsExW(This->devname, ENUM_CURRENT_SETTINGS, &dm, 0) || !dm.dmPelsHeight)
+            return D3DERR_INVALIDCALL;
+        This->mode_refresh_rate = refresh_rate = dm.dmDisplayFrequency;
+        This->mode_height = height = dm.dmPelsHeight;
+    }
+
+    /* without any vblank seen yet, the phase is arbitrary */
+    if (!PRESENTGetStats(This->present_priv, &stats) || stats.sync_ust > stats.now_ust)
+        stats.sync_ust = 0;
+
+    period = stats.refresh_period_us;
+    if (!period)
+        period = 1000000 / (refresh_rate > 1 ? refresh_rate : 60);
+
+    /* Assume 20 scan lines in the vertical blank, like wined3d. */
+    line_time = max(period / (height + 20), 1);
+    phase = (stats.now_ust - stats.sync_ust) % period;
+    scan_line = phase / line_time;
+
+    if (scan_line < height) {
+        pRasterStatus->InVBlank = FALSE;
+        pRasterStatus->ScanLine = scan_line;
+    } else {
+        pRasterStatus->InVBlank = TRUE;
+        pRasterStatus->ScanLine = 0;
+    }
+    return D3D_OK;
 }
 
 static HRESULT WINAPI
@@ -479,8 +590,29 @@ static HRESULT WINAPI
 DRI3Present_GetPresentStats( struct DRI3Present *This,
                              D3DPRESENTSTATS *pStats )
 {
-    FIXME("(%p, %p), stub!\n", This, pStats);
-    return D3DERR_INVALIDCALL;
+    struct PRESENTStats stats;
+    LARGE_INTEGER counter, freq;
+
+    TRACE("(%p, %p)\n", This, pStats);
+
+    if (!pStats)
+        return D3DERR_INVALIDCALL;
+    if (!PRESENTGetStats(This->present_priv, &stats))
+        return D3DERR_INVALIDCALL;
+    if (!QueryPerformanceCounter(&counter) || !QueryPerformanceFrequency(&freq))
+        return D3DERR_INVALIDCALL;
+    if (stats.sync_ust > stats.now_ust)
+        stats.now_ust = stats.sync_ust;
+
+    pStats->PresentCount = stats.complete_present_count;
+    pStats->PresentRefreshCount = stats.complete_msc;
+    pStats->SyncRefreshCount = stats.sync_msc;
+    /* UST and the performance counter are both monotonic clocks,
+     * translate with the offset sampled now. */
+    pStats->SyncQPCTime.QuadPart = counter.QuadPart -
+            (LONGLONG)((stats.now_ust - stats.sync_ust) * freq.QuadPart / 1000000);
+    pStats->SyncGPUTime.QuadPart = 0;
+    return D3D_OK;
 }
 
 static HRESULT WINAPI
@@ -629,6 +761,7 @@ DRI3Present_ChangeDisplaySettingsIfNeccessary( struct DRI3Present *This, DEVMODE
            || (current_mode.dmDisplayFrequency != new_mode->dmDisplayFrequency
            && (new_mode->dmFields & DM_DISPLAYFREQUENCY)))
     {
+        This->mode_height = 0;
         hr = ChangeDisplaySettingsExW(This->devname, new_mode, 0, CDS_FULLSCREEN, NULL);
         if (hr != DISP_CHANGE_SUCCESSFUL) {
             /* try again without display RefreshRate */
@@ -677,6 +810,7 @@ LRESULT device_process_message(struct DRI3Present *present, HWND window, BOOL un
     else if (message == WM_DISPLAYCHANGE)
     {
         present->mode_changed = TRUE;
+        present->mode_height = 0;
         /* Ex restores display mode, while non Ex requires the
          * user to call Device::Reset() */
         ZeroMemory(&current_mode, sizeof(DEVMODEW));
@@ -975,6 +1109,40 @@ DRI3Present_ChangePresentParameters( struct DRI3Present *This,
     return D3D_OK;
 }
 
+static BOOL
+present_get_config_dword(HKEY regkey, const char *name, DWORD *value)
+{
+    DWORD type, data;
+    DWORD size = sizeof(DWORD);
+
+    if (RegQueryValueExA(regkey, name, 0, &type, (BYTE *)&data, &size) ||
+        (type != REG_DWORD) || (size != sizeof(DWORD)))
+        return FALSE;
+    *value = data;
+    return TRUE;
+}
+
+static void
+present_read_settings(struct DRI3Present *This)
+{
+    HKEY regkey;
+    DWORD value;
+
+    if (!RegOpenKeyA(HKEY_CURRENT_USER, "Software\\Wine\\Direct3DNine", &regkey)) {
+        if (present_get_config_dword(regkey, "Mailbox", &value))
+            This->mailbox = !!value;
+        if (present_get_config_dword(regkey, "MaxFrameRate", &value))
+            This->frame_time_us = value ? 1000000 / value : 0;
+        /* There can't be more frames in flight than back buffers. */
+        if (present_get_config_dword(regkey, "MaxFramesInFlight", &value))
+            This->max_frames_in_flight = min(value, D3DPRESENT_BACK_BUFFERS_MAX_EX);
+        RegCloseKey(regkey);
+    }
+
+    TRACE("Mailbox present mode %s, frame time %u us, max frames in flight %u\n",
+          This->mailbox ? "enabled" : "disabled", This->frame_time_us, This->max_frames_in_flight);
+}
+
 static HRESULT
 DRI3Present_new( Display *gdi_display,
                  const WCHAR *devname,
@@ -1014,7 +1182,8 @@ DRI3Present_new( Display *gdi_display,
 
     EnumDisplaySettingsExW(This->devname, ENUM_CURRENT_SETTINGS, &(This->initial_mode), 0);
 
-    PRESENTInit(gdi_display, &(This->present_priv));
+    present_read_settings(This);
+    PRESENTInit(gdi_display, &(This->present_priv), This->mailbox);
 #ifdef D3DADAPTER9_DRI2
     if (is_dri2_fallback)
         DRI2FallbackInit(gdi_display, &(This->dri2_priv));
@@ -52,6 +52,8 @@ struct nine_wndproc
     BOOL unicode;
     WNDPROC proc;
     struct DRI3Present *present;
+    LONG *drawable_invalid; /* set when the X drawable info might have changed */
+    LONG *drawable_tracked; /* cleared when drawable_invalid stops being updated */
 };
 
 struct nine_wndproc_table
@@ -169,6 +171,20 @@ static LRESULT CALLBACK nine_wndproc(HWND window, UINT message, WPARAM wparam, L
     present = entry->present;
     unicode = entry->unicode;
     proc = entry->proc;
+    if (entry->drawable_invalid)
+    {
+        switch (message)
+        {
+            case WM_WINDOWPOSCHANGED:
+            case WM_MOVE:
+            case WM_SIZE:
+            case WM_STYLECHANGED:
+            case WM_DISPLAYCHANGE:
+            case WM_DESTROY:
+                InterlockedExchange(entry->drawable_invalid, TRUE);
+                break;
+        }
+    }
     nine_wndproc_mutex_unlock();
 
     if (present)
@@ -178,19 +194,11 @@ static LRESULT CALLBACK nine_wndproc(HWND window, UINT message, WPARAM wparam, L
     return CallWindowProcA(proc, window, message, wparam, lparam);
 }
 
-BOOL nine_register_window(HWND window, struct DRI3Present *present)
+/* Must be called with the wndproc mutex held */
+static struct nine_wndproc *nine_add_wndproc(HWND window)
 {
     struct nine_wndproc *entry;
 
-    nine_wndproc_mutex_lock();
-
-    if (nine_find_wndproc(window))
-    {
-        nine_wndproc_mutex_unlock();
-        WARN("Window %p is already registered with wined3d.\n", window);
-        return TRUE;
-    }
-
     if (wndproc_table.size == wndproc_table.count)
     {
         unsigned int new_size = max(1, wndproc_table.size * 2);
@@ -201,9 +209,8 @@ BOOL nine_register_window(HWND window, struct DRI3Present *present)
 
         if (!new_entries)
         {
-            nine_wndproc_mutex_unlock();
             ERR("Failed to grow table.\n");
-            return FALSE;
+            return NULL;
         }
 
         wndproc_table.entries = new_entries;
@@ -220,6 +227,90 @@ BOOL nine_register_window(HWND window, struct DRI3Present *present)
         entry->proc = (WNDPROC)SetWindowLongPtrW(window, GWLP_WNDPROC, (LONG_PTR)nine_wndproc);
     else
         entry->proc = (WNDPROC)SetWindowLongPtrA(window, GWLP_WNDPROC, (LONG_PTR)nine_wndproc);
+    entry->present = NULL;
+    entry->drawable_invalid = NULL;
+    entry->drawable_tracked = NULL;
+
+    return entry;
+}
+
+/* Must be called with the wndproc mutex held */
+static void nine_untrack_drawable(struct nine_wndproc *entry)
+{
+    if (!entry->drawable_invalid)
+        return;
+
+    /* The drawable falls back to checking its position on every present */
+    InterlockedExchange(entry->drawable_tracked, FALSE);
+    entry->drawable_invalid = NULL;
+    entry->drawable_tracked = NULL;
+}
+
+/* Must be called with the wndproc mutex held */
+static BOOL nine_remove_wndproc(struct nine_wndproc *entry)
+{
+    struct nine_wndproc *last;
+    HWND window = entry->window;
+    LONG_PTR proc;
+
+    /* Nothing to restore on a destroyed window */
+    if (IsWindow(window))
+    {
+        if (entry->unicode)
+        {
+            proc = GetWindowLongPtrW(window, GWLP_WNDPROC);
+            if (proc != (LONG_PTR)nine_wndproc)
+            {
+                WARN("Not unregistering window %p, window proc %#lx doesn't match wined3d window proc %p.\n",
+                        window, proc, nine_wndproc);
+                return FALSE;
+            }
+
+            SetWindowLongPtrW(window, GWLP_WNDPROC, (LONG_PTR)entry->proc);
+        }
+        else
+        {
+            proc = GetWindowLongPtrA(window, GWLP_WNDPROC);
+            if (proc != (LONG_PTR)nine_wndproc)
+            {
+                WARN("Not unregistering window %p, window proc %#lx doesn't match wined3d window proc %p.\n",
+                        window, proc, nine_wndproc);
+                return FALSE;
+            }
+
+            SetWindowLongPtrA(window, GWLP_WNDPROC, (LONG_PTR)entry->proc);
+        }
+    }
+
+    nine_untrack_drawable(entry);
+    last = &wndproc_table.entries[--wndproc_table.count];
+    if (entry != last) *entry = *last;
+
+    return TRUE;
+}
+
+BOOL nine_register_window(HWND window, struct DRI3Present *present)
+{
+    struct nine_wndproc *entry;
+
+    nine_wndproc_mutex_lock();
+
+    if ((entry = nine_find_wndproc(window)))
+    {
+        /* The window might be hooked only to track its drawable */
+        if (!entry->present)
+            entry->present = present;
+        else
+            WARN("Window %p is already registered with wined3d.\n", window);
+        nine_wndproc_mutex_unlock();
+        return TRUE;
+    }
+
+    if (!(entry = nine_add_wndproc(window)))
+    {
+        nine_wndproc_mutex_unlock();
+        return FALSE;
+    }
     entry->present = present;
 
     nine_wndproc_mutex_unlock();
@@ -229,49 +320,69 @@ BOOL nine_register_window(HWND window, struct DRI3Present *present)
 
 BOOL nine_unregister_window(HWND window)
 {
-    struct nine_wndproc *entry, *last;
-    LONG_PTR proc;
+    struct nine_wndproc *entry;
+    BOOL ret;
 
     nine_wndproc_mutex_lock();
 
-    if (!(entry = nine_find_wndproc(window)))
+    if (!(entry = nine_find_wndproc(window)) || !entry->present)
     {
         nine_wndproc_mutex_unlock();
         return FALSE;
     }
 
-    if (entry->unicode)
+    /* keep tracking the drawable */
+    if (entry->drawable_invalid)
     {
-        proc = GetWindowLongPtrW(window, GWLP_WNDPROC);
-        if (proc != (LONG_PTR)nine_wndproc)
-        {
-            entry->present = NULL;
-            nine_wndproc_mutex_unlock();
-            WARN("Not unregistering window %p, window proc %#lx doesn't match wined3d window proc %p.\n",
-                    window, proc, nine_wndproc);
-            return FALSE;
-        }
-
-        SetWindowLongPtrW(window, GWLP_WNDPROC, (LONG_PTR)entry->proc);
+        entry->present = NULL;
+        nine_wndproc_mutex_unlock();
+        return TRUE;
     }
-    else
-    {
-        proc = GetWindowLongPtrA(window, GWLP_WNDPROC);
-        if (proc != (LONG_PTR)nine_wndproc)
-        {
-            entry->present = NULL;
-            nine_wndproc_mutex_unlock();
-            WARN("Not unregistering window %p, window proc %#lx doesn't match wined3d window proc %p.\n",
-                    window, proc, nine_wndproc);
-            return FALSE;
-        }
 
-        SetWindowLongPtrA(window, GWLP_WNDPROC, (LONG_PTR)entry->proc);
-    }
+    /* The hook stays in place when the application replaced it, but the
+     * device is going away and must not get any message anymore */
+    if (!(ret = nine_remove_wndproc(entry)))
+        entry->present = NULL;
 
-    last = &wndproc_table.entries[--wndproc_table.count];
-    if (entry != last) *entry = *last;
+    nine_wndproc_mutex_unlock();
+    return ret;
+}
+
+BOOL nine_register_drawable_window(HWND window, LONG *invalid, LONG *tracked)
+{
+    struct nine_wndproc *entry;
+
+    nine_wndproc_mutex_lock();
+
+    if (!(entry = nine_find_wndproc(window)) && !(entry = nine_add_wndproc(window)))
+    {
+        nine_wndproc_mutex_unlock();
+        return FALSE;
+    }
+    /* A previous drawable of the window stops being tracked */
+    nine_untrack_drawable(entry);
+    entry->drawable_invalid = invalid;
+    entry->drawable_tracked = tracked;
+    InterlockedExchange(tracked, TRUE);
 
     nine_wndproc_mutex_unlock();
     return TRUE;
 }
+
+void nine_unregister_drawable_window(HWND window, LONG *invalid)
+{
+    struct nine_wndproc *entry;
+
+    nine_wndproc_mutex_lock();
+
+    /* A newer drawable for the same window might have replaced ours */
+    if ((entry = nine_find_wndproc(window)) && entry->drawable_invalid == invalid)
+    {
+        /* The entry stays hooked if the application replaced the window
+         * proc, the drawable is going away anyway */
+        if (entry->present || !nine_remove_wndproc(entry))
+            nine_untrack_drawable(entry);
+    }
+
+    nine_wndproc_mutex_unlock();
+}
@@ -30,6 +30,11 @@ struct DRI3Present;
 BOOL nine_register_window(HWND window, struct DRI3Present *present);
 BOOL nine_unregister_window(HWND window);
 
+/* *invalid is set to TRUE when the window moves or is resized. *tracked is
+ * TRUE while the hook updates *invalid, both are only cleared together. */
+BOOL nine_register_drawable_window(HWND window, LONG *invalid, LONG *tracked);
+void nine_unregister_drawable_window(HWND window, LONG *invalid);
+
 BOOL nine_dll_init(HINSTANCE hInstDLL);
 BOOL nine_dll_destroy(HINSTANCE hInstDLL);
 
@@ -616,7 +616,7 @@ static void shader_arb_vs_local_constants(const struct arb_vs_compiled_shader *g
     checkGLcall("Load vs int consts");
 }
 
-static void shader_arb_select(void *shader_priv, struct wined3d_context *context,
+static BOOL shader_arb_select(void *shader_priv, struct wined3d_context *context,
         const struct wined3d_state *state);
 
 /**
@@ -4663,7 +4663,7 @@ static void find_arb_vs_compile_args(const struct wined3d_state *state,
 }
 
 /* Context activation is done by the caller. */
-static void shader_arb_select(void *shader_priv, struct wined3d_context *context,
+static BOOL shader_arb_select(void *shader_priv, struct wined3d_context *context,
         const struct wined3d_state *state)
 {
     struct shader_arb_priv *priv = shader_priv;
@@ -4798,6 +4798,8 @@ static void shader_arb_select(void *shader_priv, struct wined3d_context *context
         }
         priv->vertex_pipe->vp_enable(gl_info, TRUE);
     }
+
+    return TRUE;
 }
 
 
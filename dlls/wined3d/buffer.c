@@ -28,6 +28,7 @@
 #include "wined3d_private.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(d3d);
+WINE_DECLARE_DEBUG_CHANNEL(d3d_perf);
 
 #define WINED3D_BUFFER_HASDESC      0x01    /* A vertex description has been found. */
 #define WINED3D_BUFFER_CREATEBO     0x02    /* Create a buffer object for this buffer. */
@@ -36,6 +37,7 @@ WINE_DEFAULT_DEBUG_CHANNEL(d3d);
 #define WINED3D_BUFFER_DISCARD      0x10    /* A DISCARD lock has occurred since the last preload. */
 #define WINED3D_BUFFER_SYNC         0x20    /* There has been at least one synchronized map since the last preload. */
 #define WINED3D_BUFFER_APPLESYNC    0x40    /* Using sync as in GL_APPLE_flush_buffer_range. */
+#define WINED3D_BUFFER_PERSISTENT   0x80    /* Using persistently mapped GL_ARB_buffer_storage regions. */
 
 #define VB_MAXDECLCHANGES     100     /* After that number of decl changes we stop converting */
 #define VB_RESETDECLCHANGE    1000    /* Reset the decl changecount after that number of draws */
@@ -103,18 +105,222 @@ static BOOL buffer_is_fully_dirty(const struct wined3d_buffer *buffer)
 /* Context activation is done by the caller */
 static void delete_gl_buffer(struct wined3d_buffer *This, const struct wined3d_gl_info *gl_info)
 {
+    unsigned int i;
+
     if(!This->buffer_object) return;
 
+    /* Deleting the buffer object implicitly unmaps persistent mappings. */
     GL_EXTCALL(glDeleteBuffers(1, &This->buffer_object));
     checkGLcall("glDeleteBuffers");
     This->buffer_object = 0;
 
+    /* For persistently mapped buffers the query is one of the region queries. */
+    if (This->flags & WINED3D_BUFFER_PERSISTENT)
+        This->query = NULL;
+    for (i = 0; i < WINED3D_BUFFER_STREAM_REGIONS; ++i)
+    {
+        if (This->stream_queries[i])
+        {
+            wined3d_event_query_destroy(This->stream_queries[i]);
+            This->stream_queries[i] = NULL;
+        }
+    }
+    This->stream_ptr = NULL;
+    This->stream_region = 0;
+
     if(This->query)
     {
         wined3d_event_query_destroy(This->query);
         This->query = NULL;
     }
-    This->flags &= ~WINED3D_BUFFER_APPLESYNC;
+    This->flags &= ~(WINED3D_BUFFER_APPLESYNC | WINED3D_BUFFER_PERSISTENT);
+}
+
+/* Allocates immutable storage for stream_region_count copies of the buffer,
+ * and maps it persistently.
+ *
+ * Context activation is done by the caller. The buffer object is bound. */
+static BYTE *buffer_alloc_stream_storage(struct wined3d_buffer *buffer, const struct wined3d_gl_info *gl_info)
+{
+    static const GLbitfield storage_flags = GL_MAP_READ_BIT | GL_MAP_WRITE_BIT
+            | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+    GLsizeiptr size;
+    GLenum error;
+    BYTE *ptr;
+
+    size = (GLsizeiptr)buffer->stream_region_size * buffer->stream_region_count;
+
+    GL_EXTCALL(glBufferStorage(buffer->buffer_type_hint, size, NULL, storage_flags));
+    error = gl_info->gl_ops.gl.p_glGetError();
+    if (error != GL_NO_ERROR)
+    {
+        ERR("glBufferStorage failed with error %s (%#x).\n", debug_glerror(error), error);
+        return NULL;
+    }
+
+    ptr = GL_EXTCALL(glMapBufferRange(buffer->buffer_type_hint, 0, size, storage_flags));
+    checkGLcall("glMapBufferRange");
+    if (!ptr)
+    {
+        ERR("Failed to map buffer storage.\n");
+        return NULL;
+    }
+    if (((DWORD_PTR)ptr) & (RESOURCE_ALIGNMENT - 1))
+    {
+        WARN("Pointer %p is not %u byte aligned.\n", ptr, RESOURCE_ALIGNMENT);
+        return NULL;
+    }
+
+    return ptr;
+}
+
+/* Dynamic buffers that aren't double buffered get immutable storage that
+ * stays mapped for the lifetime of the buffer object. It starts out with a
+ * single copy of the buffer, and grows up to WINED3D_BUFFER_STREAM_REGIONS
+ * copies for buffers the GPU is still using when they are discarded. Maps
+ * just return a pointer into the current region; see buffer_sync_stream()
+ * for how regions are recycled.
+ *
+ * Context activation is done by the caller. The buffer object is bound. */
+static BOOL buffer_create_stream_storage(struct wined3d_buffer *buffer, const struct wined3d_gl_info *gl_info)
+{
+    unsigned int i;
+
+    buffer->stream_region_size = (buffer->resource.size + RESOURCE_ALIGNMENT - 1) & ~(RESOURCE_ALIGNMENT - 1);
+    buffer->stream_region_count = 1;
+
+    for (i = 0; i < WINED3D_BUFFER_STREAM_REGIONS; ++i)
+    {
+        if (!(buffer->stream_queries[i] = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
+                sizeof(*buffer->stream_queries[i]))))
+        {
+            ERR("Failed to allocate event query memory.\n");
+            return FALSE;
+        }
+    }
+
+    if (!(buffer->stream_ptr = buffer_alloc_stream_storage(buffer, gl_info)))
+        return FALSE;
+
+    if (buffer->resource.heap_memory)
+        memcpy(buffer->stream_ptr, buffer->resource.heap_memory, buffer->resource.size);
+
+    buffer->stream_region = 0;
+    buffer->query = buffer->stream_queries[0];
+    buffer->flags |= WINED3D_BUFFER_PERSISTENT;
+
+    return TRUE;
+}
+
+/* Moves a persistently mapped buffer to a new buffer object with twice as
+ * many regions, when the GPU still uses the next region. Deleting the old
+ * buffer object leaves its storage to the GL until the GPU is done with it,
+ * like glBufferData() does for mutable storage. Returns FALSE, and keeps the
+ * old storage, if the buffer already has WINED3D_BUFFER_STREAM_REGIONS
+ * regions or the new storage can't be allocated.
+ *
+ * Context activation is done by the caller. */
+static BOOL buffer_grow_stream_storage(struct wined3d_buffer *buffer, struct wined3d_context *context)
+{
+    const struct wined3d_gl_info *gl_info = context->gl_info;
+    struct wined3d_device *device = buffer->resource.device;
+    unsigned int region_count = buffer->stream_region_count;
+    GLuint buffer_object = 0;
+    unsigned int i;
+    BYTE *ptr;
+
+    TRACE("buffer %p.\n", buffer);
+
+    if (region_count >= WINED3D_BUFFER_STREAM_REGIONS)
+        return FALSE;
+
+    GL_EXTCALL(glGenBuffers(1, &buffer_object));
+    checkGLcall("glGenBuffers");
+    if (!buffer_object)
+        return FALSE;
+
+    if (buffer->buffer_type_hint == GL_ELEMENT_ARRAY_BUFFER_ARB)
+        context_invalidate_state(context, STATE_INDEXBUFFER);
+    GL_EXTCALL(glBindBuffer(buffer->buffer_type_hint, buffer_object));
+    checkGLcall("glBindBuffer");
+
+    buffer->stream_region_count = min(region_count * 2, WINED3D_BUFFER_STREAM_REGIONS);
+    if (!(ptr = buffer_alloc_stream_storage(buffer, gl_info)))
+    {
+        buffer->stream_region_count = region_count;
+        GL_EXTCALL(glDeleteBuffers(1, &buffer_object));
+        checkGLcall("glDeleteBuffers");
+        return FALSE;
+    }
+
+    GL_EXTCALL(glDeleteBuffers(1, &buffer->buffer_object));
+    checkGLcall("glDeleteBuffers");
+    buffer->buffer_object = buffer_object;
+    buffer->stream_ptr = ptr;
+
+    /* The fences of the old regions don't apply to the new ones. */
+    for (i = 0; i < WINED3D_BUFFER_STREAM_REGIONS; ++i)
+    {
+        if (buffer->stream_queries[i]->context)
+            context_free_event_query(buffer->stream_queries[i]);
+    }
+    buffer->stream_region = 0;
+    buffer->query = buffer->stream_queries[0];
+
+    if (buffer->resource.bind_count)
+    {
+        device_invalidate_state(device, STATE_STREAMSRC);
+        device_invalidate_state(device, STATE_INDEXBUFFER);
+    }
+
+    return TRUE;
+}
+
+/* Replaces the persistently mapped storage of a buffer with regular mutable
+ * storage, when even WINED3D_BUFFER_STREAM_REGIONS regions don't keep up
+ * with the DISCARD maps. The regular map path orphans the storage through
+ * GL_MAP_INVALIDATE_BUFFER_BIT, which is cheaper than allocating new
+ * immutable storage on every map. The contents are discarded.
+ *
+ * Context activation is done by the caller. */
+static BOOL buffer_drop_stream_storage(struct wined3d_buffer *buffer, struct wined3d_context *context)
+{
+    const struct wined3d_gl_info *gl_info = context->gl_info;
+    struct wined3d_device *device = buffer->resource.device;
+    GLuint buffer_object = 0;
+    GLenum error;
+
+    TRACE("buffer %p.\n", buffer);
+
+    GL_EXTCALL(glGenBuffers(1, &buffer_object));
+    checkGLcall("glGenBuffers");
+    if (!buffer_object)
+        return FALSE;
+
+    if (buffer->buffer_type_hint == GL_ELEMENT_ARRAY_BUFFER_ARB)
+        context_invalidate_state(context, STATE_INDEXBUFFER);
+    GL_EXTCALL(glBindBuffer(buffer->buffer_type_hint, buffer_object));
+    GL_EXTCALL(glBufferData(buffer->buffer_type_hint, buffer->resource.size, NULL, GL_STREAM_DRAW_ARB));
+    error = gl_info->gl_ops.gl.p_glGetError();
+    if (error != GL_NO_ERROR)
+    {
+        ERR("glBufferData failed with error %s (%#x).\n", debug_glerror(error), error);
+        GL_EXTCALL(glDeleteBuffers(1, &buffer_object));
+        checkGLcall("glDeleteBuffers");
+        return FALSE;
+    }
+
+    delete_gl_buffer(buffer, gl_info);
+    buffer->buffer_object = buffer_object;
+    buffer->buffer_object_usage = GL_STREAM_DRAW_ARB;
+
+    if (buffer->resource.bind_count)
+    {
+        device_invalidate_state(device, STATE_STREAMSRC);
+        device_invalidate_state(device, STATE_INDEXBUFFER);
+    }
+
+    return TRUE;
 }
 
 /* Context activation is done by the caller. */
@@ -158,6 +364,19 @@ static void buffer_create_buffer_object(struct wined3d_buffer *This, struct wine
         goto fail;
     }
 
+    if ((This->resource.usage & WINED3DUSAGE_DYNAMIC) && !(This->flags & WINED3D_BUFFER_DOUBLEBUFFER)
+            && gl_info->supported[ARB_BUFFER_STORAGE] && gl_info->supported[ARB_SYNC])
+    {
+        TRACE("Using persistently mapped storage for dynamic buffer.\n");
+
+        if (!buffer_create_stream_storage(This, gl_info))
+            goto fail;
+
+        This->buffer_object_usage = GL_STREAM_DRAW_ARB;
+        wined3d_resource_free_sysmem(&This->resource);
+        return;
+    }
+
     if (This->resource.usage & WINED3DUSAGE_DYNAMIC)
     {
         TRACE("Buffer has WINED3DUSAGE_DYNAMIC set.\n");
@@ -472,7 +691,7 @@ void buffer_get_memory(struct wined3d_buffer *buffer, struct wined3d_context *co
     }
     else
     {
-        data->addr = NULL;
+        data->addr = (BYTE *)(ULONG_PTR)buffer_get_stream_offset(buffer);
     }
 }
 
@@ -497,6 +716,14 @@ BYTE *buffer_get_sysmem(struct wined3d_buffer *This, struct wined3d_context *con
     if (!wined3d_resource_allocate_sysmem(&This->resource))
         ERR("Failed to allocate system memory.\n");
 
+    if (This->flags & WINED3D_BUFFER_PERSISTENT)
+    {
+        memcpy(This->resource.heap_memory, This->stream_ptr + buffer_get_stream_offset(This),
+                This->resource.size);
+        This->flags |= WINED3D_BUFFER_DOUBLEBUFFER;
+        return This->resource.heap_memory;
+    }
+
     if (This->buffer_type_hint == GL_ELEMENT_ARRAY_BUFFER_ARB)
         context_invalidate_state(context, STATE_INDEXBUFFER);
 
@@ -507,6 +734,19 @@ BYTE *buffer_get_sysmem(struct wined3d_buffer *This, struct wined3d_context *con
     return This->resource.heap_memory;
 }
 
+/* Returns the system memory address that corresponds to an address returned
+ * by buffer_get_memory(). For persistently mapped buffers, the latter include
+ * the offset of the current stream region, which the system memory copy
+ * doesn't have.
+ *
+ * Context activation is done by the caller. */
+BYTE *buffer_get_sysmem_addr(struct wined3d_buffer *buffer, struct wined3d_context *context, const BYTE *addr)
+{
+    ULONG_PTR offset = (ULONG_PTR)addr - buffer_get_stream_offset(buffer);
+
+    return buffer_get_sysmem(buffer, context) + offset;
+}
+
 static void buffer_unload(struct wined3d_resource *resource)
 {
     struct wined3d_buffer *buffer = buffer_from_resource(resource);
@@ -552,6 +792,8 @@ ULONG CDECL wined3d_buffer_decref(struct wined3d_buffer *buffer)
 
     if (!refcount)
     {
+        buffer->resource.device->cs->ops->finish(buffer->resource.device->cs);
+
         if (buffer->buffer_object)
         {
             context = context_acquire(buffer->resource.device, NULL);
@@ -561,6 +803,10 @@ ULONG CDECL wined3d_buffer_decref(struct wined3d_buffer *buffer)
             HeapFree(GetProcessHeap(), 0, buffer->conversion_map);
         }
 
+        HeapFree(GetProcessHeap(), 0, buffer->cs_map_memory);
+        HeapFree(GetProcessHeap(), 0, buffer->cs_free_memory);
+        HeapFree(GetProcessHeap(), 0, buffer->cs_map_ranges);
+
         resource_cleanup(&buffer->resource);
         buffer->resource.parent_ops->wined3d_object_destroyed(buffer->resource.parent);
         HeapFree(GetProcessHeap(), 0, buffer->maps);
@@ -646,12 +892,106 @@ drop_query:
     This->flags &= ~WINED3D_BUFFER_APPLESYNC;
 }
 
+/* Select the region of a persistently mapped buffer that the CPU is going to
+ * write to. DISCARD moves on to the next region, so that the GPU can keep
+ * reading from the previous one. If the GPU still uses the next region as
+ * well, the buffer gets more regions instead of waiting for it, and once it
+ * has WINED3D_BUFFER_STREAM_REGIONS of them, it goes back to regular storage.
+ * Callers have to check WINED3D_BUFFER_PERSISTENT again afterwards.
+ * NOOVERWRITE writes into the current region without any synchronisation,
+ * and everything else waits until the GPU is done with the current region.
+ * The region queries are issued by draws through buffer->query, like the
+ * APPLE_flush_buffer_range fence above. */
+static void buffer_sync_stream(struct wined3d_buffer *buffer, DWORD flags)
+{
+    struct wined3d_device *device = buffer->resource.device;
+    enum wined3d_event_query_result ret;
+    struct wined3d_context *context;
+    unsigned int next_region;
+    BOOL grown, dropped = FALSE;
+
+    if (flags & WINED3D_MAP_NOOVERWRITE)
+        return;
+
+    if (flags & WINED3D_MAP_DISCARD)
+    {
+        next_region = (buffer->stream_region + 1) % buffer->stream_region_count;
+        if (wined3d_event_query_test(buffer->stream_queries[next_region], device) == WINED3D_EVENT_QUERY_WAITING)
+        {
+            context = context_acquire(device, NULL);
+            if (!(grown = buffer_grow_stream_storage(buffer, context)))
+                dropped = buffer_drop_stream_storage(buffer, context);
+            context_release(context);
+            if (grown)
+            {
+                WARN_(d3d_perf)("Buffer %p is still in use, grew its storage to %u regions.\n",
+                        buffer, buffer->stream_region_count);
+                return;
+            }
+            if (dropped)
+            {
+                WARN_(d3d_perf)("Buffer %p is still in use, dropped its persistent storage.\n", buffer);
+                return;
+            }
+        }
+
+        buffer->stream_region = next_region;
+        buffer->query = buffer->stream_queries[buffer->stream_region];
+        TRACE("Buffer %p switched to region %u.\n", buffer, buffer->stream_region);
+
+        /* The stream source state points into the previous region. Index
+         * buffer offsets are applied at draw time. */
+        if (buffer->resource.bind_count)
+            device_invalidate_state(device, STATE_STREAMSRC);
+    }
+
+    ret = wined3d_event_query_finish(buffer->query, device);
+    switch (ret)
+    {
+        case WINED3D_EVENT_QUERY_NOT_STARTED:
+        case WINED3D_EVENT_QUERY_OK:
+            return;
+
+        default:
+            ERR("wined3d_event_query_finish returned %u, falling back to glFinish().\n", ret);
+            context = context_acquire(device, NULL);
+            context->gl_info->gl_ops.gl.p_glFinish();
+            context_release(context);
+            return;
+    }
+}
+
 /* The caller provides a GL context */
 static void buffer_direct_upload(struct wined3d_buffer *This, const struct wined3d_gl_info *gl_info, DWORD flags)
 {
     BYTE *map;
     UINT start, len;
 
+    if (This->flags & WINED3D_BUFFER_PERSISTENT)
+    {
+        DWORD syncflags = 0;
+
+        if (flags & WINED3D_BUFFER_DISCARD)
+            syncflags |= WINED3D_MAP_DISCARD;
+        else if (!(flags & WINED3D_BUFFER_SYNC))
+            syncflags |= WINED3D_MAP_NOOVERWRITE;
+        buffer_sync_stream(This, syncflags);
+    }
+
+    if (This->flags & WINED3D_BUFFER_PERSISTENT)
+    {
+        map = This->stream_ptr + buffer_get_stream_offset(This);
+        while (This->modified_areas)
+        {
+            This->modified_areas--;
+            start = This->maps[This->modified_areas].offset;
+            len = This->maps[This->modified_areas].size;
+
+            memcpy(map + start, (BYTE *)This->resource.heap_memory + start, len);
+        }
+        return;
+    }
+
     /* This potentially invalidates the element array buffer binding, but the
      * caller always takes care of this. */
     GL_EXTCALL(glBindBuffer(This->buffer_type_hint, This->buffer_object));
@@ -761,7 +1101,10 @@ void buffer_internal_preload(struct wined3d_buffer *buffer, struct wined3d_conte
 
         if (!use_vs(state))
         {
-            if (!context->gl_info->supported[ARB_VERTEX_ARRAY_BGRA])
+            /* The generic attribute vertex pipe swizzles D3DCOLOR
+             * attributes in the vertex shader. */
+            if (!context->gl_info->supported[ARB_VERTEX_ARRAY_BGRA]
+                    && !context->d3d_info->ffp_generic_attributes)
                 fixup_flags |= WINED3D_BUFFER_FIXUP_D3DCOLOR;
             if (!context->d3d_info->xyzrhw)
                 fixup_flags |= WINED3D_BUFFER_FIXUP_XYZRHW;
@@ -925,6 +1268,8 @@ void buffer_internal_preload(struct wined3d_buffer *buffer, struct wined3d_conte
 void CDECL wined3d_buffer_preload(struct wined3d_buffer *buffer)
 {
     struct wined3d_context *context;
+
+    buffer->resource.device->cs->ops->finish(buffer->resource.device->cs);
     context = context_acquire(buffer->resource.device, NULL);
     buffer_internal_preload(buffer, context, NULL);
     context_release(context);
@@ -937,14 +1282,176 @@ struct wined3d_resource * CDECL wined3d_buffer_get_resource(struct wined3d_buffe
     return &buffer->resource;
 }
 
+static HRESULT buffer_map(struct wined3d_buffer *buffer, UINT offset, UINT size, BYTE **data, DWORD flags);
+static void buffer_unmap(struct wined3d_buffer *buffer);
+
+static BOOL buffer_add_cs_map_range(struct wined3d_buffer *buffer, UINT offset, UINT size)
+{
+    struct wined3d_map_range *range;
+
+    offset = min(offset, buffer->resource.size);
+    size = min(size, buffer->resource.size - offset);
+
+    if (buffer->cs_map_range_count)
+    {
+        range = &buffer->cs_map_ranges[buffer->cs_map_range_count - 1];
+        if (offset <= range->offset + range->size && offset + size >= range->offset)
+        {
+            size = max(offset + size, range->offset + range->size);
+            range->offset = min(offset, range->offset);
+            range->size = size - range->offset;
+            return TRUE;
+        }
+    }
+
+    if (buffer->cs_map_range_count >= buffer->cs_map_ranges_size)
+    {
+        unsigned int new_size = max(buffer->cs_map_ranges_size * 2, 4);
+
+        if (buffer->cs_map_ranges)
+            range = HeapReAlloc(GetProcessHeap(), 0, buffer->cs_map_ranges, new_size * sizeof(*range));
+        else
+            range = HeapAlloc(GetProcessHeap(), 0, new_size * sizeof(*range));
+        if (!range)
+            return FALSE;
+
+        buffer->cs_map_ranges = range;
+        buffer->cs_map_ranges_size = new_size;
+    }
+
+    range = &buffer->cs_map_ranges[buffer->cs_map_range_count++];
+    range->offset = offset;
+    range->size = size;
+
+    return TRUE;
+}
+
+/* Makes the CS map memory hold the current contents of the buffer, except
+ * for the ranges the application mapped before, for maps that need to see
+ * them. This waits for the CS, and the entire buffer is uploaded on unmap. */
+static HRESULT buffer_load_cs_map_memory(struct wined3d_buffer *buffer)
+{
+    const struct wined3d_map_range *range;
+    BYTE *memory, *data;
+    unsigned int i;
+
+    TRACE("buffer %p.\n", buffer);
+
+    if (!(memory = HeapAlloc(GetProcessHeap(), 0, buffer->resource.size)))
+        return E_OUTOFMEMORY;
+
+    buffer->resource.device->cs->ops->finish(buffer->resource.device->cs);
+    buffer_map(buffer, 0, 0, &data, WINED3D_MAP_READONLY);
+    memcpy(memory, data, buffer->resource.size);
+    buffer_unmap(buffer);
+
+    /* Earlier maps still point into the CS map memory, so update it in place. */
+    for (i = 0; i < buffer->cs_map_range_count; ++i)
+    {
+        range = &buffer->cs_map_ranges[i];
+        memcpy(memory + range->offset, buffer->cs_map_memory + range->offset, range->size);
+    }
+    memcpy(buffer->cs_map_memory, memory, buffer->resource.size);
+    HeapFree(GetProcessHeap(), 0, memory);
+
+    buffer->cs_map_range_count = 0;
+    buffer_add_cs_map_range(buffer, 0, buffer->resource.size);
+
+    return WINED3D_OK;
+}
+
+/* Maps that don't need the current contents of the buffer don't have to
+ * wait for the CS thread. The application writes to separate memory instead,
+ * which the CS copies into the buffer on unmap, in order with the draws.
+ * DISCARD maps upload the entire buffer. NOOVERWRITE maps only qualify for
+ * write-only buffers and with an explicit size, since the memory doesn't hold
+ * the previous contents of the buffer, and only the mapped ranges are
+ * uploaded. Returns S_FALSE if the map has to go to the buffer itself. */
+static HRESULT buffer_map_cs_memory(struct wined3d_buffer *buffer, UINT offset, UINT size, BYTE **data, DWORD flags)
+{
+    HRESULT hr;
+
+    if (!buffer->cs_map_memory)
+    {
+        if (buffer->app_map_count)
+            return S_FALSE;
+        if (!(flags & WINED3D_MAP_DISCARD) && !((flags & WINED3D_MAP_NOOVERWRITE) && size
+                && (buffer->resource.usage & WINED3DUSAGE_WRITEONLY)))
+            return S_FALSE;
+
+        if (!(buffer->cs_map_memory = InterlockedExchangePointer(&buffer->cs_free_memory, NULL))
+                && !(buffer->cs_map_memory = HeapAlloc(GetProcessHeap(), 0, buffer->resource.size)))
+            return S_FALSE;
+        buffer->cs_map_flags = WINED3D_MAP_NOOVERWRITE;
+        buffer->cs_map_range_count = 0;
+    }
+
+    /* DISCARD uploads the entire buffer, see buffer_map(). Other maps made
+     * while the memory is in use can't go to the buffer itself, so they get
+     * the current contents loaded into it if they need them. */
+    if (flags & WINED3D_MAP_DISCARD)
+        buffer->cs_map_flags = WINED3D_MAP_DISCARD;
+    if (!(buffer->cs_map_flags & WINED3D_MAP_DISCARD) && (!(flags & WINED3D_MAP_NOOVERWRITE) || !size
+            || !buffer_add_cs_map_range(buffer, offset, size)) && FAILED(hr = buffer_load_cs_map_memory(buffer)))
+        return hr;
+
+    *data = buffer->cs_map_memory + offset;
+    TRACE("Returning CS map memory at %p.\n", *data);
+
+    return WINED3D_OK;
+}
+
+/* Called by the CS thread for buffer_map_cs_memory() maps. */
+void buffer_update_from_memory(struct wined3d_buffer *buffer, const struct wined3d_map_range *ranges,
+        unsigned int range_count, DWORD flags, BYTE *memory)
+{
+    unsigned int i;
+    BYTE *data;
+
+    for (i = 0; i < range_count; ++i)
+    {
+        if (SUCCEEDED(buffer_map(buffer, ranges[i].offset, ranges[i].size, &data, flags)))
+        {
+            memcpy(data, memory + ranges[i].offset, ranges[i].size);
+            buffer_unmap(buffer);
+        }
+    }
+
+    if (InterlockedCompareExchangePointer(&buffer->cs_free_memory, memory, NULL))
+        HeapFree(GetProcessHeap(), 0, memory);
+}
+
 HRESULT CDECL wined3d_buffer_map(struct wined3d_buffer *buffer, UINT offset, UINT size, BYTE **data, DWORD flags)
 {
-    LONG count;
-    BYTE *base;
+    const struct wined3d_cs *cs = buffer->resource.device->cs;
+    HRESULT hr;
 
     TRACE("buffer %p, offset %u, size %u, data %p, flags %#x\n", buffer, offset, size, data, flags);
 
     flags = wined3d_resource_sanitize_map_flags(&buffer->resource, flags);
+    if (cs->thread && GetCurrentThreadId() != cs->thread_id)
+    {
+        if ((hr = buffer_map_cs_memory(buffer, offset, size, data, flags)) != S_FALSE)
+        {
+            if (SUCCEEDED(hr))
+                ++buffer->app_map_count;
+            return hr;
+        }
+        ++buffer->app_map_count;
+    }
+
+    buffer->resource.device->cs->ops->finish(buffer->resource.device->cs);
+    return buffer_map(buffer, offset, size, data, flags);
+}
+
+/* Maps the buffer itself. The CS must not be running any commands at this
+ * point, either because this is the CS thread or because the caller waited
+ * for it. */
+static HRESULT buffer_map(struct wined3d_buffer *buffer, UINT offset, UINT size, BYTE **data, DWORD flags)
+{
+    LONG count;
+    BYTE *base;
+
     /* Filter redundant WINED3D_MAP_DISCARD maps. The 3DMark2001 multitexture
      * fill rate test seems to depend on this. When we map a buffer with
      * GL_MAP_INVALIDATE_BUFFER_BIT, the driver is free to discard the
@@ -968,7 +1475,15 @@ HRESULT CDECL wined3d_buffer_map(struct wined3d_buffer *buffer, UINT offset, UIN
 
         if (!(buffer->flags & WINED3D_BUFFER_DOUBLEBUFFER))
         {
-            if (count == 1)
+            if (count == 1 && (buffer->flags & WINED3D_BUFFER_PERSISTENT))
+                buffer_sync_stream(buffer, flags);
+
+            if (buffer->flags & WINED3D_BUFFER_PERSISTENT)
+            {
+                if (count == 1)
+                    buffer->map_ptr = buffer->stream_ptr + buffer_get_stream_offset(buffer);
+            }
+            else if (count == 1)
             {
                 struct wined3d_device *device = buffer->resource.device;
                 struct wined3d_context *context;
@@ -1046,10 +1561,49 @@ HRESULT CDECL wined3d_buffer_map(struct wined3d_buffer *buffer, UINT offset, UIN
 
 void CDECL wined3d_buffer_unmap(struct wined3d_buffer *buffer)
 {
-    ULONG i;
+    struct wined3d_cs *cs = buffer->resource.device->cs;
+    struct wined3d_map_range range;
 
     TRACE("buffer %p.\n", buffer);
 
+    /* The CS thread itself maps and unmaps the buffer to copy the memory. */
+    if (cs->thread && GetCurrentThreadId() != cs->thread_id)
+    {
+        if (!buffer->app_map_count)
+        {
+            WARN("Unmap called without a previous map call.\n");
+            return;
+        }
+
+        --buffer->app_map_count;
+        if (buffer->cs_map_memory)
+        {
+            if (buffer->app_map_count)
+                return;
+
+            if (buffer->cs_map_flags & WINED3D_MAP_DISCARD)
+            {
+                range.offset = 0;
+                range.size = buffer->resource.size;
+                wined3d_cs_emit_update_buffer(cs, buffer, &range, 1, buffer->cs_map_flags, buffer->cs_map_memory);
+            }
+            else
+            {
+                wined3d_cs_emit_update_buffer(cs, buffer, buffer->cs_map_ranges,
+                        buffer->cs_map_range_count, buffer->cs_map_flags, buffer->cs_map_memory);
+            }
+            buffer->cs_map_memory = NULL;
+            return;
+        }
+    }
+
+    buffer_unmap(buffer);
+}
+
+static void buffer_unmap(struct wined3d_buffer *buffer)
+{
+    ULONG i;
+
     /* In the case that the number of Unmap calls > the
      * number of Map calls, d3d returns always D3D_OK.
      * This is also needed to prevent Map from returning garbage on
@@ -1067,7 +1621,13 @@ void CDECL wined3d_buffer_unmap(struct wined3d_buffer *buffer)
         return;
     }
 
-    if (!(buffer->flags & WINED3D_BUFFER_DOUBLEBUFFER) && buffer->buffer_object)
+    if (!(buffer->flags & WINED3D_BUFFER_DOUBLEBUFFER) && (buffer->flags & WINED3D_BUFFER_PERSISTENT))
+    {
+        /* The mapping is coherent and stays in place. */
+        buffer_clear_dirty_areas(buffer);
+        buffer->map_ptr = NULL;
+    }
+    else if (!(buffer->flags & WINED3D_BUFFER_DOUBLEBUFFER) && buffer->buffer_object)
     {
         struct wined3d_device *device = buffer->resource.device;
         const struct wined3d_gl_info *gl_info;
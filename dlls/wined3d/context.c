@@ -306,19 +306,76 @@ static inline DWORD context_generate_rt_mask_from_surface(const struct wined3d_s
     return (1u << 31) | surface_get_gl_buffer(target);
 }
 
-static struct fbo_entry *context_create_fbo_entry(const struct wined3d_context *context,
+static DWORD context_fbo_hash(const struct wined3d_gl_info *gl_info,
         struct wined3d_surface **render_targets, struct wined3d_surface *depth_stencil,
         DWORD color_location, DWORD ds_location)
+{
+    UINT64 hash;
+
+    hash = wined3d_hash(WINED3D_HASH_INIT, render_targets, gl_info->limits.buffers * sizeof(*render_targets));
+    hash = wined3d_hash(hash, &depth_stencil, sizeof(depth_stencil));
+    hash = wined3d_hash(hash, &color_location, sizeof(color_location));
+    hash = wined3d_hash(hash, &ds_location, sizeof(ds_location));
+
+    return hash ^ (hash >> 32);
+}
+
+/* Adds the entry to the context's lookup table and to the fbo_entries list of
+ * each attached surface. */
+static void context_link_fbo_entry(struct wined3d_context *context, struct fbo_entry *entry)
+{
+    const struct wined3d_gl_info *gl_info = context->gl_info;
+    unsigned int i;
+
+    list_add_head(&context->fbo_hash[entry->hash % WINED3D_FBO_HASH_SIZE], &entry->hash_entry);
+
+    for (i = 0; i < gl_info->limits.buffers; ++i)
+    {
+        if (entry->render_targets[i])
+            list_add_head(&entry->render_targets[i]->fbo_entries, &entry->surface_refs[i].entry);
+    }
+    if (entry->depth_stencil)
+        list_add_head(&entry->depth_stencil->fbo_entries, &entry->surface_refs[gl_info->limits.buffers].entry);
+}
+
+static void context_unlink_fbo_entry(struct wined3d_context *context, struct fbo_entry *entry)
+{
+    const struct wined3d_gl_info *gl_info = context->gl_info;
+    unsigned int i;
+
+    list_remove(&entry->hash_entry);
+    list_init(&entry->hash_entry);
+
+    for (i = 0; i <= gl_info->limits.buffers; ++i)
+    {
+        list_remove(&entry->surface_refs[i].entry);
+        list_init(&entry->surface_refs[i].entry);
+    }
+}
+
+static struct fbo_entry *context_create_fbo_entry(struct wined3d_context *context,
+        struct wined3d_surface **render_targets, struct wined3d_surface *depth_stencil,
+        DWORD color_location, DWORD ds_location, DWORD hash)
 {
     const struct wined3d_gl_info *gl_info = context->gl_info;
     struct fbo_entry *entry;
+    unsigned int i;
 
     entry = HeapAlloc(GetProcessHeap(), 0, sizeof(*entry));
     entry->render_targets = HeapAlloc(GetProcessHeap(), 0, gl_info->limits.buffers * sizeof(*entry->render_targets));
     memcpy(entry->render_targets, render_targets, gl_info->limits.buffers * sizeof(*entry->render_targets));
+    entry->surface_refs = HeapAlloc(GetProcessHeap(), 0, (gl_info->limits.buffers + 1) * sizeof(*entry->surface_refs));
+    for (i = 0; i <= gl_info->limits.buffers; ++i)
+    {
+        list_init(&entry->surface_refs[i].entry);
+        entry->surface_refs[i].fbo = entry;
+    }
+    list_init(&entry->hash_entry);
+    entry->context = context;
     entry->depth_stencil = depth_stencil;
     entry->color_location = color_location;
     entry->ds_location = ds_location;
+    entry->hash = hash;
     entry->rt_mask = context_generate_rt_mask(GL_COLOR_ATTACHMENT0);
     entry->attached = FALSE;
     gl_info->fbo_ops.glGenFramebuffers(1, &entry->id);
@@ -331,7 +388,7 @@ static struct fbo_entry *context_create_fbo_entry(const struct wined3d_context *
 /* Context activation is done by the caller. */
 static void context_reuse_fbo_entry(struct wined3d_context *context, GLenum target,
         struct wined3d_surface **render_targets, struct wined3d_surface *depth_stencil,
-        DWORD color_location, DWORD ds_location, struct fbo_entry *entry)
+        DWORD color_location, DWORD ds_location, DWORD hash, struct fbo_entry *entry)
 {
     const struct wined3d_gl_info *gl_info = context->gl_info;
 
@@ -342,6 +399,7 @@ static void context_reuse_fbo_entry(struct wined3d_context *context, GLenum targ
     entry->depth_stencil = depth_stencil;
     entry->color_location = color_location;
     entry->ds_location = ds_location;
+    entry->hash = hash;
     entry->attached = FALSE;
 }
 
@@ -355,6 +413,8 @@ static void context_destroy_fbo_entry(struct wined3d_context *context, struct fb
     }
     --context->fbo_entry_count;
     list_remove(&entry->entry);
+    context_unlink_fbo_entry(context, entry);
+    HeapFree(GetProcessHeap(), 0, entry->surface_refs);
     HeapFree(GetProcessHeap(), 0, entry->render_targets);
     HeapFree(GetProcessHeap(), 0, entry);
 }
@@ -366,6 +426,7 @@ static struct fbo_entry *context_find_fbo_entry(struct wined3d_context *context,
 {
     const struct wined3d_gl_info *gl_info = context->gl_info;
     struct fbo_entry *entry;
+    DWORD hash;
 
     if (depth_stencil && render_targets && render_targets[0])
     {
@@ -377,9 +438,11 @@ static struct fbo_entry *context_find_fbo_entry(struct wined3d_context *context,
         }
     }
 
-    LIST_FOR_EACH_ENTRY(entry, &context->fbo_list, struct fbo_entry, entry)
+    hash = context_fbo_hash(gl_info, render_targets, depth_stencil, color_location, ds_location);
+
+    LIST_FOR_EACH_ENTRY(entry, &context->fbo_hash[hash % WINED3D_FBO_HASH_SIZE], struct fbo_entry, hash_entry)
     {
-        if (!memcmp(entry->render_targets,
+        if (entry->hash == hash && !memcmp(entry->render_targets,
                 render_targets, gl_info->limits.buffers * sizeof(*entry->render_targets))
                 && entry->depth_stencil == depth_stencil && entry->color_location == color_location
                 && entry->ds_location == ds_location)
@@ -392,17 +455,20 @@ static struct fbo_entry *context_find_fbo_entry(struct wined3d_context *context,
 
     if (context->fbo_entry_count < WINED3D_MAX_FBO_ENTRIES)
     {
-        entry = context_create_fbo_entry(context, render_targets, depth_stencil, color_location, ds_location);
+        entry = context_create_fbo_entry(context, render_targets, depth_stencil, color_location, ds_location, hash);
         list_add_head(&context->fbo_list, &entry->entry);
         ++context->fbo_entry_count;
     }
     else
     {
         entry = LIST_ENTRY(list_tail(&context->fbo_list), struct fbo_entry, entry);
-        context_reuse_fbo_entry(context, target, render_targets, depth_stencil, color_location, ds_location, entry);
+        context_unlink_fbo_entry(context, entry);
+        context_reuse_fbo_entry(context, target, render_targets, depth_stencil,
+                color_location, ds_location, hash, entry);
         list_remove(&entry->entry);
         list_add_head(&context->fbo_list, &entry->entry);
     }
+    context_link_fbo_entry(context, entry);
 
     return entry;
 }
@@ -678,38 +744,24 @@ void context_free_timestamp_query(struct wined3d_timestamp_query *query)
 
 typedef void (context_fbo_entry_func_t)(struct wined3d_context *context, struct fbo_entry *entry);
 
+/* The callback may be called more than once for the same entry, if the
+ * surface is attached to it more than once. */
 static void context_enum_surface_fbo_entries(const struct wined3d_device *device,
-        const struct wined3d_surface *surface, context_fbo_entry_func_t *callback)
+        struct wined3d_surface *surface, context_fbo_entry_func_t *callback)
 {
+    struct fbo_entry_surface_ref *ref, *ref2;
     UINT i;
 
     for (i = 0; i < device->context_count; ++i)
     {
         struct wined3d_context *context = device->contexts[i];
-        const struct wined3d_gl_info *gl_info = context->gl_info;
-        struct fbo_entry *entry, *entry2;
 
         if (context->current_rt == surface) context->current_rt = NULL;
+    }
 
-        LIST_FOR_EACH_ENTRY_SAFE(entry, entry2, &context->fbo_list, struct fbo_entry, entry)
-        {
-            UINT j;
-
-            if (entry->depth_stencil == surface)
-            {
-                callback(context, entry);
-                continue;
-            }
-
-            for (j = 0; j < gl_info->limits.buffers; ++j)
-            {
-                if (entry->render_targets[j] == surface)
-                {
-                    callback(context, entry);
-                    break;
-                }
-            }
-        }
+    LIST_FOR_EACH_ENTRY_SAFE(ref, ref2, &surface->fbo_entries, struct fbo_entry_surface_ref, entry)
+    {
+        callback(ref->fbo->context, ref->fbo);
     }
 }
 
@@ -717,18 +769,29 @@ static void context_queue_fbo_entry_destruction(struct wined3d_context *context,
 {
     list_remove(&entry->entry);
     list_add_head(&context->fbo_destroy_list, &entry->entry);
+    list_remove(&entry->hash_entry);
+    list_init(&entry->hash_entry);
 }
 
 void context_resource_released(const struct wined3d_device *device,
         struct wined3d_resource *resource, enum wined3d_resource_type type)
 {
-    if (!device->d3d_initialized) return;
+    struct fbo_entry_surface_ref *ref, *ref2;
+    struct wined3d_surface *surface;
 
     switch (type)
     {
         case WINED3D_RTYPE_SURFACE:
-            context_enum_surface_fbo_entries(device, surface_from_resource(resource),
-                    context_queue_fbo_entry_destruction);
+            surface = surface_from_resource(resource);
+            if (device->d3d_initialized)
+                context_enum_surface_fbo_entries(device, surface, context_queue_fbo_entry_destruction);
+            /* Entries queued for destruction may still reference other
+             * surfaces, but none of them can reference this one anymore. */
+            LIST_FOR_EACH_ENTRY_SAFE(ref, ref2, &surface->fbo_entries, struct fbo_entry_surface_ref, entry)
+            {
+                list_remove(&ref->entry);
+                list_init(&ref->entry);
+            }
             break;
 
         default:
@@ -979,6 +1042,7 @@ static void context_destroy_gl_resources(struct wined3d_context *context)
     struct wined3d_timestamp_query *timestamp_query;
     struct wined3d_occlusion_query *occlusion_query;
     struct wined3d_event_query *event_query;
+    struct wined3d_query *query, *query2;
     struct fbo_entry *entry, *entry2;
     HGLRC restore_ctx;
     HDC restore_dc;
@@ -992,6 +1056,15 @@ static void context_destroy_gl_resources(struct wined3d_context *context)
     else if (context->valid)
         context_set_gl_context(context);
 
+    /* The results of the pending queries are lost with the context. */
+    LIST_FOR_EACH_ENTRY_SAFE(query, query2, &context->pending_queries, struct wined3d_query, poll_entry)
+    {
+        list_remove(&query->poll_entry);
+        list_init(&query->poll_entry);
+        query->result = 0;
+        InterlockedExchange(&query->counter_retrieved, query->counter_issued);
+    }
+
     LIST_FOR_EACH_ENTRY(timestamp_query, &context->timestamp_queries, struct wined3d_timestamp_query, entry)
     {
         if (context->valid)
@@ -1039,6 +1112,9 @@ static void context_destroy_gl_resources(struct wined3d_context *context)
             GL_EXTCALL(glDeleteProgramsARB(1, &context->dummy_arbfp_prog));
         }
 
+        if (context->transient_vbo)
+            GL_EXTCALL(glDeleteBuffers(1, &context->transient_vbo));
+
         if (gl_info->supported[ARB_TIMER_QUERY])
             GL_EXTCALL(glDeleteQueries(context->free_timestamp_query_count, context->free_timestamp_queries));
 
@@ -1073,6 +1149,7 @@ static void context_destroy_gl_resources(struct wined3d_context *context)
     HeapFree(GetProcessHeap(), 0, context->free_timestamp_queries);
     HeapFree(GetProcessHeap(), 0, context->free_occlusion_queries);
     HeapFree(GetProcessHeap(), 0, context->free_event_queries);
+    HeapFree(GetProcessHeap(), 0, context->transient_data);
 
     context_restore_pixel_format(context);
     if (restore_ctx)
@@ -1189,7 +1266,14 @@ void context_release(struct wined3d_context *context)
             context->restore_ctx = NULL;
             context->restore_dc = NULL;
         }
+        else if (context->swapchain->device->cs->thread && context->valid
+                && context->tid != context->swapchain->device->cs->thread_id)
+        {
+            context->gl_info->gl_ops.gl.p_glFlush(); /* Flush to ensure ordering across contexts. */
+        }
     }
+
+    wined3d_cs_unlock(context->swapchain->device->cs);
 }
 
 /* This is used when a context for render target A is active, but a separate context is
@@ -1231,16 +1315,7 @@ static void context_enter(struct wined3d_context *context)
 
 void context_invalidate_state(struct wined3d_context *context, DWORD state)
 {
-    DWORD rep = context->state_table[state].representative;
-    DWORD idx;
-    BYTE shift;
-
-    if (isStateDirty(context, rep)) return;
-
-    context->dirtyArray[context->numDirtyEntries++] = rep;
-    idx = rep / (sizeof(*context->isStateDirty) * CHAR_BIT);
-    shift = rep & ((sizeof(*context->isStateDirty) * CHAR_BIT) - 1);
-    context->isStateDirty[idx] |= (1u << shift);
+    context_mark_state_dirty(context, context->state_table[state].representative);
 }
 
 /* This function takes care of wined3d pixel format selection. */
@@ -1453,7 +1528,7 @@ struct wined3d_context *context_create(struct wined3d_swapchain *swapchain,
     BOOL auxBuffers = FALSE;
     HGLRC ctx, share_ctx;
     int pixel_format;
-    unsigned int s;
+    unsigned int s, i;
     int swap_interval;
     DWORD state;
     HDC hdc = 0;
@@ -1497,8 +1572,11 @@ struct wined3d_context *context_create(struct wined3d_swapchain *swapchain,
         goto out;
 
     list_init(&ret->event_queries);
+    list_init(&ret->pending_queries);
     list_init(&ret->fbo_list);
     list_init(&ret->fbo_destroy_list);
+    for (i = 0; i < WINED3D_FBO_HASH_SIZE; ++i)
+        list_init(&ret->fbo_hash[i]);
 
     if (!device->shader_backend->shader_allocate_context_data(ret))
     {
@@ -2385,7 +2463,7 @@ BOOL context_apply_clear_state(struct wined3d_context *context, const struct win
     DWORD rt_mask = 0, *cur_mask;
     UINT i;
 
-    if (isStateDirty(context, STATE_FRAMEBUFFER) || fb != &device->fb
+    if (isStateDirty(context, STATE_FRAMEBUFFER) || fb != &device->cs->fb
             || rt_count != context->gl_info->limits.buffers)
     {
         if (!context_validate_rt_config(rt_count, rts, dsv))
@@ -2470,7 +2548,7 @@ BOOL context_apply_clear_state(struct wined3d_context *context, const struct win
     gl_info->gl_ops.gl.p_glEnable(GL_SCISSOR_TEST);
     if (gl_info->supported[ARB_FRAMEBUFFER_SRGB])
     {
-        if (device->state.render_states[WINED3D_RS_SRGBWRITEENABLE])
+        if (device->cs->state.render_states[WINED3D_RS_SRGBWRITEENABLE])
             gl_info->gl_ops.gl.p_glEnable(GL_FRAMEBUFFER_SRGB);
         else
             gl_info->gl_ops.gl.p_glDisable(GL_FRAMEBUFFER_SRGB);
@@ -2487,7 +2565,7 @@ BOOL context_apply_clear_state(struct wined3d_context *context, const struct win
 
 static DWORD find_draw_buffers_mask(const struct wined3d_context *context, const struct wined3d_device *device)
 {
-    const struct wined3d_state *state = &device->state;
+    const struct wined3d_state *state = &device->cs->state;
     struct wined3d_rendertarget_view **rts = state->fb->render_targets;
     struct wined3d_shader *ps = state->shader[WINED3D_SHADER_TYPE_PIXEL];
     DWORD rt_mask, rt_mask_bits;
@@ -3015,7 +3093,7 @@ static void context_update_stream_info(struct wined3d_context *context, const st
     else
     {
         WORD slow_mask = -!d3d_info->ffp_generic_attributes & (1u << WINED3D_FFP_PSIZE);
-        slow_mask |= -!gl_info->supported[ARB_VERTEX_ARRAY_BGRA]
+        slow_mask |= -!(gl_info->supported[ARB_VERTEX_ARRAY_BGRA] || d3d_info->ffp_generic_attributes)
                 & ((1u << WINED3D_FFP_DIFFUSE) | (1u << WINED3D_FFP_SPECULAR));
 
         if (((stream_info->position_transformed && !d3d_info->xyzrhw)
@@ -3188,13 +3266,47 @@ static void context_bind_shader_resources(struct wined3d_context *context, const
     }
 }
 
+/* Clears and returns the lowest numbered dirty state, or ~0u if all states
+ * are clean. Applying a state may dirty other states again, so this always
+ * starts from the first group.
+ *
+ * The order is not significant for correctness. The dirty array this
+ * replaced applied states in the order they were invalidated, which is
+ * arbitrary, so the apply functions can't rely on any order. States that
+ * depend on each other check isStateDirty() instead, and a state stays dirty
+ * until it is returned here. Taking the lowest one lets every call simply
+ * restart from the first group, which also picks up the states that applying
+ * another state dirtied, whatever their number. */
+static DWORD context_next_dirty_state(struct wined3d_context *context)
+{
+    unsigned int group, idx, shift;
+    DWORD map;
+
+    for (group = 0; group < ARRAY_SIZE(context->dirty_groups); ++group)
+    {
+        if (!(map = context->dirty_groups[group]))
+            continue;
+
+        idx = group * sizeof(map) * CHAR_BIT + wined3d_log2i(map & -map);
+        map = context->isStateDirty[idx];
+        shift = wined3d_log2i(map & -map);
+        if (!(context->isStateDirty[idx] &= ~(1u << shift)))
+            context->dirty_groups[group] &= ~(1u << (idx & ((sizeof(map) * CHAR_BIT) - 1)));
+
+        return idx * sizeof(map) * CHAR_BIT + shift;
+    }
+
+    return ~0u;
+}
+
 /* Context activation is done by the caller. */
 BOOL context_apply_draw_state(struct wined3d_context *context, struct wined3d_device *device)
 {
-    const struct wined3d_state *state = &device->state;
+    const struct wined3d_state *state = &device->cs->state;
     const struct StateEntry *state_table = context->state_table;
     const struct wined3d_fb_state *fb = state->fb;
     unsigned int i;
+    DWORD rep;
     WORD map;
 
     if (!context_validate_rt_config(context->gl_info->limits.buffers,
@@ -3237,18 +3349,18 @@ BOOL context_apply_draw_state(struct wined3d_context *context, struct wined3d_de
             buffer_get_sysmem(state->index_buffer, context);
     }
 
-    for (i = 0; i < context->numDirtyEntries; ++i)
+    while ((rep = context_next_dirty_state(context)) != ~0u)
     {
-        DWORD rep = context->dirtyArray[i];
-        DWORD idx = rep / (sizeof(*context->isStateDirty) * CHAR_BIT);
-        BYTE shift = rep & ((sizeof(*context->isStateDirty) * CHAR_BIT) - 1);
-        context->isStateDirty[idx] &= ~(1u << shift);
         state_table[rep].apply(context, state, rep);
     }
 
     if (context->shader_update_mask)
     {
-        device->shader_backend->shader_select(device->shader_priv, context, state);
+        /* With asynchronous shader compilation the new shaders may not be
+         * ready yet. Skip the draw, but keep the update masks so that we try
+         * again on the next one. */
+        if (!device->shader_backend->shader_select(device->shader_priv, context, state))
+            return FALSE;
         context->shader_update_mask = 0;
     }
 
@@ -3269,7 +3381,6 @@ BOOL context_apply_draw_state(struct wined3d_context *context, struct wined3d_de
         context_check_fbo_status(context, GL_FRAMEBUFFER);
     }
 
-    context->numDirtyEntries = 0; /* This makes the whole list clean */
     context->last_was_blit = FALSE;
 
     return TRUE;
@@ -3337,6 +3448,11 @@ struct wined3d_context *context_acquire(const struct wined3d_device *device, str
 
     TRACE("device %p, target %p.\n", device, target);
 
+    /* GL work outside the command stream can't run concurrently with the
+     * execution of the queued commands. Callers that depend on the results
+     * of those commands call the CS finish() operation themselves. */
+    wined3d_cs_lock(device->cs);
+
     if (current_context && current_context->destroyed)
         current_context = NULL;
 
@@ -21,8 +21,10 @@
 #include "wined3d_private.h"
 
 WINE_DEFAULT_DEBUG_CHANNEL(d3d);
+WINE_DECLARE_DEBUG_CHANNEL(d3d_perf);
 
 #define WINED3D_INITIAL_CS_SIZE 4096
+#define WINED3D_CS_SPIN_COUNT 10000
 
 enum wined3d_cs_op
 {
@@ -47,11 +49,36 @@ enum wined3d_cs_op
     WINED3D_CS_OP_SET_RENDER_STATE,
     WINED3D_CS_OP_SET_TEXTURE_STATE,
     WINED3D_CS_OP_SET_SAMPLER_STATE,
+    WINED3D_CS_OP_SET_STATES,
     WINED3D_CS_OP_SET_TRANSFORM,
     WINED3D_CS_OP_SET_CLIP_PLANE,
     WINED3D_CS_OP_SET_COLOR_KEY,
     WINED3D_CS_OP_SET_MATERIAL,
+    WINED3D_CS_OP_SET_LIGHT,
+    WINED3D_CS_OP_SET_LIGHT_ENABLE,
+    WINED3D_CS_OP_SET_SHADER_CONSTANTS,
     WINED3D_CS_OP_RESET_STATE,
+    WINED3D_CS_OP_UPDATE_BUFFER,
+    WINED3D_CS_OP_QUERY_ISSUE,
+    WINED3D_CS_OP_QUERY_POLL,
+    WINED3D_CS_OP_NOP,
+    WINED3D_CS_OP_FLUSH,
+    WINED3D_CS_OP_STOP,
+};
+
+/* Every operation is stored as a packet. The size includes the header and
+ * is a multiple of WINED3D_CS_PACKET_ALIGNMENT, so packets can be stored
+ * back to back with their data aligned, and the space left at the end of the
+ * ring is always large enough for a padding packet. Operations with
+ * variable-sized data store it inline, after the fixed part of the
+ * operation. */
+#define WINED3D_CS_PACKET_ALIGNMENT 16
+
+struct wined3d_cs_packet
+{
+    size_t size;
+    size_t reserved[WINED3D_CS_PACKET_ALIGNMENT / sizeof(size_t) - 1];
+    BYTE data[1];
 };
 
 struct wined3d_cs_present
@@ -59,21 +86,24 @@ struct wined3d_cs_present
     enum wined3d_cs_op opcode;
     HWND dst_window_override;
     struct wined3d_swapchain *swapchain;
-    const RECT *src_rect;
-    const RECT *dst_rect;
-    const RGNDATA *dirty_region;
+    BOOL has_src_rect;
+    BOOL has_dst_rect;
+    BOOL has_dirty_region;
+    RECT src_rect;
+    RECT dst_rect;
     DWORD flags;
+    RGNDATA dirty_region;
 };
 
 struct wined3d_cs_clear
 {
     enum wined3d_cs_op opcode;
-    DWORD rect_count;
-    const RECT *rects;
     DWORD flags;
-    const struct wined3d_color *color;
+    struct wined3d_color color;
     float depth;
     DWORD stencil;
+    DWORD rect_count;
+    RECT rects[1];
 };
 
 struct wined3d_cs_draw
@@ -84,6 +114,8 @@ struct wined3d_cs_draw
     UINT start_instance;
     UINT instance_count;
     BOOL indexed;
+    INT base_vertex_idx;
+    GLenum gl_primitive_type;
 };
 
 struct wined3d_cs_set_predication
@@ -96,13 +128,13 @@ struct wined3d_cs_set_predication
 struct wined3d_cs_set_viewport
 {
     enum wined3d_cs_op opcode;
-    const struct wined3d_viewport *viewport;
+    struct wined3d_viewport viewport;
 };
 
 struct wined3d_cs_set_scissor_rect
 {
     enum wined3d_cs_op opcode;
-    const RECT *rect;
+    RECT rect;
 };
 
 struct wined3d_cs_set_rendertarget_view
@@ -226,24 +258,55 @@ struct wined3d_cs_set_sampler_state
     DWORD value;
 };
 
+struct wined3d_cs_set_states
+{
+    enum wined3d_cs_op opcode;
+    unsigned int render_state_count;
+    unsigned int texture_state_count;
+    unsigned int sampler_state_count;
+    struct wined3d_state_change changes[1];
+};
+
 struct wined3d_cs_set_transform
 {
     enum wined3d_cs_op opcode;
     enum wined3d_transform_state state;
-    const struct wined3d_matrix *matrix;
+    struct wined3d_matrix matrix;
 };
 
 struct wined3d_cs_set_clip_plane
 {
     enum wined3d_cs_op opcode;
     UINT plane_idx;
-    const struct wined3d_vec4 *plane;
+    struct wined3d_vec4 plane;
 };
 
 struct wined3d_cs_set_material
 {
     enum wined3d_cs_op opcode;
-    const struct wined3d_material *material;
+    struct wined3d_material material;
+};
+
+struct wined3d_cs_set_light
+{
+    enum wined3d_cs_op opcode;
+    struct wined3d_light_info light;
+};
+
+struct wined3d_cs_set_light_enable
+{
+    enum wined3d_cs_op opcode;
+    UINT idx;
+    BOOL enable;
+};
+
+struct wined3d_cs_set_shader_constants
+{
+    enum wined3d_cs_op opcode;
+    DWORD type;
+    UINT start_idx;
+    UINT count;
+    BYTE constants[1];
 };
 
 struct wined3d_cs_reset_state
@@ -251,16 +314,57 @@ struct wined3d_cs_reset_state
     enum wined3d_cs_op opcode;
 };
 
+struct wined3d_cs_update_buffer
+{
+    enum wined3d_cs_op opcode;
+    struct wined3d_buffer *buffer;
+    DWORD flags;
+    BYTE *memory;
+    unsigned int range_count;
+    struct wined3d_map_range ranges[1];
+};
+
+struct wined3d_cs_query_issue
+{
+    enum wined3d_cs_op opcode;
+    struct wined3d_query *query;
+    DWORD flags;
+    LONG counter;
+};
+
+struct wined3d_cs_query_poll
+{
+    enum wined3d_cs_op opcode;
+    struct wined3d_query *query;
+};
+
+struct wined3d_cs_nop
+{
+    enum wined3d_cs_op opcode;
+};
+
 static void wined3d_cs_exec_present(struct wined3d_cs *cs, const void *data)
 {
     const struct wined3d_cs_present *op = data;
     struct wined3d_swapchain *swapchain;
+    struct wined3d_context *context;
 
     swapchain = op->swapchain;
     wined3d_swapchain_set_window(swapchain, op->dst_window_override);
 
     swapchain->swapchain_ops->swapchain_present(swapchain,
-            op->src_rect, op->dst_rect, op->dirty_region, op->flags);
+            op->has_src_rect ? &op->src_rect : NULL, op->has_dst_rect ? &op->dst_rect : NULL,
+            op->has_dirty_region ? &op->dirty_region : NULL, op->flags);
+
+    /* Besides the polls requested by GetData(), poll the queries once per
+     * frame. Presenting leaves the swapchain context current, so only make
+     * it current again if it actually has queries to poll. */
+    if ((context = context_get_current()) && !list_empty(&context->pending_queries))
+    {
+        context = context_acquire(cs->device, context->current_rt);
+        wined3d_poll_queries(context);
+        context_release(context);
+    }
 }
 
 void wined3d_cs_emit_present(struct wined3d_cs *cs, struct wined3d_swapchain *swapchain,
@@ -268,14 +372,30 @@ void wined3d_cs_emit_present(struct wined3d_cs *cs, struct wined3d_swapchain *sw
         const RGNDATA *dirty_region, DWORD flags)
 {
     struct wined3d_cs_present *op;
+    size_t region_size = 0;
 
-    op = cs->ops->require_space(cs, sizeof(*op));
+    if (dirty_region)
+        region_size = dirty_region->rdh.nCount * sizeof(RECT);
+
+    if (cs->redundant_state_count)
+    {
+        TRACE_(d3d_perf)("Dropped %u redundant state changes this frame.\n", cs->redundant_state_count);
+        cs->redundant_state_count = 0;
+    }
+
+    op = cs->ops->require_space(cs, FIELD_OFFSET(struct wined3d_cs_present, dirty_region.Buffer[region_size]));
     op->opcode = WINED3D_CS_OP_PRESENT;
     op->dst_window_override = dst_window_override;
     op->swapchain = swapchain;
-    op->src_rect = src_rect;
-    op->dst_rect = dst_rect;
-    op->dirty_region = dirty_region;
+    if ((op->has_src_rect = !!src_rect))
+        op->src_rect = *src_rect;
+    if ((op->has_dst_rect = !!dst_rect))
+        op->dst_rect = *dst_rect;
+    if ((op->has_dirty_region = !!dirty_region))
+    {
+        op->dirty_region.rdh = dirty_region->rdh;
+        memcpy(op->dirty_region.Buffer, dirty_region->Buffer, region_size);
+    }
     op->flags = flags;
 
     cs->ops->submit(cs);
@@ -288,10 +408,10 @@ static void wined3d_cs_exec_clear(struct wined3d_cs *cs, const void *data)
     RECT draw_rect;
 
     device = cs->device;
-    wined3d_get_draw_rect(&device->state, &draw_rect);
+    wined3d_get_draw_rect(&cs->state, &draw_rect);
     device_clear_render_targets(device, device->adapter->gl_info.limits.buffers,
-            &device->fb, op->rect_count, op->rects, &draw_rect, op->flags,
-            op->color, op->depth, op->stencil);
+            &cs->fb, op->rect_count, op->rect_count ? op->rects : NULL, &draw_rect, op->flags,
+            &op->color, op->depth, op->stencil);
 }
 
 void wined3d_cs_emit_clear(struct wined3d_cs *cs, DWORD rect_count, const RECT *rects,
@@ -299,21 +419,50 @@ void wined3d_cs_emit_clear(struct wined3d_cs *cs, DWORD rect_count, const RECT *
 {
     struct wined3d_cs_clear *op;
 
-    op = cs->ops->require_space(cs, sizeof(*op));
+    if (!rects)
+        rect_count = 0;
+
+    op = cs->ops->require_space(cs, FIELD_OFFSET(struct wined3d_cs_clear, rects[rect_count]));
     op->opcode = WINED3D_CS_OP_CLEAR;
-    op->rect_count = rect_count;
-    op->rects = rects;
     op->flags = flags;
-    op->color = color;
+    op->color = *color;
     op->depth = depth;
     op->stencil = stencil;
+    op->rect_count = rect_count;
+    memcpy(op->rects, rects, rect_count * sizeof(*rects));
 
     cs->ops->submit(cs);
 }
 
 static void wined3d_cs_exec_draw(struct wined3d_cs *cs, const void *data)
 {
+    const struct wined3d_gl_info *gl_info = &cs->device->adapter->gl_info;
     const struct wined3d_cs_draw *op = data;
+    struct wined3d_state *state = &cs->state;
+    INT load_base_vertex_idx;
+
+    if (op->gl_primitive_type != state->gl_primitive_type)
+    {
+        if (op->gl_primitive_type == GL_POINTS || state->gl_primitive_type == GL_POINTS)
+            device_invalidate_state(cs->device, STATE_POINT_ENABLE);
+        state->gl_primitive_type = op->gl_primitive_type;
+    }
+    state->base_vertex_index = op->base_vertex_idx;
+
+    /* Non-indexed drawing needs 0 here, indexed drawing needs the base
+     * vertex index unless the GL can apply it itself. */
+    if (!op->indexed)
+        load_base_vertex_idx = 0;
+    else if (!gl_info->supported[ARB_DRAW_ELEMENTS_BASE_VERTEX])
+        load_base_vertex_idx = op->base_vertex_idx;
+    else
+        load_base_vertex_idx = state->load_base_vertex_index;
+
+    if (state->load_base_vertex_index != load_base_vertex_idx)
+    {
+        state->load_base_vertex_index = load_base_vertex_idx;
+        device_invalidate_state(cs->device, STATE_BASEVERTEXINDEX);
+    }
 
     draw_primitive(cs->device, op->start_idx, op->index_count,
             op->start_instance, op->instance_count, op->indexed);
@@ -331,6 +480,8 @@ void wined3d_cs_emit_draw(struct wined3d_cs *cs, UINT start_idx, UINT index_coun
     op->start_instance = start_instance;
     op->instance_count = instance_count;
     op->indexed = indexed;
+    op->base_vertex_idx = cs->device->state.base_vertex_index;
+    op->gl_primitive_type = cs->device->state.gl_primitive_type;
 
     cs->ops->submit(cs);
 }
@@ -359,7 +510,7 @@ static void wined3d_cs_exec_set_viewport(struct wined3d_cs *cs, const void *data
 {
     const struct wined3d_cs_set_viewport *op = data;
 
-    cs->state.viewport = *op->viewport;
+    cs->state.viewport = op->viewport;
     device_invalidate_state(cs->device, STATE_VIEWPORT);
 }
 
@@ -369,7 +520,7 @@ void wined3d_cs_emit_set_viewport(struct wined3d_cs *cs, const struct wined3d_vi
 
     op = cs->ops->require_space(cs, sizeof(*op));
     op->opcode = WINED3D_CS_OP_SET_VIEWPORT;
-    op->viewport = viewport;
+    op->viewport = *viewport;
 
     cs->ops->submit(cs);
 }
@@ -378,7 +529,7 @@ static void wined3d_cs_exec_set_scissor_rect(struct wined3d_cs *cs, const void *
 {
     const struct wined3d_cs_set_scissor_rect *op = data;
 
-    cs->state.scissor_rect = *op->rect;
+    cs->state.scissor_rect = op->rect;
     device_invalidate_state(cs->device, STATE_SCISSORRECT);
 }
 
@@ -388,7 +539,7 @@ void wined3d_cs_emit_set_scissor_rect(struct wined3d_cs *cs, const RECT *rect)
 
     op = cs->ops->require_space(cs, sizeof(*op));
     op->opcode = WINED3D_CS_OP_SET_SCISSOR_RECT;
-    op->rect = rect;
+    op->rect = *rect;
 
     cs->ops->submit(cs);
 }
@@ -854,11 +1005,55 @@ void wined3d_cs_emit_set_sampler_state(struct wined3d_cs *cs, UINT sampler_idx,
     cs->ops->submit(cs);
 }
 
+static void wined3d_cs_exec_set_states(struct wined3d_cs *cs, const void *data)
+{
+    const struct wined3d_cs_set_states *op = data;
+    const struct wined3d_state_change *change = op->changes;
+    const struct wined3d_device *device = cs->device;
+    unsigned int i;
+
+    for (i = 0; i < op->render_state_count; ++i, ++change)
+    {
+        cs->state.render_states[change->state] = change->value;
+        device_invalidate_state(device, STATE_RENDER(change->state));
+    }
+
+    for (i = 0; i < op->texture_state_count; ++i, ++change)
+    {
+        cs->state.texture_states[change->stage][change->state] = change->value;
+        device_invalidate_state(device, STATE_TEXTURESTAGE(change->stage, change->state));
+    }
+
+    for (i = 0; i < op->sampler_state_count; ++i, ++change)
+    {
+        cs->state.sampler_states[change->stage][change->state] = change->value;
+        device_invalidate_state(device, STATE_SAMPLER(change->stage));
+    }
+}
+
+/* The changes are ordered by type: render states first, then texture stage
+ * states, then sampler states. */
+void wined3d_cs_emit_set_states(struct wined3d_cs *cs, const struct wined3d_state_change *changes,
+        unsigned int render_state_count, unsigned int texture_state_count, unsigned int sampler_state_count)
+{
+    unsigned int count = render_state_count + texture_state_count + sampler_state_count;
+    struct wined3d_cs_set_states *op;
+
+    op = cs->ops->require_space(cs, FIELD_OFFSET(struct wined3d_cs_set_states, changes[count]));
+    op->opcode = WINED3D_CS_OP_SET_STATES;
+    op->render_state_count = render_state_count;
+    op->texture_state_count = texture_state_count;
+    op->sampler_state_count = sampler_state_count;
+    memcpy(op->changes, changes, count * sizeof(*changes));
+
+    cs->ops->submit(cs);
+}
+
 static void wined3d_cs_exec_set_transform(struct wined3d_cs *cs, const void *data)
 {
     const struct wined3d_cs_set_transform *op = data;
 
-    cs->state.transforms[op->state] = *op->matrix;
+    cs->state.transforms[op->state] = op->matrix;
     if (op->state < WINED3D_TS_WORLD_MATRIX(cs->device->adapter->d3d_info.limits.ffp_vertex_blend_matrices))
         device_invalidate_state(cs->device, STATE_TRANSFORM(op->state));
 }
@@ -871,7 +1066,7 @@ void wined3d_cs_emit_set_transform(struct wined3d_cs *cs, enum wined3d_transform
     op = cs->ops->require_space(cs, sizeof(*op));
     op->opcode = WINED3D_CS_OP_SET_TRANSFORM;
     op->state = state;
-    op->matrix = matrix;
+    op->matrix = *matrix;
 
     cs->ops->submit(cs);
 }
@@ -880,7 +1075,7 @@ static void wined3d_cs_exec_set_clip_plane(struct wined3d_cs *cs, const void *da
 {
     const struct wined3d_cs_set_clip_plane *op = data;
 
-    cs->state.clip_planes[op->plane_idx] = *op->plane;
+    cs->state.clip_planes[op->plane_idx] = op->plane;
     device_invalidate_state(cs->device, STATE_CLIPPLANE(op->plane_idx));
 }
 
@@ -891,7 +1086,7 @@ void wined3d_cs_emit_set_clip_plane(struct wined3d_cs *cs, UINT plane_idx, const
     op = cs->ops->require_space(cs, sizeof(*op));
     op->opcode = WINED3D_CS_OP_SET_CLIP_PLANE;
     op->plane_idx = plane_idx;
-    op->plane = plane;
+    op->plane = *plane;
 
     cs->ops->submit(cs);
 }
@@ -983,7 +1178,7 @@ static void wined3d_cs_exec_set_material(struct wined3d_cs *cs, const void *data
 {
     const struct wined3d_cs_set_material *op = data;
 
-    cs->state.material = *op->material;
+    cs->state.material = op->material;
     device_invalidate_state(cs->device, STATE_MATERIAL);
 }
 
@@ -993,7 +1188,201 @@ void wined3d_cs_emit_set_material(struct wined3d_cs *cs, const struct wined3d_ma
 
     op = cs->ops->require_space(cs, sizeof(*op));
     op->opcode = WINED3D_CS_OP_SET_MATERIAL;
-    op->material = material;
+    op->material = *material;
+
+    cs->ops->submit(cs);
+}
+
+static struct wined3d_light_info *wined3d_cs_find_light(const struct wined3d_state *state, UINT light_idx)
+{
+    struct wined3d_light_info *light_info;
+
+    LIST_FOR_EACH_ENTRY(light_info, &state->light_map[LIGHTMAP_HASHFUNC(light_idx)], struct wined3d_light_info, entry)
+    {
+        if (light_info->OriginalIndex == light_idx)
+            return light_info;
+    }
+
+    return NULL;
+}
+
+static void wined3d_cs_exec_set_light(struct wined3d_cs *cs, const void *data)
+{
+    const struct wined3d_cs_set_light *op = data;
+    struct wined3d_light_info *light_info;
+    UINT light_idx;
+
+    light_idx = op->light.OriginalIndex;
+    if (!(light_info = wined3d_cs_find_light(&cs->state, light_idx)))
+    {
+        TRACE("Adding new light.\n");
+        if (!(light_info = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*light_info))))
+        {
+            ERR("Failed to allocate light info.\n");
+            return;
+        }
+
+        list_add_head(&cs->state.light_map[LIGHTMAP_HASHFUNC(light_idx)], &light_info->entry);
+        light_info->glIndex = -1;
+        light_info->OriginalIndex = light_idx;
+    }
+
+    if (light_info->glIndex != -1)
+    {
+        if (light_info->OriginalParms.type != op->light.OriginalParms.type)
+            device_invalidate_state(cs->device, STATE_LIGHT_TYPE);
+        device_invalidate_state(cs->device, STATE_ACTIVELIGHT(light_info->glIndex));
+    }
+
+    light_info->OriginalParms = op->light.OriginalParms;
+    light_info->position = op->light.position;
+    light_info->direction = op->light.direction;
+    light_info->exponent = op->light.exponent;
+    light_info->cutoff = op->light.cutoff;
+}
+
+void wined3d_cs_emit_set_light(struct wined3d_cs *cs, const struct wined3d_light_info *light)
+{
+    struct wined3d_cs_set_light *op;
+
+    op = cs->ops->require_space(cs, sizeof(*op));
+    op->opcode = WINED3D_CS_OP_SET_LIGHT;
+    op->light = *light;
+
+    cs->ops->submit(cs);
+}
+
+static void wined3d_cs_exec_set_light_enable(struct wined3d_cs *cs, const void *data)
+{
+    const struct wined3d_gl_info *gl_info = &cs->device->adapter->gl_info;
+    const struct wined3d_cs_set_light_enable *op = data;
+    struct wined3d_light_info *light_info;
+    unsigned int i;
+
+    if (!(light_info = wined3d_cs_find_light(&cs->state, op->idx)))
+    {
+        ERR("Light %u doesn't exist.\n", op->idx);
+        return;
+    }
+
+    if (!op->enable)
+    {
+        if (light_info->glIndex != -1)
+        {
+            device_invalidate_state(cs->device, STATE_LIGHT_TYPE);
+            device_invalidate_state(cs->device, STATE_ACTIVELIGHT(light_info->glIndex));
+            cs->state.lights[light_info->glIndex] = NULL;
+            light_info->glIndex = -1;
+        }
+        light_info->enabled = FALSE;
+        return;
+    }
+
+    light_info->enabled = TRUE;
+    if (light_info->glIndex != -1)
+        return;
+
+    for (i = 0; i < gl_info->limits.lights; ++i)
+    {
+        if (!cs->state.lights[i])
+        {
+            cs->state.lights[i] = light_info;
+            light_info->glIndex = i;
+            device_invalidate_state(cs->device, STATE_LIGHT_TYPE);
+            device_invalidate_state(cs->device, STATE_ACTIVELIGHT(i));
+            break;
+        }
+    }
+}
+
+void wined3d_cs_emit_set_light_enable(struct wined3d_cs *cs, UINT light_idx, BOOL enable)
+{
+    struct wined3d_cs_set_light_enable *op;
+
+    op = cs->ops->require_space(cs, sizeof(*op));
+    op->opcode = WINED3D_CS_OP_SET_LIGHT_ENABLE;
+    op->idx = light_idx;
+    op->enable = enable;
+
+    cs->ops->submit(cs);
+}
+
+static size_t wined3d_cs_shader_constant_size(DWORD type)
+{
+    switch (type)
+    {
+        case WINED3D_SHADER_CONST_VS_F:
+        case WINED3D_SHADER_CONST_PS_F:
+            return sizeof(float) * 4;
+
+        case WINED3D_SHADER_CONST_VS_I:
+        case WINED3D_SHADER_CONST_PS_I:
+            return sizeof(int) * 4;
+
+        case WINED3D_SHADER_CONST_VS_B:
+        case WINED3D_SHADER_CONST_PS_B:
+            return sizeof(BOOL);
+
+        default:
+            ERR("Unhandled shader constant type %#x.\n", type);
+            return 0;
+    }
+}
+
+static void wined3d_cs_exec_set_shader_constants(struct wined3d_cs *cs, const void *data)
+{
+    const struct wined3d_cs_set_shader_constants *op = data;
+    struct wined3d_device *device = cs->device;
+    size_t size;
+
+    size = op->count * wined3d_cs_shader_constant_size(op->type);
+    switch (op->type)
+    {
+        case WINED3D_SHADER_CONST_VS_F:
+            memcpy(&cs->state.vs_consts_f[op->start_idx * 4], op->constants, size);
+            device->shader_backend->shader_update_float_vertex_constants(device, op->start_idx, op->count);
+            break;
+
+        case WINED3D_SHADER_CONST_PS_F:
+            memcpy(&cs->state.ps_consts_f[op->start_idx * 4], op->constants, size);
+            device->shader_backend->shader_update_float_pixel_constants(device, op->start_idx, op->count);
+            break;
+
+        case WINED3D_SHADER_CONST_VS_I:
+            memcpy(&cs->state.vs_consts_i[op->start_idx * 4], op->constants, size);
+            device_invalidate_shader_constants(device, op->type);
+            break;
+
+        case WINED3D_SHADER_CONST_PS_I:
+            memcpy(&cs->state.ps_consts_i[op->start_idx * 4], op->constants, size);
+            device_invalidate_shader_constants(device, op->type);
+            break;
+
+        case WINED3D_SHADER_CONST_VS_B:
+            memcpy(&cs->state.vs_consts_b[op->start_idx], op->constants, size);
+            device_invalidate_shader_constants(device, op->type);
+            break;
+
+        case WINED3D_SHADER_CONST_PS_B:
+            memcpy(&cs->state.ps_consts_b[op->start_idx], op->constants, size);
+            device_invalidate_shader_constants(device, op->type);
+            break;
+    }
+}
+
+void wined3d_cs_emit_set_shader_constants(struct wined3d_cs *cs, DWORD type,
+        UINT start_idx, UINT count, const void *constants)
+{
+    struct wined3d_cs_set_shader_constants *op;
+    size_t size;
+
+    size = count * wined3d_cs_shader_constant_size(type);
+    op = cs->ops->require_space(cs, FIELD_OFFSET(struct wined3d_cs_set_shader_constants, constants[size]));
+    op->opcode = WINED3D_CS_OP_SET_SHADER_CONSTANTS;
+    op->type = type;
+    op->start_idx = start_idx;
+    op->count = count;
+    memcpy(op->constants, constants, size);
 
     cs->ops->submit(cs);
 }
@@ -1020,6 +1409,97 @@ void wined3d_cs_emit_reset_state(struct wined3d_cs *cs)
     cs->ops->submit(cs);
 }
 
+static void wined3d_cs_exec_update_buffer(struct wined3d_cs *cs, const void *data)
+{
+    const struct wined3d_cs_update_buffer *op = data;
+
+    buffer_update_from_memory(op->buffer, op->ranges, op->range_count, op->flags, op->memory);
+}
+
+/* memory holds the whole buffer, and is owned by the buffer again once the
+ * packet is executed. Only the given ranges of it are copied. */
+void wined3d_cs_emit_update_buffer(struct wined3d_cs *cs, struct wined3d_buffer *buffer,
+        const struct wined3d_map_range *ranges, unsigned int range_count, DWORD flags, BYTE *memory)
+{
+    struct wined3d_cs_update_buffer *op;
+
+    op = cs->ops->require_space(cs, FIELD_OFFSET(struct wined3d_cs_update_buffer, ranges[range_count]));
+    op->opcode = WINED3D_CS_OP_UPDATE_BUFFER;
+    op->buffer = buffer;
+    op->flags = flags;
+    op->memory = memory;
+    op->range_count = range_count;
+    memcpy(op->ranges, ranges, range_count * sizeof(*ranges));
+
+    cs->ops->submit(cs);
+}
+
+static void wined3d_cs_exec_query_issue(struct wined3d_cs *cs, const void *data)
+{
+    const struct wined3d_cs_query_issue *op = data;
+    struct wined3d_query *query = op->query;
+
+    if (op->flags & WINED3DISSUE_END)
+        query->counter_issued = op->counter;
+    query->query_ops->query_issue(query, op->flags);
+}
+
+void wined3d_cs_emit_query_issue(struct wined3d_cs *cs, struct wined3d_query *query, DWORD flags, LONG counter)
+{
+    struct wined3d_cs_query_issue *op;
+
+    op = cs->ops->require_space(cs, sizeof(*op));
+    op->opcode = WINED3D_CS_OP_QUERY_ISSUE;
+    op->query = query;
+    op->flags = flags;
+    op->counter = counter;
+
+    cs->ops->submit(cs);
+}
+
+static void wined3d_cs_exec_query_poll(struct wined3d_cs *cs, const void *data)
+{
+    const struct wined3d_cs_query_poll *op = data;
+
+    InterlockedExchange(&op->query->poll_queued, FALSE);
+    wined3d_query_poll(op->query);
+}
+
+void wined3d_cs_emit_query_poll(struct wined3d_cs *cs, struct wined3d_query *query)
+{
+    struct wined3d_cs_query_poll *op;
+
+    op = cs->ops->require_space(cs, sizeof(*op));
+    op->opcode = WINED3D_CS_OP_QUERY_POLL;
+    op->query = query;
+
+    cs->ops->submit(cs);
+}
+
+static void wined3d_cs_exec_nop(struct wined3d_cs *cs, const void *data)
+{
+}
+
+static void wined3d_cs_exec_flush(struct wined3d_cs *cs, const void *data)
+{
+    struct wined3d_context *context;
+
+    /* Make the results of the commands executed so far visible to contexts
+     * on other threads. */
+    if ((context = context_get_current()) && !context->destroyed)
+        context->gl_info->gl_ops.gl.p_glFlush();
+}
+
+void wined3d_cs_emit_flush(struct wined3d_cs *cs)
+{
+    struct wined3d_cs_nop *op;
+
+    op = cs->ops->require_space(cs, sizeof(*op));
+    op->opcode = WINED3D_CS_OP_FLUSH;
+
+    cs->ops->submit(cs);
+}
+
 static void (* const wined3d_cs_op_handlers[])(struct wined3d_cs *cs, const void *data) =
 {
     /* WINED3D_CS_OP_PRESENT                    */ wined3d_cs_exec_present,
@@ -1043,43 +1523,372 @@ static void (* const wined3d_cs_op_handlers[])(struct wined3d_cs *cs, const void
     /* WINED3D_CS_OP_SET_RENDER_STATE           */ wined3d_cs_exec_set_render_state,
     /* WINED3D_CS_OP_SET_TEXTURE_STATE          */ wined3d_cs_exec_set_texture_state,
     /* WINED3D_CS_OP_SET_SAMPLER_STATE          */ wined3d_cs_exec_set_sampler_state,
+    /* WINED3D_CS_OP_SET_STATES                 */ wined3d_cs_exec_set_states,
     /* WINED3D_CS_OP_SET_TRANSFORM              */ wined3d_cs_exec_set_transform,
     /* WINED3D_CS_OP_SET_CLIP_PLANE             */ wined3d_cs_exec_set_clip_plane,
     /* WINED3D_CS_OP_SET_COLOR_KEY              */ wined3d_cs_exec_set_color_key,
     /* WINED3D_CS_OP_SET_MATERIAL               */ wined3d_cs_exec_set_material,
+    /* WINED3D_CS_OP_SET_LIGHT                  */ wined3d_cs_exec_set_light,
+    /* WINED3D_CS_OP_SET_LIGHT_ENABLE           */ wined3d_cs_exec_set_light_enable,
+    /* WINED3D_CS_OP_SET_SHADER_CONSTANTS       */ wined3d_cs_exec_set_shader_constants,
     /* WINED3D_CS_OP_RESET_STATE                */ wined3d_cs_exec_reset_state,
+    /* WINED3D_CS_OP_UPDATE_BUFFER              */ wined3d_cs_exec_update_buffer,
+    /* WINED3D_CS_OP_QUERY_ISSUE                */ wined3d_cs_exec_query_issue,
+    /* WINED3D_CS_OP_QUERY_POLL                 */ wined3d_cs_exec_query_poll,
+    /* WINED3D_CS_OP_NOP                        */ wined3d_cs_exec_nop,
+    /* WINED3D_CS_OP_FLUSH                      */ wined3d_cs_exec_flush,
+    /* WINED3D_CS_OP_STOP                       */ wined3d_cs_exec_nop,
 };
 
+static size_t wined3d_cs_packet_size(size_t data_size)
+{
+    return (FIELD_OFFSET(struct wined3d_cs_packet, data[data_size]) + WINED3D_CS_PACKET_ALIGNMENT - 1)
+            & ~(size_t)(WINED3D_CS_PACKET_ALIGNMENT - 1);
+}
+
+/* The heap only guarantees 8-byte alignment on 32-bit. */
+static struct wined3d_cs_packet *wined3d_cs_st_packet(const struct wined3d_cs *cs)
+{
+    return (struct wined3d_cs_packet *)(((ULONG_PTR)cs->data + WINED3D_CS_PACKET_ALIGNMENT - 1)
+            & ~(ULONG_PTR)(WINED3D_CS_PACKET_ALIGNMENT - 1));
+}
+
 static void *wined3d_cs_st_require_space(struct wined3d_cs *cs, size_t size)
 {
-    if (size > cs->data_size)
+    struct wined3d_cs_packet *packet;
+    size_t packet_size;
+
+    packet_size = wined3d_cs_packet_size(size);
+    if (packet_size > cs->data_size)
     {
+        size_t new_size = max(packet_size, cs->data_size * 2);
         void *new_data;
 
-        size = max( size, cs->data_size * 2 );
-        if (!(new_data = HeapReAlloc(GetProcessHeap(), 0, cs->data, size)))
+        if (!(new_data = HeapReAlloc(GetProcessHeap(), 0, cs->data, new_size + WINED3D_CS_PACKET_ALIGNMENT - 1)))
             return NULL;
 
-        cs->data_size = size;
+        cs->data_size = new_size;
         cs->data = new_data;
     }
 
-    return cs->data;
+    packet = wined3d_cs_st_packet(cs);
+    packet->size = packet_size;
+
+    return packet->data;
 }
 
 static void wined3d_cs_st_submit(struct wined3d_cs *cs)
 {
-    enum wined3d_cs_op opcode = *(const enum wined3d_cs_op *)cs->data;
+    struct wined3d_cs_packet *packet = wined3d_cs_st_packet(cs);
+    enum wined3d_cs_op opcode = *(const enum wined3d_cs_op *)packet->data;
 
-    wined3d_cs_op_handlers[opcode](cs, cs->data);
+    wined3d_cs_op_handlers[opcode](cs, packet->data);
+}
+
+static void wined3d_cs_st_finish(struct wined3d_cs *cs)
+{
 }
 
 static const struct wined3d_cs_ops wined3d_cs_st_ops =
 {
     wined3d_cs_st_require_space,
     wined3d_cs_st_submit,
+    wined3d_cs_st_finish,
 };
 
+static inline void wined3d_pause(void)
+{
+#if defined(__i386__) || defined(__x86_64__)
+    __asm__ __volatile__( "rep;nop" : : : "memory" );
+#else
+    __asm__ __volatile__( "" : : : "memory" );
+#endif
+}
+
+/* Only the owner writes its own thread id to lock_owner, so other threads
+ * never read their own id there. */
+static BOOL wined3d_cs_owns_lock(const struct wined3d_cs *cs)
+{
+    return *(volatile const DWORD *)&cs->lock_owner == GetCurrentThreadId();
+}
+
+static void wined3d_cs_enter_lock(struct wined3d_cs *cs)
+{
+    EnterCriticalSection(&cs->exec_lock);
+    if (!cs->lock_count++)
+        cs->lock_owner = GetCurrentThreadId();
+}
+
+static void wined3d_cs_leave_lock(struct wined3d_cs *cs)
+{
+    if (!--cs->lock_count)
+        cs->lock_owner = 0;
+    LeaveCriticalSection(&cs->exec_lock);
+}
+
+/* Executes the queued packets. Called with the execution lock held, either
+ * by the CS thread or by an application thread that needs the queue drained
+ * while it holds the lock itself. Returns TRUE when a STOP packet was
+ * reached. */
+static BOOL wined3d_cs_mt_execute(struct wined3d_cs *cs)
+{
+    struct wined3d_cs_queue *queue = &cs->queue;
+    const struct wined3d_cs_packet *packet;
+    enum wined3d_cs_op opcode;
+    LONG tail;
+
+    /* Packets may acquire a context, which in turn may try to drain the
+     * queue. Don't execute the packets behind the current one early. */
+    if (cs->executing)
+        return FALSE;
+    cs->executing = TRUE;
+
+    while ((tail = queue->tail) != *(volatile LONG *)&queue->head)
+    {
+        packet = (const struct wined3d_cs_packet *)&queue->data[tail & WINED3D_CS_QUEUE_MASK];
+
+        /* Packets without any data only pad the end of the ring. */
+        if (packet->size == FIELD_OFFSET(struct wined3d_cs_packet, data[0]))
+            opcode = WINED3D_CS_OP_NOP;
+        else
+            opcode = *(const enum wined3d_cs_op *)packet->data;
+
+        if (opcode != WINED3D_CS_OP_STOP)
+            wined3d_cs_op_handlers[opcode](cs, packet->data);
+
+        InterlockedExchange(&queue->tail, tail + packet->size);
+
+        if (opcode == WINED3D_CS_OP_STOP)
+        {
+            cs->executing = FALSE;
+            return TRUE;
+        }
+    }
+
+    cs->executing = FALSE;
+    return FALSE;
+}
+
+static void wined3d_cs_mt_wait_space(struct wined3d_cs *cs, size_t size)
+{
+    struct wined3d_cs_queue *queue = &cs->queue;
+
+    while (WINED3D_CS_QUEUE_SIZE - (ULONG)(queue->head - *(volatile LONG *)&queue->tail) < size)
+    {
+        if (wined3d_cs_owns_lock(cs))
+            wined3d_cs_mt_execute(cs);
+        else
+            wined3d_pause();
+    }
+}
+
+static void wined3d_cs_mt_publish(struct wined3d_cs *cs, size_t size)
+{
+    InterlockedExchange(&cs->queue.head, cs->queue.head + size);
+
+    if (InterlockedCompareExchange(&cs->waiting_for_event, FALSE, TRUE))
+        SetEvent(cs->event);
+}
+
+static void *wined3d_cs_mt_require_space(struct wined3d_cs *cs, size_t size)
+{
+    struct wined3d_cs_queue *queue = &cs->queue;
+    size_t packet_size, remaining;
+    struct wined3d_cs_packet *packet;
+    void *data;
+
+    packet_size = wined3d_cs_packet_size(size);
+    if (packet_size > WINED3D_CS_QUEUE_SIZE / 2)
+    {
+        /* Build the packet outside of the queue, and execute it directly
+         * on submission. */
+        WARN("Packet size %lu is too large for the command queue.\n", (unsigned long)packet_size);
+        if (!(data = wined3d_cs_st_require_space(cs, size)))
+            return NULL;
+        cs->direct_packet = TRUE;
+        return data;
+    }
+
+    /* Packets never wrap; fill the end of the ring with a NOP instead. */
+    remaining = WINED3D_CS_QUEUE_SIZE - (queue->head & WINED3D_CS_QUEUE_MASK);
+    if (remaining < packet_size)
+    {
+        wined3d_cs_mt_wait_space(cs, remaining);
+        packet = (struct wined3d_cs_packet *)&queue->data[queue->head & WINED3D_CS_QUEUE_MASK];
+        packet->size = remaining;
+        if (remaining > FIELD_OFFSET(struct wined3d_cs_packet, data[0]))
+            *(enum wined3d_cs_op *)packet->data = WINED3D_CS_OP_NOP;
+        wined3d_cs_mt_publish(cs, remaining);
+    }
+
+    wined3d_cs_mt_wait_space(cs, packet_size);
+    packet = (struct wined3d_cs_packet *)&queue->data[queue->head & WINED3D_CS_QUEUE_MASK];
+    packet->size = packet_size;
+    queue->pending_size = packet_size;
+
+    return packet->data;
+}
+
+static void wined3d_cs_mt_finish(struct wined3d_cs *cs);
+
+static void wined3d_cs_mt_submit(struct wined3d_cs *cs)
+{
+    if (cs->direct_packet)
+    {
+        cs->direct_packet = FALSE;
+        /* The packets queued before this one have to be executed first. */
+        wined3d_cs_mt_finish(cs);
+        wined3d_cs_enter_lock(cs);
+        wined3d_cs_st_submit(cs);
+        wined3d_cs_leave_lock(cs);
+        return;
+    }
+
+    wined3d_cs_mt_publish(cs, cs->queue.pending_size);
+    cs->queue.pending_size = 0;
+}
+
+static void wined3d_cs_mt_finish(struct wined3d_cs *cs)
+{
+    struct wined3d_cs_queue *queue = &cs->queue;
+    unsigned int spin_count = 0;
+
+    if (GetCurrentThreadId() == cs->thread_id)
+        return;
+
+    /* A thread holding the execution lock drains the queue itself, unless
+     * it's already executing packets. */
+    if (wined3d_cs_owns_lock(cs))
+    {
+        wined3d_cs_mt_execute(cs);
+        return;
+    }
+
+    wined3d_cs_emit_flush(cs);
+
+    while (*(volatile LONG *)&queue->tail != queue->head)
+    {
+        if (++spin_count < WINED3D_CS_SPIN_COUNT)
+            wined3d_pause();
+        else
+            Sleep(0);
+    }
+}
+
+static const struct wined3d_cs_ops wined3d_cs_mt_ops =
+{
+    wined3d_cs_mt_require_space,
+    wined3d_cs_mt_submit,
+    wined3d_cs_mt_finish,
+};
+
+static DWORD WINAPI wined3d_cs_run(void *thread_param)
+{
+    struct wined3d_cs *cs = thread_param;
+    struct wined3d_cs_queue *queue = &cs->queue;
+    unsigned int spin_count = 0;
+    BOOL stop;
+
+    TRACE("Started CS thread %#x.\n", GetCurrentThreadId());
+
+    for (;;)
+    {
+        if (*(volatile LONG *)&queue->head == queue->tail)
+        {
+            if (++spin_count < WINED3D_CS_SPIN_COUNT)
+            {
+                wined3d_pause();
+                continue;
+            }
+
+            /* Recheck after announcing the wait, the application thread may
+             * have submitted a packet in the meantime. */
+            InterlockedExchange(&cs->waiting_for_event, TRUE);
+            if (*(volatile LONG *)&queue->head == queue->tail)
+                WaitForSingleObject(cs->event, INFINITE);
+            InterlockedExchange(&cs->waiting_for_event, FALSE);
+            spin_count = 0;
+            continue;
+        }
+        spin_count = 0;
+
+        wined3d_cs_enter_lock(cs);
+        stop = wined3d_cs_mt_execute(cs);
+        wined3d_cs_leave_lock(cs);
+
+        if (stop)
+            break;
+    }
+
+    wined3d_cs_enter_lock(cs);
+    context_set_current(NULL);
+    wined3d_cs_leave_lock(cs);
+
+    TRACE("Stopped CS thread %#x.\n", GetCurrentThreadId());
+
+    return 0;
+}
+
+void wined3d_cs_lock(struct wined3d_cs *cs)
+{
+    if (cs->thread)
+        wined3d_cs_enter_lock(cs);
+}
+
+void wined3d_cs_unlock(struct wined3d_cs *cs)
+{
+    if (cs->thread)
+        wined3d_cs_leave_lock(cs);
+}
+
+static BOOL wined3d_cs_start_thread(struct wined3d_cs *cs)
+{
+    /* Page aligned, and therefore suitably aligned for packets. */
+    if (!(cs->queue.data = VirtualAlloc(NULL, WINED3D_CS_QUEUE_SIZE, MEM_COMMIT, PAGE_READWRITE)))
+        return FALSE;
+
+    if (!(cs->event = CreateEventW(NULL, FALSE, FALSE, NULL)))
+    {
+        VirtualFree(cs->queue.data, 0, MEM_RELEASE);
+        return FALSE;
+    }
+
+    InitializeCriticalSection(&cs->exec_lock);
+    cs->exec_lock.DebugInfo->Spare[0] = (DWORD_PTR)(__FILE__ ": wined3d_cs.exec_lock");
+
+    if (!(cs->thread = CreateThread(NULL, 0, wined3d_cs_run, cs, 0, &cs->thread_id)))
+    {
+        cs->exec_lock.DebugInfo->Spare[0] = 0;
+        DeleteCriticalSection(&cs->exec_lock);
+        CloseHandle(cs->event);
+        VirtualFree(cs->queue.data, 0, MEM_RELEASE);
+        return FALSE;
+    }
+
+    cs->ops = &wined3d_cs_mt_ops;
+
+    return TRUE;
+}
+
+static void wined3d_cs_stop_thread(struct wined3d_cs *cs)
+{
+    struct wined3d_cs_nop *op;
+
+    op = cs->ops->require_space(cs, sizeof(*op));
+    op->opcode = WINED3D_CS_OP_STOP;
+    cs->ops->submit(cs);
+
+    WaitForSingleObject(cs->thread, INFINITE);
+    CloseHandle(cs->thread);
+    cs->thread = NULL;
+    cs->ops = &wined3d_cs_st_ops;
+
+    cs->exec_lock.DebugInfo->Spare[0] = 0;
+    DeleteCriticalSection(&cs->exec_lock);
+    CloseHandle(cs->event);
+    VirtualFree(cs->queue.data, 0, MEM_RELEASE);
+}
+
 struct wined3d_cs *wined3d_cs_create(struct wined3d_device *device)
 {
     const struct wined3d_gl_info *gl_info = &device->adapter->gl_info;
@@ -1107,17 +1916,23 @@ struct wined3d_cs *wined3d_cs_create(struct wined3d_device *device)
     cs->device = device;
 
     cs->data_size = WINED3D_INITIAL_CS_SIZE;
-    if (!(cs->data = HeapAlloc(GetProcessHeap(), 0, cs->data_size)))
+    if (!(cs->data = HeapAlloc(GetProcessHeap(), 0, cs->data_size + WINED3D_CS_PACKET_ALIGNMENT - 1)))
     {
         HeapFree(GetProcessHeap(), 0, cs);
         return NULL;
     }
 
+    if (wined3d_settings.cs_multithreaded && !wined3d_cs_start_thread(cs))
+        WARN("Failed to start the CS thread, using the single-threaded command stream.\n");
+
     return cs;
 }
 
 void wined3d_cs_destroy(struct wined3d_cs *cs)
 {
+    if (cs->thread)
+        wined3d_cs_stop_thread(cs);
+
     state_cleanup(&cs->state);
     HeapFree(GetProcessHeap(), 0, cs->fb.render_targets);
     HeapFree(GetProcessHeap(), 0, cs->data);
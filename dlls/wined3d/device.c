@@ -95,6 +95,15 @@ GLenum gl_primitive_type_from_d3d(enum wined3d_primitive_type primitive_type)
     }
 }
 
+/* Counts a state change that was filtered out because it would not change the
+ * current state. Changes recorded into a stateblock are not counted, they
+ * never reach the command stream directly. */
+static inline void device_skip_redundant_state(struct wined3d_device *device)
+{
+    if (!device->recording)
+        ++device->cs->redundant_state_count;
+}
+
 static enum wined3d_primitive_type d3d_primitive_type_from_gl(GLenum primitive_type)
 {
     switch(primitive_type)
@@ -404,7 +413,7 @@ void device_clear_render_targets(struct wined3d_device *device, UINT rt_count, c
         }
 
         if (!gl_info->supported[ARB_FRAMEBUFFER_SRGB]
-                && device->state.render_states[WINED3D_RS_SRGBWRITEENABLE])
+                && device->cs->state.render_states[WINED3D_RS_SRGBWRITEENABLE])
         {
             if (fb->render_targets[0]->format_flags & WINED3DFMT_FLAG_SRGB_WRITE)
             {
@@ -530,14 +539,14 @@ ULONG CDECL wined3d_device_decref(struct wined3d_device *device)
     {
         UINT i;
 
-        wined3d_cs_destroy(device->cs);
-
         if (device->recording && wined3d_stateblock_decref(device->recording))
             FIXME("Something's still holding the recording stateblock.\n");
         device->recording = NULL;
 
         state_cleanup(&device->state);
 
+        wined3d_cs_destroy(device->cs);
+
         for (i = 0; i < sizeof(device->multistate_funcs) / sizeof(device->multistate_funcs[0]); ++i)
         {
             HeapFree(GetProcessHeap(), 0, device->multistate_funcs[i]);
@@ -1137,6 +1146,8 @@ HRESULT CDECL wined3d_device_uninit_3d(struct wined3d_device *device)
     if (!device->d3d_initialized)
         return WINED3DERR_INVALIDCALL;
 
+    device->cs->ops->finish(device->cs);
+
     /* I don't think that the interface guarantees that the device is destroyed from the same thread
      * it was created. Thus make sure a context is active for the glDelete* calls
      */
@@ -1354,6 +1365,7 @@ HRESULT CDECL wined3d_device_set_stream_source(struct wined3d_device *device, UI
             && stream->offset == offset)
     {
        TRACE("Application is setting the old values over, nothing to do.\n");
+       device_skip_redundant_state(device);
        return WINED3D_OK;
     }
 
@@ -1431,6 +1443,8 @@ HRESULT CDECL wined3d_device_set_stream_source_freq(struct wined3d_device *devic
         device->recording->changed.streamFreq |= 1u << stream_idx;
     else if (stream->frequency != old_freq || stream->flags != old_flags)
         wined3d_cs_emit_set_stream_source_freq(device->cs, stream_idx, stream->frequency, stream->flags);
+    else
+        device_skip_redundant_state(device);
 
     return WINED3D_OK;
 }
@@ -1478,6 +1492,7 @@ void CDECL wined3d_device_set_transform(struct wined3d_device *device,
     if (!memcmp(&device->state.transforms[d3dts], matrix, sizeof(*matrix)))
     {
         TRACE("The application is setting the same matrix over again.\n");
+        device_skip_redundant_state(device);
         return;
     }
 
@@ -1595,14 +1610,6 @@ HRESULT CDECL wined3d_device_set_light(struct wined3d_device *device,
     TRACE("... Range(%f), Falloff(%f), Theta(%f), Phi(%f)\n",
             light->range, light->falloff, light->theta, light->phi);
 
-    /* Update the live definitions if the light is currently assigned a glIndex. */
-    if (object->glIndex != -1 && !device->recording)
-    {
-        if (object->OriginalParms.type != light->type)
-            device_invalidate_state(device, STATE_LIGHT_TYPE);
-        device_invalidate_state(device, STATE_ACTIVELIGHT(object->glIndex));
-    }
-
     /* Save away the information. */
     object->OriginalParms = *light;
 
@@ -1682,6 +1689,9 @@ HRESULT CDECL wined3d_device_set_light(struct wined3d_device *device,
             FIXME("Unrecognized light type %#x.\n", light->type);
     }
 
+    if (!device->recording)
+        wined3d_cs_emit_set_light(device->cs, object);
+
     return WINED3D_OK;
 }
 
@@ -1750,16 +1760,13 @@ HRESULT CDECL wined3d_device_set_light_enable(struct wined3d_device *device, UIN
         }
     }
 
+    if (!device->recording)
+        wined3d_cs_emit_set_light_enable(device->cs, light_idx, enable);
+
     if (!enable)
     {
         if (light_info->glIndex != -1)
         {
-            if (!device->recording)
-            {
-                device_invalidate_state(device, STATE_LIGHT_TYPE);
-                device_invalidate_state(device, STATE_ACTIVELIGHT(light_info->glIndex));
-            }
-
             device->update_state->lights[light_info->glIndex] = NULL;
             light_info->glIndex = -1;
         }
@@ -1801,13 +1808,6 @@ HRESULT CDECL wined3d_device_set_light_enable(struct wined3d_device *device, UIN
                 WARN("Too many concurrently active lights\n");
                 return WINED3D_OK;
             }
-
-            /* i == light_info->glIndex */
-            if (!device->recording)
-            {
-                device_invalidate_state(device, STATE_LIGHT_TYPE);
-                device_invalidate_state(device, STATE_ACTIVELIGHT(i));
-            }
         }
     }
 
@@ -1858,6 +1858,7 @@ HRESULT CDECL wined3d_device_set_clip_plane(struct wined3d_device *device,
     if (!memcmp(&device->update_state->clip_planes[plane_idx], plane, sizeof(*plane)))
     {
         TRACE("Application is setting old values over, nothing to do.\n");
+        device_skip_redundant_state(device);
         return WINED3D_OK;
     }
 
@@ -1912,6 +1913,13 @@ void CDECL wined3d_device_set_material(struct wined3d_device *device, const stru
 {
     TRACE("device %p, material %p.\n", device, material);
 
+    if (!device->recording && !memcmp(&device->state.material, material, sizeof(*material)))
+    {
+        TRACE("Application is setting the old material over, nothing to do.\n");
+        device_skip_redundant_state(device);
+        return;
+    }
+
     device->update_state->material = *material;
 
     if (device->recording)
@@ -1960,7 +1968,10 @@ void CDECL wined3d_device_set_index_buffer(struct wined3d_device *device,
         device->recording->changed.indices = TRUE;
 
     if (prev_buffer == buffer && prev_format == format_id)
+    {
+        device_skip_redundant_state(device);
         return;
+    }
 
     if (buffer)
         wined3d_buffer_incref(buffer);
@@ -1999,6 +2010,13 @@ void CDECL wined3d_device_set_viewport(struct wined3d_device *device, const stru
     TRACE("x %u, y %u, w %u, h %u, min_z %.8e, max_z %.8e.\n",
           viewport->x, viewport->y, viewport->width, viewport->height, viewport->min_z, viewport->max_z);
 
+    if (!device->recording && !memcmp(&device->state.viewport, viewport, sizeof(*viewport)))
+    {
+        TRACE("Application is setting the old viewport over, nothing to do.\n");
+        device_skip_redundant_state(device);
+        return;
+    }
+
     device->update_state->viewport = *viewport;
 
     /* Handle recording of state blocks */
@@ -2063,7 +2081,10 @@ void CDECL wined3d_device_set_render_state(struct wined3d_device *device,
 
     /* Compared here and not before the assignment to allow proper stateblock recording. */
     if (value == old_value)
+    {
         TRACE("Application is setting the old value over, nothing to do.\n");
+        device_skip_redundant_state(device);
+    }
     else
         wined3d_cs_emit_set_render_state(device->cs, state, value);
 
@@ -2112,6 +2133,7 @@ void CDECL wined3d_device_set_sampler_state(struct wined3d_device *device,
     if (old_value == value)
     {
         TRACE("Application is setting the old value over, nothing to do.\n");
+        device_skip_redundant_state(device);
         return;
     }
 
@@ -2146,6 +2168,7 @@ void CDECL wined3d_device_set_scissor_rect(struct wined3d_device *device, const
     if (EqualRect(&device->update_state->scissor_rect, rect))
     {
         TRACE("App is setting the old scissor rectangle over, nothing to do.\n");
+        device_skip_redundant_state(device);
         return;
     }
     CopyRect(&device->update_state->scissor_rect, rect);
@@ -2358,7 +2381,7 @@ struct wined3d_sampler * CDECL wined3d_device_get_vs_sampler(const struct wined3
     return device->state.sampler[WINED3D_SHADER_TYPE_VERTEX][idx];
 }
 
-static void device_invalidate_shader_constants(const struct wined3d_device *device, DWORD mask)
+void device_invalidate_shader_constants(const struct wined3d_device *device, DWORD mask)
 {
     UINT i;
 
@@ -2380,6 +2403,14 @@ HRESULT CDECL wined3d_device_set_vs_consts_b(struct wined3d_device *device,
     if (!constants || start_register >= MAX_CONST_B)
         return WINED3DERR_INVALIDCALL;
 
+    if (!device->recording
+            && !memcmp(&device->state.vs_consts_b[start_register], constants, count * sizeof(BOOL)))
+    {
+        TRACE("Application is setting the old values over, nothing to do.\n");
+        device_skip_redundant_state(device);
+        return WINED3D_OK;
+    }
+
     memcpy(&device->update_state->vs_consts_b[start_register], constants, count * sizeof(BOOL));
     for (i = 0; i < count; ++i)
         TRACE("Set BOOL constant %u to %s.\n", start_register + i, constants[i] ? "true" : "false");
@@ -2391,7 +2422,8 @@ HRESULT CDECL wined3d_device_set_vs_consts_b(struct wined3d_device *device,
     }
     else
     {
-        device_invalidate_shader_constants(device, WINED3D_SHADER_CONST_VS_B);
+        wined3d_cs_emit_set_shader_constants(device->cs, WINED3D_SHADER_CONST_VS_B,
+                start_register, count, constants);
     }
 
     return WINED3D_OK;
@@ -2425,6 +2457,14 @@ HRESULT CDECL wined3d_device_set_vs_consts_i(struct wined3d_device *device,
     if (!constants || start_register >= MAX_CONST_I)
         return WINED3DERR_INVALIDCALL;
 
+    if (!device->recording
+            && !memcmp(&device->state.vs_consts_i[start_register * 4], constants, count * sizeof(int) * 4))
+    {
+        TRACE("Application is setting the old values over, nothing to do.\n");
+        device_skip_redundant_state(device);
+        return WINED3D_OK;
+    }
+
     memcpy(&device->update_state->vs_consts_i[start_register * 4], constants, count * sizeof(int) * 4);
     for (i = 0; i < count; ++i)
         TRACE("Set INT constant %u to {%d, %d, %d, %d}.\n", start_register + i,
@@ -2438,7 +2478,8 @@ HRESULT CDECL wined3d_device_set_vs_consts_i(struct wined3d_device *device,
     }
     else
     {
-        device_invalidate_shader_constants(device, WINED3D_SHADER_CONST_VS_I);
+        wined3d_cs_emit_set_shader_constants(device->cs, WINED3D_SHADER_CONST_VS_I,
+                start_register, count, constants);
     }
 
     return WINED3D_OK;
@@ -2475,6 +2516,15 @@ HRESULT CDECL wined3d_device_set_vs_consts_f(struct wined3d_device *device,
             || start_register > d3d_info->limits.vs_uniform_count)
         return WINED3DERR_INVALIDCALL;
 
+    if (!device->recording
+            && !memcmp(&device->state.vs_consts_f[start_register * 4], constants,
+            vector4f_count * sizeof(float) * 4))
+    {
+        TRACE("Application is setting the old values over, nothing to do.\n");
+        device_skip_redundant_state(device);
+        return WINED3D_OK;
+    }
+
     memcpy(&device->update_state->vs_consts_f[start_register * 4],
             constants, vector4f_count * sizeof(float) * 4);
     if (TRACE_ON(d3d))
@@ -2489,7 +2539,8 @@ HRESULT CDECL wined3d_device_set_vs_consts_f(struct wined3d_device *device,
         memset(device->recording->changed.vertexShaderConstantsF + start_register, 1,
                 sizeof(*device->recording->changed.vertexShaderConstantsF) * vector4f_count);
     else
-        device->shader_backend->shader_update_float_vertex_constants(device, start_register, vector4f_count);
+        wined3d_cs_emit_set_shader_constants(device->cs, WINED3D_SHADER_CONST_VS_F,
+                start_register, vector4f_count, constants);
 
 
     return WINED3D_OK;
@@ -2614,6 +2665,14 @@ HRESULT CDECL wined3d_device_set_ps_consts_b(struct wined3d_device *device,
     if (!constants || start_register >= MAX_CONST_B)
         return WINED3DERR_INVALIDCALL;
 
+    if (!device->recording
+            && !memcmp(&device->state.ps_consts_b[start_register], constants, count * sizeof(BOOL)))
+    {
+        TRACE("Application is setting the old values over, nothing to do.\n");
+        device_skip_redundant_state(device);
+        return WINED3D_OK;
+    }
+
     memcpy(&device->update_state->ps_consts_b[start_register], constants, count * sizeof(BOOL));
     for (i = 0; i < count; ++i)
         TRACE("Set BOOL constant %u to %s.\n", start_register + i, constants[i] ? "true" : "false");
@@ -2625,7 +2684,8 @@ HRESULT CDECL wined3d_device_set_ps_consts_b(struct wined3d_device *device,
     }
     else
     {
-        device_invalidate_shader_constants(device, WINED3D_SHADER_CONST_PS_B);
+        wined3d_cs_emit_set_shader_constants(device->cs, WINED3D_SHADER_CONST_PS_B,
+                start_register, count, constants);
     }
 
     return WINED3D_OK;
@@ -2659,6 +2719,14 @@ HRESULT CDECL wined3d_device_set_ps_consts_i(struct wined3d_device *device,
     if (!constants || start_register >= MAX_CONST_I)
         return WINED3DERR_INVALIDCALL;
 
+    if (!device->recording
+            && !memcmp(&device->state.ps_consts_i[start_register * 4], constants, count * sizeof(int) * 4))
+    {
+        TRACE("Application is setting the old values over, nothing to do.\n");
+        device_skip_redundant_state(device);
+        return WINED3D_OK;
+    }
+
     memcpy(&device->update_state->ps_consts_i[start_register * 4], constants, count * sizeof(int) * 4);
     for (i = 0; i < count; ++i)
         TRACE("Set INT constant %u to {%d, %d, %d, %d}.\n", start_register + i,
@@ -2672,7 +2740,8 @@ HRESULT CDECL wined3d_device_set_ps_consts_i(struct wined3d_device *device,
     }
     else
     {
-        device_invalidate_shader_constants(device, WINED3D_SHADER_CONST_PS_I);
+        wined3d_cs_emit_set_shader_constants(device->cs, WINED3D_SHADER_CONST_PS_I,
+                start_register, count, constants);
     }
 
     return WINED3D_OK;
@@ -2710,6 +2779,15 @@ HRESULT CDECL wined3d_device_set_ps_consts_f(struct wined3d_device *device,
             || start_register > d3d_info->limits.ps_uniform_count)
         return WINED3DERR_INVALIDCALL;
 
+    if (!device->recording
+            && !memcmp(&device->state.ps_consts_f[start_register * 4], constants,
+            vector4f_count * sizeof(float) * 4))
+    {
+        TRACE("Application is setting the old values over, nothing to do.\n");
+        device_skip_redundant_state(device);
+        return WINED3D_OK;
+    }
+
     memcpy(&device->update_state->ps_consts_f[start_register * 4],
             constants, vector4f_count * sizeof(float) * 4);
     if (TRACE_ON(d3d))
@@ -2724,7 +2802,8 @@ HRESULT CDECL wined3d_device_set_ps_consts_f(struct wined3d_device *device,
         memset(device->recording->changed.pixelShaderConstantsF + start_register, 1,
                 sizeof(*device->recording->changed.pixelShaderConstantsF) * vector4f_count);
     else
-        device->shader_backend->shader_update_float_pixel_constants(device, start_register, vector4f_count);
+        wined3d_cs_emit_set_shader_constants(device->cs, WINED3D_SHADER_CONST_PS_F,
+                start_register, vector4f_count, constants);
 
     return WINED3D_OK;
 }
@@ -3119,6 +3198,9 @@ HRESULT CDECL wined3d_device_process_vertices(struct wined3d_device *device,
     if (declaration)
         FIXME("Output vertex declaration not implemented yet.\n");
 
+    /* The source buffers may still be updated by the CS. */
+    device->cs->ops->finish(device->cs);
+
     /* Need any context to write to the vbo. */
     context = context_acquire(device, NULL);
     gl_info = context->gl_info;
@@ -3198,6 +3280,7 @@ void CDECL wined3d_device_set_texture_stage_state(struct wined3d_device *device,
     if (old_value == value)
     {
         TRACE("Application is setting the old value over, nothing to do.\n");
+        device_skip_redundant_state(device);
         return;
     }
 
@@ -3251,6 +3334,7 @@ HRESULT CDECL wined3d_device_set_texture(struct wined3d_device *device,
     if (texture == prev)
     {
         TRACE("App is setting the same texture again, nothing to do.\n");
+        device_skip_redundant_state(device);
         return WINED3D_OK;
     }
 
@@ -3369,8 +3453,6 @@ HRESULT CDECL wined3d_device_begin_scene(struct wined3d_device *device)
 
 HRESULT CDECL wined3d_device_end_scene(struct wined3d_device *device)
 {
-    struct wined3d_context *context;
-
     TRACE("device %p.\n", device);
 
     if (!device->inScene)
@@ -3379,12 +3461,8 @@ HRESULT CDECL wined3d_device_end_scene(struct wined3d_device *device)
         return WINED3DERR_INVALIDCALL;
     }
 
-    context = context_acquire(device, NULL);
     /* We only have to do this if we need to read the, swapbuffers performs a flush for us */
-    context->gl_info->gl_ops.gl.p_glFlush();
-    /* No checkGLcall here to avoid locking the lock just for checking a call that hardly ever
-     * fails. */
-    context_release(context);
+    wined3d_cs_emit_flush(device->cs);
 
     device->inScene = FALSE;
     return WINED3D_OK;
@@ -3459,17 +3537,11 @@ struct wined3d_query * CDECL wined3d_device_get_predication(struct wined3d_devic
 void CDECL wined3d_device_set_primitive_type(struct wined3d_device *device,
         enum wined3d_primitive_type primitive_type)
 {
-    GLenum gl_primitive_type, prev;
-
     TRACE("device %p, primitive_type %s\n", device, debug_d3dprimitivetype(primitive_type));
 
-    gl_primitive_type = gl_primitive_type_from_d3d(primitive_type);
-    prev = device->update_state->gl_primitive_type;
-    device->update_state->gl_primitive_type = gl_primitive_type;
+    device->update_state->gl_primitive_type = gl_primitive_type_from_d3d(primitive_type);
     if (device->recording)
         device->recording->changed.primitive_type = TRUE;
-    else if (gl_primitive_type != prev && (gl_primitive_type == GL_POINTS || prev == GL_POINTS))
-        device_invalidate_state(device, STATE_POINT_ENABLE);
 }
 
 void CDECL wined3d_device_get_primitive_type(const struct wined3d_device *device,
@@ -3492,12 +3564,6 @@ HRESULT CDECL wined3d_device_draw_primitive(struct wined3d_device *device, UINT
         return WINED3DERR_INVALIDCALL;
     }
 
-    if (device->state.load_base_vertex_index)
-    {
-        device->state.load_base_vertex_index = 0;
-        device_invalidate_state(device, STATE_BASEVERTEXINDEX);
-    }
-
     wined3d_cs_emit_draw(device->cs, start_vertex, vertex_count, 0, 0, FALSE);
 
     return WINED3D_OK;
@@ -3514,8 +3580,6 @@ void CDECL wined3d_device_draw_primitive_instanced(struct wined3d_device *device
 
 HRESULT CDECL wined3d_device_draw_indexed_primitive(struct wined3d_device *device, UINT start_idx, UINT index_count)
 {
-    const struct wined3d_gl_info *gl_info = &device->adapter->gl_info;
-
     TRACE("device %p, start_idx %u, index_count %u.\n", device, start_idx, index_count);
 
     if (!device->state.index_buffer)
@@ -3534,13 +3598,6 @@ HRESULT CDECL wined3d_device_draw_indexed_primitive(struct wined3d_device *devic
         return WINED3DERR_INVALIDCALL;
     }
 
-    if (!gl_info->supported[ARB_DRAW_ELEMENTS_BASE_VERTEX] &&
-        device->state.load_base_vertex_index != device->state.base_vertex_index)
-    {
-        device->state.load_base_vertex_index = device->state.base_vertex_index;
-        device_invalidate_state(device, STATE_BASEVERTEXINDEX);
-    }
-
     wined3d_cs_emit_draw(device->cs, start_idx, index_count, 0, 0, TRUE);
 
     return WINED3D_OK;
@@ -3662,6 +3719,7 @@ HRESULT CDECL wined3d_device_update_texture(struct wined3d_device *device,
     }
 
     /* Make sure that the destination texture is loaded. */
+    device->cs->ops->finish(device->cs);
     context = context_acquire(device, NULL);
     wined3d_texture_load(dst_texture, context, FALSE);
     context_release(context);
@@ -3875,6 +3933,8 @@ HRESULT CDECL wined3d_device_update_surface(struct wined3d_device *device,
         return WINED3DERR_INVALIDCALL;
     }
 
+    device->cs->ops->finish(device->cs);
+
     return surface_upload_from_surface(dst_surface, dst_point, src_surface, src_rect);
 }
 
@@ -4120,6 +4180,7 @@ void CDECL wined3d_device_update_sub_resource(struct wined3d_device *device, str
     addr.buffer_object = 0;
     addr.addr = data;
 
+    device->cs->ops->finish(device->cs);
     context = context_acquire(resource->device, NULL);
     gl_info = context->gl_info;
 
@@ -4170,6 +4231,8 @@ HRESULT CDECL wined3d_device_clear_rendertarget_view(struct wined3d_device *devi
 
     resource = wined3d_texture_get_sub_resource(wined3d_texture_from_resource(resource), view->sub_resource_idx);
 
+    device->cs->ops->finish(device->cs);
+
     return surface_color_fill(surface_from_resource(resource), rect, color);
 }
 
@@ -4489,6 +4552,8 @@ void CDECL wined3d_device_evict_managed_resources(struct wined3d_device *device)
 
     TRACE("device %p.\n", device);
 
+    device->cs->ops->finish(device->cs);
+
     LIST_FOR_EACH_ENTRY_SAFE(resource, cursor, &device->resources, struct wined3d_resource, resource_list_entry)
     {
         TRACE("Checking resource %p for eviction.\n", resource);
@@ -4614,6 +4679,8 @@ HRESULT CDECL wined3d_device_reset(struct wined3d_device *device,
     TRACE("device %p, swapchain_desc %p, mode %p, callback %p, reset_state %#x.\n",
             device, swapchain_desc, mode, callback, reset_state);
 
+    device->cs->ops->finish(device->cs);
+
     if (!(swapchain = wined3d_device_get_swapchain(device, 0)))
     {
         ERR("Failed to get the first implicit swapchain.\n");
@@ -4975,6 +5042,9 @@ void device_resource_released(struct wined3d_device *device, struct wined3d_reso
 
     TRACE("device %p, resource %p, type %s.\n", device, resource, debug_d3dresourcetype(type));
 
+    /* The CS state is only written by the command stream, make sure it's idle. */
+    device->cs->ops->finish(device->cs);
+
     context_resource_released(device, resource, type);
 
     switch (type)
@@ -4992,6 +5062,8 @@ void device_resource_released(struct wined3d_device *device, struct wined3d_reso
                         ERR("Surface %p is still in use as render target %u.\n", surface, i);
                         device->fb.render_targets[i] = NULL;
                     }
+                    if (wined3d_rendertarget_view_get_surface(device->cs->fb.render_targets[i]) == surface)
+                        device->cs->fb.render_targets[i] = NULL;
                 }
 
                 if (wined3d_rendertarget_view_get_surface(device->fb.depth_stencil) == surface)
@@ -4999,6 +5071,8 @@ void device_resource_released(struct wined3d_device *device, struct wined3d_reso
                     ERR("Surface %p is still in use as depth/stencil buffer.\n", surface);
                     device->fb.depth_stencil = NULL;
                 }
+                if (wined3d_rendertarget_view_get_surface(device->cs->fb.depth_stencil) == surface)
+                    device->cs->fb.depth_stencil = NULL;
             }
             break;
 
@@ -5013,6 +5087,8 @@ void device_resource_released(struct wined3d_device *device, struct wined3d_reso
                     ERR("Texture %p is still in use, stage %u.\n", texture, i);
                     device->state.textures[i] = NULL;
                 }
+                if (device->cs->state.textures[i] == texture)
+                    device->cs->state.textures[i] = NULL;
 
                 if (device->recording && device->update_state->textures[i] == texture)
                 {
@@ -5034,6 +5110,8 @@ void device_resource_released(struct wined3d_device *device, struct wined3d_reso
                         ERR("Buffer %p is still in use, stream %u.\n", buffer, i);
                         device->state.streams[i].buffer = NULL;
                     }
+                    if (device->cs->state.streams[i].buffer == buffer)
+                        device->cs->state.streams[i].buffer = NULL;
 
                     if (device->recording && device->update_state->streams[i].buffer == buffer)
                     {
@@ -5048,6 +5126,8 @@ void device_resource_released(struct wined3d_device *device, struct wined3d_reso
                     ERR("Buffer %p is still in use as index buffer.\n", buffer);
                     device->state.index_buffer =  NULL;
                 }
+                if (device->cs->state.index_buffer == buffer)
+                    device->cs->state.index_buffer = NULL;
 
                 if (device->recording && device->update_state->index_buffer == buffer)
                 {
@@ -5191,21 +5271,14 @@ err:
 void device_invalidate_state(const struct wined3d_device *device, DWORD state)
 {
     DWORD rep = device->StateTable[state].representative;
-    struct wined3d_context *context;
-    DWORD idx;
-    BYTE shift;
     UINT i;
 
+    wined3d_cs_lock(device->cs);
     for (i = 0; i < device->context_count; ++i)
     {
-        context = device->contexts[i];
-        if(isStateDirty(context, rep)) continue;
-
-        context->dirtyArray[context->numDirtyEntries++] = rep;
-        idx = rep / (sizeof(*context->isStateDirty) * CHAR_BIT);
-        shift = rep & ((sizeof(*context->isStateDirty) * CHAR_BIT) - 1);
-        context->isStateDirty[idx] |= (1u << shift);
+        context_mark_state_dirty(device->contexts[i], rep);
     }
+    wined3d_cs_unlock(device->cs);
 }
 
 LRESULT device_process_message(struct wined3d_device *device, HWND window, BOOL unicode,
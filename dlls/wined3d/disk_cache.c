@@ -0,0 +1,419 @@
+/*
+ * Copyright 2026 agent
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+#include "config.h"
+#include "wine/port.h"
+
+#include <stdio.h>
+
+#include "wined3d_private.h"
+
+WINE_DEFAULT_DEBUG_CHANNEL(d3d);
+
+#define WINED3D_DISK_CACHE_MAGIC    0x43443357 /* "W3DC" */
+#define WINED3D_DISK_CACHE_VERSION  2
+/* Number of entries wined3d_disk_cache_trim() collects per directory scan. */
+#define WINED3D_DISK_CACHE_EVICT_BATCH  32
+
+/* Every cache entry is a single file consisting of this header, "key_size"
+ * bytes of key data and "size" bytes of payload. The file name only contains
+ * a hash of the key data, so the full key data is stored as well and
+ * compared on load; two keys with the same hash are never confused. */
+struct wined3d_disk_cache_header
+{
+    DWORD magic;
+    DWORD version;
+    UINT64 hash;
+    UINT64 checksum;
+    DWORD size;
+    DWORD key_size;
+};
+
+static CRITICAL_SECTION wined3d_disk_cache_cs;
+static CRITICAL_SECTION_DEBUG wined3d_disk_cache_cs_debug =
+{
+    0, 0, &wined3d_disk_cache_cs,
+    {&wined3d_disk_cache_cs_debug.ProcessLocksList,
+    &wined3d_disk_cache_cs_debug.ProcessLocksList},
+    0, 0, {(DWORD_PTR)(__FILE__ ": wined3d_disk_cache_cs")}
+};
+static CRITICAL_SECTION wined3d_disk_cache_cs = {&wined3d_disk_cache_cs_debug, -1, 0, 0, 0, 0};
+
+static BOOL wined3d_disk_cache_initialized;
+static BOOL wined3d_disk_cache_available;
+/* Approximate size of the cache directory. Only used to decide when to trim
+ * the cache, so it doesn't matter if other processes write to it as well. */
+static UINT64 wined3d_disk_cache_size;
+
+/* 64-bit FNV-1a. */
+UINT64 wined3d_hash(UINT64 hash, const void *data, size_t size)
+{
+    const BYTE *ptr = data;
+
+    while (size--)
+    {
+        hash ^= *ptr++;
+        hash *= 0x100000001b3ull;
+    }
+
+    return hash;
+}
+
+static UINT64 wined3d_disk_cache_get_limit(void)
+{
+    return (UINT64)wined3d_settings.shader_cache_size * 1024 * 1024;
+}
+
+/* Returns FALSE if the path doesn't fit, the entry is skipped in that case. */
+static BOOL wined3d_disk_cache_get_path(char *path, size_t size, const char *name, UINT64 hash)
+{
+    if (snprintf(path, size, "%s\\%s-%08x%08x.bin", wined3d_settings.shader_cache_path,
+            name, (DWORD)(hash >> 32), (DWORD)hash) >= size)
+    {
+        WARN("Cache path for %s is too long.\n", debugstr_a(name));
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL wined3d_disk_cache_key_add(struct wined3d_disk_cache_key *key, const void *data, size_t size)
+{
+    size_t new_size;
+    BYTE *new_data;
+
+    if (!key->data)
+        return FALSE;
+
+    if (key->size + size > key->capacity)
+    {
+        new_size = max(key->capacity * 2, key->size + size);
+        if (!(new_data = HeapReAlloc(GetProcessHeap(), 0, key->data, new_size)))
+        {
+            HeapFree(GetProcessHeap(), 0, key->data);
+            key->data = NULL;
+            return FALSE;
+        }
+        key->data = new_data;
+        key->capacity = new_size;
+    }
+
+    memcpy(key->data + key->size, data, size);
+    key->size += size;
+
+    return TRUE;
+}
+
+/* Strings are added including their terminator, so that e.g. "ab" + "c"
+ * and "a" + "bc" give different keys. */
+BOOL wined3d_disk_cache_key_add_string(struct wined3d_disk_cache_key *key, const char *str)
+{
+    return wined3d_disk_cache_key_add(key, str ? str : "", str ? strlen(str) + 1 : 1);
+}
+
+BOOL wined3d_disk_cache_key_init(struct wined3d_disk_cache_key *key, const struct wined3d_disk_cache_key *prefix)
+{
+    key->size = 0;
+    key->capacity = prefix ? max(prefix->size, 256) : 256;
+    if (!(key->data = HeapAlloc(GetProcessHeap(), 0, key->capacity)))
+        return FALSE;
+
+    return !prefix || wined3d_disk_cache_key_add(key, prefix->data, prefix->size);
+}
+
+void wined3d_disk_cache_key_cleanup(struct wined3d_disk_cache_key *key)
+{
+    HeapFree(GetProcessHeap(), 0, key->data);
+    key->data = NULL;
+    key->size = key->capacity = 0;
+}
+
+static UINT64 wined3d_disk_cache_scan(void)
+{
+    char pattern[MAX_PATH];
+    WIN32_FIND_DATAA data;
+    UINT64 total = 0;
+    HANDLE find;
+
+    if (snprintf(pattern, sizeof(pattern), "%s\\*.bin", wined3d_settings.shader_cache_path) >= sizeof(pattern)
+            || (find = FindFirstFileA(pattern, &data)) == INVALID_HANDLE_VALUE)
+        return 0;
+
+    do
+    {
+        total += ((UINT64)data.nFileSizeHigh << 32) | data.nFileSizeLow;
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+
+    return total;
+}
+
+/* Delete the least recently used entries until the cache is comfortably
+ * below its size limit again. Entries are "used" when they're written or
+ * successfully loaded, see wined3d_disk_cache_load(). Each directory scan
+ * collects the WINED3D_DISK_CACHE_EVICT_BATCH oldest entries, so that
+ * evicting many small entries doesn't rescan the directory for each one. */
+static void wined3d_disk_cache_trim(UINT64 target)
+{
+    WIN32_FIND_DATAA data, oldest[WINED3D_DISK_CACHE_EVICT_BATCH];
+    char pattern[MAX_PATH], path[MAX_PATH];
+    unsigned int count, i;
+    BOOL evicted;
+    HANDLE find;
+
+    if (snprintf(pattern, sizeof(pattern), "%s\\*.bin", wined3d_settings.shader_cache_path) >= sizeof(pattern))
+        return;
+
+    while (wined3d_disk_cache_size > target)
+    {
+        if ((find = FindFirstFileA(pattern, &data)) == INVALID_HANDLE_VALUE)
+        {
+            wined3d_disk_cache_size = 0;
+            return;
+        }
+
+        /* Keep "oldest" sorted by modification time. */
+        count = 0;
+        do
+        {
+            if (count == ARRAY_SIZE(oldest)
+                    && CompareFileTime(&data.ftLastWriteTime, &oldest[count - 1].ftLastWriteTime) >= 0)
+                continue;
+
+            if (count < ARRAY_SIZE(oldest))
+                ++count;
+            for (i = count - 1; i && CompareFileTime(&data.ftLastWriteTime, &oldest[i - 1].ftLastWriteTime) < 0; --i)
+                oldest[i] = oldest[i - 1];
+            oldest[i] = data;
+        } while (FindNextFileA(find, &data));
+        FindClose(find);
+
+        evicted = FALSE;
+        for (i = 0; i < count && wined3d_disk_cache_size > target; ++i)
+        {
+            if (snprintf(path, sizeof(path), "%s\\%s", wined3d_settings.shader_cache_path,
+                    oldest[i].cFileName) >= sizeof(path))
+                continue;
+
+            TRACE("Evicting cache entry %s.\n", debugstr_a(path));
+            if (!DeleteFileA(path))
+            {
+                WARN("Failed to delete %s, error %u.\n", debugstr_a(path), GetLastError());
+                continue;
+            }
+            wined3d_disk_cache_size -= min(wined3d_disk_cache_size,
+                    ((UINT64)oldest[i].nFileSizeHigh << 32) | oldest[i].nFileSizeLow);
+            evicted = TRUE;
+        }
+
+        /* Nothing we can delete, resynchronise with the directory instead
+         * of scanning it again and again. */
+        if (!evicted)
+        {
+            wined3d_disk_cache_size = wined3d_disk_cache_scan();
+            return;
+        }
+    }
+}
+
+/* Called with wined3d_disk_cache_cs held. */
+static BOOL wined3d_disk_cache_init(void)
+{
+    if (wined3d_disk_cache_initialized)
+        return wined3d_disk_cache_available;
+    wined3d_disk_cache_initialized = TRUE;
+
+    if (!wined3d_settings.shader_cache_path || !wined3d_settings.shader_cache_size)
+        return FALSE;
+
+    if (!CreateDirectoryA(wined3d_settings.shader_cache_path, NULL)
+            && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        WARN("Failed to create cache directory %s, error %u.\n",
+                debugstr_a(wined3d_settings.shader_cache_path), GetLastError());
+        return FALSE;
+    }
+
+    wined3d_disk_cache_size = wined3d_disk_cache_scan();
+    TRACE("Using cache directory %s, %s bytes in use.\n", debugstr_a(wined3d_settings.shader_cache_path),
+            wine_dbgstr_longlong(wined3d_disk_cache_size));
+
+    return wined3d_disk_cache_available = TRUE;
+}
+
+BOOL wined3d_disk_cache_enabled(void)
+{
+    BOOL ret;
+
+    if (!wined3d_settings.shader_cache_path)
+        return FALSE;
+
+    EnterCriticalSection(&wined3d_disk_cache_cs);
+    ret = wined3d_disk_cache_init();
+    LeaveCriticalSection(&wined3d_disk_cache_cs);
+
+    return ret;
+}
+
+/* Returns a HeapAlloc()'ed copy of the payload stored for "name" and "key",
+ * or NULL if there is no such entry or the entry is damaged. */
+void *wined3d_disk_cache_load(const char *name, const struct wined3d_disk_cache_key *key, DWORD *size)
+{
+    struct wined3d_disk_cache_header header;
+    char path[MAX_PATH];
+    BYTE *key_data;
+    FILETIME now;
+    UINT64 hash;
+    void *data;
+    HANDLE file;
+    DWORD read;
+    BOOL match;
+
+    if (!key->data || !wined3d_disk_cache_enabled())
+        return NULL;
+
+    hash = wined3d_hash(WINED3D_HASH_INIT, key->data, key->size);
+    if (!wined3d_disk_cache_get_path(path, sizeof(path), name, hash))
+        return NULL;
+    if ((file = CreateFileA(path, GENERIC_READ | FILE_WRITE_ATTRIBUTES, FILE_SHARE_READ | FILE_SHARE_DELETE,
+            NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL)) == INVALID_HANDLE_VALUE)
+        return NULL;
+
+    if (!ReadFile(file, &header, sizeof(header), &read, NULL) || read != sizeof(header)
+            || header.magic != WINED3D_DISK_CACHE_MAGIC || header.version != WINED3D_DISK_CACHE_VERSION
+            || header.hash != hash || header.size > wined3d_disk_cache_get_limit()
+            || header.key_size > wined3d_disk_cache_get_limit()
+            || GetFileSize(file, NULL) != sizeof(header) + header.key_size + header.size)
+    {
+        WARN("Ignoring invalid cache entry %s.\n", debugstr_a(path));
+        CloseHandle(file);
+        DeleteFileA(path);
+        return NULL;
+    }
+
+    /* A different key with the same hash. Leave the entry alone, storing
+     * ours will replace it. */
+    if (header.key_size != key->size)
+    {
+        TRACE("Key size mismatch for %s.\n", debugstr_a(path));
+        CloseHandle(file);
+        return NULL;
+    }
+
+    if (!(key_data = HeapAlloc(GetProcessHeap(), 0, key->size)))
+    {
+        CloseHandle(file);
+        return NULL;
+    }
+    match = ReadFile(file, key_data, key->size, &read, NULL) && read == key->size
+            && !memcmp(key_data, key->data, key->size);
+    HeapFree(GetProcessHeap(), 0, key_data);
+    if (!match)
+    {
+        TRACE("Key mismatch for %s.\n", debugstr_a(path));
+        CloseHandle(file);
+        return NULL;
+    }
+
+    if (!(data = HeapAlloc(GetProcessHeap(), 0, header.size)))
+    {
+        CloseHandle(file);
+        return NULL;
+    }
+
+    if (!ReadFile(file, data, header.size, &read, NULL) || read != header.size
+            || wined3d_hash(WINED3D_HASH_INIT, data, header.size) != header.checksum)
+    {
+        WARN("Ignoring corrupted cache entry %s.\n", debugstr_a(path));
+        HeapFree(GetProcessHeap(), 0, data);
+        CloseHandle(file);
+        DeleteFileA(path);
+        return NULL;
+    }
+
+    /* Bump the modification time so that trimming evicts the least recently
+     * used entries first. */
+    GetSystemTimeAsFileTime(&now);
+    SetFileTime(file, NULL, NULL, &now);
+    CloseHandle(file);
+
+    TRACE("Loaded %u bytes from %s.\n", header.size, debugstr_a(path));
+    *size = header.size;
+    return data;
+}
+
+void wined3d_disk_cache_store(const char *name, const struct wined3d_disk_cache_key *key,
+        const void *data, DWORD size)
+{
+    struct wined3d_disk_cache_header header;
+    char path[MAX_PATH], tmp_path[MAX_PATH];
+    UINT64 limit = wined3d_disk_cache_get_limit();
+    DWORD written;
+    HANDLE file;
+    BOOL ret;
+
+    if (!key->data || !wined3d_disk_cache_enabled())
+        return;
+
+    /* Don't let a single entry push everything else out of the cache. */
+    if (sizeof(header) + key->size + size > limit / 4)
+    {
+        TRACE("Not caching %u bytes for %s.\n", size, debugstr_a(name));
+        return;
+    }
+
+    header.magic = WINED3D_DISK_CACHE_MAGIC;
+    header.version = WINED3D_DISK_CACHE_VERSION;
+    header.hash = wined3d_hash(WINED3D_HASH_INIT, key->data, key->size);
+    header.checksum = wined3d_hash(WINED3D_HASH_INIT, data, size);
+    header.size = size;
+    header.key_size = key->size;
+
+    /* Write to a private file first and rename it into place afterwards, so
+     * that other processes never see partially written entries. */
+    if (!wined3d_disk_cache_get_path(path, sizeof(path), name, header.hash)
+            || snprintf(tmp_path, sizeof(tmp_path), "%s.%x-%x.tmp", path,
+            GetCurrentProcessId(), GetCurrentThreadId()) >= sizeof(tmp_path))
+        return;
+    if ((file = CreateFileA(tmp_path, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+            FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+    {
+        WARN("Failed to create %s, error %u.\n", debugstr_a(tmp_path), GetLastError());
+        return;
+    }
+
+    ret = WriteFile(file, &header, sizeof(header), &written, NULL) && written == sizeof(header)
+            && WriteFile(file, key->data, key->size, &written, NULL) && written == key->size
+            && WriteFile(file, data, size, &written, NULL) && written == size;
+    CloseHandle(file);
+
+    if (!ret || !MoveFileExA(tmp_path, path, MOVEFILE_REPLACE_EXISTING))
+    {
+        WARN("Failed to write cache entry %s, error %u.\n", debugstr_a(path), GetLastError());
+        DeleteFileA(tmp_path);
+        return;
+    }
+
+    TRACE("Stored %u bytes to %s.\n", size, debugstr_a(path));
+
+    EnterCriticalSection(&wined3d_disk_cache_cs);
+    wined3d_disk_cache_size += sizeof(header) + key->size + size;
+    if (wined3d_disk_cache_size > limit)
+        wined3d_disk_cache_trim(limit - limit / 4);
+    LeaveCriticalSection(&wined3d_disk_cache_cs);
+}
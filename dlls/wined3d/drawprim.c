@@ -103,7 +103,7 @@ static void drawStridedSlow(const struct wined3d_device *device, struct wined3d_
     const WORD                *pIdxBufS     = NULL;
     const DWORD               *pIdxBufL     = NULL;
     UINT vx_index;
-    const struct wined3d_state *state = &device->state;
+    const struct wined3d_state *state = &device->cs->state;
     LONG SkipnStrides = startIdx;
     BOOL pixelShader = use_ps(state);
     BOOL specular_fog = FALSE;
@@ -509,6 +509,460 @@ static void drawStridedSlowVs(struct wined3d_context *context, const struct wine
     gl_info->gl_ops.gl.p_glEnd();
 }
 
+/* Converts a vertex attribute to four floats, with the same result as the
+ * glVertexAttrib*() call send_attribute() uses for it, except for
+ * R16G16_SNORM and R16G16_UNORM. send_attribute() passes w = 1 as a
+ * normalised integer for those, i.e. 1/32767 or 1/65535, while this returns
+ * the w = 1.0 that D3D specifies for missing components. */
+static BOOL convert_attribute(const struct wined3d_gl_info *gl_info,
+        enum wined3d_format_id format, const void *ptr, float *dst)
+{
+    const unsigned short *h = ptr;
+    const GLushort *us = ptr;
+    const GLshort *s = ptr;
+    const GLubyte *b = ptr;
+    const float *f = ptr;
+
+    dst[0] = dst[1] = dst[2] = 0.0f;
+    dst[3] = 1.0f;
+
+    switch (format)
+    {
+        case WINED3DFMT_R32G32B32A32_FLOAT:
+            dst[3] = f[3];
+            /* fall through */
+        case WINED3DFMT_R32G32B32_FLOAT:
+            dst[2] = f[2];
+            /* fall through */
+        case WINED3DFMT_R32G32_FLOAT:
+            dst[1] = f[1];
+            /* fall through */
+        case WINED3DFMT_R32_FLOAT:
+            dst[0] = f[0];
+            return TRUE;
+
+        case WINED3DFMT_R8G8B8A8_UINT:
+            dst[0] = b[0];
+            dst[1] = b[1];
+            dst[2] = b[2];
+            dst[3] = b[3];
+            return TRUE;
+        case WINED3DFMT_B8G8R8A8_UNORM:
+            if (gl_info->supported[ARB_VERTEX_ARRAY_BGRA])
+            {
+                dst[0] = b[2] / 255.0f;
+                dst[1] = b[1] / 255.0f;
+                dst[2] = b[0] / 255.0f;
+                dst[3] = b[3] / 255.0f;
+                return TRUE;
+            }
+            /* fall through */
+        case WINED3DFMT_R8G8B8A8_UNORM:
+            dst[0] = b[0] / 255.0f;
+            dst[1] = b[1] / 255.0f;
+            dst[2] = b[2] / 255.0f;
+            dst[3] = b[3] / 255.0f;
+            return TRUE;
+
+        case WINED3DFMT_R16G16B16A16_SINT:
+            dst[2] = s[2];
+            dst[3] = s[3];
+            /* fall through */
+        case WINED3DFMT_R16G16_SINT:
+            dst[0] = s[0];
+            dst[1] = s[1];
+            return TRUE;
+
+        case WINED3DFMT_R16G16B16A16_SNORM:
+            dst[2] = max(s[2] / 32767.0f, -1.0f);
+            dst[3] = max(s[3] / 32767.0f, -1.0f);
+            /* fall through */
+        case WINED3DFMT_R16G16_SNORM:
+            dst[0] = max(s[0] / 32767.0f, -1.0f);
+            dst[1] = max(s[1] / 32767.0f, -1.0f);
+            return TRUE;
+
+        case WINED3DFMT_R16G16B16A16_UNORM:
+            dst[2] = us[2] / 65535.0f;
+            dst[3] = us[3] / 65535.0f;
+            /* fall through */
+        case WINED3DFMT_R16G16_UNORM:
+            dst[0] = us[0] / 65535.0f;
+            dst[1] = us[1] / 65535.0f;
+            return TRUE;
+
+        case WINED3DFMT_R16G16B16A16_FLOAT:
+            dst[2] = float_16_to_32(&h[2]);
+            dst[3] = float_16_to_32(&h[3]);
+            /* fall through */
+        case WINED3DFMT_R16G16_FLOAT:
+            dst[0] = float_16_to_32(&h[0]);
+            dst[1] = float_16_to_32(&h[1]);
+            return TRUE;
+
+        default:
+            return FALSE;
+    }
+}
+
+/* Returns memory for size bytes of converted vertex data, to be uploaded with
+ * upload_transient_data(). */
+static float *get_transient_data(struct wined3d_context *context, SIZE_T size)
+{
+    if (size > context->transient_data_size)
+    {
+        BYTE *data;
+
+        if (context->transient_data)
+            data = HeapReAlloc(GetProcessHeap(), 0, context->transient_data, size);
+        else
+            data = HeapAlloc(GetProcessHeap(), 0, size);
+        if (!data)
+            return NULL;
+
+        context->transient_data = data;
+        context->transient_data_size = size;
+    }
+
+    return (float *)context->transient_data;
+}
+
+/* Uploads the converted vertex data into the transient buffer object and
+ * binds it to GL_ARRAY_BUFFER.
+ *
+ * Context activation is done by the caller. */
+static void upload_transient_data(struct wined3d_context *context, SIZE_T size)
+{
+    const struct wined3d_gl_info *gl_info = context->gl_info;
+
+    if (!context->transient_vbo)
+    {
+        GL_EXTCALL(glGenBuffers(1, &context->transient_vbo));
+        checkGLcall("glGenBuffers");
+    }
+    GL_EXTCALL(glBindBuffer(GL_ARRAY_BUFFER, context->transient_vbo));
+    GL_EXTCALL(glBufferData(GL_ARRAY_BUFFER, size, context->transient_data, GL_STREAM_DRAW));
+    checkGLcall("glBufferData");
+}
+
+/* Like drawStridedSlowVs(), but converts the vertices into a buffer object
+ * and draws them with a single call. See convert_attribute() for where the
+ * results differ. Returns FALSE if the draw needs to go through
+ * drawStridedSlowVs() instead.
+ *
+ * Context activation is done by the caller. */
+static BOOL drawStridedTransient(struct wined3d_context *context, const struct wined3d_state *state,
+        const struct wined3d_stream_info *si, UINT vertex_count, GLenum primitive_type,
+        const void *idx_data, UINT idx_size, UINT start_idx)
+{
+    const struct wined3d_gl_info *gl_info = context->gl_info;
+    const BYTE *attrib_data[MAX_ATTRIBS];
+    unsigned int attribs[MAX_ATTRIBS];
+    unsigned int attrib_count = 0;
+    SIZE_T vertex_size, size;
+    unsigned int i, j;
+    float *dst;
+    LONG idx;
+
+    if (!gl_info->supported[ARB_VERTEX_BUFFER_OBJECT])
+        return FALSE;
+
+    if (idx_size && !idx_data)
+        idx_data = buffer_get_sysmem(state->index_buffer, context);
+
+    for (i = 0; i < MAX_ATTRIBS; ++i)
+    {
+        const struct wined3d_stream_info_element *element = &si->elements[i];
+
+        if (!(si->use_map & (1u << i)))
+            continue;
+
+        if (element->data.buffer_object)
+            attrib_data[attrib_count] = buffer_get_sysmem_addr(
+                    state->streams[element->stream_idx].buffer, context, element->data.addr);
+        else
+            attrib_data[attrib_count] = element->data.addr;
+        attribs[attrib_count++] = i;
+    }
+    if (!attrib_count)
+        return FALSE;
+
+    vertex_size = attrib_count * 4 * sizeof(float);
+    size = vertex_count * vertex_size;
+    if (!(dst = get_transient_data(context, size)))
+        return FALSE;
+
+    for (i = 0; i < vertex_count; ++i)
+    {
+        if (idx_size == 2)
+            idx = ((const WORD *)idx_data)[start_idx + i];
+        else if (idx_size)
+            idx = ((const DWORD *)idx_data)[start_idx + i];
+        else
+            idx = start_idx + i;
+        idx += state->load_base_vertex_index;
+
+        for (j = 0; j < attrib_count; ++j, dst += 4)
+        {
+            const struct wined3d_stream_info_element *element = &si->elements[attribs[j]];
+
+            if (!convert_attribute(gl_info, element->format->id, attrib_data[j] + idx * element->stride, dst))
+            {
+                TRACE_(d3d_perf)("Can't convert attribute format %s.\n", debug_d3dformat(element->format->id));
+                return FALSE;
+            }
+        }
+    }
+
+    upload_transient_data(context, size);
+
+    for (j = 0; j < attrib_count; ++j)
+    {
+        i = attribs[j];
+
+        GL_EXTCALL(glVertexAttribPointer(i, 4, GL_FLOAT, GL_FALSE, vertex_size,
+                (const BYTE *)NULL + j * 4 * sizeof(float)));
+        if (gl_info->supported[ARB_INSTANCED_ARRAYS])
+            GL_EXTCALL(glVertexAttribDivisor(i, 0));
+        if (!(context->numbered_array_mask & (1u << i)))
+        {
+            GL_EXTCALL(glEnableVertexAttribArray(i));
+            context->numbered_array_mask |= 1u << i;
+        }
+    }
+    context->numberedArraysLoaded = TRUE;
+    GL_EXTCALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    checkGLcall("load transient vertex arrays");
+
+    gl_info->gl_ops.gl.p_glDrawArrays(primitive_type, 0, vertex_count);
+    checkGLcall("glDrawArrays");
+
+    /* The attribute pointers now point into the transient buffer. */
+    context_invalidate_state(context, STATE_STREAMSRC);
+
+    return TRUE;
+}
+
+/* Converts a fixed function vertex attribute to four floats, with the same
+ * result as the immediate mode call drawStridedSlow() uses for it. Returns
+ * FALSE for formats drawStridedSlow() has no entry point for. */
+static BOOL convert_ffp_attribute(const struct wined3d_context *context,
+        unsigned int idx, enum wined3d_format_id format, const void *ptr, float *dst)
+{
+    const float *f = ptr;
+    DWORD c;
+
+    switch (idx)
+    {
+        case WINED3D_FFP_POSITION:
+            /* See position_float4(). */
+            if (format == WINED3DFMT_R32G32B32A32_FLOAT && !context->d3d_info->xyzrhw)
+            {
+                if (f[3] != 0.0f && f[3] != 1.0f)
+                {
+                    dst[3] = 1.0f / f[3];
+                    dst[0] = f[0] * dst[3];
+                    dst[1] = f[1] * dst[3];
+                    dst[2] = f[2] * dst[3];
+                }
+                else
+                {
+                    dst[0] = f[0];
+                    dst[1] = f[1];
+                    dst[2] = f[2];
+                    dst[3] = 1.0f;
+                }
+                return TRUE;
+            }
+            /* fall through */
+        case WINED3D_FFP_NORMAL:
+            if (format != WINED3DFMT_R32G32B32_FLOAT && format != WINED3DFMT_R32G32B32A32_FLOAT)
+                return FALSE;
+            break;
+
+        case WINED3D_FFP_DIFFUSE:
+        case WINED3D_FFP_SPECULAR:
+            if (format == WINED3DFMT_B8G8R8A8_UNORM)
+            {
+                c = *(const DWORD *)ptr;
+                dst[0] = D3DCOLOR_B_R(c) / 255.0f;
+                dst[1] = D3DCOLOR_B_G(c) / 255.0f;
+                dst[2] = D3DCOLOR_B_B(c) / 255.0f;
+                dst[3] = D3DCOLOR_B_A(c) / 255.0f;
+                return TRUE;
+            }
+            if (idx == WINED3D_FFP_SPECULAR && format != WINED3DFMT_R32G32B32_FLOAT)
+                return FALSE;
+            if (format != WINED3DFMT_R32G32B32_FLOAT && format != WINED3DFMT_R32G32B32A32_FLOAT
+                    && format != WINED3DFMT_R8G8B8A8_UNORM && format != WINED3DFMT_R16G16B16A16_SNORM
+                    && format != WINED3DFMT_R16G16B16A16_UNORM)
+                return FALSE;
+            break;
+
+        default:
+            break;
+    }
+
+    return convert_attribute(context->gl_info, format, ptr, dst);
+}
+
+/* Like drawStridedSlow(), but converts the vertices into a buffer object and
+ * draws them with a single call through the fixed function vertex arrays.
+ * This doesn't handle the emulation of untracked material properties and
+ * fog coordinates, which needs per-vertex glMaterial() and glFogCoord()
+ * calls. Returns FALSE if the draw needs to go through drawStridedSlow()
+ * instead.
+ *
+ * Context activation is done by the caller. */
+static BOOL drawStridedTransientFfp(struct wined3d_context *context, const struct wined3d_state *state,
+        const struct wined3d_stream_info *si, UINT vertex_count, GLenum primitive_type,
+        const void *idx_data, UINT idx_size, UINT start_idx)
+{
+    const struct wined3d_gl_info *gl_info = context->gl_info;
+    unsigned int slots[WINED3D_FFP_ATTRIBS_COUNT];
+    const BYTE *attrib_data[WINED3D_FFP_ATTRIBS_COUNT];
+    unsigned int attribs[WINED3D_FFP_ATTRIBS_COUNT];
+    unsigned int attrib_count = 0;
+    unsigned int i, j, texture_idx;
+    SIZE_T vertex_size, size;
+    const BYTE *offset;
+    int coord_idx;
+    float *dst;
+    LONG idx;
+
+    if (!gl_info->supported[ARB_VERTEX_BUFFER_OBJECT] || !gl_info->supported[ARB_MULTITEXTURE]
+            || !(si->use_map & (1u << WINED3D_FFP_POSITION)))
+        return FALSE;
+
+    if (idx_size && !idx_data)
+        idx_data = buffer_get_sysmem(state->index_buffer, context);
+
+    for (i = 0; i < WINED3D_FFP_ATTRIBS_COUNT; ++i)
+    {
+        const struct wined3d_stream_info_element *element = &si->elements[i];
+
+        /* Blend weights and point sizes aren't supported by drawStridedSlow() either. */
+        if (!(si->use_map & (1u << i)) || i == WINED3D_FFP_BLENDWEIGHT
+                || i == WINED3D_FFP_BLENDINDICES || i == WINED3D_FFP_PSIZE
+                || (i == WINED3D_FFP_SPECULAR && !gl_info->supported[EXT_SECONDARY_COLOR]))
+            continue;
+
+        if (element->data.buffer_object)
+            attrib_data[attrib_count] = buffer_get_sysmem_addr(
+                    state->streams[element->stream_idx].buffer, context, element->data.addr);
+        else
+            attrib_data[attrib_count] = element->data.addr;
+        slots[i] = attrib_count;
+        attribs[attrib_count++] = i;
+    }
+
+    vertex_size = attrib_count * 4 * sizeof(float);
+    size = vertex_count * vertex_size;
+    if (!(dst = get_transient_data(context, size)))
+        return FALSE;
+
+    for (i = 0; i < vertex_count; ++i)
+    {
+        if (idx_size == 2)
+            idx = ((const WORD *)idx_data)[start_idx + i];
+        else if (idx_size)
+            idx = ((const DWORD *)idx_data)[start_idx + i];
+        else
+            idx = start_idx + i;
+        idx += state->load_base_vertex_index;
+
+        for (j = 0; j < attrib_count; ++j, dst += 4)
+        {
+            const struct wined3d_stream_info_element *element = &si->elements[attribs[j]];
+
+            if (!convert_ffp_attribute(context, attribs[j], element->format->id,
+                    attrib_data[j] + idx * element->stride, dst))
+            {
+                TRACE_(d3d_perf)("Can't convert attribute %u format %s.\n",
+                        attribs[j], debug_d3dformat(element->format->id));
+                return FALSE;
+            }
+        }
+    }
+
+    upload_transient_data(context, size);
+
+    offset = (const BYTE *)NULL + slots[WINED3D_FFP_POSITION] * 4 * sizeof(float);
+    gl_info->gl_ops.gl.p_glVertexPointer(4, GL_FLOAT, vertex_size, offset);
+    gl_info->gl_ops.gl.p_glEnableClientState(GL_VERTEX_ARRAY);
+
+    if (si->use_map & (1u << WINED3D_FFP_NORMAL))
+    {
+        offset = (const BYTE *)NULL + slots[WINED3D_FFP_NORMAL] * 4 * sizeof(float);
+        gl_info->gl_ops.gl.p_glNormalPointer(GL_FLOAT, vertex_size, offset);
+        gl_info->gl_ops.gl.p_glEnableClientState(GL_NORMAL_ARRAY);
+    }
+    else
+    {
+        gl_info->gl_ops.gl.p_glNormal3f(0, 0, 0);
+    }
+
+    if (si->use_map & (1u << WINED3D_FFP_DIFFUSE))
+    {
+        offset = (const BYTE *)NULL + slots[WINED3D_FFP_DIFFUSE] * 4 * sizeof(float);
+        gl_info->gl_ops.gl.p_glColorPointer(4, GL_FLOAT, vertex_size, offset);
+        gl_info->gl_ops.gl.p_glEnableClientState(GL_COLOR_ARRAY);
+    }
+    else
+    {
+        gl_info->gl_ops.gl.p_glColor4f(1.0f, 1.0f, 1.0f, 1.0f);
+    }
+
+    if (gl_info->supported[EXT_SECONDARY_COLOR])
+    {
+        if (si->use_map & (1u << WINED3D_FFP_SPECULAR))
+        {
+            offset = (const BYTE *)NULL + slots[WINED3D_FFP_SPECULAR] * 4 * sizeof(float);
+            GL_EXTCALL(glSecondaryColorPointerEXT(3, GL_FLOAT, vertex_size, offset));
+            gl_info->gl_ops.gl.p_glEnableClientState(GL_SECONDARY_COLOR_ARRAY_EXT);
+        }
+        else
+        {
+            GL_EXTCALL(glSecondaryColor3fEXT(0, 0, 0));
+        }
+    }
+
+    for (i = 0; i < context->d3d_info->limits.ffp_blend_stages; ++i)
+    {
+        coord_idx = state->texture_states[i][WINED3D_TSS_TEXCOORD_INDEX];
+        texture_idx = context->tex_unit_map[i];
+
+        if (!use_ps(state) && !state->textures[i])
+            continue;
+        if (texture_idx == WINED3D_UNMAPPED_STAGE || texture_idx >= gl_info->limits.texture_coords
+                || coord_idx < 0 || coord_idx > 7)
+            continue;
+
+        if (si->use_map & (1u << (WINED3D_FFP_TEXCOORD0 + coord_idx)))
+        {
+            offset = (const BYTE *)NULL + slots[WINED3D_FFP_TEXCOORD0 + coord_idx] * 4 * sizeof(float);
+            GL_EXTCALL(glClientActiveTextureARB(GL_TEXTURE0_ARB + texture_idx));
+            gl_info->gl_ops.gl.p_glTexCoordPointer(4, GL_FLOAT, vertex_size, offset);
+            gl_info->gl_ops.gl.p_glEnableClientState(GL_TEXTURE_COORD_ARRAY);
+        }
+        else
+        {
+            GL_EXTCALL(glMultiTexCoord4fARB(GL_TEXTURE0_ARB + texture_idx, 0, 0, 0, 1));
+        }
+    }
+    context->namedArraysLoaded = TRUE;
+    GL_EXTCALL(glBindBuffer(GL_ARRAY_BUFFER, 0));
+    checkGLcall("load transient vertex arrays");
+
+    gl_info->gl_ops.gl.p_glDrawArrays(primitive_type, 0, vertex_count);
+    checkGLcall("glDrawArrays");
+
+    /* The vertex arrays now point into the transient buffer. */
+    context_invalidate_state(context, STATE_STREAMSRC);
+
+    return TRUE;
+}
+
 /* Context activation is done by the caller. */
 static void drawStridedInstanced(struct wined3d_context *context, const struct wined3d_state *state,
         const struct wined3d_stream_info *si, UINT numberOfVertices, GLenum glPrimitiveType,
@@ -547,13 +1001,13 @@ static void drawStridedInstanced(struct wined3d_context *context, const struct w
     {
         /* Specify the instanced attributes using immediate mode calls */
         for(j = 0; j < numInstancedAttribs; j++) {
-            const BYTE *ptr = si->elements[instancedData[j]].data.addr
-                    + si->elements[instancedData[j]].stride * i;
+            const BYTE *ptr = si->elements[instancedData[j]].data.addr;
             if (si->elements[instancedData[j]].data.buffer_object)
             {
                 struct wined3d_buffer *vb = state->streams[si->elements[instancedData[j]].stream_idx].buffer;
-                ptr += (ULONG_PTR)buffer_get_sysmem(vb, context);
+                ptr = buffer_get_sysmem_addr(vb, context, ptr);
             }
+            ptr += si->elements[instancedData[j]].stride * i;
 
             send_attribute(gl_info, si->elements[instancedData[j]].format->id, instancedData[j], ptr);
         }
@@ -589,7 +1043,7 @@ static void remove_vbos(struct wined3d_context *context,
         {
             struct wined3d_buffer *vb = state->streams[e->stream_idx].buffer;
             e->data.buffer_object = 0;
-            e->data.addr = (BYTE *)((ULONG_PTR)e->data.addr + (ULONG_PTR)buffer_get_sysmem(vb, context));
+            e->data.addr = buffer_get_sysmem_addr(vb, context, e->data.addr);
         }
     }
 }
@@ -598,7 +1052,7 @@ static void remove_vbos(struct wined3d_context *context,
 void draw_primitive(struct wined3d_device *device, UINT start_idx, UINT index_count,
         UINT start_instance, UINT instance_count, BOOL indexed)
 {
-    const struct wined3d_state *state = &device->state;
+    const struct wined3d_state *state = &device->cs->state;
     const struct wined3d_stream_info *stream_info;
     struct wined3d_event_query *ib_query = NULL;
     struct wined3d_stream_info si_emulated;
@@ -611,7 +1065,7 @@ void draw_primitive(struct wined3d_device *device, UINT start_idx, UINT index_co
 
     if (!index_count) return;
 
-    context = context_acquire(device, wined3d_rendertarget_view_get_surface(device->fb.render_targets[0]));
+    context = context_acquire(device, wined3d_rendertarget_view_get_surface(device->cs->fb.render_targets[0]));
     if (!context->valid)
     {
         context_release(context);
@@ -622,7 +1076,7 @@ void draw_primitive(struct wined3d_device *device, UINT start_idx, UINT index_co
 
     for (i = 0; i < device->adapter->gl_info.limits.buffers; ++i)
     {
-        struct wined3d_surface *target = wined3d_rendertarget_view_get_surface(device->fb.render_targets[i]);
+        struct wined3d_surface *target = wined3d_rendertarget_view_get_surface(device->cs->fb.render_targets[i]);
         if (target && target->resource.format->id != WINED3DFMT_NULL)
         {
             if (state->render_states[WINED3D_RS_COLORWRITEENABLE])
@@ -637,16 +1091,16 @@ void draw_primitive(struct wined3d_device *device, UINT start_idx, UINT index_co
         }
     }
 
-    if (device->fb.depth_stencil)
+    if (device->cs->fb.depth_stencil)
     {
         /* Note that this depends on the context_acquire() call above to set
          * context->render_offscreen properly. We don't currently take the
          * Z-compare function into account, but we could skip loading the
          * depthstencil for D3DCMP_NEVER and D3DCMP_ALWAYS as well. Also note
          * that we never copy the stencil data.*/
-        DWORD location = context->render_offscreen ? device->fb.depth_stencil->resource->draw_binding
+        DWORD location = context->render_offscreen ? device->cs->fb.depth_stencil->resource->draw_binding
                 : WINED3D_LOCATION_DRAWABLE;
-        struct wined3d_surface *ds = wined3d_rendertarget_view_get_surface(device->fb.depth_stencil);
+        struct wined3d_surface *ds = wined3d_rendertarget_view_get_surface(device->cs->fb.depth_stencil);
 
         if (state->render_states[WINED3D_RS_ZWRITEENABLE] || state->render_states[WINED3D_RS_ZENABLE])
         {
@@ -679,9 +1133,9 @@ void draw_primitive(struct wined3d_device *device, UINT start_idx, UINT index_co
         return;
     }
 
-    if (device->fb.depth_stencil && state->render_states[WINED3D_RS_ZWRITEENABLE])
+    if (device->cs->fb.depth_stencil && state->render_states[WINED3D_RS_ZWRITEENABLE])
     {
-        struct wined3d_surface *ds = wined3d_rendertarget_view_get_surface(device->fb.depth_stencil);
+        struct wined3d_surface *ds = wined3d_rendertarget_view_get_surface(device->cs->fb.depth_stencil);
         DWORD location = context->render_offscreen ? ds->container->resource.draw_binding : WINED3D_LOCATION_DRAWABLE;
 
         surface_modify_ds_location(ds, location, ds->ds_current_size.cx, ds->ds_current_size.cy);
@@ -708,7 +1162,7 @@ void draw_primitive(struct wined3d_device *device, UINT start_idx, UINT index_co
         else
         {
             ib_query = index_buffer->query;
-            idx_data = NULL;
+            idx_data = (const void *)(ULONG_PTR)buffer_get_stream_offset(index_buffer);
         }
 
         if (state->index_format == WINED3DFMT_R16_UINT)
@@ -754,27 +1208,34 @@ void draw_primitive(struct wined3d_device *device, UINT start_idx, UINT index_co
 
     if (context->use_immediate_mode_draw || emulation)
     {
-        /* Immediate mode drawing. */
-        if (use_vs(state))
+        /* The index data is read on the CPU in this case. */
+        if (ib_query)
         {
-            static BOOL warned;
+            ib_query = NULL;
+            idx_data = NULL;
+        }
 
-            if (!warned++)
-                FIXME("Using immediate mode with vertex shaders for half float emulation.\n");
-            else
-                WARN_(d3d_perf)("Using immediate mode with vertex shaders for half float emulation.\n");
+        if (use_vs(state) || context->d3d_info->ffp_generic_attributes)
+        {
+            if (!drawStridedTransient(context, state, stream_info, index_count,
+                    state->gl_primitive_type, idx_data, idx_size, start_idx))
+            {
+                static BOOL warned;
 
-            drawStridedSlowVs(context, state, stream_info, index_count,
-                    state->gl_primitive_type, idx_data, idx_size, start_idx);
+                if (!warned++)
+                    FIXME("Using immediate mode for vertex attribute conversion.\n");
+                else
+                    WARN_(d3d_perf)("Using immediate mode for vertex attribute conversion.\n");
+
+                drawStridedSlowVs(context, state, stream_info, index_count,
+                        state->gl_primitive_type, idx_data, idx_size, start_idx);
+            }
         }
-        else
+        else if (emulation || !drawStridedTransientFfp(context, state, stream_info, index_count,
+                state->gl_primitive_type, idx_data, idx_size, start_idx))
         {
-            if (context->d3d_info->ffp_generic_attributes)
-                drawStridedSlowVs(context, state, stream_info, index_count,
+            drawStridedSlow(device, context, stream_info, index_count,
                     state->gl_primitive_type, idx_data, idx_size, start_idx);
-            else
-                drawStridedSlow(device, context, stream_info, index_count,
-                        state->gl_primitive_type, idx_data, idx_size, start_idx);
         }
     }
     else if (!gl_info->supported[ARB_INSTANCED_ARRAYS] && instance_count)
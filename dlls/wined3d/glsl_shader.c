@@ -92,10 +92,26 @@ struct constant_heap
 };
 
 /* GLSL shader private data */
+#define WINED3D_GLSL_RECENT_PROGRAM_COUNT 4
+
+/* Open addressing hash table of linked programs, keyed on the attached
+ * shader objects. Deleted slots are marked with a tombstone so that probe
+ * sequences stay intact; they're dropped when the table is rehashed. */
+struct glsl_program_table
+{
+    struct glsl_shader_prog_link **entries;
+    unsigned int size;
+    unsigned int count;
+    unsigned int used;
+};
+
 struct shader_glsl_priv {
     struct wined3d_string_buffer shader_buffer;
     struct wined3d_string_buffer_list string_buffers;
-    struct wine_rb_tree program_lookup;
+    struct glsl_program_table programs;
+    /* Incremented whenever a program is deleted, invalidating the per-context
+     * recently used program caches. */
+    unsigned int program_generation;
     struct constant_heap vconst_heap;
     struct constant_heap pconst_heap;
     unsigned char *stack;
@@ -109,6 +125,18 @@ struct shader_glsl_priv {
     struct wine_rb_tree ffp_fragment_shaders;
     BOOL ffp_proj_control;
     BOOL legacy_lighting;
+
+    BOOL program_cache_initialized;
+    BOOL program_cache;
+    struct wined3d_disk_cache_key program_cache_prefix;
+    /* Shader objects whose compilation is deferred, see
+     * shader_glsl_compile_deferred(). */
+    struct wine_rb_tree pending_compiles;
+
+    /* Streaming buffer for shader constants, see shader_glsl_load_constant_block(). */
+    GLuint constant_buffer;
+    BYTE *constant_buffer_ptr; /* persistent mapping, if any */
+    unsigned int constant_buffer_offset;
 };
 
 struct glsl_vs_program
@@ -117,6 +145,7 @@ struct glsl_vs_program
     GLuint id;
     GLenum vertex_color_clamp;
     GLint *uniform_f_locations;
+    unsigned int constant_block_count;
     GLint uniform_i_locations[MAX_CONST_I];
     GLint uniform_b_locations[MAX_CONST_B];
     GLint pos_fixup_location;
@@ -165,6 +194,7 @@ struct glsl_ps_program
     struct list shader_entry;
     GLuint id;
     GLint *uniform_f_locations;
+    unsigned int constant_block_count;
     GLint uniform_i_locations[MAX_CONST_I];
     GLint uniform_b_locations[MAX_CONST_B];
     GLint bumpenv_mat_location[MAX_TEXTURES];
@@ -186,20 +216,20 @@ struct glsl_ps_program
 /* Struct to maintain data about a linked GLSL program */
 struct glsl_shader_prog_link
 {
-    struct wine_rb_entry program_lookup_entry;
+    unsigned int hash;
     struct glsl_vs_program vs;
     struct glsl_gs_program gs;
     struct glsl_ps_program ps;
     GLuint id;
     DWORD constant_update_mask;
     UINT constant_version;
-};
-
-struct glsl_program_key
-{
-    GLuint vs_id;
-    GLuint gs_id;
-    GLuint ps_id;
+    struct wined3d_disk_cache_key cache_key;
+    struct wined3d_shader *vshader;
+    struct wined3d_shader *gshader;
+    struct wined3d_shader *pshader;
+    /* The program was linked, but the driver may still be compiling it in
+     * the background. See shader_glsl_program_ready(). */
+    BOOL pending;
 };
 
 struct shader_glsl_ctx_priv {
@@ -212,6 +242,10 @@ struct shader_glsl_ctx_priv {
 struct glsl_context_data
 {
     struct glsl_shader_prog_link *glsl_program;
+    /* Most recently used first. Only valid while recent_generation matches
+     * the device's program_generation. */
+    struct glsl_shader_prog_link *recent_programs[WINED3D_GLSL_RECENT_PROGRAM_COUNT];
+    unsigned int recent_generation;
 };
 
 struct glsl_ps_compiled_shader
@@ -380,13 +414,35 @@ void print_glsl_info_log(const struct wined3d_gl_info *gl_info, GLuint id, BOOL
     }
 }
 
+static BOOL shader_glsl_use_async_compile(const struct wined3d_gl_info *gl_info)
+{
+    return wined3d_settings.async_shader_compile && gl_info->supported[ARB_PARALLEL_SHADER_COMPILE];
+}
+
+/* The uniform buffer binding points used for SM1-3 float constants. These
+ * come after the ones used for SM4 constant buffers. */
+static unsigned int shader_glsl_get_constant_block_binding(const struct wined3d_gl_info *gl_info,
+        enum wined3d_shader_type type)
+{
+    unsigned int base = gl_info->limits.vertex_uniform_blocks + gl_info->limits.geometry_uniform_blocks
+            + gl_info->limits.fragment_uniform_blocks;
+
+    return type == WINED3D_SHADER_TYPE_PIXEL ? base + 1 : base;
+}
+
+static BOOL shader_glsl_use_constant_blocks(const struct wined3d_gl_info *gl_info)
+{
+    return wined3d_settings.ubo_constants && gl_info->supported[ARB_UNIFORM_BUFFER_OBJECT]
+            && gl_info->supported[ARB_MAP_BUFFER_RANGE]
+            && shader_glsl_get_constant_block_binding(gl_info, WINED3D_SHADER_TYPE_PIXEL)
+            < gl_info->limits.uniform_buffer_bindings;
+}
+
 /* Context activation is done by the caller. */
-static void shader_glsl_compile(const struct wined3d_gl_info *gl_info, GLuint shader, const char *src)
+static void shader_glsl_set_source(const struct wined3d_gl_info *gl_info, GLuint shader, const char *src)
 {
     const char *ptr, *line;
 
-    TRACE("Compiling shader object %u.\n", shader);
-
     if (TRACE_ON(d3d_shader))
     {
         ptr = src;
@@ -395,9 +451,119 @@ static void shader_glsl_compile(const struct wined3d_gl_info *gl_info, GLuint sh
 
     GL_EXTCALL(glShaderSource(shader, 1, &src, NULL));
     checkGLcall("glShaderSource");
+}
+
+/* Context activation is done by the caller. */
+static void shader_glsl_compile_source(const struct wined3d_gl_info *gl_info, GLuint shader)
+{
     GL_EXTCALL(glCompileShader(shader));
     checkGLcall("glCompileShader");
-    print_glsl_info_log(gl_info, shader, FALSE);
+    /* Querying the info log would wait for the compiler. Errors will still
+     * show up in the program info log once the program is linked. */
+    if (!shader_glsl_use_async_compile(gl_info))
+        print_glsl_info_log(gl_info, shader, FALSE);
+}
+
+/* Context activation is done by the caller. */
+static void shader_glsl_compile(const struct wined3d_gl_info *gl_info, GLuint shader, const char *src)
+{
+    TRACE("Compiling shader object %u.\n", shader);
+
+    shader_glsl_set_source(gl_info, shader, src);
+    shader_glsl_compile_source(gl_info, shader);
+}
+
+struct glsl_pending_compile
+{
+    struct wine_rb_entry entry;
+    GLuint id;
+};
+
+static int glsl_pending_compile_compare(const void *key, const struct wine_rb_entry *entry)
+{
+    const struct glsl_pending_compile *pending = WINE_RB_ENTRY_VALUE(entry, struct glsl_pending_compile, entry);
+    GLuint id = *(const GLuint *)key;
+
+    return id < pending->id ? -1 : id > pending->id;
+}
+
+static const struct wine_rb_functions glsl_pending_compile_rb_functions =
+{
+    wined3d_rb_alloc,
+    wined3d_rb_realloc,
+    wined3d_rb_free,
+    glsl_pending_compile_compare,
+};
+
+static void glsl_free_pending_compile(struct wine_rb_entry *entry, void *context)
+{
+    HeapFree(GetProcessHeap(), 0, WINE_RB_ENTRY_VALUE(entry, struct glsl_pending_compile, entry));
+}
+
+/* With the program cache in use, shaders are only compiled once a program
+ * using them has to be linked; programs loaded from the cache don't need
+ * compiled shaders. The source is set right away, since it's part of the
+ * program cache key.
+ *
+ * Context activation is done by the caller. */
+static void shader_glsl_compile_deferred(struct shader_glsl_priv *priv,
+        const struct wined3d_gl_info *gl_info, GLuint shader, const char *src)
+{
+    struct glsl_pending_compile *pending;
+
+    if (!priv->program_cache || !(pending = HeapAlloc(GetProcessHeap(), 0, sizeof(*pending))))
+    {
+        shader_glsl_compile(gl_info, shader, src);
+        return;
+    }
+
+    TRACE("Deferring compilation of shader object %u.\n", shader);
+    shader_glsl_set_source(gl_info, shader, src);
+
+    pending->id = shader;
+    if (wine_rb_put(&priv->pending_compiles, &pending->id, &pending->entry) == -1)
+    {
+        HeapFree(GetProcessHeap(), 0, pending);
+        if (!wine_rb_get(&priv->pending_compiles, &shader))
+            shader_glsl_compile_source(gl_info, shader);
+    }
+}
+
+/* Removes "shader" from the pending compiles and returns TRUE if it was
+ * there. */
+static BOOL shader_glsl_take_pending_compile(struct shader_glsl_priv *priv, GLuint shader)
+{
+    struct wine_rb_entry *entry;
+
+    if (!(entry = wine_rb_get(&priv->pending_compiles, &shader)))
+        return FALSE;
+
+    wine_rb_remove(&priv->pending_compiles, &shader);
+    glsl_free_pending_compile(entry, NULL);
+    return TRUE;
+}
+
+/* Context activation is done by the caller. */
+static void shader_glsl_attach_shader(struct shader_glsl_priv *priv,
+        const struct wined3d_gl_info *gl_info, GLuint program, GLuint shader)
+{
+    if (shader_glsl_take_pending_compile(priv, shader))
+    {
+        TRACE("Compiling deferred shader object %u.\n", shader);
+        shader_glsl_compile_source(gl_info, shader);
+    }
+
+    TRACE("Attaching GLSL shader object %u to program %u.\n", shader, program);
+    GL_EXTCALL(glAttachShader(program, shader));
+    checkGLcall("glAttachShader");
+}
+
+/* Context activation is done by the caller. */
+static void shader_glsl_delete_shader(struct shader_glsl_priv *priv,
+        const struct wined3d_gl_info *gl_info, GLuint shader)
+{
+    shader_glsl_take_pending_compile(priv, shader);
+    GL_EXTCALL(glDeleteShader(shader));
 }
 
 /* Context activation is done by the caller. */
@@ -695,6 +861,137 @@ static void shader_glsl_load_constantsF(const struct wined3d_shader *shader, con
     checkGLcall("glUniform4fv()");
 }
 
+#define WINED3D_GLSL_CONSTANT_BUFFER_SIZE (1024 * 1024)
+
+/* Context activation is done by the caller.
+ *
+ * Creates new storage for the constant buffer, and binds it. With
+ * ARB_buffer_storage the storage is mapped persistently. The previous buffer
+ * object is deleted, which leaves its storage to the GL until the GPU is done
+ * with it, like glBufferData() does for mutable storage. */
+static BOOL shader_glsl_alloc_constant_buffer(const struct wined3d_gl_info *gl_info, struct shader_glsl_priv *priv)
+{
+    static const GLbitfield storage_flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+    if (priv->constant_buffer)
+        GL_EXTCALL(glDeleteBuffers(1, &priv->constant_buffer));
+    priv->constant_buffer_ptr = NULL;
+    priv->constant_buffer_offset = 0;
+
+    GL_EXTCALL(glGenBuffers(1, &priv->constant_buffer));
+    GL_EXTCALL(glBindBuffer(GL_UNIFORM_BUFFER, priv->constant_buffer));
+    if (gl_info->supported[ARB_BUFFER_STORAGE])
+    {
+        GL_EXTCALL(glBufferStorage(GL_UNIFORM_BUFFER, WINED3D_GLSL_CONSTANT_BUFFER_SIZE, NULL, storage_flags));
+        priv->constant_buffer_ptr = GL_EXTCALL(glMapBufferRange(GL_UNIFORM_BUFFER,
+                0, WINED3D_GLSL_CONSTANT_BUFFER_SIZE, storage_flags));
+    }
+    else
+    {
+        GL_EXTCALL(glBufferData(GL_UNIFORM_BUFFER, WINED3D_GLSL_CONSTANT_BUFFER_SIZE, NULL, GL_STREAM_DRAW));
+    }
+    checkGLcall("create constant buffer");
+
+    if (gl_info->supported[ARB_BUFFER_STORAGE] && !priv->constant_buffer_ptr)
+    {
+        ERR("Failed to map constant buffer storage.\n");
+        GL_EXTCALL(glDeleteBuffers(1, &priv->constant_buffer));
+        priv->constant_buffer = 0;
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+/* Context activation is done by the caller.
+ *
+ * Copies all float, integer and boolean constants of the shader into the
+ * next free range of the constant buffer and binds that range. The layout
+ * matches the std140 block declared by shader_generate_glsl_declarations():
+ * count vec4 float constants, MAX_CONST_I ivec4 integer constants, and
+ * MAX_CONST_B booleans with a 16 byte array stride. Ranges are never reused
+ * until the buffer wraps around, at which point new storage is allocated, so
+ * writing doesn't need to synchronise with the GPU. With ARB_buffer_storage
+ * the buffer stays mapped, otherwise each range is mapped unsynchronised. */
+static void shader_glsl_load_constant_block(const struct wined3d_gl_info *gl_info, struct shader_glsl_priv *priv,
+        const struct wined3d_shader *shader, const float *constants_f, unsigned int count,
+        const int *constants_i, const BOOL *constants_b)
+{
+    unsigned int alignment = max(gl_info->limits.uniform_buffer_offset_alignment, 1);
+    unsigned int size = (count + MAX_CONST_I + MAX_CONST_B) * 4 * sizeof(*constants_f);
+    const struct wined3d_shader_lconst *lconst;
+    unsigned int offset, i;
+    GLint *data_i, *data_b;
+    float *data;
+
+    offset = (priv->constant_buffer_offset + alignment - 1) / alignment * alignment;
+    if (!priv->constant_buffer || offset + size > WINED3D_GLSL_CONSTANT_BUFFER_SIZE)
+    {
+        if (!shader_glsl_alloc_constant_buffer(gl_info, priv))
+            return;
+        offset = 0;
+    }
+
+    if (priv->constant_buffer_ptr)
+    {
+        data = (float *)(priv->constant_buffer_ptr + offset);
+    }
+    else
+    {
+        GL_EXTCALL(glBindBuffer(GL_UNIFORM_BUFFER, priv->constant_buffer));
+        if (!(data = GL_EXTCALL(glMapBufferRange(GL_UNIFORM_BUFFER, offset, size,
+                GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT))))
+        {
+            ERR("Failed to map constant buffer.\n");
+            return;
+        }
+    }
+    data_i = (GLint *)&data[count * 4];
+    data_b = &data_i[MAX_CONST_I * 4];
+
+    /* 1.X pshaders have the constants clamped to [-1;1] implicitly. */
+    if (shader->reg_maps.shader_version.major == 1
+            && shader->reg_maps.shader_version.type == WINED3D_SHADER_TYPE_PIXEL)
+    {
+        for (i = 0; i < count * 4; ++i)
+            data[i] = constants_f[i] < -1.0f ? -1.0f : constants_f[i] > 1.0f ? 1.0f : constants_f[i];
+    }
+    else
+    {
+        memcpy(data, constants_f, count * 4 * sizeof(*data));
+    }
+    memcpy(data_i, constants_i, MAX_CONST_I * 4 * sizeof(*data_i));
+    for (i = 0; i < MAX_CONST_B; ++i)
+        data_b[i * 4] = constants_b[i];
+
+    /* Immediate constants are clamped to [-1;1] at shader creation time if needed */
+    if (shader->load_local_constsF)
+    {
+        LIST_FOR_EACH_ENTRY(lconst, &shader->constantsF, struct wined3d_shader_lconst, entry)
+        {
+            if (lconst->idx < count)
+                memcpy(&data[lconst->idx * 4], lconst->value, 4 * sizeof(*data));
+        }
+    }
+    LIST_FOR_EACH_ENTRY(lconst, &shader->constantsI, struct wined3d_shader_lconst, entry)
+    {
+        memcpy(&data_i[lconst->idx * 4], lconst->value, 4 * sizeof(*data_i));
+    }
+    LIST_FOR_EACH_ENTRY(lconst, &shader->constantsB, struct wined3d_shader_lconst, entry)
+    {
+        data_b[lconst->idx * 4] = *(const GLint *)lconst->value;
+    }
+
+    if (!priv->constant_buffer_ptr)
+        GL_EXTCALL(glUnmapBuffer(GL_UNIFORM_BUFFER));
+    GL_EXTCALL(glBindBufferRange(GL_UNIFORM_BUFFER,
+            shader_glsl_get_constant_block_binding(gl_info, shader->reg_maps.shader_version.type),
+            priv->constant_buffer, offset, size));
+    checkGLcall("load constant block");
+
+    priv->constant_buffer_offset = offset + size;
+}
+
 /* Context activation is done by the caller. */
 static void shader_glsl_load_constantsI(const struct wined3d_shader *shader, const struct wined3d_gl_info *gl_info,
         const GLint locations[MAX_CONST_I], const int *constants, WORD constants_set)
@@ -753,9 +1050,18 @@ static void shader_glsl_load_constantsB(const struct wined3d_shader *shader, con
     checkGLcall("glUniform1iv()");
 }
 
-static void reset_program_constant_version(struct wine_rb_entry *entry, void *context)
+#define GLSL_PROGRAM_TOMBSTONE ((struct glsl_shader_prog_link *)~(ULONG_PTR)0)
+
+static void reset_program_constant_versions(struct glsl_program_table *table)
 {
-    WINE_RB_ENTRY_VALUE(entry, struct glsl_shader_prog_link, program_lookup_entry)->constant_version = 0;
+    struct glsl_shader_prog_link *entry;
+    unsigned int i;
+
+    for (i = 0; i < table->size; ++i)
+    {
+        if ((entry = table->entries[i]) && entry != GLSL_PROGRAM_TOMBSTONE)
+            entry->constant_version = 0;
+    }
 }
 
 /* Context activation is done by the caller (state handler). */
@@ -1298,17 +1604,26 @@ static void shader_glsl_load_constants(void *shader_priv, struct wined3d_context
     constant_version = prog->constant_version;
     update_mask = context->constant_update_mask & prog->constant_update_mask;
 
-    if (update_mask & WINED3D_SHADER_CONST_VS_F)
-        shader_glsl_load_constantsF(vshader, gl_info, state->vs_consts_f,
-                prog->vs.uniform_f_locations, &priv->vconst_heap, priv->stack, constant_version);
+    if (prog->vs.constant_block_count)
+    {
+        if (update_mask & (WINED3D_SHADER_CONST_VS_F | WINED3D_SHADER_CONST_VS_I | WINED3D_SHADER_CONST_VS_B))
+            shader_glsl_load_constant_block(gl_info, priv, vshader, state->vs_consts_f,
+                    prog->vs.constant_block_count, state->vs_consts_i, state->vs_consts_b);
+    }
+    else
+    {
+        if (update_mask & WINED3D_SHADER_CONST_VS_F)
+            shader_glsl_load_constantsF(vshader, gl_info, state->vs_consts_f,
+                    prog->vs.uniform_f_locations, &priv->vconst_heap, priv->stack, constant_version);
 
-    if (update_mask & WINED3D_SHADER_CONST_VS_I)
-        shader_glsl_load_constantsI(vshader, gl_info, prog->vs.uniform_i_locations, state->vs_consts_i,
-                vshader->reg_maps.integer_constants);
+        if (update_mask & WINED3D_SHADER_CONST_VS_I)
+            shader_glsl_load_constantsI(vshader, gl_info, prog->vs.uniform_i_locations, state->vs_consts_i,
+                    vshader->reg_maps.integer_constants);
 
-    if (update_mask & WINED3D_SHADER_CONST_VS_B)
-        shader_glsl_load_constantsB(vshader, gl_info, prog->vs.uniform_b_locations, state->vs_consts_b,
-                vshader->reg_maps.boolean_constants);
+        if (update_mask & WINED3D_SHADER_CONST_VS_B)
+            shader_glsl_load_constantsB(vshader, gl_info, prog->vs.uniform_b_locations, state->vs_consts_b,
+                    vshader->reg_maps.boolean_constants);
+    }
 
     if (update_mask & WINED3D_SHADER_CONST_VS_POINTSIZE)
         shader_glsl_pointsize_uniform(context, state, prog);
@@ -1371,17 +1686,26 @@ static void shader_glsl_load_constants(void *shader_priv, struct wined3d_context
             shader_glsl_ffp_vertex_light_uniform(context, state, i, prog);
     }
 
-    if (update_mask & WINED3D_SHADER_CONST_PS_F)
-        shader_glsl_load_constantsF(pshader, gl_info, state->ps_consts_f,
-                prog->ps.uniform_f_locations, &priv->pconst_heap, priv->stack, constant_version);
+    if (prog->ps.constant_block_count)
+    {
+        if (update_mask & (WINED3D_SHADER_CONST_PS_F | WINED3D_SHADER_CONST_PS_I | WINED3D_SHADER_CONST_PS_B))
+            shader_glsl_load_constant_block(gl_info, priv, pshader, state->ps_consts_f,
+                    prog->ps.constant_block_count, state->ps_consts_i, state->ps_consts_b);
+    }
+    else
+    {
+        if (update_mask & WINED3D_SHADER_CONST_PS_F)
+            shader_glsl_load_constantsF(pshader, gl_info, state->ps_consts_f,
+                    prog->ps.uniform_f_locations, &priv->pconst_heap, priv->stack, constant_version);
 
-    if (update_mask & WINED3D_SHADER_CONST_PS_I)
-        shader_glsl_load_constantsI(pshader, gl_info, prog->ps.uniform_i_locations, state->ps_consts_i,
-                pshader->reg_maps.integer_constants);
+        if (update_mask & WINED3D_SHADER_CONST_PS_I)
+            shader_glsl_load_constantsI(pshader, gl_info, prog->ps.uniform_i_locations, state->ps_consts_i,
+                    pshader->reg_maps.integer_constants);
 
-    if (update_mask & WINED3D_SHADER_CONST_PS_B)
-        shader_glsl_load_constantsB(pshader, gl_info, prog->ps.uniform_b_locations, state->ps_consts_b,
-                pshader->reg_maps.boolean_constants);
+        if (update_mask & WINED3D_SHADER_CONST_PS_B)
+            shader_glsl_load_constantsB(pshader, gl_info, prog->ps.uniform_b_locations, state->ps_consts_b,
+                    pshader->reg_maps.boolean_constants);
+    }
 
     if (update_mask & WINED3D_SHADER_CONST_PS_BUMP_ENV)
     {
@@ -1457,7 +1781,7 @@ static void shader_glsl_load_constants(void *shader_priv, struct wined3d_context
     if (priv->next_constant_version == UINT_MAX)
     {
         TRACE("Max constant version reached, resetting to 0.\n");
-        wine_rb_for_each_entry(&priv->program_lookup, reset_program_constant_version, NULL);
+        reset_program_constant_versions(&priv->programs);
         priv->next_constant_version = 1;
     }
     else
@@ -1623,13 +1947,14 @@ static void shader_generate_glsl_declarations(const struct wined3d_context *cont
         const struct wined3d_shader_reg_maps *reg_maps, const struct shader_glsl_ctx_priv *ctx_priv)
 {
     const struct wined3d_shader_version *version = &reg_maps->shader_version;
-    const struct wined3d_state *state = &shader->device->state;
+    const struct wined3d_state *state = &shader->device->cs->state;
     const struct vs_compile_args *vs_args = ctx_priv->cur_vs_args;
     const struct ps_compile_args *ps_args = ctx_priv->cur_ps_args;
     const struct wined3d_gl_info *gl_info = context->gl_info;
-    const struct wined3d_fb_state *fb = &shader->device->fb;
+    const struct wined3d_fb_state *fb = &shader->device->cs->fb;
     unsigned int i, extra_constants_needed = 0;
     const struct wined3d_shader_lconst *lconst;
+    BOOL constant_block;
     const char *prefix;
     DWORD map;
 
@@ -1642,7 +1967,18 @@ static void shader_generate_glsl_declarations(const struct wined3d_context *cont
     }
 
     /* Declare the constants (aka uniforms) */
-    if (shader->limits->constant_float > 0)
+    constant_block = shader->limits->constant_float > 0 && shader_glsl_use_constant_blocks(gl_info);
+    if (constant_block)
+    {
+        /* Uniform blocks are large enough for all the constants we expose,
+         * so none of the considerations below apply here. This has to match
+         * the layout written by shader_glsl_load_constant_block(). */
+        shader_addline(buffer, "layout(std140) uniform block_%s_c { vec4 %s_c[%u]; ivec4 %s_i[%u]; bool %s_b[%u]; };\n",
+                prefix, prefix, min(shader->limits->constant_float, version->type == WINED3D_SHADER_TYPE_PIXEL
+                ? gl_info->limits.glsl_ps_float_constants : gl_info->limits.glsl_vs_float_constants),
+                prefix, MAX_CONST_I, prefix, MAX_CONST_B);
+    }
+    else if (shader->limits->constant_float > 0)
     {
         unsigned max_constantsF;
 
@@ -1717,10 +2053,10 @@ static void shader_generate_glsl_declarations(const struct wined3d_context *cont
     /* Always declare the full set of constants, the compiler can remove the
      * unused ones because d3d doesn't (yet) support indirect int and bool
      * constant addressing. This avoids problems if the app uses e.g. i0 and i9. */
-    if (shader->limits->constant_int > 0 && reg_maps->integer_constants)
+    if (!constant_block && shader->limits->constant_int > 0 && reg_maps->integer_constants)
         shader_addline(buffer, "uniform ivec4 %s_i[%u];\n", prefix, shader->limits->constant_int);
 
-    if (shader->limits->constant_bool > 0 && reg_maps->boolean_constants)
+    if (!constant_block && shader->limits->constant_bool > 0 && reg_maps->boolean_constants)
         shader_addline(buffer, "uniform bool %s_b[%u];\n", prefix, shader->limits->constant_bool);
 
     for (i = 0; i < WINED3D_MAX_CBS; ++i)
@@ -5000,44 +5336,170 @@ static void shader_glsl_input_pack(const struct wined3d_shader *shader, struct w
  * Vertex Shader Specific Code begins here
  ********************************************/
 
+static unsigned int glsl_program_hash(GLuint vs_id, GLuint gs_id, GLuint ps_id)
+{
+    unsigned int hash;
+
+    hash = vs_id * 0x9e3779b1u;
+    hash ^= gs_id * 0x85ebca6bu;
+    hash ^= ps_id * 0xc2b2ae35u;
+    hash ^= hash >> 16;
+    hash *= 0x7feb352du;
+    hash ^= hash >> 15;
+
+    return hash;
+}
+
+static BOOL glsl_program_table_init(struct glsl_program_table *table)
+{
+    table->size = 64;
+    table->count = 0;
+    table->used = 0;
+
+    return !!(table->entries = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY,
+            table->size * sizeof(*table->entries)));
+}
+
+static void glsl_program_table_cleanup(struct glsl_program_table *table)
+{
+    HeapFree(GetProcessHeap(), 0, table->entries);
+}
+
+static BOOL glsl_program_table_resize(struct glsl_program_table *table, unsigned int size)
+{
+    struct glsl_shader_prog_link **entries, *entry;
+    unsigned int i, idx;
+
+    if (!(entries = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, size * sizeof(*entries))))
+        return FALSE;
+
+    for (i = 0; i < table->size; ++i)
+    {
+        if (!(entry = table->entries[i]) || entry == GLSL_PROGRAM_TOMBSTONE)
+            continue;
+
+        idx = entry->hash & (size - 1);
+        while (entries[idx])
+            idx = (idx + 1) & (size - 1);
+        entries[idx] = entry;
+    }
+
+    HeapFree(GetProcessHeap(), 0, table->entries);
+    table->entries = entries;
+    table->size = size;
+    table->used = table->count;
+
+    return TRUE;
+}
+
 static void add_glsl_program_entry(struct shader_glsl_priv *priv, struct glsl_shader_prog_link *entry)
 {
-    struct glsl_program_key key;
+    struct glsl_program_table *table = &priv->programs;
+    unsigned int idx;
+
+    /* Keep the load factor, including tombstones, below 3/4. If that's only
+     * because of tombstones, rehashing at the same size is enough. */
+    if ((table->used + 1) * 4 > table->size * 3)
+    {
+        unsigned int size = (table->count + 1) * 2 > table->size ? table->size * 2 : table->size;
 
-    key.vs_id = entry->vs.id;
-    key.gs_id = entry->gs.id;
-    key.ps_id = entry->ps.id;
+        /* A fuller table is only slower, so keep using the old one. */
+        if (!glsl_program_table_resize(table, size))
+            WARN("Failed to resize program table, load %u/%u.\n", table->used, table->size);
+    }
+
+    entry->hash = glsl_program_hash(entry->vs.id, entry->gs.id, entry->ps.id);
+    idx = entry->hash & (table->size - 1);
+    while (table->entries[idx] && table->entries[idx] != GLSL_PROGRAM_TOMBSTONE)
+        idx = (idx + 1) & (table->size - 1);
 
-    if (wine_rb_put(&priv->program_lookup, &key, &entry->program_lookup_entry) == -1)
+    if (!table->entries[idx])
     {
-        ERR("Failed to insert program entry.\n");
+        /* Lookups stop at the first empty slot, so never fill the last one. */
+        if (table->used + 1 >= table->size)
+        {
+            ERR("Program table is full, not adding program %u.\n", entry->id);
+            return;
+        }
+        ++table->used;
     }
+    table->entries[idx] = entry;
+    ++table->count;
 }
 
 static struct glsl_shader_prog_link *get_glsl_program_entry(const struct shader_glsl_priv *priv,
         GLuint vs_id, GLuint gs_id, GLuint ps_id)
 {
-    struct wine_rb_entry *entry;
-    struct glsl_program_key key;
+    const struct glsl_program_table *table = &priv->programs;
+    unsigned int hash = glsl_program_hash(vs_id, gs_id, ps_id);
+    struct glsl_shader_prog_link *entry;
+    unsigned int idx;
+
+    for (idx = hash & (table->size - 1); (entry = table->entries[idx]); idx = (idx + 1) & (table->size - 1))
+    {
+        if (entry != GLSL_PROGRAM_TOMBSTONE && entry->hash == hash
+                && entry->vs.id == vs_id && entry->gs.id == gs_id && entry->ps.id == ps_id)
+            return entry;
+    }
+
+    return NULL;
+}
+
+static void remove_glsl_program_entry(struct shader_glsl_priv *priv, struct glsl_shader_prog_link *entry)
+{
+    struct glsl_program_table *table = &priv->programs;
+    unsigned int idx;
+
+    for (idx = entry->hash & (table->size - 1); table->entries[idx]; idx = (idx + 1) & (table->size - 1))
+    {
+        if (table->entries[idx] == entry)
+        {
+            table->entries[idx] = GLSL_PROGRAM_TOMBSTONE;
+            --table->count;
+            ++priv->program_generation;
+            return;
+        }
+    }
+}
+
+/* Looks up a program in the context's recently used programs first, and
+ * moves it to the front of that list. */
+static struct glsl_shader_prog_link *find_glsl_program_entry(struct shader_glsl_priv *priv,
+        struct glsl_context_data *ctx_data, GLuint vs_id, GLuint gs_id, GLuint ps_id)
+{
+    struct glsl_shader_prog_link *entry = NULL;
+    unsigned int i;
+
+    if (ctx_data->recent_generation != priv->program_generation)
+    {
+        memset(ctx_data->recent_programs, 0, sizeof(ctx_data->recent_programs));
+        ctx_data->recent_generation = priv->program_generation;
+    }
+
+    for (i = 0; i < WINED3D_GLSL_RECENT_PROGRAM_COUNT && ctx_data->recent_programs[i]; ++i)
+    {
+        entry = ctx_data->recent_programs[i];
+        if (entry->vs.id == vs_id && entry->gs.id == gs_id && entry->ps.id == ps_id)
+            break;
+        entry = NULL;
+    }
+
+    if (!entry && !(entry = get_glsl_program_entry(priv, vs_id, gs_id, ps_id)))
+        return NULL;
 
-    key.vs_id = vs_id;
-    key.gs_id = gs_id;
-    key.ps_id = ps_id;
+    if (i == WINED3D_GLSL_RECENT_PROGRAM_COUNT)
+        --i;
+    memmove(&ctx_data->recent_programs[1], &ctx_data->recent_programs[0], i * sizeof(*ctx_data->recent_programs));
+    ctx_data->recent_programs[0] = entry;
 
-    entry = wine_rb_get(&priv->program_lookup, &key);
-    return entry ? WINE_RB_ENTRY_VALUE(entry, struct glsl_shader_prog_link, program_lookup_entry) : NULL;
+    return entry;
 }
 
 /* Context activation is done by the caller. */
 static void delete_glsl_program_entry(struct shader_glsl_priv *priv, const struct wined3d_gl_info *gl_info,
         struct glsl_shader_prog_link *entry)
 {
-    struct glsl_program_key key;
-
-    key.vs_id = entry->vs.id;
-    key.gs_id = entry->gs.id;
-    key.ps_id = entry->ps.id;
-    wine_rb_remove(&priv->program_lookup, &key);
+    remove_glsl_program_entry(priv, entry);
 
     GL_EXTCALL(glDeleteProgram(entry->id));
     if (entry->vs.id)
@@ -5048,6 +5510,7 @@ static void delete_glsl_program_entry(struct shader_glsl_priv *priv, const struc
         list_remove(&entry->ps.shader_entry);
     HeapFree(GetProcessHeap(), 0, entry->vs.uniform_f_locations);
     HeapFree(GetProcessHeap(), 0, entry->ps.uniform_f_locations);
+    wined3d_disk_cache_key_cleanup(&entry->cache_key);
     HeapFree(GetProcessHeap(), 0, entry);
 }
 
@@ -5314,7 +5777,7 @@ static GLuint generate_param_reorder_function(struct shader_glsl_priv *priv,
 
     ret = GL_EXTCALL(glCreateShader(GL_VERTEX_SHADER));
     checkGLcall("glCreateShader(GL_VERTEX_SHADER)");
-    shader_glsl_compile(gl_info, ret, buffer->buffer);
+    shader_glsl_compile_deferred(priv, gl_info, ret, buffer->buffer);
 
     return ret;
 }
@@ -5454,7 +5917,7 @@ static GLuint shader_glsl_generate_pshader(const struct wined3d_context *context
     shader_addline(buffer, "}\n");
 
     TRACE("Compiling shader object %u.\n", shader_id);
-    shader_glsl_compile(gl_info, shader_id, buffer->buffer);
+    shader_glsl_compile_deferred(context->swapchain->device->shader_priv, gl_info, shader_id, buffer->buffer);
 
     return shader_id;
 }
@@ -5543,7 +6006,7 @@ static GLuint shader_glsl_generate_vshader(const struct wined3d_context *context
     shader_addline(buffer, "}\n");
 
     TRACE("Compiling shader object %u.\n", shader_id);
-    shader_glsl_compile(gl_info, shader_id, buffer->buffer);
+    shader_glsl_compile_deferred(context->swapchain->device->shader_priv, gl_info, shader_id, buffer->buffer);
 
     return shader_id;
 }
@@ -5581,7 +6044,7 @@ static GLuint shader_glsl_generate_geometry_shader(const struct wined3d_context
     shader_addline(buffer, "}\n");
 
     TRACE("Compiling shader object %u.\n", shader_id);
-    shader_glsl_compile(gl_info, shader_id, buffer->buffer);
+    shader_glsl_compile_deferred(context->swapchain->device->shader_priv, gl_info, shader_id, buffer->buffer);
 
     return shader_id;
 }
@@ -6061,6 +6524,12 @@ static GLuint shader_glsl_generate_ffp_vertex_shader(struct shader_glsl_priv *pr
             shader_addline(buffer, "%s %s = vs_in%u;\n",
                     attrib_info[i].type, attrib_info[i].name, i);
     }
+    /* D3DCOLOR attributes are loaded as RGBA when GL_ARB_vertex_array_bgra
+     * isn't available. */
+    if (settings->swizzle_map & 0x1)
+        shader_addline(buffer, "ffp_attrib_diffuse = ffp_attrib_diffuse.zyxw;\n");
+    if (settings->swizzle_map & 0x2)
+        shader_addline(buffer, "ffp_attrib_specular = ffp_attrib_specular.zyxw;\n");
     for (i = 0; i < MAX_TEXTURES; ++i)
     {
         unsigned int coord_idx = settings->texgen[i] & 0x0000ffff;
@@ -6204,7 +6673,7 @@ static GLuint shader_glsl_generate_ffp_vertex_shader(struct shader_glsl_priv *pr
     shader_addline(buffer, "}\n");
 
     shader_obj = GL_EXTCALL(glCreateShader(GL_VERTEX_SHADER));
-    shader_glsl_compile(gl_info, shader_obj, buffer->buffer);
+    shader_glsl_compile_deferred(priv, gl_info, shader_obj, buffer->buffer);
 
     return shader_obj;
 }
@@ -6859,7 +7328,7 @@ static GLuint shader_glsl_generate_ffp_fragment_shader(struct shader_glsl_priv *
     shader_addline(buffer, "}\n");
 
     shader_id = GL_EXTCALL(glCreateShader(GL_FRAGMENT_SHADER));
-    shader_glsl_compile(gl_info, shader_id, buffer->buffer);
+    shader_glsl_compile_deferred(priv, gl_info, shader_id, buffer->buffer);
 
     string_buffer_release(&priv->string_buffers, tex_reg_name);
     return shader_id;
@@ -6915,6 +7384,12 @@ static void shader_glsl_init_vs_uniform_locations(const struct wined3d_gl_info *
 
     vs->uniform_f_locations = HeapAlloc(GetProcessHeap(), 0,
             sizeof(GLuint) * gl_info->limits.glsl_vs_float_constants);
+    vs->constant_block_count = 0;
+    if (vs_c_count && shader_glsl_use_constant_blocks(gl_info))
+    {
+        vs->constant_block_count = vs_c_count;
+        vs_c_count = 0;
+    }
     for (i = 0; i < vs_c_count; ++i)
     {
         string_buffer_sprintf(name, "vs_c[%u]", i);
@@ -7000,6 +7475,12 @@ static void shader_glsl_init_ps_uniform_locations(const struct wined3d_gl_info *
 
     ps->uniform_f_locations = HeapAlloc(GetProcessHeap(), 0,
             sizeof(GLuint) * gl_info->limits.glsl_ps_float_constants);
+    ps->constant_block_count = 0;
+    if (ps_c_count && shader_glsl_use_constant_blocks(gl_info))
+    {
+        ps->constant_block_count = ps_c_count;
+        ps_c_count = 0;
+    }
     for (i = 0; i < ps_c_count; ++i)
     {
         string_buffer_sprintf(name, "ps_c[%u]", i);
@@ -7069,206 +7550,149 @@ static void shader_glsl_init_uniform_block_bindings(const struct wined3d_gl_info
     string_buffer_release(&priv->string_buffers, name);
 }
 
-/* Context activation is done by the caller. */
-static void set_glsl_shader_program(const struct wined3d_context *context, const struct wined3d_state *state,
-        struct shader_glsl_priv *priv, struct glsl_context_data *ctx_data)
+static void shader_glsl_init_constant_block_binding(const struct wined3d_gl_info *gl_info,
+        GLuint program_id, enum wined3d_shader_type type)
 {
-    const struct wined3d_gl_info *gl_info = context->gl_info;
-    const struct wined3d_d3d_info *d3d_info = context->d3d_info;
-    const struct ps_np2fixup_info *np2fixup_info = NULL;
-    struct glsl_shader_prog_link *entry = NULL;
-    struct wined3d_shader *vshader = NULL;
-    struct wined3d_shader *gshader = NULL;
-    struct wined3d_shader *pshader = NULL;
-    GLuint program_id;
-    GLuint reorder_shader_id = 0;
-    unsigned int i;
-    GLuint vs_id = 0;
-    GLuint gs_id = 0;
-    GLuint ps_id = 0;
-    struct list *ps_list, *vs_list;
-    WORD attribs_map;
-    struct wined3d_string_buffer *tmp_name;
+    GLuint block_idx;
 
-    if (!(context->shader_update_mask & (1u << WINED3D_SHADER_TYPE_VERTEX)) && ctx_data->glsl_program)
-    {
-        vs_id = ctx_data->glsl_program->vs.id;
-        vs_list = &ctx_data->glsl_program->vs.shader_entry;
+    block_idx = GL_EXTCALL(glGetUniformBlockIndex(program_id,
+            type == WINED3D_SHADER_TYPE_PIXEL ? "block_ps_c" : "block_vs_c"));
+    if (block_idx != GL_INVALID_INDEX)
+        GL_EXTCALL(glUniformBlockBinding(program_id, block_idx,
+                shader_glsl_get_constant_block_binding(gl_info, type)));
+    checkGLcall("glUniformBlockBinding");
+}
 
-        if (use_vs(state))
-        {
-            vshader = state->shader[WINED3D_SHADER_TYPE_VERTEX];
-            gshader = state->shader[WINED3D_SHADER_TYPE_GEOMETRY];
+/* Everything besides the program itself that influences the program binary,
+ * i.e. the driver. The extensions, limits and options we generate GLSL for
+ * are covered by the shader sources in the program key. */
+static void shader_glsl_init_program_cache(struct shader_glsl_priv *priv, const struct wined3d_gl_info *gl_info)
+{
+    struct wined3d_disk_cache_key *key = &priv->program_cache_prefix;
+    static const DWORD version = 2;
+    GLint count = 0;
 
-            if (!(context->shader_update_mask & (1u << WINED3D_SHADER_TYPE_GEOMETRY))
-                    && ctx_data->glsl_program->gs.id)
-                gs_id = ctx_data->glsl_program->gs.id;
-            else if (gshader)
-                gs_id = find_glsl_geometry_shader(context, &priv->shader_buffer, &priv->string_buffers, gshader);
-        }
-    }
-    else if (use_vs(state))
-    {
-        struct vs_compile_args vs_compile_args;
+    priv->program_cache_initialized = TRUE;
 
-        vshader = state->shader[WINED3D_SHADER_TYPE_VERTEX];
-
-        find_vs_compile_args(state, vshader, context->stream_info.swizzle_map, &vs_compile_args, d3d_info);
-        vs_id = find_glsl_vshader(context, &priv->shader_buffer, &priv->string_buffers, vshader, &vs_compile_args);
-        vs_list = &vshader->linked_programs;
+    if (!gl_info->supported[ARB_GET_PROGRAM_BINARY] || !wined3d_disk_cache_enabled())
+        return;
 
-        if ((gshader = state->shader[WINED3D_SHADER_TYPE_GEOMETRY]))
-            gs_id = find_glsl_geometry_shader(context, &priv->shader_buffer, &priv->string_buffers, gshader);
-    }
-    else if (priv->vertex_pipe == &glsl_vertex_pipe)
+    gl_info->gl_ops.gl.p_glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &count);
+    if (!count)
     {
-        struct glsl_ffp_vertex_shader *ffp_shader;
-        struct wined3d_ffp_vs_settings settings;
-
-        wined3d_ffp_get_vs_settings(context, state, &settings);
-        ffp_shader = shader_glsl_find_ffp_vertex_shader(priv, gl_info, &settings);
-        vs_id = ffp_shader->id;
-        vs_list = &ffp_shader->linked_programs;
+        TRACE("The driver doesn't support any program binary formats.\n");
+        return;
     }
 
-    if (!(context->shader_update_mask & (1u << WINED3D_SHADER_TYPE_PIXEL)) && ctx_data->glsl_program)
-    {
-        ps_id = ctx_data->glsl_program->ps.id;
-        ps_list = &ctx_data->glsl_program->ps.shader_entry;
+    if (!wined3d_disk_cache_key_init(key, NULL))
+        return;
+    wined3d_disk_cache_key_add(key, &version, sizeof(version));
+    wined3d_disk_cache_key_add_string(key, (const char *)gl_info->gl_ops.gl.p_glGetString(GL_VENDOR));
+    wined3d_disk_cache_key_add_string(key, (const char *)gl_info->gl_ops.gl.p_glGetString(GL_RENDERER));
+    wined3d_disk_cache_key_add_string(key, (const char *)gl_info->gl_ops.gl.p_glGetString(GL_VERSION));
+    if (!wined3d_disk_cache_key_add(key, &gl_info->glsl_version, sizeof(gl_info->glsl_version)))
+        return;
 
-        if (use_ps(state))
-            pshader = state->shader[WINED3D_SHADER_TYPE_PIXEL];
-    }
-    else if (use_ps(state))
-    {
-        struct ps_compile_args ps_compile_args;
-        pshader = state->shader[WINED3D_SHADER_TYPE_PIXEL];
-        find_ps_compile_args(state, pshader, context->stream_info.position_transformed, &ps_compile_args, context);
-        ps_id = find_glsl_pshader(context, &priv->shader_buffer, &priv->string_buffers,
-                pshader, &ps_compile_args, &np2fixup_info);
-        ps_list = &pshader->linked_programs;
-    }
-    else if (priv->fragment_pipe == &glsl_fragment_pipe)
-    {
-        struct glsl_ffp_fragment_shader *ffp_shader;
-        struct ffp_frag_settings settings;
+    priv->program_cache = TRUE;
+}
 
-        gen_ffp_frag_op(context, state, &settings, FALSE);
-        ffp_shader = shader_glsl_find_ffp_fragment_shader(priv, gl_info, &settings);
-        ps_id = ffp_shader->id;
-        ps_list = &ffp_shader->linked_programs;
-    }
+/* Context activation is done by the caller. */
+static void shader_glsl_add_source_to_key(const struct wined3d_gl_info *gl_info,
+        struct wined3d_disk_cache_key *key, GLuint shader)
+{
+    GLint length = 0;
+    char *source;
 
-    if ((!vs_id && !gs_id && !ps_id) || (entry = get_glsl_program_entry(priv, vs_id, gs_id, ps_id)))
+    if (!shader)
     {
-        ctx_data->glsl_program = entry;
+        wined3d_disk_cache_key_add_string(key, NULL);
         return;
     }
 
-    /* If we get to this point, then no matching program exists, so we create one */
-    program_id = GL_EXTCALL(glCreateProgram());
-    TRACE("Created new GLSL shader program %u.\n", program_id);
+    GL_EXTCALL(glGetShaderiv(shader, GL_SHADER_SOURCE_LENGTH, &length));
+    if (length <= 0 || !(source = HeapAlloc(GetProcessHeap(), 0, length)))
+    {
+        wined3d_disk_cache_key_cleanup(key);
+        return;
+    }
+    GL_EXTCALL(glGetShaderSource(shader, length, NULL, source));
+    checkGLcall("glGetShaderSource");
+    wined3d_disk_cache_key_add(key, source, length);
+    HeapFree(GetProcessHeap(), 0, source);
+}
 
-    /* Create the entry */
-    entry = HeapAlloc(GetProcessHeap(), 0, sizeof(struct glsl_shader_prog_link));
-    entry->id = program_id;
-    entry->vs.id = vs_id;
-    entry->gs.id = gs_id;
-    entry->ps.id = ps_id;
-    entry->constant_version = 0;
-    entry->ps.np2_fixup_info = np2fixup_info;
-    /* Add the hash table entry */
-    add_glsl_program_entry(priv, entry);
+static BOOL shader_glsl_load_program_binary(const struct wined3d_gl_info *gl_info, GLuint program_id,
+        const struct wined3d_disk_cache_key *key)
+{
+    GLint status;
+    DWORD size;
+    void *data;
 
-    /* Set the current program */
-    ctx_data->glsl_program = entry;
+    if (!(data = wined3d_disk_cache_load("glsl", key, &size)))
+        return FALSE;
 
-    /* Attach GLSL vshader */
-    if (vs_id)
+    if (size <= sizeof(GLenum))
     {
-        TRACE("Attaching GLSL shader object %u to program %u.\n", vs_id, program_id);
-        GL_EXTCALL(glAttachShader(program_id, vs_id));
-        checkGLcall("glAttachShader");
-
-        list_add_head(vs_list, &entry->vs.shader_entry);
+        HeapFree(GetProcessHeap(), 0, data);
+        return FALSE;
     }
 
-    if (vshader)
-    {
-        attribs_map = vshader->reg_maps.input_registers;
-        reorder_shader_id = generate_param_reorder_function(priv, vshader, pshader,
-                state->gl_primitive_type == GL_POINTS && vshader->reg_maps.point_size,
-                d3d_info->emulated_flatshading
-                && state->render_states[WINED3D_RS_SHADEMODE] == WINED3D_SHADE_FLAT, gl_info);
-        TRACE("Attaching GLSL shader object %u to program %u.\n", reorder_shader_id, program_id);
-        GL_EXTCALL(glAttachShader(program_id, reorder_shader_id));
-        checkGLcall("glAttachShader");
-        /* Flag the reorder function for deletion, then it will be freed automatically when the program
-         * is destroyed
-         */
-        GL_EXTCALL(glDeleteShader(reorder_shader_id));
-    }
-    else
+    GL_EXTCALL(glProgramBinary(program_id, *(GLenum *)data, (GLenum *)data + 1, size - sizeof(GLenum)));
+    HeapFree(GetProcessHeap(), 0, data);
+    GL_EXTCALL(glGetProgramiv(program_id, GL_LINK_STATUS, &status));
+    checkGLcall("glProgramBinary");
+
+    /* Drivers reject binaries from e.g. a different driver version; just
+     * link the program normally in that case. */
+    if (!status)
     {
-        attribs_map = (1u << WINED3D_FFP_ATTRIBS_COUNT) - 1;
+        TRACE("Driver rejected the cached binary for program %u.\n", program_id);
+        return FALSE;
     }
 
-    /* Bind vertex attributes to a corresponding index number to match
-     * the same index numbers as ARB_vertex_programs (makes loading
-     * vertex attributes simpler).  With this method, we can use the
-     * exact same code to load the attributes later for both ARB and
-     * GLSL shaders.
-     *
-     * We have to do this here because we need to know the Program ID
-     * in order to make the bindings work, and it has to be done prior
-     * to linking the GLSL program. */
-    tmp_name = string_buffer_get(&priv->string_buffers);
-    for (i = 0; attribs_map; attribs_map >>= 1, ++i)
-    {
-        if (!(attribs_map & 1))
-            continue;
+    TRACE("Loaded program %u from the shader cache.\n", program_id);
+    return TRUE;
+}
 
-        string_buffer_sprintf(tmp_name, "vs_in%u", i);
-        GL_EXTCALL(glBindAttribLocation(program_id, i, tmp_name->buffer));
-    }
-    checkGLcall("glBindAttribLocation");
-    string_buffer_release(&priv->string_buffers, tmp_name);
+static void shader_glsl_store_program_binary(const struct wined3d_gl_info *gl_info, GLuint program_id,
+        const struct wined3d_disk_cache_key *key)
+{
+    GLint status, length = 0;
+    GLenum *data;
 
-    if (gshader)
-    {
-        TRACE("Attaching GLSL geometry shader object %u to program %u.\n", gs_id, program_id);
-        GL_EXTCALL(glAttachShader(program_id, gs_id));
-        checkGLcall("glAttachShader");
-
-        TRACE("input type %s, output type %s, vertices out %u.\n",
-                debug_d3dprimitivetype(gshader->u.gs.input_type),
-                debug_d3dprimitivetype(gshader->u.gs.output_type),
-                gshader->u.gs.vertices_out);
-        GL_EXTCALL(glProgramParameteriARB(program_id, GL_GEOMETRY_INPUT_TYPE_ARB,
-                gl_primitive_type_from_d3d(gshader->u.gs.input_type)));
-        GL_EXTCALL(glProgramParameteriARB(program_id, GL_GEOMETRY_OUTPUT_TYPE_ARB,
-                gl_primitive_type_from_d3d(gshader->u.gs.output_type)));
-        GL_EXTCALL(glProgramParameteriARB(program_id, GL_GEOMETRY_VERTICES_OUT_ARB,
-                gshader->u.gs.vertices_out));
-        checkGLcall("glProgramParameteriARB");
+    GL_EXTCALL(glGetProgramiv(program_id, GL_LINK_STATUS, &status));
+    if (!status)
+        return;
+    GL_EXTCALL(glGetProgramiv(program_id, GL_PROGRAM_BINARY_LENGTH, &length));
+    if (length <= 0 || !(data = HeapAlloc(GetProcessHeap(), 0, sizeof(*data) + length)))
+        return;
 
-        list_add_head(&gshader->linked_programs, &entry->gs.shader_entry);
-    }
+    GL_EXTCALL(glGetProgramBinary(program_id, length, &length, data, data + 1));
+    checkGLcall("glGetProgramBinary");
+    if (length > 0)
+        wined3d_disk_cache_store("glsl", key, data, sizeof(*data) + length);
+    HeapFree(GetProcessHeap(), 0, data);
+}
 
-    /* Attach GLSL pshader */
-    if (ps_id)
+/* Context activation is done by the caller. */
+static void shader_glsl_init_program(const struct wined3d_context *context,
+        struct shader_glsl_priv *priv, struct glsl_shader_prog_link *entry, BOOL linked)
+{
+    const struct wined3d_gl_info *gl_info = context->gl_info;
+    const struct wined3d_shader *vshader = entry->vshader;
+    const struct wined3d_shader *gshader = entry->gshader;
+    const struct wined3d_shader *pshader = entry->pshader;
+    GLuint program_id = entry->id;
+    unsigned int i;
+
+    if (linked)
     {
-        TRACE("Attaching GLSL shader object %u to program %u.\n", ps_id, program_id);
-        GL_EXTCALL(glAttachShader(program_id, ps_id));
-        checkGLcall("glAttachShader");
+        shader_glsl_validate_link(gl_info, program_id);
 
-        list_add_head(ps_list, &entry->ps.shader_entry);
+        if (priv->program_cache)
+            shader_glsl_store_program_binary(gl_info, program_id, &entry->cache_key);
     }
-
-    /* Link the program */
-    TRACE("Linking GLSL shader program %u.\n", program_id);
-    GL_EXTCALL(glLinkProgram(program_id));
-    shader_glsl_validate_link(gl_info, program_id);
+    wined3d_disk_cache_key_cleanup(&entry->cache_key);
 
     shader_glsl_init_vs_uniform_locations(gl_info, priv, program_id, &entry->vs,
             vshader ? min(vshader->limits->constant_float, gl_info->limits.glsl_vs_float_constants) : 0);
@@ -7295,6 +7719,11 @@ static void set_glsl_shader_program(const struct wined3d_context *context, const
      * program is used so we can hardcode the sampler uniform values. */
     shader_glsl_load_samplers(gl_info, priv, context->tex_unit_map, program_id);
 
+    if (entry->vs.constant_block_count)
+        shader_glsl_init_constant_block_binding(gl_info, program_id, WINED3D_SHADER_TYPE_VERTEX);
+    if (entry->ps.constant_block_count)
+        shader_glsl_init_constant_block_binding(gl_info, program_id, WINED3D_SHADER_TYPE_PIXEL);
+
     entry->constant_update_mask = 0;
     if (vshader)
     {
@@ -7345,7 +7774,7 @@ static void set_glsl_shader_program(const struct wined3d_context *context, const
         shader_glsl_init_uniform_block_bindings(gl_info, priv, program_id, &gshader->reg_maps,
                 gl_info->limits.vertex_uniform_blocks, gl_info->limits.geometry_uniform_blocks);
 
-    if (ps_id)
+    if (entry->ps.id)
     {
         if (pshader)
         {
@@ -7384,6 +7813,273 @@ static void set_glsl_shader_program(const struct wined3d_context *context, const
     }
 }
 
+/* Context activation is done by the caller. */
+static void set_glsl_shader_program(const struct wined3d_context *context, const struct wined3d_state *state,
+        struct shader_glsl_priv *priv, struct glsl_context_data *ctx_data)
+{
+    const struct wined3d_gl_info *gl_info = context->gl_info;
+    const struct wined3d_d3d_info *d3d_info = context->d3d_info;
+    const struct ps_np2fixup_info *np2fixup_info = NULL;
+    struct glsl_shader_prog_link *entry = NULL;
+    struct wined3d_shader *vshader = NULL;
+    struct wined3d_shader *gshader = NULL;
+    struct wined3d_shader *pshader = NULL;
+    GLuint program_id;
+    GLuint reorder_shader_id = 0;
+    unsigned int i;
+    GLuint vs_id = 0;
+    GLuint gs_id = 0;
+    GLuint ps_id = 0;
+    struct list *ps_list, *vs_list;
+    WORD attribs_map;
+    struct wined3d_string_buffer *tmp_name;
+    BOOL loaded = FALSE;
+
+    if (!priv->program_cache_initialized)
+        shader_glsl_init_program_cache(priv, gl_info);
+
+    if (!(context->shader_update_mask & (1u << WINED3D_SHADER_TYPE_VERTEX)) && ctx_data->glsl_program)
+    {
+        vs_id = ctx_data->glsl_program->vs.id;
+        vs_list = &ctx_data->glsl_program->vs.shader_entry;
+
+        if (use_vs(state))
+        {
+            vshader = state->shader[WINED3D_SHADER_TYPE_VERTEX];
+            gshader = state->shader[WINED3D_SHADER_TYPE_GEOMETRY];
+
+            if (!(context->shader_update_mask & (1u << WINED3D_SHADER_TYPE_GEOMETRY))
+                    && ctx_data->glsl_program->gs.id)
+            {
+                gs_id = ctx_data->glsl_program->gs.id;
+            }
+            else if (gshader)
+            {
+                gs_id = find_glsl_geometry_shader(context, &priv->shader_buffer, &priv->string_buffers, gshader);
+            }
+        }
+    }
+    else if (use_vs(state))
+    {
+        struct vs_compile_args vs_compile_args;
+
+        vshader = state->shader[WINED3D_SHADER_TYPE_VERTEX];
+
+        find_vs_compile_args(state, vshader, context->stream_info.swizzle_map, &vs_compile_args, d3d_info);
+        vs_id = find_glsl_vshader(context, &priv->shader_buffer, &priv->string_buffers, vshader, &vs_compile_args);
+        vs_list = &vshader->linked_programs;
+
+        if ((gshader = state->shader[WINED3D_SHADER_TYPE_GEOMETRY]))
+            gs_id = find_glsl_geometry_shader(context, &priv->shader_buffer, &priv->string_buffers, gshader);
+    }
+    else if (priv->vertex_pipe == &glsl_vertex_pipe)
+    {
+        struct glsl_ffp_vertex_shader *ffp_shader;
+        struct wined3d_ffp_vs_settings settings;
+
+        wined3d_ffp_get_vs_settings(context, state, &settings);
+        ffp_shader = shader_glsl_find_ffp_vertex_shader(priv, gl_info, &settings);
+        vs_id = ffp_shader->id;
+        vs_list = &ffp_shader->linked_programs;
+    }
+
+    if (!(context->shader_update_mask & (1u << WINED3D_SHADER_TYPE_PIXEL)) && ctx_data->glsl_program)
+    {
+        ps_id = ctx_data->glsl_program->ps.id;
+        ps_list = &ctx_data->glsl_program->ps.shader_entry;
+
+        if (use_ps(state))
+            pshader = state->shader[WINED3D_SHADER_TYPE_PIXEL];
+    }
+    else if (use_ps(state))
+    {
+        struct ps_compile_args ps_compile_args;
+        pshader = state->shader[WINED3D_SHADER_TYPE_PIXEL];
+        find_ps_compile_args(state, pshader, context->stream_info.position_transformed, &ps_compile_args, context);
+        ps_id = find_glsl_pshader(context, &priv->shader_buffer, &priv->string_buffers,
+                pshader, &ps_compile_args, &np2fixup_info);
+        ps_list = &pshader->linked_programs;
+    }
+    else if (priv->fragment_pipe == &glsl_fragment_pipe)
+    {
+        struct glsl_ffp_fragment_shader *ffp_shader;
+        struct ffp_frag_settings settings;
+
+        gen_ffp_frag_op(context, state, &settings, FALSE);
+        ffp_shader = shader_glsl_find_ffp_fragment_shader(priv, gl_info, &settings);
+        ps_id = ffp_shader->id;
+        ps_list = &ffp_shader->linked_programs;
+    }
+
+    if ((!vs_id && !gs_id && !ps_id) || (entry = find_glsl_program_entry(priv, ctx_data, vs_id, gs_id, ps_id)))
+    {
+        ctx_data->glsl_program = entry;
+        return;
+    }
+
+    /* If we get to this point, then no matching program exists, so we create one */
+    program_id = GL_EXTCALL(glCreateProgram());
+    TRACE("Created new GLSL shader program %u.\n", program_id);
+
+    /* Create the entry */
+    entry = HeapAlloc(GetProcessHeap(), 0, sizeof(struct glsl_shader_prog_link));
+    entry->id = program_id;
+    entry->vs.id = vs_id;
+    entry->gs.id = gs_id;
+    entry->ps.id = ps_id;
+    memset(&entry->cache_key, 0, sizeof(entry->cache_key));
+    entry->constant_version = 0;
+    entry->ps.np2_fixup_info = np2fixup_info;
+    entry->pending = FALSE;
+    /* Add the hash table entry */
+    add_glsl_program_entry(priv, entry);
+
+    /* Set the current program */
+    ctx_data->glsl_program = entry;
+
+    if (vs_id)
+        list_add_head(vs_list, &entry->vs.shader_entry);
+    if (gshader)
+        list_add_head(&gshader->linked_programs, &entry->gs.shader_entry);
+    if (ps_id)
+        list_add_head(ps_list, &entry->ps.shader_entry);
+
+    if (vshader)
+    {
+        attribs_map = vshader->reg_maps.input_registers;
+        reorder_shader_id = generate_param_reorder_function(priv, vshader, pshader,
+                state->gl_primitive_type == GL_POINTS && vshader->reg_maps.point_size,
+                d3d_info->emulated_flatshading
+                && state->render_states[WINED3D_RS_SHADEMODE] == WINED3D_SHADE_FLAT, gl_info);
+    }
+    else
+    {
+        attribs_map = (1u << WINED3D_FFP_ATTRIBS_COUNT) - 1;
+    }
+
+    /* The program key contains the source of every attached shader object,
+     * and the state that's set on the program itself. */
+    if (priv->program_cache && wined3d_disk_cache_key_init(&entry->cache_key, &priv->program_cache_prefix))
+    {
+        shader_glsl_add_source_to_key(gl_info, &entry->cache_key, vs_id);
+        shader_glsl_add_source_to_key(gl_info, &entry->cache_key, reorder_shader_id);
+        shader_glsl_add_source_to_key(gl_info, &entry->cache_key, gs_id);
+        shader_glsl_add_source_to_key(gl_info, &entry->cache_key, ps_id);
+        wined3d_disk_cache_key_add(&entry->cache_key, &attribs_map, sizeof(attribs_map));
+        if (gshader)
+        {
+            wined3d_disk_cache_key_add(&entry->cache_key, &gshader->u.gs.input_type,
+                    sizeof(gshader->u.gs.input_type));
+            wined3d_disk_cache_key_add(&entry->cache_key, &gshader->u.gs.output_type,
+                    sizeof(gshader->u.gs.output_type));
+            wined3d_disk_cache_key_add(&entry->cache_key, &gshader->u.gs.vertices_out,
+                    sizeof(gshader->u.gs.vertices_out));
+        }
+
+        loaded = shader_glsl_load_program_binary(gl_info, program_id, &entry->cache_key);
+    }
+
+    if (!loaded)
+    {
+        if (vs_id)
+            shader_glsl_attach_shader(priv, gl_info, program_id, vs_id);
+        if (reorder_shader_id)
+            shader_glsl_attach_shader(priv, gl_info, program_id, reorder_shader_id);
+
+        /* Bind vertex attributes to a corresponding index number to match
+         * the same index numbers as ARB_vertex_programs (makes loading
+         * vertex attributes simpler).  With this method, we can use the
+         * exact same code to load the attributes later for both ARB and
+         * GLSL shaders.
+         *
+         * We have to do this here because we need to know the Program ID
+         * in order to make the bindings work, and it has to be done prior
+         * to linking the GLSL program. */
+        tmp_name = string_buffer_get(&priv->string_buffers);
+        for (i = 0; attribs_map; attribs_map >>= 1, ++i)
+        {
+            if (!(attribs_map & 1))
+                continue;
+
+            string_buffer_sprintf(tmp_name, "vs_in%u", i);
+            GL_EXTCALL(glBindAttribLocation(program_id, i, tmp_name->buffer));
+        }
+        checkGLcall("glBindAttribLocation");
+        string_buffer_release(&priv->string_buffers, tmp_name);
+
+        if (gshader)
+        {
+            shader_glsl_attach_shader(priv, gl_info, program_id, gs_id);
+
+            TRACE("input type %s, output type %s, vertices out %u.\n",
+                    debug_d3dprimitivetype(gshader->u.gs.input_type),
+                    debug_d3dprimitivetype(gshader->u.gs.output_type),
+                    gshader->u.gs.vertices_out);
+            GL_EXTCALL(glProgramParameteriARB(program_id, GL_GEOMETRY_INPUT_TYPE_ARB,
+                    gl_primitive_type_from_d3d(gshader->u.gs.input_type)));
+            GL_EXTCALL(glProgramParameteriARB(program_id, GL_GEOMETRY_OUTPUT_TYPE_ARB,
+                    gl_primitive_type_from_d3d(gshader->u.gs.output_type)));
+            GL_EXTCALL(glProgramParameteriARB(program_id, GL_GEOMETRY_VERTICES_OUT_ARB,
+                    gshader->u.gs.vertices_out));
+            checkGLcall("glProgramParameteriARB");
+        }
+
+        /* Attach GLSL pshader */
+        if (ps_id)
+            shader_glsl_attach_shader(priv, gl_info, program_id, ps_id);
+
+        if (priv->program_cache)
+        {
+            GL_EXTCALL(glProgramParameteri(program_id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+            checkGLcall("glProgramParameteri");
+        }
+
+        /* Link the program */
+        TRACE("Linking GLSL shader program %u.\n", program_id);
+        GL_EXTCALL(glLinkProgram(program_id));
+    }
+
+    /* Flag the reorder function for deletion, then it will be freed
+     * automatically when the program is destroyed. */
+    if (reorder_shader_id)
+        shader_glsl_delete_shader(priv, gl_info, reorder_shader_id);
+
+    entry->vshader = vshader;
+    entry->gshader = gshader;
+    entry->pshader = pshader;
+
+    if (!loaded && shader_glsl_use_async_compile(gl_info))
+    {
+        TRACE("Compiling GLSL shader program %u asynchronously.\n", program_id);
+        entry->pending = TRUE;
+        return;
+    }
+
+    shader_glsl_init_program(context, priv, entry, !loaded);
+}
+
+/* Context activation is done by the caller. */
+static BOOL shader_glsl_program_ready(const struct wined3d_context *context,
+        struct shader_glsl_priv *priv, struct glsl_shader_prog_link *entry)
+{
+    const struct wined3d_gl_info *gl_info = context->gl_info;
+    GLint complete;
+
+    if (!entry->pending)
+        return TRUE;
+
+    GL_EXTCALL(glGetProgramiv(entry->id, GL_COMPLETION_STATUS_ARB, &complete));
+    checkGLcall("glGetProgramiv(GL_COMPLETION_STATUS_ARB)");
+    if (!complete)
+        return FALSE;
+
+    TRACE("GLSL shader program %u finished compiling.\n", entry->id);
+    entry->pending = FALSE;
+    shader_glsl_init_program(context, priv, entry, TRUE);
+
+    return TRUE;
+}
+
 /* Context activation is done by the caller. */
 static GLuint create_glsl_blt_shader(const struct wined3d_gl_info *gl_info, enum wined3d_gl_resource_type tex_type,
         BOOL masked)
@@ -7504,10 +8200,11 @@ static GLuint create_glsl_blt_shader(const struct wined3d_gl_info *gl_info, enum
 }
 
 /* Context activation is done by the caller. */
-static void shader_glsl_select(void *shader_priv, struct wined3d_context *context,
+static BOOL shader_glsl_select(void *shader_priv, struct wined3d_context *context,
         const struct wined3d_state *state)
 {
     struct glsl_context_data *ctx_data = context->shader_backend_data;
+    struct glsl_shader_prog_link *prev_program = ctx_data->glsl_program;
     const struct wined3d_gl_info *gl_info = context->gl_info;
     struct shader_glsl_priv *priv = shader_priv;
     GLuint program_id = 0, prev_id = 0;
@@ -7529,6 +8226,13 @@ static void shader_glsl_select(void *shader_priv, struct wined3d_context *contex
 
     set_glsl_shader_program(context, state, priv, ctx_data);
 
+    if (ctx_data->glsl_program && !shader_glsl_program_ready(context, priv, ctx_data->glsl_program))
+    {
+        TRACE("GLSL shader program %u is still compiling.\n", ctx_data->glsl_program->id);
+        ctx_data->glsl_program = prev_program;
+        return FALSE;
+    }
+
     if (ctx_data->glsl_program)
     {
         program_id = ctx_data->glsl_program->id;
@@ -7563,6 +8267,8 @@ static void shader_glsl_select(void *shader_priv, struct wined3d_context *contex
         if (program_id)
             context->constant_update_mask |= ctx_data->glsl_program->constant_update_mask;
     }
+
+    return TRUE;
 }
 
 /* "context" is not necessarily the currently active context. */
@@ -7690,7 +8396,7 @@ static void shader_glsl_destroy(struct wined3d_shader *shader)
                 for (i = 0; i < shader_data->num_gl_shaders; ++i)
                 {
                     TRACE("Deleting pixel shader %u.\n", gl_shaders[i].id);
-                    GL_EXTCALL(glDeleteShader(gl_shaders[i].id));
+                    shader_glsl_delete_shader(priv, gl_info, gl_shaders[i].id);
                     checkGLcall("glDeleteShader");
                 }
                 HeapFree(GetProcessHeap(), 0, shader_data->gl_shaders.ps);
@@ -7712,7 +8418,7 @@ static void shader_glsl_destroy(struct wined3d_shader *shader)
                 for (i = 0; i < shader_data->num_gl_shaders; ++i)
                 {
                     TRACE("Deleting vertex shader %u.\n", gl_shaders[i].id);
-                    GL_EXTCALL(glDeleteShader(gl_shaders[i].id));
+                    shader_glsl_delete_shader(priv, gl_info, gl_shaders[i].id);
                     checkGLcall("glDeleteShader");
                 }
                 HeapFree(GetProcessHeap(), 0, shader_data->gl_shaders.vs);
@@ -7734,7 +8440,7 @@ static void shader_glsl_destroy(struct wined3d_shader *shader)
                 for (i = 0; i < shader_data->num_gl_shaders; ++i)
                 {
                     TRACE("Deleting geometry shader %u.\n", gl_shaders[i].id);
-                    GL_EXTCALL(glDeleteShader(gl_shaders[i].id));
+                    shader_glsl_delete_shader(priv, gl_info, gl_shaders[i].id);
                     checkGLcall("glDeleteShader");
                 }
                 HeapFree(GetProcessHeap(), 0, shader_data->gl_shaders.gs);
@@ -7761,24 +8467,6 @@ static void shader_glsl_destroy(struct wined3d_shader *shader)
     context_release(context);
 }
 
-static int glsl_program_key_compare(const void *key, const struct wine_rb_entry *entry)
-{
-    const struct glsl_program_key *k = key;
-    const struct glsl_shader_prog_link *prog = WINE_RB_ENTRY_VALUE(entry,
-            const struct glsl_shader_prog_link, program_lookup_entry);
-
-    if (k->vs_id > prog->vs.id) return 1;
-    else if (k->vs_id < prog->vs.id) return -1;
-
-    if (k->gs_id > prog->gs.id) return 1;
-    else if (k->gs_id < prog->gs.id) return -1;
-
-    if (k->ps_id > prog->ps.id) return 1;
-    else if (k->ps_id < prog->ps.id) return -1;
-
-    return 0;
-}
-
 static BOOL constant_heap_init(struct constant_heap *heap, unsigned int constant_count)
 {
     SIZE_T size = (constant_count + 1) * sizeof(*heap->entries)
@@ -7807,14 +8495,6 @@ static void constant_heap_free(struct constant_heap *heap)
     HeapFree(GetProcessHeap(), 0, heap->entries);
 }
 
-static const struct wine_rb_functions wined3d_glsl_program_rb_functions =
-{
-    wined3d_rb_alloc,
-    wined3d_rb_realloc,
-    wined3d_rb_free,
-    glsl_program_key_compare,
-};
-
 static HRESULT shader_glsl_alloc(struct wined3d_device *device, const struct wined3d_vertex_pipe_ops *vertex_pipe,
         const struct fragment_pipeline *fragment_pipe)
 {
@@ -7867,9 +8547,16 @@ static HRESULT shader_glsl_alloc(struct wined3d_device *device, const struct win
         goto fail;
     }
 
-    if (wine_rb_init(&priv->program_lookup, &wined3d_glsl_program_rb_functions) == -1)
+    if (!glsl_program_table_init(&priv->programs))
+    {
+        ERR("Failed to initialize program table.\n");
+        goto fail;
+    }
+
+    if (wine_rb_init(&priv->pending_compiles, &glsl_pending_compile_rb_functions) == -1)
     {
         ERR("Failed to initialize rbtree.\n");
+        glsl_program_table_cleanup(&priv->programs);
         goto fail;
     }
 
@@ -7916,7 +8603,10 @@ static void shader_glsl_free(struct wined3d_device *device)
         }
     }
 
-    wine_rb_destroy(&priv->program_lookup, NULL, NULL);
+    if (priv->constant_buffer)
+        GL_EXTCALL(glDeleteBuffers(1, &priv->constant_buffer));
+
+    glsl_program_table_cleanup(&priv->programs);
     constant_heap_free(&priv->pconst_heap);
     constant_heap_free(&priv->vconst_heap);
     HeapFree(GetProcessHeap(), 0, priv->stack);
@@ -7924,6 +8614,8 @@ static void shader_glsl_free(struct wined3d_device *device)
     string_buffer_free(&priv->shader_buffer);
     priv->fragment_pipe->free_private(device);
     priv->vertex_pipe->vp_free(device);
+    wine_rb_destroy(&priv->pending_compiles, glsl_free_pending_compile, NULL);
+    wined3d_disk_cache_key_cleanup(&priv->program_cache_prefix);
 
     HeapFree(GetProcessHeap(), 0, device->shader_priv);
     device->shader_priv = NULL;
@@ -8268,7 +8960,7 @@ static void shader_glsl_free_ffp_vertex_shader(struct wine_rb_entry *entry, void
     {
         delete_glsl_program_entry(ctx->priv, ctx->gl_info, program);
     }
-    ctx->gl_info->gl_ops.ext.p_glDeleteShader(shader->id);
+    shader_glsl_delete_shader(ctx->priv, ctx->gl_info, shader->id);
     HeapFree(GetProcessHeap(), 0, shader);
 }
 
@@ -8703,7 +9395,7 @@ static void shader_glsl_free_ffp_fragment_shader(struct wine_rb_entry *entry, vo
     {
         delete_glsl_program_entry(ctx->priv, ctx->gl_info, program);
     }
-    ctx->gl_info->gl_ops.ext.p_glDeleteShader(shader->id);
+    shader_glsl_delete_shader(ctx->priv, ctx->gl_info, shader->id);
     HeapFree(GetProcessHeap(), 0, shader);
 }
 
@@ -36,7 +36,7 @@ void wined3d_event_query_destroy(struct wined3d_event_query *query)
     HeapFree(GetProcessHeap(), 0, query);
 }
 
-static enum wined3d_event_query_result wined3d_event_query_test(const struct wined3d_event_query *query,
+enum wined3d_event_query_result wined3d_event_query_test(const struct wined3d_event_query *query,
         const struct wined3d_device *device)
 {
     struct wined3d_context *context;
@@ -241,6 +241,13 @@ ULONG CDECL wined3d_query_decref(struct wined3d_query *query)
 
     if (!refcount)
     {
+        struct wined3d_cs *cs = query->device->cs;
+
+        /* The query lists belong to the command stream. */
+        cs->ops->finish(cs);
+        wined3d_cs_lock(cs);
+        list_remove(&query->poll_entry);
+
         /* Queries are specific to the GL context that created them. Not
          * deleting the query will obviously leak it, but that's still better
          * than potentially deleting a different query with the same id in this
@@ -265,6 +272,7 @@ ULONG CDECL wined3d_query_decref(struct wined3d_query *query)
                 context_free_timestamp_query(tq);
             HeapFree(GetProcessHeap(), 0, query->extendedData);
         }
+        wined3d_cs_unlock(cs);
 
         HeapFree(GetProcessHeap(), 0, query);
     }
@@ -292,7 +300,17 @@ HRESULT CDECL wined3d_query_issue(struct wined3d_query *query, DWORD flags)
 {
     TRACE("query %p, flags %#x.\n", query, flags);
 
-    return query->query_ops->query_issue(query, flags);
+    if (flags & WINED3DISSUE_END)
+        ++query->counter_main;
+
+    wined3d_cs_emit_query_issue(query->device->cs, query, flags, query->counter_main);
+
+    if (flags & WINED3DISSUE_BEGIN)
+        query->state = QUERY_BUILDING;
+    else
+        query->state = QUERY_SIGNALLED;
+
+    return WINED3D_OK;
 }
 
 static void fill_query_data(void *out, unsigned int out_size, const void *result, unsigned int result_size)
@@ -300,22 +318,196 @@ static void fill_query_data(void *out, unsigned int out_size, const void *result
     memcpy(out, result, min(out_size, result_size));
 }
 
+/* The functions from here to wined3d_query_poll(), and the query_issue()
+ * implementations, are executed by the command stream. */
+static void query_set_result(struct wined3d_query *query, UINT64 result)
+{
+    query->result = result;
+    InterlockedExchange(&query->counter_retrieved, query->counter_issued);
+}
+
+static void query_add_pending(struct wined3d_query *query, struct wined3d_context *context)
+{
+    list_remove(&query->poll_entry);
+    list_add_tail(&context->pending_queries, &query->poll_entry);
+}
+
+static void query_remove_pending(struct wined3d_query *query)
+{
+    list_remove(&query->poll_entry);
+    list_init(&query->poll_entry);
+}
+
+static struct wined3d_context *query_get_context(const struct wined3d_query *query)
+{
+    switch (query->type)
+    {
+        case WINED3D_QUERY_TYPE_OCCLUSION:
+            return ((struct wined3d_occlusion_query *)query->extendedData)->context;
+
+        case WINED3D_QUERY_TYPE_TIMESTAMP:
+            return ((struct wined3d_timestamp_query *)query->extendedData)->context;
+
+        case WINED3D_QUERY_TYPE_EVENT:
+            if (!query->extendedData)
+                return NULL;
+            return ((struct wined3d_event_query *)query->extendedData)->context;
+
+        default:
+            return NULL;
+    }
+}
+
+/* Context activation is done by the caller. */
+static BOOL query_poll(struct wined3d_query *query, const struct wined3d_gl_info *gl_info, UINT64 *result)
+{
+    enum wined3d_event_query_result ret;
+    GLuint64 timestamp;
+    GLuint available;
+    GLuint samples;
+
+    switch (query->type)
+    {
+        case WINED3D_QUERY_TYPE_OCCLUSION:
+        {
+            struct wined3d_occlusion_query *oq = query->extendedData;
+
+            GL_EXTCALL(glGetQueryObjectuiv(oq->id, GL_QUERY_RESULT_AVAILABLE, &available));
+            checkGLcall("glGetQueryObjectuiv(GL_QUERY_RESULT_AVAILABLE)");
+            if (!available)
+                return FALSE;
+
+            GL_EXTCALL(glGetQueryObjectuiv(oq->id, GL_QUERY_RESULT, &samples));
+            checkGLcall("glGetQueryObjectuiv(GL_QUERY_RESULT)");
+            *result = samples;
+            return TRUE;
+        }
+
+        case WINED3D_QUERY_TYPE_TIMESTAMP:
+        {
+            struct wined3d_timestamp_query *tq = query->extendedData;
+
+            GL_EXTCALL(glGetQueryObjectuiv(tq->id, GL_QUERY_RESULT_AVAILABLE, &available));
+            checkGLcall("glGetQueryObjectuiv(GL_QUERY_RESULT_AVAILABLE)");
+            if (!available)
+                return FALSE;
+
+            GL_EXTCALL(glGetQueryObjectui64v(tq->id, GL_QUERY_RESULT, &timestamp));
+            checkGLcall("glGetQueryObjectui64v(GL_QUERY_RESULT)");
+            *result = timestamp;
+            return TRUE;
+        }
+
+        case WINED3D_QUERY_TYPE_EVENT:
+            if ((ret = wined3d_event_query_test(query->extendedData, query->device)) == WINED3D_EVENT_QUERY_WAITING)
+                return FALSE;
+            *result = ret;
+            return TRUE;
+
+        default:
+            ERR("Unexpected query type %#x.\n", query->type);
+            *result = 0;
+            return TRUE;
+    }
+}
+
+/* Poll the outstanding queries of a context in issue order, and cache the
+ * results of the ones that are done. Queries generally complete in the order
+ * they were issued, so this stops at the first one that isn't available yet,
+ * and costs a single GL call when nothing new has completed. Only the thread
+ * of the context modifies its list; queries whose result was cached from
+ * another thread are unlinked here.
+ *
+ * Context activation is done by the caller. */
+void wined3d_poll_queries(struct wined3d_context *context)
+{
+    struct wined3d_query *query, *next;
+    UINT64 result;
+
+    TRACE("context %p.\n", context);
+
+    context->query_poll_time = GetTickCount();
+
+    LIST_FOR_EACH_ENTRY_SAFE(query, next, &context->pending_queries, struct wined3d_query, poll_entry)
+    {
+        if (query->counter_retrieved != query->counter_issued)
+        {
+            if (!query_poll(query, context->gl_info, &result))
+                break;
+            query_set_result(query, result);
+        }
+
+        query_remove_pending(query);
+    }
+}
+
+/* Applications tend to poll many queries in a row, so repeated polls of the
+ * same issue go back to GL at most once per timer tick. The first poll after
+ * an issue always does, so that results which are already available aren't
+ * delayed by a poll of some other query. wined3d_cs_exec_present() polls once
+ * per frame on top of that. */
+void wined3d_query_poll(struct wined3d_query *query)
+{
+    struct wined3d_context *query_context, *context;
+    UINT64 result;
+
+    if (query->counter_retrieved == query->counter_issued)
+        return;
+
+    if (!(query_context = query_get_context(query)))
+        return;
+
+    if (query_context->tid != GetCurrentThreadId())
+    {
+        /* The pending list belongs to a context of another thread, so leave
+         * unlinking the query to that thread's next poll. Event queries can
+         * still be tested individually from here. */
+        if (query->type == WINED3D_QUERY_TYPE_EVENT && query_poll(query, NULL, &result))
+            query_set_result(query, result);
+        return;
+    }
+
+    if (query->counter_polled == query->counter_issued && query_context->query_poll_time == GetTickCount())
+        return;
+    query->counter_polled = query->counter_issued;
+
+    context = context_acquire(query->device, query_context->current_rt);
+    wined3d_poll_queries(query_context);
+    context_release(context);
+}
+
+/* Returns whether the result of the last END issue is cached. If it isn't,
+ * the command stream is asked to poll for it, which in the single-threaded
+ * case happens before this returns. WINED3DGETDATA_FLUSH only makes sure the
+ * commands queued so far are submitted to GL, it doesn't force a poll. */
+static BOOL query_result_available(struct wined3d_query *query, DWORD flags)
+{
+    struct wined3d_cs *cs = query->device->cs;
+
+    if (*(volatile LONG *)&query->counter_retrieved == query->counter_main)
+        return TRUE;
+
+    if (flags & WINED3DGETDATA_FLUSH)
+        wined3d_cs_emit_flush(cs);
+
+    if (!query->poll_queued)
+    {
+        query->poll_queued = TRUE;
+        wined3d_cs_emit_query_poll(cs, query);
+    }
+
+    return *(volatile LONG *)&query->counter_retrieved == query->counter_main;
+}
+
 static HRESULT wined3d_occlusion_query_ops_get_data(struct wined3d_query *query,
         void *data, DWORD size, DWORD flags)
 {
-    struct wined3d_occlusion_query *oq = query->extendedData;
     struct wined3d_device *device = query->device;
     const struct wined3d_gl_info *gl_info = &device->adapter->gl_info;
-    struct wined3d_context *context;
-    GLuint available;
     GLuint samples;
-    HRESULT res;
 
     TRACE("query %p, data %p, size %#x, flags %#x.\n", query, data, size, flags);
 
-    if (!oq->context)
-        query->state = QUERY_CREATED;
-
     if (query->state == QUERY_CREATED)
     {
         /* D3D allows GetData on a new query, OpenGL doesn't. So just invent the data ourselves */
@@ -340,39 +532,20 @@ static HRESULT wined3d_occlusion_query_ops_get_data(struct wined3d_query *query,
         return S_OK;
     }
 
-    if (oq->context->tid != GetCurrentThreadId())
+    if (!query_result_available(query, flags))
     {
-        FIXME("%p Wrong thread, returning 1.\n", query);
-        samples = 1;
-        fill_query_data(data, size, &samples, sizeof(samples));
-        return S_OK;
+        TRACE("Result not available yet, returning S_FALSE.\n");
+        return S_FALSE;
     }
 
-    context = context_acquire(query->device, oq->context->current_rt);
-
-    GL_EXTCALL(glGetQueryObjectuiv(oq->id, GL_QUERY_RESULT_AVAILABLE, &available));
-    checkGLcall("glGetQueryObjectuiv(GL_QUERY_RESULT_AVAILABLE)");
-    TRACE("available %#x.\n", available);
-
-    if (available)
+    if (size)
     {
-        if (size)
-        {
-            GL_EXTCALL(glGetQueryObjectuiv(oq->id, GL_QUERY_RESULT, &samples));
-            checkGLcall("glGetQueryObjectuiv(GL_QUERY_RESULT)");
-            TRACE("Returning %d samples.\n", samples);
-            fill_query_data(data, size, &samples, sizeof(samples));
-        }
-        res = S_OK;
-    }
-    else
-    {
-        res = S_FALSE;
+        samples = query->result;
+        TRACE("Returning %d samples.\n", samples);
+        fill_query_data(data, size, &samples, sizeof(samples));
     }
 
-    context_release(context);
-
-    return res;
+    return S_OK;
 }
 
 static HRESULT wined3d_event_query_ops_get_data(struct wined3d_query *query,
@@ -393,7 +566,13 @@ static HRESULT wined3d_event_query_ops_get_data(struct wined3d_query *query,
         return S_OK;
     }
 
-    ret = wined3d_event_query_test(event_query, query->device);
+    if (!query->counter_main)
+        ret = WINED3D_EVENT_QUERY_NOT_STARTED;
+    else if (query_result_available(query, flags))
+        ret = query->result;
+    else
+        ret = WINED3D_EVENT_QUERY_WAITING;
+
     switch(ret)
     {
         case WINED3D_EVENT_QUERY_OK:
@@ -435,7 +614,7 @@ enum wined3d_query_type CDECL wined3d_query_get_type(const struct wined3d_query
     return query->type;
 }
 
-static HRESULT wined3d_event_query_ops_issue(struct wined3d_query *query, DWORD flags)
+static void wined3d_event_query_ops_issue(struct wined3d_query *query, DWORD flags)
 {
     TRACE("query %p, flags %#x.\n", query, flags);
 
@@ -445,25 +624,19 @@ static HRESULT wined3d_event_query_ops_issue(struct wined3d_query *query, DWORD
         struct wined3d_event_query *event_query = query->extendedData;
 
         /* Faked event query support */
-        if (!event_query) return WINED3D_OK;
+        if (!event_query) return;
 
         wined3d_event_query_issue(event_query, query->device);
+        query_add_pending(query, event_query->context);
     }
     else if (flags & WINED3DISSUE_BEGIN)
     {
         /* Started implicitly at device creation */
         ERR("Event query issued with START flag - what to do?\n");
     }
-
-    if (flags & WINED3DISSUE_BEGIN)
-        query->state = QUERY_BUILDING;
-    else
-        query->state = QUERY_SIGNALLED;
-
-    return WINED3D_OK;
 }
 
-static HRESULT wined3d_occlusion_query_ops_issue(struct wined3d_query *query, DWORD flags)
+static void wined3d_occlusion_query_ops_issue(struct wined3d_query *query, DWORD flags)
 {
     struct wined3d_device *device = query->device;
     const struct wined3d_gl_info *gl_info = &device->adapter->gl_info;
@@ -475,10 +648,16 @@ static HRESULT wined3d_occlusion_query_ops_issue(struct wined3d_query *query, DW
         struct wined3d_occlusion_query *oq = query->extendedData;
         struct wined3d_context *context;
 
+        /* The context the query was started in may have been destroyed. */
+        if (!oq->context)
+            oq->started = FALSE;
+
         /* This is allowed according to msdn and our tests. Reset the query and restart */
         if (flags & WINED3DISSUE_BEGIN)
         {
-            if (query->state == QUERY_BUILDING)
+            query_remove_pending(query);
+
+            if (oq->started)
             {
                 if (oq->context->tid != GetCurrentThreadId())
                 {
@@ -505,6 +684,7 @@ static HRESULT wined3d_occlusion_query_ops_issue(struct wined3d_query *query, DW
 
             GL_EXTCALL(glBeginQuery(GL_SAMPLES_PASSED, oq->id));
             checkGLcall("glBeginQuery()");
+            oq->started = TRUE;
 
             context_release(context);
         }
@@ -514,53 +694,41 @@ static HRESULT wined3d_occlusion_query_ops_issue(struct wined3d_query *query, DW
              * our tests show that it returns OK. But OpenGL doesn't like it, so avoid
              * generating an error
              */
-            if (query->state == QUERY_BUILDING)
+            if (!oq->started)
             {
-                if (oq->context->tid != GetCurrentThreadId())
-                {
-                    FIXME("Wrong thread, can't end query.\n");
-                }
-                else
-                {
-                    context = context_acquire(query->device, oq->context->current_rt);
+                query_set_result(query, 0);
+            }
+            else if (oq->context->tid != GetCurrentThreadId())
+            {
+                FIXME("Wrong thread, can't end query, returning 1.\n");
+                query_set_result(query, 1);
+            }
+            else
+            {
+                context = context_acquire(query->device, oq->context->current_rt);
 
-                    GL_EXTCALL(glEndQuery(GL_SAMPLES_PASSED));
-                    checkGLcall("glEndQuery()");
+                GL_EXTCALL(glEndQuery(GL_SAMPLES_PASSED));
+                checkGLcall("glEndQuery()");
+                query_add_pending(query, oq->context);
 
-                    context_release(context);
-                }
+                context_release(context);
             }
+            oq->started = FALSE;
         }
     }
     else
     {
         FIXME("%p Occlusion queries not supported.\n", query);
     }
-
-    if (flags & WINED3DISSUE_BEGIN)
-        query->state = QUERY_BUILDING;
-    else
-        query->state = QUERY_SIGNALLED;
-
-    return WINED3D_OK; /* can be WINED3DERR_INVALIDCALL.    */
 }
 
 static HRESULT wined3d_timestamp_query_ops_get_data(struct wined3d_query *query,
         void *data, DWORD size, DWORD flags)
 {
-    struct wined3d_timestamp_query *tq = query->extendedData;
-    struct wined3d_device *device = query->device;
-    const struct wined3d_gl_info *gl_info = &device->adapter->gl_info;
-    struct wined3d_context *context;
-    GLuint available;
     GLuint64 timestamp;
-    HRESULT res;
 
     TRACE("query %p, data %p, size %#x, flags %#x.\n", query, data, size, flags);
 
-    if (!tq->context)
-        query->state = QUERY_CREATED;
-
     if (query->state == QUERY_CREATED)
     {
         /* D3D allows GetData on a new query, OpenGL doesn't. So just invent the data ourselves. */
@@ -570,42 +738,23 @@ static HRESULT wined3d_timestamp_query_ops_get_data(struct wined3d_query *query,
         return S_OK;
     }
 
-    if (tq->context->tid != GetCurrentThreadId())
+    if (!query_result_available(query, flags))
     {
-        FIXME("%p Wrong thread, returning 1.\n", query);
-        timestamp = 1;
-        fill_query_data(data, size, &timestamp, sizeof(timestamp));
-        return S_OK;
+        TRACE("Result not available yet, returning S_FALSE.\n");
+        return S_FALSE;
     }
 
-    context = context_acquire(query->device, tq->context->current_rt);
-
-    GL_EXTCALL(glGetQueryObjectuiv(tq->id, GL_QUERY_RESULT_AVAILABLE, &available));
-    checkGLcall("glGetQueryObjectuiv(GL_QUERY_RESULT_AVAILABLE)");
-    TRACE("available %#x.\n", available);
-
-    if (available)
+    if (size)
     {
-        if (size)
-        {
-            GL_EXTCALL(glGetQueryObjectui64v(tq->id, GL_QUERY_RESULT, &timestamp));
-            checkGLcall("glGetQueryObjectui64v(GL_QUERY_RESULT)");
-            TRACE("Returning timestamp %s.\n", wine_dbgstr_longlong(timestamp));
-            fill_query_data(data, size, &timestamp, sizeof(timestamp));
-        }
-        res = S_OK;
-    }
-    else
-    {
-        res = S_FALSE;
+        timestamp = query->result;
+        TRACE("Returning timestamp %s.\n", wine_dbgstr_longlong(timestamp));
+        fill_query_data(data, size, &timestamp, sizeof(timestamp));
     }
 
-    context_release(context);
-
-    return res;
+    return S_OK;
 }
 
-static HRESULT wined3d_timestamp_query_ops_issue(struct wined3d_query *query, DWORD flags)
+static void wined3d_timestamp_query_ops_issue(struct wined3d_query *query, DWORD flags)
 {
     struct wined3d_device *device = query->device;
     const struct wined3d_gl_info *gl_info = &device->adapter->gl_info;
@@ -629,18 +778,16 @@ static HRESULT wined3d_timestamp_query_ops_issue(struct wined3d_query *query, DW
             context_alloc_timestamp_query(context, tq);
             GL_EXTCALL(glQueryCounter(tq->id, GL_TIMESTAMP));
             checkGLcall("glQueryCounter()");
+            query_add_pending(query, tq->context);
             context_release(context);
         }
     }
     else
     {
         ERR("Timestamp queries not supported.\n");
+        if (flags & WINED3DISSUE_END)
+            query_set_result(query, 0);
     }
-
-    if (flags & WINED3DISSUE_END)
-        query->state = QUERY_SIGNALLED;
-
-    return WINED3D_OK;
 }
 
 static HRESULT wined3d_timestamp_disjoint_query_ops_get_data(struct wined3d_query *query,
@@ -669,16 +816,9 @@ static HRESULT wined3d_timestamp_disjoint_query_ops_get_data(struct wined3d_quer
     return S_OK;
 }
 
-static HRESULT wined3d_timestamp_disjoint_query_ops_issue(struct wined3d_query *query, DWORD flags)
+static void wined3d_timestamp_disjoint_query_ops_issue(struct wined3d_query *query, DWORD flags)
 {
     TRACE("query %p, flags %#x.\n", query, flags);
-
-    if (flags & WINED3DISSUE_BEGIN)
-        query->state = QUERY_BUILDING;
-    if (flags & WINED3DISSUE_END)
-        query->state = QUERY_SIGNALLED;
-
-    return WINED3D_OK;
 }
 
 static const struct wined3d_query_ops event_query_ops =
@@ -711,6 +851,7 @@ static HRESULT query_init(struct wined3d_query *query, struct wined3d_device *de
     const struct wined3d_gl_info *gl_info = &device->adapter->gl_info;
 
     query->parent = parent;
+    list_init(&query->poll_entry);
 
     switch (type)
     {
@@ -730,6 +871,7 @@ static HRESULT query_init(struct wined3d_query *query, struct wined3d_device *de
                 return E_OUTOFMEMORY;
             }
             ((struct wined3d_occlusion_query *)query->extendedData)->context = NULL;
+            ((struct wined3d_occlusion_query *)query->extendedData)->started = FALSE;
             break;
 
         case WINED3D_QUERY_TYPE_EVENT:
@@ -2111,7 +2111,7 @@ static void shader_none_free_context_data(struct wined3d_context *context) {}
 static void shader_none_init_context_state(struct wined3d_context *context) {}
 
 /* Context activation is done by the caller. */
-static void shader_none_select(void *shader_priv, struct wined3d_context *context,
+static BOOL shader_none_select(void *shader_priv, struct wined3d_context *context,
         const struct wined3d_state *state)
 {
     const struct wined3d_gl_info *gl_info = context->gl_info;
@@ -2119,6 +2119,8 @@ static void shader_none_select(void *shader_priv, struct wined3d_context *contex
 
     priv->vertex_pipe->vp_enable(gl_info, !use_vs(state));
     priv->fragment_pipe->enable_extension(gl_info, !use_ps(state));
+
+    return TRUE;
 }
 
 /* Context activation is done by the caller. */
@@ -2332,6 +2334,7 @@ ULONG CDECL wined3d_shader_decref(struct wined3d_shader *shader)
 
     if (!refcount)
     {
+        shader->device->cs->ops->finish(shader->device->cs);
         shader_cleanup(shader);
         shader->parent_ops->wined3d_object_destroyed(shader->parent);
         HeapFree(GetProcessHeap(), 0, shader);
@@ -320,7 +320,7 @@ static void stateblock_savedstates_set_vertex(struct wined3d_saved_states *state
 void stateblock_init_contained_states(struct wined3d_stateblock *stateblock)
 {
     const struct wined3d_d3d_info *d3d_info = &stateblock->device->adapter->d3d_info;
-    unsigned int i, j;
+    unsigned int i, j, count;
 
     for (i = 0; i <= WINEHIGHEST_RENDER_STATE >> 5; ++i)
     {
@@ -427,6 +427,12 @@ void stateblock_init_contained_states(struct wined3d_stateblock *stateblock)
             ++stateblock->num_contained_sampler_states;
         }
     }
+
+    /* Without this buffer the states are applied one by one. */
+    count = stateblock->num_contained_render_states + stateblock->num_contained_tss_states
+            + stateblock->num_contained_sampler_states;
+    if (count && !(stateblock->changes = HeapAlloc(GetProcessHeap(), 0, count * sizeof(*stateblock->changes))))
+        WARN("Failed to allocate %u state changes.\n", count);
 }
 
 static void stateblock_init_lights(struct wined3d_stateblock *stateblock, struct list *light_map)
@@ -583,6 +589,7 @@ ULONG CDECL wined3d_stateblock_decref(struct wined3d_stateblock *stateblock)
         HeapFree(GetProcessHeap(), 0, stateblock->changed.pixelShaderConstantsF);
         HeapFree(GetProcessHeap(), 0, stateblock->contained_vs_consts_f);
         HeapFree(GetProcessHeap(), 0, stateblock->contained_ps_consts_f);
+        HeapFree(GetProcessHeap(), 0, stateblock->changes);
         HeapFree(GetProcessHeap(), 0, stateblock);
     }
 
@@ -955,6 +962,131 @@ static void apply_lights(struct wined3d_device *device, const struct wined3d_sta
     }
 }
 
+static void apply_states(const struct wined3d_stateblock *stateblock)
+{
+    struct wined3d_device *device = stateblock->device;
+    unsigned int i;
+
+    for (i = 0; i < stateblock->num_contained_render_states; ++i)
+    {
+        wined3d_device_set_render_state(device, stateblock->contained_render_states[i],
+                stateblock->state.render_states[stateblock->contained_render_states[i]]);
+    }
+
+    for (i = 0; i < stateblock->num_contained_tss_states; ++i)
+    {
+        DWORD stage = stateblock->contained_tss_states[i].stage;
+        DWORD state = stateblock->contained_tss_states[i].state;
+
+        wined3d_device_set_texture_stage_state(device, stage, state, stateblock->state.texture_states[stage][state]);
+    }
+
+    for (i = 0; i < stateblock->num_contained_sampler_states; ++i)
+    {
+        DWORD stage = stateblock->contained_sampler_states[i].stage;
+        DWORD state = stateblock->contained_sampler_states[i].state;
+        DWORD value = stateblock->state.sampler_states[stage][state];
+
+        if (stage >= MAX_FRAGMENT_SAMPLERS) stage += WINED3DVERTEXTEXTURESAMPLER0 - MAX_FRAGMENT_SAMPLERS;
+        wined3d_device_set_sampler_state(device, stage, state, value);
+    }
+}
+
+/* Same as apply_states(), but sends all the changed states to the command
+ * stream as a single packet instead of one packet per state. Not usable
+ * while recording. */
+static BOOL apply_states_batched(const struct wined3d_stateblock *stateblock)
+{
+    struct wined3d_device *device = stateblock->device;
+    const struct wined3d_d3d_info *d3d_info = &device->adapter->d3d_info;
+    unsigned int render_state_count = 0, texture_state_count = 0, sampler_state_count = 0;
+    struct wined3d_state_change *change = stateblock->changes;
+    struct wined3d_state *state = &device->state;
+    unsigned int i, redundant_count = 0;
+    BOOL resz = FALSE;
+
+    if (!change)
+        return FALSE;
+
+    for (i = 0; i < stateblock->num_contained_render_states; ++i)
+    {
+        DWORD rs = stateblock->contained_render_states[i];
+        DWORD value = stateblock->state.render_states[rs];
+
+        /* Triggers a depth buffer resolve, leave that to the device. */
+        if (rs == WINED3D_RS_POINTSIZE && value == WINED3D_RESZ_CODE)
+        {
+            resz = TRUE;
+            continue;
+        }
+
+        if (state->render_states[rs] == value)
+        {
+            ++redundant_count;
+            continue;
+        }
+
+        state->render_states[rs] = value;
+        change->state = rs;
+        change->value = value;
+        ++change;
+        ++render_state_count;
+    }
+
+    for (i = 0; i < stateblock->num_contained_tss_states; ++i)
+    {
+        DWORD stage = stateblock->contained_tss_states[i].stage;
+        DWORD tss = stateblock->contained_tss_states[i].state;
+        DWORD value = stateblock->state.texture_states[stage][tss];
+
+        if (stage >= d3d_info->limits.ffp_blend_stages)
+            continue;
+
+        if (state->texture_states[stage][tss] == value)
+        {
+            ++redundant_count;
+            continue;
+        }
+
+        state->texture_states[stage][tss] = value;
+        change->stage = stage;
+        change->state = tss;
+        change->value = value;
+        ++change;
+        ++texture_state_count;
+    }
+
+    for (i = 0; i < stateblock->num_contained_sampler_states; ++i)
+    {
+        DWORD stage = stateblock->contained_sampler_states[i].stage;
+        DWORD sampler_state = stateblock->contained_sampler_states[i].state;
+        DWORD value = stateblock->state.sampler_states[stage][sampler_state];
+
+        if (state->sampler_states[stage][sampler_state] == value)
+        {
+            ++redundant_count;
+            continue;
+        }
+
+        state->sampler_states[stage][sampler_state] = value;
+        change->stage = stage;
+        change->state = sampler_state;
+        change->value = value;
+        ++change;
+        ++sampler_state_count;
+    }
+
+    if (change != stateblock->changes)
+        wined3d_cs_emit_set_states(device->cs, stateblock->changes,
+                render_state_count, texture_state_count, sampler_state_count);
+    device->cs->redundant_state_count += redundant_count;
+
+    if (resz)
+        wined3d_device_set_render_state(device, WINED3D_RS_POINTSIZE, WINED3D_RESZ_CODE);
+
+    return TRUE;
+}
+
 void CDECL wined3d_stateblock_apply(const struct wined3d_stateblock *stateblock)
 {
     struct wined3d_device *device = stateblock->device;
@@ -1005,32 +1137,9 @@ void CDECL wined3d_stateblock_apply(const struct wined3d_stateblock *stateblock)
                 stateblock->state.ps_consts_b + stateblock->contained_ps_consts_b[i], 1);
     }
 
-    /* Render states. */
-    for (i = 0; i < stateblock->num_contained_render_states; ++i)
-    {
-        wined3d_device_set_render_state(device, stateblock->contained_render_states[i],
-                stateblock->state.render_states[stateblock->contained_render_states[i]]);
-    }
-
-    /* Texture states. */
-    for (i = 0; i < stateblock->num_contained_tss_states; ++i)
-    {
-        DWORD stage = stateblock->contained_tss_states[i].stage;
-        DWORD state = stateblock->contained_tss_states[i].state;
-
-        wined3d_device_set_texture_stage_state(device, stage, state, stateblock->state.texture_states[stage][state]);
-    }
-
-    /* Sampler states. */
-    for (i = 0; i < stateblock->num_contained_sampler_states; ++i)
-    {
-        DWORD stage = stateblock->contained_sampler_states[i].stage;
-        DWORD state = stateblock->contained_sampler_states[i].state;
-        DWORD value = stateblock->state.sampler_states[stage][state];
-
-        if (stage >= MAX_FRAGMENT_SAMPLERS) stage += WINED3DVERTEXTEXTURESAMPLER0 - MAX_FRAGMENT_SAMPLERS;
-        wined3d_device_set_sampler_state(device, stage, state, value);
-    }
+    /* Render, texture and sampler states. */
+    if (device->recording || !apply_states_batched(stateblock))
+        apply_states(stateblock);
 
     /* Transform states. */
     for (i = 0; i < stateblock->num_contained_transform_states; ++i)
@@ -1041,15 +1150,9 @@ void CDECL wined3d_stateblock_apply(const struct wined3d_stateblock *stateblock)
 
     if (stateblock->changed.primitive_type)
     {
-        GLenum gl_primitive_type, prev;
-
         if (device->recording)
             device->recording->changed.primitive_type = TRUE;
-        gl_primitive_type = stateblock->state.gl_primitive_type;
-        prev = device->update_state->gl_primitive_type;
-        device->update_state->gl_primitive_type = gl_primitive_type;
-        if (gl_primitive_type != prev && (gl_primitive_type == GL_POINTS || prev == GL_POINTS))
-            device_invalidate_state(device, STATE_POINT_ENABLE);
+        device->update_state->gl_primitive_type = stateblock->state.gl_primitive_type;
     }
 
     if (stateblock->changed.indices)
@@ -30,6 +30,10 @@
 #include "wine/port.h"
 #include "wined3d_private.h"
 
+#ifdef WINED3D_HAVE_SSE2
+#include <emmintrin.h>
+#endif
+
 WINE_DEFAULT_DEBUG_CHANNEL(d3d_surface);
 WINE_DECLARE_DEBUG_CHANNEL(d3d_perf);
 WINE_DECLARE_DEBUG_CHANNEL(d3d);
@@ -62,6 +66,9 @@ static void surface_cleanup(struct wined3d_surface *surface)
             GL_EXTCALL(glDeleteBuffers(1, &surface->pbo));
         }
 
+        if (surface->readback_query)
+            wined3d_event_query_destroy(surface->readback_query);
+
         if (surface->rb_multisample)
         {
             TRACE("Deleting multisample renderbuffer %u.\n", surface->rb_multisample);
@@ -510,7 +517,9 @@ static void surface_get_memory(const struct wined3d_surface *surface, struct win
     data->buffer_object = 0;
 }
 
-static void surface_prepare_buffer(struct wined3d_surface *surface)
+/* The target and usage only matter when the PBO gets created. PBOs for
+ * uploads are GL_STREAM_DRAW, PBOs for read backs are GL_STREAM_READ. */
+static void surface_prepare_buffer(struct wined3d_surface *surface, GLenum target, GLenum usage)
 {
     struct wined3d_context *context;
     GLenum error;
@@ -529,14 +538,13 @@ static void surface_prepare_buffer(struct wined3d_surface *surface)
 
     TRACE("Binding PBO %u.\n", surface->pbo);
 
-    GL_EXTCALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, surface->pbo));
+    GL_EXTCALL(glBindBuffer(target, surface->pbo));
     checkGLcall("glBindBuffer");
 
-    GL_EXTCALL(glBufferData(GL_PIXEL_UNPACK_BUFFER, surface->resource.size + 4,
-            NULL, GL_STREAM_DRAW));
+    GL_EXTCALL(glBufferData(target, surface->resource.size + 4, NULL, usage));
     checkGLcall("glBufferData");
 
-    GL_EXTCALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+    GL_EXTCALL(glBindBuffer(target, 0));
     checkGLcall("glBindBuffer");
 
     context_release(context);
@@ -577,7 +585,7 @@ void surface_prepare_map_memory(struct wined3d_surface *surface)
             break;
 
         case WINED3D_LOCATION_BUFFER:
-            surface_prepare_buffer(surface);
+            surface_prepare_buffer(surface, GL_PIXEL_UNPACK_BUFFER, GL_STREAM_DRAW);
             break;
 
         default:
@@ -1105,6 +1113,12 @@ static void surface_remove_pbo(struct wined3d_surface *surface, const struct win
 
     surface->pbo = 0;
     surface_invalidate_location(surface, WINED3D_LOCATION_BUFFER);
+
+    if (surface->readback_query)
+    {
+        wined3d_event_query_destroy(surface->readback_query);
+        surface->readback_query = NULL;
+    }
 }
 
 static ULONG surface_resource_incref(struct wined3d_resource *resource)
@@ -1292,10 +1306,9 @@ static const struct wined3d_surface_ops gdi_surface_ops =
  * correct texture. */
 /* Context activation is done by the caller. */
 static void surface_download_data(struct wined3d_surface *surface, const struct wined3d_gl_info *gl_info,
-        DWORD dst_location)
+        const struct wined3d_bo_address *data)
 {
     const struct wined3d_format *format = surface->resource.format;
-    struct wined3d_bo_address data;
 
     /* Only support read back of converted P8 surfaces. */
     if (surface->container->flags & WINED3D_TEXTURE_CONVERTED && format->id != WINED3DFMT_P8_UINT)
@@ -1304,16 +1317,14 @@ static void surface_download_data(struct wined3d_surface *surface, const struct
         return;
     }
 
-    surface_get_memory(surface, &data, dst_location);
-
     if (surface->container->resource.format_flags & WINED3DFMT_FLAG_COMPRESSED)
     {
         TRACE("(%p) : Calling glGetCompressedTexImage level %d, format %#x, type %#x, data %p.\n",
-                surface, surface->texture_level, format->glFormat, format->glType, data.addr);
+                surface, surface->texture_level, format->glFormat, format->glType, data->addr);
 
-        if (data.buffer_object)
+        if (data->buffer_object)
         {
-            GL_EXTCALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, data.buffer_object));
+            GL_EXTCALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, data->buffer_object));
             checkGLcall("glBindBuffer");
             GL_EXTCALL(glGetCompressedTexImage(surface->texture_target, surface->texture_level, NULL));
             checkGLcall("glGetCompressedTexImage");
@@ -1323,7 +1334,7 @@ static void surface_download_data(struct wined3d_surface *surface, const struct
         else
         {
             GL_EXTCALL(glGetCompressedTexImage(surface->texture_target,
-                    surface->texture_level, data.addr));
+                    surface->texture_level, data->addr));
             checkGLcall("glGetCompressedTexImage");
         }
     }
@@ -1345,15 +1356,15 @@ static void surface_download_data(struct wined3d_surface *surface, const struct
         }
         else
         {
-            mem = data.addr;
+            mem = data->addr;
         }
 
         TRACE("(%p) : Calling glGetTexImage level %d, format %#x, type %#x, data %p\n",
                 surface, surface->texture_level, gl_format, gl_type, mem);
 
-        if (data.buffer_object)
+        if (data->buffer_object)
         {
-            GL_EXTCALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, data.buffer_object));
+            GL_EXTCALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, data->buffer_object));
             checkGLcall("glBindBuffer");
 
             gl_info->gl_ops.gl.p_glGetTexImage(surface->texture_target, surface->texture_level,
@@ -1425,7 +1436,7 @@ static void surface_download_data(struct wined3d_surface *surface, const struct
              * rendering. If an app does, the WINED3D_TEXTURE_DYNAMIC_MAP flag will kick in and the memory copy
              * won't be released, and doesn't have to be re-read. */
             src_data = mem;
-            dst_data = data.addr;
+            dst_data = data->addr;
             TRACE("(%p) : Repacking the surface data from pitch %d to pitch %d\n", surface, src_pitch, dst_pitch);
             for (y = 0; y < surface->resource.height; ++y)
             {
@@ -2133,6 +2144,119 @@ static void convert_r32_float_r16_float(const BYTE *src, BYTE *dst,
     }
 }
 
+static inline BYTE cliptobyte(int x)
+{
+    return (BYTE)((x < 0) ? 0 : ((x > 255) ? 255 : x));
+}
+
+#ifdef WINED3D_HAVE_SSE2
+/* (x * 527 + 23) >> 6 and (x * 259 + 33) >> 6 give exactly the same results
+ * as the convert_5to8[] and convert_6to8[] tables below. */
+static WINED3D_SSE2_FUNC void convert_r5g6b5_x8r8g8b8_sse2(const BYTE *src, BYTE *dst,
+        DWORD pitch_in, DWORD pitch_out, unsigned int w, unsigned int h)
+{
+    const __m128i mask5 = _mm_set1_epi16(0x1f), mask6 = _mm_set1_epi16(0x3f);
+    const __m128i mul5 = _mm_set1_epi16(527), add5 = _mm_set1_epi16(23);
+    const __m128i mul6 = _mm_set1_epi16(259), add6 = _mm_set1_epi16(33);
+    const __m128i alpha = _mm_set1_epi16(0xff00);
+    __m128i pixel, r, g, b, bg, ra;
+    unsigned int x, y;
+
+    for (y = 0; y < h; ++y)
+    {
+        const WORD *src_line = (const WORD *)(src + y * pitch_in);
+        DWORD *dst_line = (DWORD *)(dst + y * pitch_out);
+
+        for (x = 0; x + 8 <= w; x += 8)
+        {
+            pixel = _mm_loadu_si128((const __m128i *)&src_line[x]);
+            r = _mm_and_si128(_mm_srli_epi16(pixel, 11), mask5);
+            g = _mm_and_si128(_mm_srli_epi16(pixel, 5), mask6);
+            b = _mm_and_si128(pixel, mask5);
+            r = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(r, mul5), add5), 6);
+            g = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(g, mul6), add6), 6);
+            b = _mm_srli_epi16(_mm_add_epi16(_mm_mullo_epi16(b, mul5), add5), 6);
+            bg = _mm_or_si128(b, _mm_slli_epi16(g, 8));
+            ra = _mm_or_si128(r, alpha);
+            _mm_storeu_si128((__m128i *)&dst_line[x], _mm_unpacklo_epi16(bg, ra));
+            _mm_storeu_si128((__m128i *)&dst_line[x + 4], _mm_unpackhi_epi16(bg, ra));
+        }
+        for (; x < w; ++x)
+        {
+            WORD pixel = src_line[x];
+            dst_line[x] = 0xff000000u
+                    | ((((pixel & 0xf800u) >> 11) * 527 + 23) >> 6) << 16
+                    | ((((pixel & 0x07e0u) >> 5) * 259 + 33) >> 6) << 8
+                    | (((pixel & 0x001fu) * 527 + 23) >> 6);
+        }
+    }
+}
+
+/* Four pixels at a time, in 32-bit lanes. _mm_madd_epi16() against a
+ * constant with a zero high half is a signed 16 x 16 -> 32 bit multiply. */
+static WINED3D_SSE2_FUNC void convert_yuy2_x8r8g8b8_sse2(const BYTE *src, BYTE *dst,
+        DWORD pitch_in, DWORD pitch_out, unsigned int w, unsigned int h)
+{
+    const __m128i zero = _mm_setzero_si128(), mask = _mm_set1_epi32(0xffff);
+    const __m128i k_c = _mm_set1_epi32(298), k_r = _mm_set1_epi32(409), k_b = _mm_set1_epi32(516);
+    const __m128i k_g = _mm_set1_epi32((-100 & 0xffff) | (-208 << 16));
+    const __m128i y_bias = _mm_set1_epi32(16), uv_bias = _mm_set1_epi32(128);
+    const __m128i round = _mm_set1_epi32(128), alpha = _mm_set1_epi32(255);
+    __m128i v, luma, uv, d, e, c2, r, g, b, t;
+    int c, dd, ee, r2 = 0, g2 = 0, b2 = 0;
+    unsigned int x, y;
+
+    for (y = 0; y < h; ++y)
+    {
+        const BYTE *src_line = src + y * pitch_in;
+        DWORD *dst_line = (DWORD *)(dst + y * pitch_out);
+
+        for (x = 0; x + 4 <= w; x += 4)
+        {
+            /* Y0 U0 Y1 V0 Y2 U1 Y3 V1 -> one {Y, U/V} pair of words per lane. */
+            v = _mm_unpacklo_epi8(_mm_loadl_epi64((const __m128i *)&src_line[x * 2]), zero);
+            luma = _mm_sub_epi32(_mm_and_si128(v, mask), y_bias);
+            uv = _mm_sub_epi32(_mm_srli_epi32(v, 16), uv_bias);
+            d = _mm_shuffle_epi32(uv, _MM_SHUFFLE(2, 2, 0, 0));
+            e = _mm_shuffle_epi32(uv, _MM_SHUFFLE(3, 3, 1, 1));
+
+            c2 = _mm_madd_epi16(_mm_and_si128(luma, mask), k_c);
+            r = _mm_add_epi32(_mm_madd_epi16(_mm_and_si128(e, mask), k_r), c2);
+            g = _mm_add_epi32(_mm_madd_epi16(_mm_or_si128(_mm_and_si128(d, mask),
+                    _mm_slli_epi32(e, 16)), k_g), c2);
+            b = _mm_add_epi32(_mm_madd_epi16(_mm_and_si128(d, mask), k_b), c2);
+            r = _mm_srai_epi32(_mm_add_epi32(r, round), 8);
+            g = _mm_srai_epi32(_mm_add_epi32(g, round), 8);
+            b = _mm_srai_epi32(_mm_add_epi32(b, round), 8);
+
+            /* Saturate to bytes: B0-3 R0-3 G0-3 A0-3, then interleave. */
+            t = _mm_packus_epi16(_mm_packs_epi32(b, r), _mm_packs_epi32(g, alpha));
+            t = _mm_unpacklo_epi8(t, _mm_srli_si128(t, 8));
+            t = _mm_unpacklo_epi16(t, _mm_srli_si128(t, 8));
+            _mm_storeu_si128((__m128i *)&dst_line[x], t);
+        }
+        for (; x < w; ++x)
+        {
+            const BYTE *p = &src_line[x * 2];
+
+            if (!(x & 1))
+            {
+                dd = (int)p[1] - 128;
+                ee = (int)p[3] - 128;
+                r2 = 409 * ee + 128;
+                g2 = - 100 * dd - 208 * ee + 128;
+                b2 = 516 * dd + 128;
+            }
+            c = 298 * ((int)p[0] - 16);
+            dst_line[x] = 0xff000000
+                    | cliptobyte((c + r2) >> 8) << 16
+                    | cliptobyte((c + g2) >> 8) << 8
+                    | cliptobyte((c + b2) >> 8);
+        }
+    }
+}
+#endif
+
 static void convert_r5g6b5_x8r8g8b8(const BYTE *src, BYTE *dst,
         DWORD pitch_in, DWORD pitch_out, unsigned int w, unsigned int h)
 {
@@ -2194,11 +2318,6 @@ static void convert_a8r8g8b8_x8r8g8b8(const BYTE *src, BYTE *dst,
     }
 }
 
-static inline BYTE cliptobyte(int x)
-{
-    return (BYTE)((x < 0) ? 0 : ((x > 255) ? 255 : x));
-}
-
 static void convert_yuy2_x8r8g8b8(const BYTE *src, BYTE *dst,
         DWORD pitch_in, DWORD pitch_out, unsigned int w, unsigned int h)
 {
@@ -2298,20 +2417,81 @@ static const struct d3dfmt_converter_desc converters[] =
     {WINED3DFMT_YUY2,           WINED3DFMT_B5G6R5_UNORM,    convert_yuy2_r5g6b5},
 };
 
-static inline const struct d3dfmt_converter_desc *find_converter(enum wined3d_format_id from,
-        enum wined3d_format_id to)
+static const struct d3dfmt_converter_desc *find_converter_in(const struct d3dfmt_converter_desc *table,
+        unsigned int count, enum wined3d_format_id from, enum wined3d_format_id to)
 {
     unsigned int i;
 
-    for (i = 0; i < (sizeof(converters) / sizeof(*converters)); ++i)
+    for (i = 0; i < count; ++i)
     {
-        if (converters[i].from == from && converters[i].to == to)
-            return &converters[i];
+        if (table[i].from == from && table[i].to == to)
+            return &table[i];
     }
 
     return NULL;
 }
 
+#ifdef WINED3D_HAVE_SSE2
+static const struct d3dfmt_converter_desc converters_sse2[] =
+{
+    {WINED3DFMT_B5G6R5_UNORM,   WINED3DFMT_B8G8R8X8_UNORM,  convert_r5g6b5_x8r8g8b8_sse2},
+    {WINED3DFMT_YUY2,           WINED3DFMT_B8G8R8X8_UNORM,  convert_yuy2_x8r8g8b8_sse2},
+};
+
+/* Compares the converters in converters_sse2[] against their scalar
+ * versions in converters[] on random data, for widths that exercise both the
+ * SIMD loops and their tails. Called from wined3d_use_sse2(). */
+BOOL surface_check_sse2_converters(void)
+{
+    BYTE src[36 * 3 * 4], dst[36 * 3 * 4], ref[36 * 3 * 4];
+    const struct d3dfmt_converter_desc *conv;
+    unsigned int i, width, height;
+    DWORD seed = 0x5eed;
+
+    for (i = 0; i < sizeof(converters_sse2) / sizeof(*converters_sse2); ++i)
+    {
+        if (!(conv = find_converter_in(converters, sizeof(converters) / sizeof(*converters),
+                converters_sse2[i].from, converters_sse2[i].to)))
+            continue;
+
+        for (width = 1; width <= 35; ++width)
+        {
+            for (height = 1; height <= 3; ++height)
+            {
+                wined3d_sse2_check_fill(src, sizeof(src), &seed);
+                memset(dst, 0xcd, sizeof(dst));
+                memset(ref, 0xcd, sizeof(ref));
+                /* Both source formats are 2 bytes per pixel. */
+                conv->convert(src, ref, (width + 1) * 2, (width + 1) * 4, width, height);
+                converters_sse2[i].convert(src, dst, (width + 1) * 2, (width + 1) * 4, width, height);
+                if (memcmp(dst, ref, sizeof(dst)))
+                {
+                    ERR("Converter from %s to %s differs for %ux%u.\n", debug_d3dformat(conv->from),
+                            debug_d3dformat(conv->to), width, height);
+                    return FALSE;
+                }
+            }
+        }
+    }
+
+    return TRUE;
+}
+#endif
+
+static inline const struct d3dfmt_converter_desc *find_converter(enum wined3d_format_id from,
+        enum wined3d_format_id to)
+{
+#ifdef WINED3D_HAVE_SSE2
+    const struct d3dfmt_converter_desc *conv;
+
+    if (wined3d_use_sse2() && (conv = find_converter_in(converters_sse2,
+            sizeof(converters_sse2) / sizeof(*converters_sse2), from, to)))
+        return conv;
+#endif
+
+    return find_converter_in(converters, sizeof(converters) / sizeof(*converters), from, to);
+}
+
 static struct wined3d_texture *surface_convert_format(struct wined3d_surface *source, enum wined3d_format_id to_fmt)
 {
     struct wined3d_map_desc src_map, dst_map;
@@ -2462,6 +2642,8 @@ HRESULT wined3d_surface_map(struct wined3d_surface *surface, struct wined3d_map_
         return WINED3DERR_INVALIDCALL;
     }
 
+    device->cs->ops->finish(device->cs);
+
     if ((fmt_flags & WINED3DFMT_FLAG_BLOCKS) && box
             && !surface_check_block_align(surface, box))
     {
@@ -3715,6 +3897,29 @@ static DWORD resource_access_from_location(DWORD location)
     }
 }
 
+/* Wait for an asynchronous read back into the surface PBO, started by
+ * surface_readback_async(), to complete. */
+static void surface_wait_readback(const struct wined3d_surface *surface)
+{
+    enum wined3d_event_query_result ret;
+
+    if (!surface->readback_query)
+        return;
+
+    ret = wined3d_event_query_finish(surface->readback_query, surface->resource.device);
+    switch (ret)
+    {
+        case WINED3D_EVENT_QUERY_NOT_STARTED:
+        case WINED3D_EVENT_QUERY_OK:
+            return;
+
+        default:
+            /* Reading the PBO synchronises implicitly. */
+            WARN("wined3d_event_query_finish returned %u.\n", ret);
+            return;
+    }
+}
+
 static void surface_copy_simple_location(struct wined3d_surface *surface, DWORD location)
 {
     struct wined3d_device *device = surface->resource.device;
@@ -3739,6 +3944,8 @@ static void surface_copy_simple_location(struct wined3d_surface *surface, DWORD
     }
     if (src.buffer_object)
     {
+        surface_wait_readback(surface);
+
         context = context_acquire(device, NULL);
         gl_info = context->gl_info;
         GL_EXTCALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, src.buffer_object));
@@ -3769,9 +3976,12 @@ static void surface_load_sysmem(struct wined3d_surface *surface,
     /* Download the surface to system memory. */
     if (surface->locations & (WINED3D_LOCATION_TEXTURE_RGB | WINED3D_LOCATION_TEXTURE_SRGB))
     {
+        struct wined3d_bo_address data;
+
         wined3d_texture_bind_and_dirtify(surface->container, context,
                 !(surface->locations & WINED3D_LOCATION_TEXTURE_RGB));
-        surface_download_data(surface, gl_info, dst_location);
+        surface_get_memory(surface, &data, dst_location);
+        surface_download_data(surface, gl_info, &data);
 
         return;
     }
@@ -4916,6 +5126,77 @@ const struct blit_shader cpu_blit =  {
     cpu_blit_blit_surface,
 };
 
+/* Start reading a render target back into the PBO of a system memory
+ * surface, e.g. for GetRenderTargetData(). The copy is fenced with an event
+ * query, so that it can overlap with further rendering, and mapping the
+ * destination only has to wait for the copy instead of the entire pipeline.
+ *
+ * The destination keeps the PBO, resource.size bytes of GL memory, after the
+ * data has been copied to system memory. Applications that use this path
+ * tend to read back into the same surface every frame, and recreating the
+ * PBO each time would cost an allocation per read back. The PBO is released
+ * with the surface, or when it's unloaded. */
+static BOOL surface_readback_async(struct wined3d_surface *dst_surface, const RECT *dst_rect,
+        struct wined3d_surface *src_surface, const RECT *src_rect)
+{
+    struct wined3d_device *device = dst_surface->resource.device;
+    const struct wined3d_gl_info *gl_info = &device->adapter->gl_info;
+    struct wined3d_context *context;
+    struct wined3d_bo_address data;
+
+    if (!gl_info->supported[ARB_PIXEL_BUFFER_OBJECT] || !wined3d_event_query_supported(gl_info))
+        return FALSE;
+
+    if (dst_surface->resource.pool != WINED3D_POOL_SYSTEM_MEM
+            || dst_surface->resource.map_binding != WINED3D_LOCATION_SYSMEM
+            || !(src_surface->resource.usage & WINED3DUSAGE_RENDERTARGET)
+            || src_surface->resource.format->id != dst_surface->resource.format->id)
+        return FALSE;
+
+    /* Only whole surface copies that glGetTexImage() can write directly. */
+    if (src_rect->left || src_rect->top || dst_rect->left || dst_rect->top
+            || src_rect->right != src_surface->resource.width
+            || src_rect->bottom != src_surface->resource.height
+            || dst_rect->right != dst_surface->resource.width
+            || dst_rect->bottom != dst_surface->resource.height
+            || wined3d_surface_get_pitch(src_surface) != wined3d_surface_get_pitch(dst_surface)
+            || src_surface->flags & SFLAG_NONPOW2
+            || src_surface->container->flags & WINED3D_TEXTURE_CONVERTED
+            || src_surface->container->resource.format_flags & WINED3DFMT_FLAG_COMPRESSED)
+        return FALSE;
+
+    if (!dst_surface->readback_query && !(dst_surface->readback_query
+            = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, sizeof(*dst_surface->readback_query))))
+        return FALSE;
+
+    TRACE("Reading back surface %p into the PBO of surface %p.\n", src_surface, dst_surface);
+
+    surface_prepare_buffer(dst_surface, GL_PIXEL_PACK_BUFFER, GL_STREAM_READ);
+
+    context = context_acquire(device, NULL);
+    if (FAILED(surface_load_location(src_surface, context, WINED3D_LOCATION_TEXTURE_RGB)))
+    {
+        context_release(context);
+        return FALSE;
+    }
+    wined3d_texture_bind_and_dirtify(src_surface->container, context, FALSE);
+
+    data.buffer_object = dst_surface->pbo;
+    data.addr = NULL;
+    surface_download_data(src_surface, context->gl_info, &data);
+
+    wined3d_event_query_issue(dst_surface->readback_query, device);
+    /* Make sure the copy gets started before the application maps the
+     * destination. */
+    context->gl_info->gl_ops.gl.p_glFlush();
+    context_release(context);
+
+    surface_validate_location(dst_surface, WINED3D_LOCATION_BUFFER);
+    surface_invalidate_location(dst_surface, ~WINED3D_LOCATION_BUFFER);
+
+    return TRUE;
+}
+
 HRESULT wined3d_surface_blt(struct wined3d_surface *dst_surface, const RECT *dst_rect,
         struct wined3d_surface *src_surface, const RECT *src_rect, DWORD flags,
         const WINEDDBLTFX *fx, enum wined3d_texture_filter_type filter)
@@ -4939,6 +5220,8 @@ HRESULT wined3d_surface_blt(struct wined3d_surface *dst_surface, const RECT *dst
             flags, fx, debug_d3dtexturefiltertype(filter));
     TRACE("Usage is %s.\n", debug_d3dusage(dst_surface->resource.usage));
 
+    device->cs->ops->finish(device->cs);
+
     if (fx)
     {
         TRACE("dwSize %#x.\n", fx->dwSize);
@@ -5203,6 +5486,10 @@ HRESULT wined3d_surface_blt(struct wined3d_surface *dst_surface, const RECT *dst
                 return WINED3D_OK;
             }
 
+            if (blit_op == WINED3D_BLIT_OP_COLOR_BLIT && !scale && !convert
+                    && surface_readback_async(dst_surface, dst_rect, src_surface, src_rect))
+                return WINED3D_OK;
+
             if (fbo_blit_supported(&device->adapter->gl_info, blit_op,
                     src_rect, src_surface->resource.usage, src_surface->resource.pool, src_surface->resource.format,
                     dst_rect, dst_surface->resource.usage, dst_surface->resource.pool, dst_surface->resource.format))
@@ -5305,6 +5592,7 @@ static HRESULT surface_init(struct wined3d_surface *surface, struct wined3d_text
     surface->container = container;
     surface_validate_location(surface, WINED3D_LOCATION_SYSMEM);
     list_init(&surface->renderbuffers);
+    list_init(&surface->fbo_entries);
     list_init(&surface->overlays);
 
     /* Flags */
@@ -413,6 +413,7 @@ ULONG CDECL wined3d_texture_decref(struct wined3d_texture *texture)
 
     if (!refcount)
     {
+        texture->resource.device->cs->ops->finish(texture->resource.device->cs);
         wined3d_texture_cleanup(texture);
         texture->resource.parent_ops->wined3d_object_destroyed(texture->resource.parent);
         HeapFree(GetProcessHeap(), 0, texture);
@@ -488,6 +489,8 @@ void wined3d_texture_load(struct wined3d_texture *texture,
 void CDECL wined3d_texture_preload(struct wined3d_texture *texture)
 {
     struct wined3d_context *context;
+
+    texture->resource.device->cs->ops->finish(texture->resource.device->cs);
     context = context_acquire(texture->resource.device, NULL);
     wined3d_texture_load(texture, context, texture->flags & WINED3D_TEXTURE_IS_SRGB);
     context_release(context);
@@ -720,6 +723,7 @@ HRESULT CDECL wined3d_texture_add_dirty_region(struct wined3d_texture *texture,
         return WINED3DERR_INVALIDCALL;
     }
 
+    texture->resource.device->cs->ops->finish(texture->resource.device->cs);
     texture->texture_ops->texture_sub_resource_add_dirty_region(sub_resource, dirty_region);
 
     return WINED3D_OK;
@@ -1451,6 +1455,7 @@ HRESULT CDECL wined3d_texture_get_dc(struct wined3d_texture *texture, unsigned i
     if (surface->resource.map_count)
         return WINED3DERR_INVALIDCALL;
 
+    device->cs->ops->finish(device->cs);
     if (device->d3d_initialized)
         context = context_acquire(device, NULL);
 
@@ -30,6 +30,11 @@
 #include <stdio.h>
 
 #include "wined3d_private.h"
+#include "wine/library.h"
+
+#ifdef WINED3D_HAVE_SSE2
+#include <emmintrin.h>
+#endif
 
 WINE_DEFAULT_DEBUG_CHANNEL(d3d);
 
@@ -528,6 +533,43 @@ static void convert_r8g8b8a8_snorm(const BYTE *src, BYTE *dst, UINT src_row_pitc
     }
 }
 
+#ifdef WINED3D_HAVE_SSE2
+/* Same as convert_r8g8b8a8_snorm(): flip the sign bit of each channel and
+ * swap the U and W bytes. */
+static WINED3D_SSE2_FUNC void convert_r8g8b8a8_snorm_sse2(const BYTE *src, BYTE *dst,
+        UINT src_row_pitch, UINT src_slice_pitch, UINT dst_row_pitch, UINT dst_slice_pitch,
+        UINT width, UINT height, UINT depth)
+{
+    const __m128i sign = _mm_set1_epi32(0x80808080), mask = _mm_set1_epi32(0xff);
+    const __m128i keep = _mm_set1_epi32(0xff00ff00);
+    unsigned int x, y, z;
+    const DWORD *Source;
+    DWORD *Dest;
+    __m128i c;
+
+    for (z = 0; z < depth; z++)
+    {
+        for (y = 0; y < height; y++)
+        {
+            Source = (const DWORD *)(src + z * src_slice_pitch + y * src_row_pitch);
+            Dest = (DWORD *)(dst + z * dst_slice_pitch + y * dst_row_pitch);
+            for (x = 0; x + 4 <= width; x += 4)
+            {
+                c = _mm_xor_si128(_mm_loadu_si128((const __m128i *)&Source[x]), sign);
+                c = _mm_or_si128(_mm_and_si128(c, keep), _mm_or_si128(
+                        _mm_and_si128(_mm_srli_epi32(c, 16), mask), _mm_slli_epi32(_mm_and_si128(c, mask), 16)));
+                _mm_storeu_si128((__m128i *)&Dest[x], c);
+            }
+            for (; x < width; x++)
+            {
+                DWORD color = Source[x] ^ 0x80808080;
+                Dest[x] = (color & 0xff00ff00) | ((color >> 16) & 0xff) | ((color & 0xff) << 16);
+            }
+        }
+    }
+}
+#endif
+
 static void convert_r16g16_snorm(const BYTE *src, BYTE *dst, UINT src_row_pitch, UINT src_slice_pitch,
         UINT dst_row_pitch, UINT dst_slice_pitch, UINT width, UINT height, UINT depth)
 {
@@ -742,6 +784,139 @@ static void convert_b5g6r5_unorm_b5g5r5a1_unorm_color_key(const BYTE *src, unsig
     }
 }
 
+#ifdef WINED3D_HAVE_SSE2
+/* SSE2 only has signed compares. Flipping the sign bit of both sides maps
+ * unsigned ordering onto signed ordering. */
+static WINED3D_SSE2_FUNC __m128i color_in_range_epi32(__m128i color, __m128i low, __m128i high)
+{
+    const __m128i bias = _mm_set1_epi32(0x80000000);
+
+    color = _mm_xor_si128(color, bias);
+    return _mm_andnot_si128(_mm_or_si128(_mm_cmplt_epi32(color, low), _mm_cmpgt_epi32(color, high)),
+            _mm_set1_epi32(~0));
+}
+
+static WINED3D_SSE2_FUNC void convert_b5g5r5x1_unorm_b5g5r5a1_unorm_color_key_sse2(const BYTE *src,
+        unsigned int src_pitch, BYTE *dst, unsigned int dst_pitch, unsigned int width, unsigned int height,
+        const struct wined3d_palette *palette, const struct wined3d_color_key *color_key)
+{
+    const __m128i bias = _mm_set1_epi16(0x8000);
+    const __m128i alpha = _mm_set1_epi16(0x8000);
+    __m128i low, high, c, in;
+    const WORD *src_row;
+    unsigned int x, y;
+    WORD *dst_row;
+
+    /* The source is 16 bits wide, so clamp the range to 16 bits. If low is
+     * out of range no colour matches, and low > high gives the same result. */
+    if (color_key->color_space_low_value > 0xffff)
+    {
+        low = _mm_xor_si128(_mm_set1_epi16(0xffff), bias);
+        high = _mm_xor_si128(_mm_setzero_si128(), bias);
+    }
+    else
+    {
+        low = _mm_xor_si128(_mm_set1_epi16(color_key->color_space_low_value), bias);
+        high = _mm_xor_si128(_mm_set1_epi16(min(color_key->color_space_high_value, 0xffff)), bias);
+    }
+
+    for (y = 0; y < height; ++y)
+    {
+        src_row = (WORD *)&src[src_pitch * y];
+        dst_row = (WORD *)&dst[dst_pitch * y];
+        for (x = 0; x + 8 <= width; x += 8)
+        {
+            c = _mm_loadu_si128((const __m128i *)&src_row[x]);
+            in = _mm_xor_si128(c, bias);
+            in = _mm_or_si128(_mm_cmplt_epi16(in, low), _mm_cmpgt_epi16(in, high));
+            /* "in" is now set for colours outside the colour key range. */
+            c = _mm_or_si128(_mm_andnot_si128(alpha, c), _mm_and_si128(in, alpha));
+            _mm_storeu_si128((__m128i *)&dst_row[x], c);
+        }
+        for (; x < width; ++x)
+        {
+            WORD src_color = src_row[x];
+            if (color_in_range(color_key, src_color))
+                dst_row[x] = src_color & ~0x8000;
+            else
+                dst_row[x] = src_color | 0x8000;
+        }
+    }
+}
+
+static WINED3D_SSE2_FUNC void convert_b8g8r8x8_unorm_b8g8r8a8_unorm_color_key_sse2(const BYTE *src,
+        unsigned int src_pitch, BYTE *dst, unsigned int dst_pitch, unsigned int width, unsigned int height,
+        const struct wined3d_palette *palette, const struct wined3d_color_key *color_key)
+{
+    const __m128i bias = _mm_set1_epi32(0x80000000);
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    __m128i low, high, c, in;
+    const DWORD *src_row;
+    unsigned int x, y;
+    DWORD *dst_row;
+
+    low = _mm_xor_si128(_mm_set1_epi32(color_key->color_space_low_value), bias);
+    high = _mm_xor_si128(_mm_set1_epi32(color_key->color_space_high_value), bias);
+
+    for (y = 0; y < height; ++y)
+    {
+        src_row = (DWORD *)&src[src_pitch * y];
+        dst_row = (DWORD *)&dst[dst_pitch * y];
+        for (x = 0; x + 4 <= width; x += 4)
+        {
+            c = _mm_loadu_si128((const __m128i *)&src_row[x]);
+            in = color_in_range_epi32(c, low, high);
+            c = _mm_or_si128(_mm_andnot_si128(alpha, c), _mm_andnot_si128(in, alpha));
+            _mm_storeu_si128((__m128i *)&dst_row[x], c);
+        }
+        for (; x < width; ++x)
+        {
+            DWORD src_color = src_row[x];
+            if (color_in_range(color_key, src_color))
+                dst_row[x] = src_color & ~0xff000000;
+            else
+                dst_row[x] = src_color | 0xff000000;
+        }
+    }
+}
+
+static WINED3D_SSE2_FUNC void convert_b8g8r8a8_unorm_b8g8r8a8_unorm_color_key_sse2(const BYTE *src,
+        unsigned int src_pitch, BYTE *dst, unsigned int dst_pitch, unsigned int width, unsigned int height,
+        const struct wined3d_palette *palette, const struct wined3d_color_key *color_key)
+{
+    const __m128i bias = _mm_set1_epi32(0x80000000);
+    const __m128i alpha = _mm_set1_epi32(0xff000000);
+    __m128i low, high, c, in;
+    const DWORD *src_row;
+    unsigned int x, y;
+    DWORD *dst_row;
+
+    low = _mm_xor_si128(_mm_set1_epi32(color_key->color_space_low_value), bias);
+    high = _mm_xor_si128(_mm_set1_epi32(color_key->color_space_high_value), bias);
+
+    for (y = 0; y < height; ++y)
+    {
+        src_row = (DWORD *)&src[src_pitch * y];
+        dst_row = (DWORD *)&dst[dst_pitch * y];
+        for (x = 0; x + 4 <= width; x += 4)
+        {
+            c = _mm_loadu_si128((const __m128i *)&src_row[x]);
+            in = color_in_range_epi32(c, low, high);
+            c = _mm_andnot_si128(_mm_and_si128(in, alpha), c);
+            _mm_storeu_si128((__m128i *)&dst_row[x], c);
+        }
+        for (; x < width; ++x)
+        {
+            DWORD src_color = src_row[x];
+            if (color_in_range(color_key, src_color))
+                src_color &= ~0xff000000;
+            dst_row[x] = src_color;
+        }
+    }
+}
+
+#endif
+
 static void convert_b5g5r5x1_unorm_b5g5r5a1_unorm_color_key(const BYTE *src, unsigned int src_pitch,
         BYTE *dst, unsigned int dst_pitch, unsigned int width, unsigned int height,
         const struct wined3d_palette *palette, const struct wined3d_color_key *color_key)
@@ -831,6 +1006,134 @@ static void convert_b8g8r8a8_unorm_b8g8r8a8_unorm_color_key(const BYTE *src, uns
     }
 }
 
+#ifdef WINED3D_HAVE_SSE2
+void wined3d_sse2_check_fill(BYTE *data, size_t size, DWORD *seed)
+{
+    size_t i;
+
+    for (i = 0; i < size; ++i)
+    {
+        *seed = *seed * 1664525 + 1013904223;
+        data[i] = *seed >> 24;
+    }
+}
+
+static DWORD sse2_check_rand(DWORD *seed)
+{
+    DWORD r;
+
+    wined3d_sse2_check_fill((BYTE *)&r, sizeof(r), seed);
+    return r;
+}
+
+/* Compares the SSE2 converters in this file against the scalar versions on
+ * random data. The widths cover the SIMD loops as well as their tails, and
+ * the destination padding is checked for stray writes. */
+static BOOL wined3d_check_sse2_converters(void)
+{
+    static const struct
+    {
+        void (*scalar)(const BYTE *src, unsigned int src_pitch, BYTE *dst, unsigned int dst_pitch,
+                unsigned int width, unsigned int height, const struct wined3d_palette *palette,
+                const struct wined3d_color_key *color_key);
+        void (*sse2)(const BYTE *src, unsigned int src_pitch, BYTE *dst, unsigned int dst_pitch,
+                unsigned int width, unsigned int height, const struct wined3d_palette *palette,
+                const struct wined3d_color_key *color_key);
+        unsigned int bpp;
+        DWORD range_mask;
+    }
+    color_key_tests[] =
+    {
+        {convert_b5g5r5x1_unorm_b5g5r5a1_unorm_color_key,
+                convert_b5g5r5x1_unorm_b5g5r5a1_unorm_color_key_sse2, 2, 0x1ffff},
+        {convert_b8g8r8x8_unorm_b8g8r8a8_unorm_color_key,
+                convert_b8g8r8x8_unorm_b8g8r8a8_unorm_color_key_sse2, 4, ~0u},
+        {convert_b8g8r8a8_unorm_b8g8r8a8_unorm_color_key,
+                convert_b8g8r8a8_unorm_b8g8r8a8_unorm_color_key_sse2, 4, ~0u},
+    };
+    BYTE src[36 * 3 * 4 * 2], dst[sizeof(src)], ref[sizeof(src)];
+    unsigned int i, width, height, pitch;
+    struct wined3d_color_key color_key;
+    DWORD seed = 0x5eed, a, b;
+
+    for (i = 0; i < sizeof(color_key_tests) / sizeof(*color_key_tests); ++i)
+    {
+        for (width = 1; width <= 35; ++width)
+        {
+            for (height = 1; height <= 3; ++height)
+            {
+                pitch = (width + 1) * color_key_tests[i].bpp;
+                wined3d_sse2_check_fill(src, sizeof(src), &seed);
+                /* Alternate between ranges taken from the source data, which
+                 * are likely to match some pixels, and fully random ones. */
+                if (width & 1)
+                    a = *(const DWORD *)src, b = *(const DWORD *)&src[pitch];
+                else
+                    a = sse2_check_rand(&seed), b = sse2_check_rand(&seed);
+                a &= color_key_tests[i].range_mask;
+                b &= color_key_tests[i].range_mask;
+                color_key.color_space_low_value = height == 3 ? max(a, b) : min(a, b);
+                color_key.color_space_high_value = height == 3 ? min(a, b) : max(a, b);
+
+                memset(dst, 0xcd, sizeof(dst));
+                memset(ref, 0xcd, sizeof(ref));
+                color_key_tests[i].scalar(src, pitch, ref, pitch, width, height, NULL, &color_key);
+                color_key_tests[i].sse2(src, pitch, dst, pitch, width, height, NULL, &color_key);
+                if (memcmp(dst, ref, sizeof(dst)))
+                {
+                    ERR("Colour key converter %u differs for %ux%u, range %#x-%#x.\n",
+                            i, width, height, color_key.color_space_low_value,
+                            color_key.color_space_high_value);
+                    return FALSE;
+                }
+            }
+        }
+    }
+
+    for (width = 1; width <= 35; ++width)
+    {
+        pitch = (width + 1) * 4;
+        wined3d_sse2_check_fill(src, sizeof(src), &seed);
+        memset(dst, 0xcd, sizeof(dst));
+        memset(ref, 0xcd, sizeof(ref));
+        convert_r8g8b8a8_snorm(src, ref, pitch, pitch * 3, pitch, pitch * 3, width, 3, 2);
+        convert_r8g8b8a8_snorm_sse2(src, dst, pitch, pitch * 3, pitch, pitch * 3, width, 3, 2);
+        if (memcmp(dst, ref, sizeof(dst)))
+        {
+            ERR("R8G8B8A8_SNORM converter differs for width %u.\n", width);
+            return FALSE;
+        }
+    }
+
+    return surface_check_sse2_converters();
+}
+
+BOOL wined3d_use_sse2(void)
+{
+    static int sse2 = -1;
+
+    if (sse2 == -1)
+    {
+#ifdef __x86_64__
+        sse2 = TRUE;
+#else
+        sse2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#endif
+        if (sse2 && wined3d_settings.check_sse2)
+        {
+            if (wined3d_check_sse2_converters())
+                TRACE("SSE2 converters match the scalar versions.\n");
+            else
+            {
+                ERR("SSE2 converters don't match the scalar versions, disabling them.\n");
+                sse2 = FALSE;
+            }
+        }
+    }
+    return sse2;
+}
+#endif
+
 const struct wined3d_color_key_conversion * wined3d_format_get_color_key_conversion(
         const struct wined3d_texture *texture, BOOL need_alpha_ck)
 {
@@ -850,6 +1153,19 @@ const struct wined3d_color_key_conversion * wined3d_format_get_color_key_convers
         {WINED3DFMT_B8G8R8X8_UNORM, {WINED3DFMT_B8G8R8A8_UNORM, convert_b8g8r8x8_unorm_b8g8r8a8_unorm_color_key }},
         {WINED3DFMT_B8G8R8A8_UNORM, {WINED3DFMT_B8G8R8A8_UNORM, convert_b8g8r8a8_unorm_b8g8r8a8_unorm_color_key }},
     };
+#ifdef WINED3D_HAVE_SSE2
+    static const struct
+    {
+        enum wined3d_format_id src_format;
+        struct wined3d_color_key_conversion conversion;
+    }
+    color_key_info_sse2[] =
+    {
+        {WINED3DFMT_B5G5R5X1_UNORM, {WINED3DFMT_B5G5R5A1_UNORM, convert_b5g5r5x1_unorm_b5g5r5a1_unorm_color_key_sse2}},
+        {WINED3DFMT_B8G8R8X8_UNORM, {WINED3DFMT_B8G8R8A8_UNORM, convert_b8g8r8x8_unorm_b8g8r8a8_unorm_color_key_sse2}},
+        {WINED3DFMT_B8G8R8A8_UNORM, {WINED3DFMT_B8G8R8A8_UNORM, convert_b8g8r8a8_unorm_b8g8r8a8_unorm_color_key_sse2}},
+    };
+#endif
     static const struct wined3d_color_key_conversion convert_p8 =
     {
         WINED3DFMT_B8G8R8A8_UNORM,  convert_p8_uint_b8g8r8a8_unorm
@@ -857,6 +1173,16 @@ const struct wined3d_color_key_conversion * wined3d_format_get_color_key_convers
 
     if (need_alpha_ck && (texture->async.flags & WINED3D_TEXTURE_ASYNC_COLOR_KEY))
     {
+#ifdef WINED3D_HAVE_SSE2
+        if (wined3d_use_sse2())
+        {
+            for (i = 0; i < sizeof(color_key_info_sse2) / sizeof(*color_key_info_sse2); ++i)
+            {
+                if (color_key_info_sse2[i].src_format == format->id)
+                    return &color_key_info_sse2[i].conversion;
+            }
+        }
+#endif
         for (i = 0; i < sizeof(color_key_info) / sizeof(*color_key_info); ++i)
         {
             if (color_key_info[i].src_format == format->id)
@@ -2326,6 +2652,10 @@ static BOOL init_format_texture_info(struct wined3d_adapter *adapter, struct win
         /* Texture conversion stuff */
         format->convert = format_texture_info[i].convert;
         format->conv_byte_count = format_texture_info[i].conv_byte_count;
+#ifdef WINED3D_HAVE_SSE2
+        if (format->convert == convert_r8g8b8a8_snorm && wined3d_use_sse2())
+            format->convert = convert_r8g8b8a8_snorm_sse2;
+#endif
     }
 
     return TRUE;
@@ -2780,10 +3110,124 @@ BOOL initPixelFormatsNoGL(struct wined3d_gl_info *gl_info)
     return TRUE;
 }
 
+/* The part of struct wined3d_format that init_format_fbo_compat_info() and
+ * init_format_filter_info() determine by drawing and reading back. Only the
+ * flags in wined3d_format_cache_flags() are stored. */
+struct wined3d_format_cache_entry
+{
+    unsigned int flags[WINED3D_GL_RES_TYPE_COUNT];
+    GLint rtInternal;
+};
+
+/* The format flags set or cleared by init_format_fbo_compat_info() and
+ * init_format_filter_info(). With ARB_internalformat_query2, filtering
+ * support comes from init_format_texture_info() instead, which always runs. */
+static unsigned int wined3d_format_cache_flags(const struct wined3d_gl_info *gl_info)
+{
+    unsigned int flags = WINED3DFMT_FLAG_RENDERTARGET | WINED3DFMT_FLAG_FBO_ATTACHABLE
+            | WINED3DFMT_FLAG_FBO_ATTACHABLE_SRGB | WINED3DFMT_FLAG_POSTPIXELSHADER_BLENDING;
+
+    if (!gl_info->supported[ARB_INTERNALFORMAT_QUERY2])
+        flags |= WINED3DFMT_FLAG_FILTERING;
+
+    return flags;
+}
+
+/* Context activation is done by the caller. */
+static BOOL wined3d_format_cache_get_key(const struct wined3d_adapter *adapter, struct wined3d_disk_cache_key *key)
+{
+    static const DWORD version = 2;
+    const struct wined3d_gl_info *gl_info = &adapter->gl_info;
+    struct fragment_caps fragment_caps;
+    struct shader_caps shader_caps;
+    DWORD format_count = ARRAY_SIZE(formats);
+
+    memset(&fragment_caps, 0, sizeof(fragment_caps));
+    memset(&shader_caps, 0, sizeof(shader_caps));
+    adapter->fragment_pipe->get_caps(gl_info, &fragment_caps);
+    adapter->shader_backend->shader_get_caps(gl_info, &shader_caps);
+
+    if (!wined3d_disk_cache_key_init(key, NULL))
+        return FALSE;
+    wined3d_disk_cache_key_add(key, &version, sizeof(version));
+    wined3d_disk_cache_key_add_string(key, wine_get_build_id());
+    wined3d_disk_cache_key_add(key, &format_count, sizeof(format_count));
+    wined3d_disk_cache_key_add_string(key, (const char *)gl_info->gl_ops.gl.p_glGetString(GL_VENDOR));
+    wined3d_disk_cache_key_add_string(key, (const char *)gl_info->gl_ops.gl.p_glGetString(GL_RENDERER));
+    wined3d_disk_cache_key_add_string(key, (const char *)gl_info->gl_ops.gl.p_glGetString(GL_VERSION));
+    wined3d_disk_cache_key_add(key, gl_info->supported, sizeof(gl_info->supported));
+    wined3d_disk_cache_key_add(key, &gl_info->limits, sizeof(gl_info->limits));
+    wined3d_disk_cache_key_add(key, &gl_info->quirks, sizeof(gl_info->quirks));
+    wined3d_disk_cache_key_add(key, &adapter->driver_info.vendor, sizeof(adapter->driver_info.vendor));
+    wined3d_disk_cache_key_add(key, &wined3d_settings.offscreen_rendering_mode,
+            sizeof(wined3d_settings.offscreen_rendering_mode));
+    wined3d_disk_cache_key_add(key, &fragment_caps, sizeof(fragment_caps));
+
+    return wined3d_disk_cache_key_add(key, &shader_caps, sizeof(shader_caps));
+}
+
+static BOOL wined3d_format_cache_load(struct wined3d_gl_info *gl_info, const struct wined3d_disk_cache_key *key)
+{
+    unsigned int mask = wined3d_format_cache_flags(gl_info);
+    struct wined3d_format_cache_entry *entries;
+    unsigned int i, type;
+    DWORD size;
+
+    if (!wined3d_settings.format_cache)
+        return FALSE;
+
+    if (!(entries = wined3d_disk_cache_load("formats", key, &size)))
+        return FALSE;
+
+    if (size != ARRAY_SIZE(formats) * sizeof(*entries))
+    {
+        WARN("Ignoring format cache entry with unexpected size %u.\n", size);
+        HeapFree(GetProcessHeap(), 0, entries);
+        return FALSE;
+    }
+
+    for (i = 0; i < ARRAY_SIZE(formats); ++i)
+    {
+        struct wined3d_format *format = &gl_info->formats[i];
+
+        for (type = 0; type < ARRAY_SIZE(format->flags); ++type)
+            format->flags[type] = (format->flags[type] & ~mask) | (entries[i].flags[type] & mask);
+        format->rtInternal = entries[i].rtInternal;
+    }
+
+    HeapFree(GetProcessHeap(), 0, entries);
+    TRACE("Using cached format probe results.\n");
+    return TRUE;
+}
+
+static void wined3d_format_cache_store(const struct wined3d_gl_info *gl_info, const struct wined3d_disk_cache_key *key)
+{
+    unsigned int mask = wined3d_format_cache_flags(gl_info);
+    struct wined3d_format_cache_entry *entries;
+    unsigned int i, type;
+
+    if (!(entries = HeapAlloc(GetProcessHeap(), HEAP_ZERO_MEMORY, ARRAY_SIZE(formats) * sizeof(*entries))))
+        return;
+
+    for (i = 0; i < ARRAY_SIZE(formats); ++i)
+    {
+        const struct wined3d_format *format = &gl_info->formats[i];
+
+        for (type = 0; type < ARRAY_SIZE(format->flags); ++type)
+            entries[i].flags[type] = format->flags[type] & mask;
+        entries[i].rtInternal = format->rtInternal;
+    }
+
+    wined3d_disk_cache_store("formats", key, entries, ARRAY_SIZE(formats) * sizeof(*entries));
+    HeapFree(GetProcessHeap(), 0, entries);
+}
+
 /* Context activation is done by the caller. */
 BOOL wined3d_adapter_init_format_info(struct wined3d_adapter *adapter, struct wined3d_caps_gl_ctx *ctx)
 {
     struct wined3d_gl_info *gl_info = &adapter->gl_info;
+    struct wined3d_disk_cache_key cache_key = {NULL};
+    BOOL cached = FALSE;
 
     if (!init_format_base_info(gl_info)) return FALSE;
 
@@ -2792,8 +3236,21 @@ BOOL wined3d_adapter_init_format_info(struct wined3d_adapter *adapter, struct wi
     if (!init_format_vertex_info(gl_info)) goto fail;
 
     apply_format_fixups(adapter, gl_info);
-    init_format_fbo_compat_info(ctx);
-    init_format_filter_info(gl_info, adapter->driver_info.vendor);
+
+    /* Probing render target and filtering support draws and reads back a
+     * couple of test quads for every format, which adds up. The results only
+     * depend on the driver and the wined3d build, so reuse them from the
+     * shader cache directory if possible. */
+    if (wined3d_disk_cache_enabled() && wined3d_format_cache_get_key(adapter, &cache_key))
+        cached = wined3d_format_cache_load(gl_info, &cache_key);
+    if (!cached)
+    {
+        init_format_fbo_compat_info(ctx);
+        init_format_filter_info(gl_info, adapter->driver_info.vendor);
+        if (cache_key.data)
+            wined3d_format_cache_store(gl_info, &cache_key);
+    }
+    wined3d_disk_cache_key_cleanup(&cache_key);
 
     return TRUE;
 
@@ -4861,6 +5318,7 @@ void wined3d_ffp_get_vs_settings(const struct wined3d_context *context,
         settings->transformed = 1;
         settings->point_size = state->gl_primitive_type == GL_POINTS;
         settings->per_vertex_point_size = !!(si->use_map & 1u << WINED3D_FFP_PSIZE);
+        settings->swizzle_map = (si->swizzle_map >> WINED3D_FFP_DIFFUSE) & 0x3;
         if (!state->render_states[WINED3D_RS_FOGENABLE])
             settings->fog_mode = WINED3D_FFP_VS_FOG_OFF;
         else if (state->render_states[WINED3D_RS_FOGTABLEMODE] != WINED3D_FOG_NONE)
@@ -4908,6 +5366,7 @@ void wined3d_ffp_get_vs_settings(const struct wined3d_context *context,
     settings->localviewer = !!state->render_states[WINED3D_RS_LOCALVIEWER];
     settings->point_size = state->gl_primitive_type == GL_POINTS;
     settings->per_vertex_point_size = !!(si->use_map & 1u << WINED3D_FFP_PSIZE);
+    settings->swizzle_map = (si->swizzle_map >> WINED3D_FFP_DIFFUSE) & 0x3;
 
     if (state->render_states[WINED3D_RS_COLORVERTEX] && (si->use_map & (1u << WINED3D_FFP_DIFFUSE)))
     {
@@ -86,6 +86,17 @@ struct wined3d_settings wined3d_settings =
     ~0U,            /* No GS shader model limit by default. */
     ~0U,            /* No PS shader model limit by default. */
     FALSE,          /* 3D support enabled by default. */
+    FALSE,          /* No multithreaded command stream by default. */
+    NULL,           /* No shader cache by default. */
+    64,             /* Shader cache size limit in MiB. */
+    FALSE,          /* Wait for shaders to finish compiling by default. */
+    FALSE,          /* Load shader constants with glUniform*() by default. */
+    TRUE,           /* Reuse cached format probe results by default. */
+#ifdef WINE_NO_TRACE_MSGS
+    FALSE,          /* Don't check the SSE2 converters in release builds. */
+#else
+    TRUE,           /* Check the SSE2 converters in debug builds. */
+#endif
 };
 
 struct wined3d * CDECL wined3d_create(DWORD flags)
@@ -296,6 +307,54 @@ static BOOL wined3d_dll_init(HINSTANCE hInstDLL)
             TRACE("Enforcing strict draw ordering.\n");
             wined3d_settings.strict_draw_ordering = TRUE;
         }
+        if (!get_config_key(hkey, appkey, "CSMT", buffer, size)
+                && !strcmp(buffer,"enabled"))
+        {
+            TRACE("Enabling the multithreaded command stream.\n");
+            wined3d_settings.cs_multithreaded = TRUE;
+        }
+        if (!get_config_key(hkey, appkey, "ShaderCache", buffer, size))
+        {
+            size_t len = strlen(buffer) + 1;
+
+            if (!(wined3d_settings.shader_cache_path = HeapAlloc(GetProcessHeap(), 0, len)))
+                ERR("Failed to allocate shader cache path memory.\n");
+            else
+                memcpy(wined3d_settings.shader_cache_path, buffer, len);
+        }
+        if (!get_config_key_dword(hkey, appkey, "ShaderCacheSize", &wined3d_settings.shader_cache_size))
+            TRACE("Limiting the shader cache to %u MiB.\n", wined3d_settings.shader_cache_size);
+        if (!get_config_key(hkey, appkey, "AsyncShaderCompile", buffer, size)
+                && !strcmp(buffer, "enabled"))
+        {
+            TRACE("Enabling asynchronous shader compilation.\n");
+            wined3d_settings.async_shader_compile = TRUE;
+        }
+        if (!get_config_key(hkey, appkey, "UniformBufferConstants", buffer, size)
+                && !strcmp(buffer, "enabled"))
+        {
+            TRACE("Loading shader constants through uniform buffers.\n");
+            wined3d_settings.ubo_constants = TRUE;
+        }
+        if (!get_config_key(hkey, appkey, "FormatCache", buffer, size)
+                && !strcmp(buffer, "disabled"))
+        {
+            TRACE("Not using cached format probe results.\n");
+            wined3d_settings.format_cache = FALSE;
+        }
+        if (!get_config_key(hkey, appkey, "CheckSSE2Converters", buffer, size))
+        {
+            if (!strcmp(buffer, "enabled"))
+            {
+                TRACE("Checking the SSE2 converters against the scalar versions.\n");
+                wined3d_settings.check_sse2 = TRUE;
+            }
+            else if (!strcmp(buffer, "disabled"))
+            {
+                TRACE("Not checking the SSE2 converters.\n");
+                wined3d_settings.check_sse2 = FALSE;
+            }
+        }
         if (!get_config_key(hkey, appkey, "AlwaysOffscreen", buffer, size)
                 && !strcmp(buffer,"disabled"))
         {
@@ -346,6 +405,7 @@ static BOOL wined3d_dll_destroy(HINSTANCE hInstDLL)
     HeapFree(GetProcessHeap(), 0, wndproc_table.entries);
 
     HeapFree(GetProcessHeap(), 0, wined3d_settings.logo);
+    HeapFree(GetProcessHeap(), 0, wined3d_settings.shader_cache_path);
     UnregisterClassA(WINED3D_OPENGL_WINDOW_CLASS_NAME, hInstDLL);
 
     DeleteCriticalSection(&wined3d_wndproc_cs);
@@ -172,6 +172,21 @@ void *wined3d_rb_alloc(size_t size) DECLSPEC_HIDDEN;
 void *wined3d_rb_realloc(void *ptr, size_t size) DECLSPEC_HIDDEN;
 void wined3d_rb_free(void *ptr) DECLSPEC_HIDDEN;
 
+/* SSE2 versions of some of the format conversion functions. They're compiled
+ * with a target attribute, so that i386 builds don't require SSE2, and are
+ * only used if wined3d_use_sse2() returns TRUE. */
+#if defined(__GNUC__) && (__GNUC__ > 4 || (__GNUC__ == 4 && __GNUC_MINOR__ >= 9)) \
+        && (defined(__i386__) || defined(__x86_64__))
+#define WINED3D_HAVE_SSE2
+#define WINED3D_SSE2_FUNC __attribute__((target("sse2")))
+BOOL wined3d_use_sse2(void) DECLSPEC_HIDDEN;
+/* With the "CheckSSE2Converters" setting enabled, wined3d_use_sse2() compares
+ * the SSE2 converters against the scalar ones once, and disables them if the
+ * output differs. */
+BOOL surface_check_sse2_converters(void) DECLSPEC_HIDDEN;
+void wined3d_sse2_check_fill(BYTE *data, size_t size, DWORD *seed) DECLSPEC_HIDDEN;
+#endif
+
 /* Device caps */
 #define MAX_STREAM_OUT              4
 #define MAX_STREAMS                 16
@@ -294,10 +309,42 @@ struct wined3d_settings
     unsigned int max_sm_gs;
     unsigned int max_sm_ps;
     BOOL no_3d;
+    BOOL cs_multithreaded;
+    char *shader_cache_path;
+    DWORD shader_cache_size;
+    BOOL async_shader_compile;
+    BOOL ubo_constants;
+    BOOL format_cache;
+    BOOL check_sse2;
 };
 
 extern struct wined3d_settings wined3d_settings DECLSPEC_HIDDEN;
 
+#define WINED3D_HASH_INIT 0xcbf29ce484222325ull
+
+UINT64 wined3d_hash(UINT64 hash, const void *data, size_t size) DECLSPEC_HIDDEN;
+
+/* The full key of a disk cache entry. A failed allocation frees "data", and
+ * the cache then ignores the key. */
+struct wined3d_disk_cache_key
+{
+    BYTE *data;
+    size_t size;
+    size_t capacity;
+};
+
+BOOL wined3d_disk_cache_key_init(struct wined3d_disk_cache_key *key,
+        const struct wined3d_disk_cache_key *prefix) DECLSPEC_HIDDEN;
+BOOL wined3d_disk_cache_key_add(struct wined3d_disk_cache_key *key, const void *data, size_t size) DECLSPEC_HIDDEN;
+BOOL wined3d_disk_cache_key_add_string(struct wined3d_disk_cache_key *key, const char *str) DECLSPEC_HIDDEN;
+void wined3d_disk_cache_key_cleanup(struct wined3d_disk_cache_key *key) DECLSPEC_HIDDEN;
+
+BOOL wined3d_disk_cache_enabled(void) DECLSPEC_HIDDEN;
+void *wined3d_disk_cache_load(const char *name, const struct wined3d_disk_cache_key *key,
+        DWORD *size) DECLSPEC_HIDDEN;
+void wined3d_disk_cache_store(const char *name, const struct wined3d_disk_cache_key *key,
+        const void *data, DWORD size) DECLSPEC_HIDDEN;
+
 enum wined3d_shader_resource_type
 {
     WINED3D_SHADER_RESOURCE_NONE,
@@ -955,7 +1002,7 @@ struct wined3d_vertex_pipe_ops;
 struct wined3d_shader_backend_ops
 {
     void (*shader_handle_instruction)(const struct wined3d_shader_instruction *);
-    void (*shader_select)(void *shader_priv, struct wined3d_context *context,
+    BOOL (*shader_select)(void *shader_priv, struct wined3d_context *context,
             const struct wined3d_state *state);
     void (*shader_disable)(void *shader_priv, struct wined3d_context *context);
     void (*shader_select_depth_blt)(void *shader_priv, const struct wined3d_gl_info *gl_info,
@@ -1190,6 +1237,7 @@ struct wined3d_occlusion_query
     struct list entry;
     GLuint id;
     struct wined3d_context *context;
+    BOOL started;
 };
 
 union wined3d_gl_query_object
@@ -1218,6 +1266,8 @@ void wined3d_event_query_destroy(struct wined3d_event_query *query) DECLSPEC_HID
 enum wined3d_event_query_result wined3d_event_query_finish(const struct wined3d_event_query *query,
         const struct wined3d_device *device) DECLSPEC_HIDDEN;
 void wined3d_event_query_issue(struct wined3d_event_query *query, const struct wined3d_device *device) DECLSPEC_HIDDEN;
+enum wined3d_event_query_result wined3d_event_query_test(const struct wined3d_event_query *query,
+        const struct wined3d_device *device) DECLSPEC_HIDDEN;
 BOOL wined3d_event_query_supported(const struct wined3d_gl_info *gl_info) DECLSPEC_HIDDEN;
 
 struct wined3d_timestamp_query
@@ -1230,20 +1280,20 @@ struct wined3d_timestamp_query
 void context_alloc_timestamp_query(struct wined3d_context *context, struct wined3d_timestamp_query *query) DECLSPEC_HIDDEN;
 void context_free_timestamp_query(struct wined3d_timestamp_query *query) DECLSPEC_HIDDEN;
 
+#define WINED3D_FBO_HASH_SIZE 64
+
 struct wined3d_context
 {
     const struct wined3d_gl_info *gl_info;
     const struct wined3d_d3d_info *d3d_info;
     const struct StateEntry *state_table;
     /* State dirtification
-     * dirtyArray is an array that contains markers for dirty states. numDirtyEntries states are dirty, their numbers are in indices
-     * 0...numDirtyEntries - 1. isStateDirty is a redundant copy of the dirtyArray. Technically only one of them would be needed,
-     * but with the help of both it is easy to find out if a state is dirty(just check the array index), and for applying dirty states
-     * only numDirtyEntries array elements have to be checked, not STATE_HIGHEST states.
+     * isStateDirty has one bit per state. Bit n of dirty_groups is set when
+     * isStateDirty[n] has any bits set, so that applying the dirty states
+     * only has to look at the groups of states that actually changed.
      */
-    DWORD                   dirtyArray[STATE_HIGHEST + 1]; /* Won't get bigger than that, a state is never marked dirty 2 times */
-    DWORD                   numDirtyEntries;
-    DWORD isStateDirty[STATE_HIGHEST / (sizeof(DWORD) * CHAR_BIT) + 1]; /* Bitmap to find out quickly if a state is dirty */
+    DWORD isStateDirty[STATE_HIGHEST / (sizeof(DWORD) * CHAR_BIT) + 1];
+    DWORD dirty_groups[STATE_HIGHEST / (sizeof(DWORD) * CHAR_BIT * sizeof(DWORD) * CHAR_BIT) + 1];
 
     struct wined3d_swapchain *swapchain;
     struct wined3d_surface *current_rt;
@@ -1288,6 +1338,12 @@ struct wined3d_context
 
     UINT instance_count;
 
+    /* Vertex data converted on the CPU for draws that can't use the
+     * application's vertex buffers directly. */
+    GLuint transient_vbo;
+    BYTE *transient_data;
+    SIZE_T transient_data_size;
+
     /* The actual opengl context */
     UINT level;
     HGLRC restore_ctx;
@@ -1306,6 +1362,7 @@ struct wined3d_context
     /* FBOs */
     UINT                    fbo_entry_count;
     struct list             fbo_list;
+    struct list             fbo_hash[WINED3D_FBO_HASH_SIZE];
     struct list             fbo_destroy_list;
     struct fbo_entry        *current_fbo;
     GLuint                  fbo_read_binding;
@@ -1330,6 +1387,10 @@ struct wined3d_context
     UINT free_timestamp_query_count;
     struct list timestamp_queries;
 
+    /* Issued queries whose results haven't been polled yet, oldest first. */
+    struct list pending_queries;
+    DWORD query_poll_time;
+
     struct wined3d_stream_info stream_info;
 
     /* Fences for GL_APPLE_flush_buffer_range */
@@ -1782,6 +1843,8 @@ struct wined3d_gl_limits
     UINT vertex_uniform_blocks;
     UINT geometry_uniform_blocks;
     UINT fragment_uniform_blocks;
+    UINT uniform_buffer_bindings;
+    UINT uniform_buffer_offset_alignment;
     UINT fragment_samplers;
     UINT vertex_samplers;
     UINT combined_samplers;
@@ -2027,7 +2090,8 @@ struct wined3d_ffp_vs_settings
     DWORD texcoords       : 8;  /* MAX_TEXTURES */
     DWORD ortho_fog       : 1;
     DWORD flatshading     : 1;
-    DWORD padding         : 10;
+    DWORD swizzle_map     : 2;  /* WINED3D_FFP_DIFFUSE, WINED3D_FFP_SPECULAR */
+    DWORD padding         : 8;
 
     DWORD texgen[MAX_TEXTURES];
 };
@@ -2231,6 +2295,7 @@ void device_resource_released(struct wined3d_device *device, struct wined3d_reso
 void device_switch_onscreen_ds(struct wined3d_device *device, struct wined3d_context *context,
         struct wined3d_surface *depth_stencil) DECLSPEC_HIDDEN;
 void device_invalidate_state(const struct wined3d_device *device, DWORD state) DECLSPEC_HIDDEN;
+void device_invalidate_shader_constants(const struct wined3d_device *device, DWORD mask) DECLSPEC_HIDDEN;
 
 static inline BOOL isStateDirty(const struct wined3d_context *context, DWORD state)
 {
@@ -2239,6 +2304,16 @@ static inline BOOL isStateDirty(const struct wined3d_context *context, DWORD sta
     return context->isStateDirty[idx] & (1u << shift);
 }
 
+static inline void context_mark_state_dirty(struct wined3d_context *context, DWORD state)
+{
+    DWORD idx = state / (sizeof(*context->isStateDirty) * CHAR_BIT);
+    BYTE shift = state & ((sizeof(*context->isStateDirty) * CHAR_BIT) - 1);
+
+    context->isStateDirty[idx] |= 1u << shift;
+    context->dirty_groups[idx / (sizeof(*context->dirty_groups) * CHAR_BIT)]
+            |= 1u << (idx & ((sizeof(*context->dirty_groups) * CHAR_BIT) - 1));
+}
+
 #define WINED3D_RESOURCE_ACCESS_GPU     0x1
 #define WINED3D_RESOURCE_ACCESS_CPU     0x2
 
@@ -2463,12 +2538,24 @@ struct wined3d_renderbuffer_entry
     UINT height;
 };
 
+struct fbo_entry_surface_ref
+{
+    struct list entry;
+    struct fbo_entry *fbo;
+};
+
 struct fbo_entry
 {
     struct list entry;
+    struct list hash_entry;
+    struct wined3d_context *context;
     struct wined3d_surface **render_targets;
     struct wined3d_surface *depth_stencil;
+    /* One reference per colour attachment plus one for the depth/stencil
+     * attachment, linked into the attached surface's fbo_entries list. */
+    struct fbo_entry_surface_ref *surface_refs;
     DWORD color_location, ds_location;
+    DWORD hash;
     DWORD rt_mask;
     BOOL attached;
     GLuint id;
@@ -2496,6 +2583,7 @@ struct wined3d_surface
 
     /* PBO */
     GLuint                    pbo;
+    struct wined3d_event_query *readback_query;
     GLuint rb_multisample;
     GLuint rb_resolved;
     GLenum texture_target;
@@ -2511,6 +2599,7 @@ struct wined3d_surface
 
     struct list               renderbuffers;
     const struct wined3d_renderbuffer_entry *current_renderbuffer;
+    struct list               fbo_entries;
     SIZE ds_current_size;
 
     /* DirectDraw Overlay handling */
@@ -2654,6 +2743,13 @@ struct StageState {
     DWORD state;
 };
 
+struct wined3d_state_change
+{
+    DWORD stage;
+    DWORD state;
+    DWORD value;
+};
+
 struct wined3d_stateblock
 {
     LONG                      ref;     /* Note: Ref counting not required */
@@ -2684,6 +2780,10 @@ struct wined3d_stateblock
     unsigned int              num_contained_tss_states;
     struct StageState         contained_sampler_states[MAX_COMBINED_SAMPLERS * WINED3D_HIGHEST_SAMPLER_STATE];
     unsigned int              num_contained_sampler_states;
+
+    /* Room for one change per contained render, texture and sampler state,
+     * used to build the packet that applies them. */
+    struct wined3d_state_change *changes;
 };
 
 void stateblock_init_contained_states(struct wined3d_stateblock *stateblock) DECLSPEC_HIDDEN;
@@ -2694,10 +2794,30 @@ HRESULT state_init(struct wined3d_state *state, struct wined3d_fb_state *fb,
         DWORD flags) DECLSPEC_HIDDEN;
 void state_unbind_resources(struct wined3d_state *state) DECLSPEC_HIDDEN;
 
+struct wined3d_map_range
+{
+    UINT offset;
+    UINT size;
+};
+
 struct wined3d_cs_ops
 {
     void *(*require_space)(struct wined3d_cs *cs, size_t size);
     void (*submit)(struct wined3d_cs *cs);
+    void (*finish)(struct wined3d_cs *cs);
+};
+
+#define WINED3D_CS_QUEUE_SIZE 0x100000
+#define WINED3D_CS_QUEUE_MASK (WINED3D_CS_QUEUE_SIZE - 1)
+
+/* Single producer, single consumer ring. "head" is only written by the
+ * application thread, "tail" only by the CS thread. Both increase
+ * monotonically and are masked when indexing "data". */
+struct wined3d_cs_queue
+{
+    LONG head, tail;
+    size_t pending_size;
+    BYTE *data;
 };
 
 struct wined3d_cs
@@ -2709,10 +2829,26 @@ struct wined3d_cs
 
     size_t data_size;
     void *data;
+
+    struct wined3d_cs_queue queue;
+    CRITICAL_SECTION exec_lock;
+    DWORD lock_owner; /* thread id of the exec_lock owner, 0 if unowned */
+    unsigned int lock_count;
+    HANDLE thread;
+    DWORD thread_id;
+    HANDLE event;
+    LONG waiting_for_event;
+    BOOL executing;
+    BOOL direct_packet; /* the pending packet doesn't fit in the queue */
+
+    /* State changes filtered out by the device since the last present. */
+    unsigned int redundant_state_count;
 };
 
 struct wined3d_cs *wined3d_cs_create(struct wined3d_device *device) DECLSPEC_HIDDEN;
 void wined3d_cs_destroy(struct wined3d_cs *cs) DECLSPEC_HIDDEN;
+void wined3d_cs_lock(struct wined3d_cs *cs) DECLSPEC_HIDDEN;
+void wined3d_cs_unlock(struct wined3d_cs *cs) DECLSPEC_HIDDEN;
 
 void wined3d_cs_emit_clear(struct wined3d_cs *cs, DWORD rect_count, const RECT *rects,
         DWORD flags, const struct wined3d_color *color, float depth, DWORD stencil) DECLSPEC_HIDDEN;
@@ -2721,6 +2857,10 @@ void wined3d_cs_emit_draw(struct wined3d_cs *cs, UINT start_idx, UINT index_coun
 void wined3d_cs_emit_present(struct wined3d_cs *cs, struct wined3d_swapchain *swapchain,
         const RECT *src_rect, const RECT *dst_rect, HWND dst_window_override,
         const RGNDATA *dirty_region, DWORD flags) DECLSPEC_HIDDEN;
+void wined3d_cs_emit_query_issue(struct wined3d_cs *cs, struct wined3d_query *query,
+        DWORD flags, LONG counter) DECLSPEC_HIDDEN;
+void wined3d_cs_emit_query_poll(struct wined3d_cs *cs, struct wined3d_query *query) DECLSPEC_HIDDEN;
+void wined3d_cs_emit_flush(struct wined3d_cs *cs) DECLSPEC_HIDDEN;
 void wined3d_cs_emit_reset_state(struct wined3d_cs *cs) DECLSPEC_HIDDEN;
 void wined3d_cs_emit_set_clip_plane(struct wined3d_cs *cs, UINT plane_idx,
         const struct wined3d_vec4 *plane) DECLSPEC_HIDDEN;
@@ -2732,6 +2872,8 @@ void wined3d_cs_emit_set_depth_stencil_view(struct wined3d_cs *cs,
         struct wined3d_rendertarget_view *view) DECLSPEC_HIDDEN;
 void wined3d_cs_emit_set_index_buffer(struct wined3d_cs *cs, struct wined3d_buffer *buffer,
         enum wined3d_format_id format_id) DECLSPEC_HIDDEN;
+void wined3d_cs_emit_set_light(struct wined3d_cs *cs, const struct wined3d_light_info *light) DECLSPEC_HIDDEN;
+void wined3d_cs_emit_set_light_enable(struct wined3d_cs *cs, UINT light_idx, BOOL enable) DECLSPEC_HIDDEN;
 void wined3d_cs_emit_set_material(struct wined3d_cs *cs, const struct wined3d_material *material) DECLSPEC_HIDDEN;
 void wined3d_cs_emit_set_predication(struct wined3d_cs *cs,
         struct wined3d_query *predicate, BOOL value) DECLSPEC_HIDDEN;
@@ -2746,8 +2888,13 @@ void wined3d_cs_emit_set_sampler(struct wined3d_cs *cs, enum wined3d_shader_type
 void wined3d_cs_emit_set_sampler_state(struct wined3d_cs *cs, UINT sampler_idx,
         enum wined3d_sampler_state state, DWORD value) DECLSPEC_HIDDEN;
 void wined3d_cs_emit_set_scissor_rect(struct wined3d_cs *cs, const RECT *rect) DECLSPEC_HIDDEN;
+void wined3d_cs_emit_set_shader_constants(struct wined3d_cs *cs, DWORD type,
+        UINT start_idx, UINT count, const void *constants) DECLSPEC_HIDDEN;
 void wined3d_cs_emit_set_shader(struct wined3d_cs *cs, enum wined3d_shader_type type,
         struct wined3d_shader *shader) DECLSPEC_HIDDEN;
+void wined3d_cs_emit_set_states(struct wined3d_cs *cs, const struct wined3d_state_change *changes,
+        unsigned int render_state_count, unsigned int texture_state_count,
+        unsigned int sampler_state_count) DECLSPEC_HIDDEN;
 void wined3d_cs_emit_set_stream_output(struct wined3d_cs *cs, UINT stream_idx,
         struct wined3d_buffer *buffer, UINT offset) DECLSPEC_HIDDEN;
 void wined3d_cs_emit_set_stream_source(struct wined3d_cs *cs, UINT stream_idx,
@@ -2762,6 +2909,8 @@ void wined3d_cs_emit_set_transform(struct wined3d_cs *cs, enum wined3d_transform
 void wined3d_cs_emit_set_vertex_declaration(struct wined3d_cs *cs,
         struct wined3d_vertex_declaration *declaration) DECLSPEC_HIDDEN;
 void wined3d_cs_emit_set_viewport(struct wined3d_cs *cs, const struct wined3d_viewport *viewport) DECLSPEC_HIDDEN;
+void wined3d_cs_emit_update_buffer(struct wined3d_cs *cs, struct wined3d_buffer *buffer,
+        const struct wined3d_map_range *ranges, unsigned int range_count, DWORD flags, BYTE *memory) DECLSPEC_HIDDEN;
 
 /* Direct3D terminology with little modifications. We do not have an issued state
  * because only the driver knows about it, but we have a created state because d3d
@@ -2776,7 +2925,7 @@ enum query_state {
 struct wined3d_query_ops
 {
     HRESULT (*query_get_data)(struct wined3d_query *query, void *data, DWORD data_size, DWORD flags);
-    HRESULT (*query_issue)(struct wined3d_query *query, DWORD flags);
+    void (*query_issue)(struct wined3d_query *query, DWORD flags);
 };
 
 struct wined3d_query
@@ -2790,8 +2939,24 @@ struct wined3d_query
     enum wined3d_query_type type;
     DWORD data_size;
     void                     *extendedData;
+
+    /* Result cache. The application thread counts the END issues in
+     * "counter_main", the command stream stores the count of the last one it
+     * executed in "counter_issued", and publishes it in "counter_retrieved"
+     * once wined3d_poll_queries() cached its result. "counter_polled" is the
+     * issue wined3d_query_poll() last went to GL for. */
+    struct list poll_entry;
+    LONG counter_main;
+    LONG counter_issued;
+    LONG counter_retrieved;
+    LONG counter_polled;
+    LONG poll_queued;
+    UINT64 result;
 };
 
+void wined3d_poll_queries(struct wined3d_context *context) DECLSPEC_HIDDEN;
+void wined3d_query_poll(struct wined3d_query *query) DECLSPEC_HIDDEN;
+
 /* TODO: Add tests and support for FLOAT16_4 POSITIONT, D3DCOLOR position, other
  * fixed function semantics as D3DCOLOR or FLOAT16 */
 enum wined3d_buffer_conversion_type
@@ -2801,11 +2966,9 @@ enum wined3d_buffer_conversion_type
     CONV_POSITIONT,
 };
 
-struct wined3d_map_range
-{
-    UINT offset;
-    UINT size;
-};
+/* Maximum number of regions a persistently mapped dynamic buffer cycles
+ * through on WINED3D_MAP_DISCARD maps. */
+#define WINED3D_BUFFER_STREAM_REGIONS 4
 
 struct wined3d_buffer
 {
@@ -2823,6 +2986,22 @@ struct wined3d_buffer
     ULONG maps_size, modified_areas;
     struct wined3d_event_query *query;
 
+    /* Persistently mapped GL_ARB_buffer_storage regions for dynamic buffers. */
+    BYTE *stream_ptr;
+    UINT stream_region_size;
+    unsigned int stream_region, stream_region_count;
+    struct wined3d_event_query *stream_queries[WINED3D_BUFFER_STREAM_REGIONS];
+
+    /* DISCARD and NOOVERWRITE maps made by the application while the CS
+     * runs in its own thread return this memory. The mapped ranges are
+     * copied into the buffer through the CS on unmap. */
+    BYTE *cs_map_memory;
+    void *cs_free_memory; /* handed back by the CS, for reuse by the next map */
+    struct wined3d_map_range *cs_map_ranges;
+    unsigned int cs_map_ranges_size, cs_map_range_count;
+    DWORD cs_map_flags;
+    UINT app_map_count; /* maps outside the CS thread, only accessed there */
+
     /* conversion stuff */
     UINT decl_change_count, full_conversion_count;
     UINT draw_count;
@@ -2836,12 +3015,21 @@ static inline struct wined3d_buffer *buffer_from_resource(struct wined3d_resourc
     return CONTAINING_RECORD(resource, struct wined3d_buffer, resource);
 }
 
+static inline UINT buffer_get_stream_offset(const struct wined3d_buffer *buffer)
+{
+    return buffer->stream_region * buffer->stream_region_size;
+}
+
 void buffer_get_memory(struct wined3d_buffer *buffer, struct wined3d_context *context,
         struct wined3d_bo_address *data) DECLSPEC_HIDDEN;
 BYTE *buffer_get_sysmem(struct wined3d_buffer *This, struct wined3d_context *context) DECLSPEC_HIDDEN;
+BYTE *buffer_get_sysmem_addr(struct wined3d_buffer *buffer, struct wined3d_context *context,
+        const BYTE *addr) DECLSPEC_HIDDEN;
 void buffer_internal_preload(struct wined3d_buffer *buffer, struct wined3d_context *context,
         const struct wined3d_state *state) DECLSPEC_HIDDEN;
 void buffer_mark_used(struct wined3d_buffer *buffer) DECLSPEC_HIDDEN;
+void buffer_update_from_memory(struct wined3d_buffer *buffer, const struct wined3d_map_range *ranges,
+        unsigned int range_count, DWORD flags, BYTE *memory) DECLSPEC_HIDDEN;
 HRESULT wined3d_buffer_upload_data(struct wined3d_buffer *buffer,
         const struct wined3d_box *box, const void *data) DECLSPEC_HIDDEN;
 